@@ -0,0 +1,423 @@
+/**
+ * Macro benchmarks: whole contracts with scripted calls, from
+ * bench/corpus. Each workload runs in its own process, so its peak
+ * RSS is its own, and reports transactions per second, ns per
+ * instruction, heap allocations per transaction and peak memory.
+ * Every call's status, log count and return data are checked against
+ * the fixture
+ *
+ * Fixtures are text, one directive per line, '#' starts a comment:
+ *
+ *   account <address> <code hex>
+ *   setup <sender> <to> <calldata hex | -> <status> <logs> <return hex | ->
+ *   call <sender> <to> <calldata hex | -> <status> <logs> <return hex | ->
+ *
+ * setup calls run once and are committed. call lines are one
+ * iteration of the workload, run in order against a buffered view
+ * that is thrown away afterwards, so every iteration sees the same
+ * state. The first iteration warms up and is not measured
+ *
+ * With --strict-allocs a workload fails if anything allocates after
+ * warm-up, which keeps the hot path allocation-free. The calls then
+ * run committed, as blocks on new threads every time, and the
+ * workload fails if the heap keeps more than COMMIT_GROWTH_MAX per
+ * block, which catches whatever threads leave behind when they exit
+ *
+ * Usage: corpus [--strict-allocs] [directory] [seconds per workload]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vm.h"
+#include "hex.h"
+#include "alloc.h"
+#include "executor.h"
+
+/* Committed run under --strict-allocs, and the heap it may keep per block for state the calls add */
+#define COMMIT_BLOCKS 200
+#define COMMIT_THREADS 4
+#define COMMIT_GROWTH_MAX 4096
+
+typedef struct {
+    Transaction transaction;
+    Status status;
+    size_t logs;
+
+    uint8_t *output;
+    size_t output_size;
+
+    size_t line;
+} Step;
+
+typedef struct {
+    Step *steps;
+    size_t length;
+    size_t capacity;
+} Steps;
+
+/* Written by the child running a workload, read by the parent */
+typedef struct {
+    bool passed;
+    char message[192];
+
+    uint64_t iterations;
+    uint64_t transactions;
+    uint64_t instructions;
+    double elapsed;
+
+    uint64_t allocations;
+    uint64_t peak_heap;
+} Report;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(Report *report, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(report->message, sizeof(report->message), format, args);
+    va_end(args);
+
+    report->passed = false;
+}
+
+/* "-" is empty */
+static uint8_t *decode(const char *hex, size_t *length) {
+    if (strcmp(hex, "-") == 0) {
+        *length = 0;
+        return NULL;
+    }
+
+    return Hex_decode(hex, length);
+}
+
+static bool parse_address(const char *hex, Address *address) {
+    return strlen(hex) == 2 * sizeof(address->bytes) && Hex_decode_into(hex, strlen(hex), address->bytes);
+}
+
+static bool parse_status(const char *name, Status *status) {
+    for (Status s = STATUS_SUCCESS; s <= STATUS_CRASHED; s++) {
+        if (strcmp(STATUS_TO_NAME[s], name) == 0) {
+            *status = s;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool parse_step(char **fields, size_t line, Step *step) {
+    size_t calldata_size;
+    uint8_t *calldata = decode(fields[2], &calldata_size);
+
+    if (strcmp(fields[2], "-") != 0 && calldata == NULL) return false;
+
+    step->transaction = (Transaction){ .calldata = calldata, .calldata_size = calldata_size };
+    step->logs = (size_t)strtoull(fields[4], NULL, 10);
+    step->output = decode(fields[5], &step->output_size);
+    step->line = line;
+
+    return parse_address(fields[0], &step->transaction.sender) && parse_address(fields[1], &step->transaction.to) &&
+        parse_status(fields[3], &step->status) && (strcmp(fields[5], "-") == 0 || step->output != NULL);
+}
+
+static void push_step(Steps *steps, const Step *step) {
+    if (steps->length == steps->capacity) {
+        steps->capacity = steps->capacity == 0 ? 8 : steps->capacity * 2;
+        steps->steps = (Step*)realloc(steps->steps, sizeof(Step) * steps->capacity);
+    }
+
+    steps->steps[steps->length++] = *step;
+}
+
+static void free_steps(Steps *steps) {
+    for (size_t i = 0; i < steps->length; i++) {
+        free((void*)steps->steps[i].transaction.calldata);
+        free(steps->steps[i].output);
+    }
+
+    free(steps->steps);
+}
+
+/* Load accounts into `vm` and collect the calls, false with the reason in `report` */
+static bool load(const char *path, VM *vm, Steps *setup, Steps *calls, Report *report) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fail(report, "can't open %s", path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0, number = 0;
+    bool ok = true;
+
+    while (ok && getline(&line, &capacity, file) >= 0) {
+        number++;
+
+        char *fields[8];
+        size_t length = 0;
+
+        for (char *field = strtok(line, " \t\r\n"); field != NULL && field[0] != '#' && length < 8; field = strtok(NULL, " \t\r\n"))
+            fields[length++] = field;
+
+        if (length == 0) continue;
+
+        if (strcmp(fields[0], "account") == 0 && length == 3) {
+            Address address;
+            size_t size;
+            uint8_t *code = Hex_decode(fields[2], &size);
+
+            if (!parse_address(fields[1], &address) || code == NULL) ok = false;
+            else {
+                Accounts_insert(&vm->accounts, &address)->code = CodeCache_insert(&vm->codes, code, size);
+                free(code);
+            }
+        } else if ((strcmp(fields[0], "setup") == 0 || strcmp(fields[0], "call") == 0) && length == 7) {
+            Step step;
+
+            if (!parse_step(fields + 1, number, &step)) ok = false;
+            else push_step(fields[0][0] == 's' ? setup : calls, &step);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) fail(report, "bad directive on line %zu", number);
+    }
+
+    free(line);
+    fclose(file);
+
+    if (ok && calls->length == 0) {
+        fail(report, "no calls");
+        ok = false;
+    }
+
+    return ok;
+}
+
+/* Run one call and compare it with what the fixture expects */
+static bool run_step(VM *vm, const Step *step, StateView *view, TransientStorage *transient, Report *report) {
+    Execution execution;
+    Receipt receipt;
+
+    VM_begin(vm, &step->transaction, view, transient, &execution);
+    Execution_run(&execution, UINT64_MAX);
+
+    report->instructions += execution.executed;
+    report->transactions++;
+
+    Execution_finish(&execution, &receipt);
+    TransientStorage_clear(transient);
+
+    bool matches = false;
+
+    if (receipt.status != step->status)
+        fail(report, "line %zu: %s, expected %s", step->line, STATUS_TO_NAME[receipt.status], STATUS_TO_NAME[step->status]);
+    else if (receipt.logs.length != step->logs)
+        fail(report, "line %zu: %zu logs, expected %zu", step->line, receipt.logs.length, step->logs);
+    else if (receipt.return_data_size != step->output_size ||
+            (step->output_size > 0 && memcmp(receipt.return_data, step->output, step->output_size) != 0))
+        fail(report, "line %zu: return data differs (%zu bytes, expected %zu)", step->line, receipt.return_data_size, step->output_size);
+    else
+        matches = true;
+
+    Receipt_free(&receipt);
+    return matches;
+}
+
+/* One iteration of the workload, every call starting from the same state */
+static bool run_iteration(VM *vm, const Steps *calls, StateView *view, TransientStorage *transient, Report *report) {
+    bool ok = true;
+
+    StateView_reset(view, true);
+
+    for (size_t i = 0; ok && i < calls->length; i++) {
+        Alloc_call_begin();
+        ok = run_step(vm, &calls->steps[i], view, transient, report);
+        Alloc_call_end();
+    }
+
+    return ok;
+}
+
+/* Run the calls as committed blocks, failing if the heap grew by more than the state they add could explain */
+static void run_committed(VM *vm, const Steps *calls, Report *report) {
+    Transaction *transactions = (Transaction*)malloc(sizeof(Transaction) * calls->length);
+    Receipt *receipts = (Receipt*)malloc(sizeof(Receipt) * calls->length);
+
+    for (size_t i = 0; i < calls->length; i++) transactions[i] = calls->steps[i].transaction;
+
+    BlockStats block;
+    AllocStats stats;
+
+    /* Statuses aren't checked, each block sees the state the one before left */
+    for (size_t i = 0; i <= COMMIT_BLOCKS; i++) {
+        /* The first block warms up this thread's spares */
+        if (i == 1) Alloc_start();
+
+        if (!Executor_run_block(vm, transactions, calls->length, COMMIT_THREADS, receipts, &block))
+            error("Failed to log block: %s\n", strerror(errno));
+
+        for (size_t j = 0; j < calls->length; j++) Receipt_free(&receipts[j]);
+    }
+
+    Alloc_stop();
+    Alloc_collect(&stats);
+
+    if (stats.live > (int64_t)COMMIT_BLOCKS * COMMIT_GROWTH_MAX)
+        fail(report, "%lld bytes kept after %d committed blocks on %d threads", (long long)stats.live, COMMIT_BLOCKS, COMMIT_THREADS);
+
+    free(transactions);
+    free(receipts);
+}
+
+/* Child side: set up, warm up, then repeat the calls for `seconds` */
+static void run_workload(const char *path, double seconds, bool strict, Report *report) {
+    VM vm;
+    VM_init(&vm);
+
+    Steps setup = { 0 }, calls = { 0 };
+
+    StateView view;
+    StateView_init(&view, false);
+
+    TransientStorage transient;
+    TransientStorage_init(&transient);
+
+    report->passed = true;
+
+    bool ok = load(path, &vm, &setup, &calls, report);
+
+    for (size_t i = 0; ok && i < setup.length; i++) ok = run_step(&vm, &setup.steps[i], &view, &transient, report);
+
+    /* Warm-up allocates the pools the rest reuse, which sets the peak */
+    AllocStats stats;
+    Alloc_start();
+
+    if (ok) ok = run_iteration(&vm, &calls, &view, &transient, report);
+
+    Alloc_collect(&stats);
+    report->peak_heap = stats.peak_max;
+    report->transactions = report->instructions = 0;
+
+    Alloc_start();
+    Alloc_seal(strict);
+
+    double start = now();
+
+    while (ok && (report->iterations == 0 || now() - start < seconds)) {
+        ok = run_iteration(&vm, &calls, &view, &transient, report);
+        report->iterations++;
+    }
+
+    report->elapsed = now() - start;
+
+    Alloc_stop();
+    Alloc_collect(&stats);
+
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) report->allocations += stats.counts[i];
+    if (stats.peak_max > report->peak_heap) report->peak_heap = stats.peak_max;
+
+    if (ok && strict && stats.violations > 0)
+        fail(report, "%llu allocations after warm-up, the first by %s during %s", (unsigned long long)stats.violations,
+            ALLOC_SUBSYSTEM_TO_NAME[stats.violation_subsystem], Alloc_opcode_name(stats.violation_opcode));
+
+    if (ok && strict && report->passed) run_committed(&vm, &calls, report);
+
+    free_steps(&setup);
+    free_steps(&calls);
+    StateView_free(&view);
+    TransientStorage_free(&transient);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+}
+
+static int by_name(const struct dirent **a, const struct dirent **b) {
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int is_fixture(const struct dirent *entry) {
+    size_t length = strlen(entry->d_name);
+    return length > 4 && strcmp(entry->d_name + length - 4, ".evm") == 0;
+}
+
+int main(int argc, char **argv) {
+    bool strict = argc > 1 && strcmp(argv[1], "--strict-allocs") == 0;
+
+    if (strict) {
+        argc--;
+        argv++;
+    }
+
+    const char *directory = argc > 1 ? argv[1] : "bench/corpus";
+    double seconds = argc > 2 ? atof(argv[2]) : 1;
+
+    struct dirent **entries;
+    int length = scandir(directory, &entries, is_fixture, by_name);
+
+    if (length < 0) error("Failed to read %s: %s\n", directory, strerror(errno));
+
+    printf("%-20s %12s %10s %10s %10s %10s %10s  %s\n", "workload", "tx/s", "ns/instr", "instr/tx", "allocs/tx", "peak heap",
+        "peak RSS", "result");
+
+    int failures = 0;
+
+    for (int i = 0; i < length; i++) {
+        char path[4096], name[64];
+
+        snprintf(path, sizeof(path), "%s/%s", directory, entries[i]->d_name);
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(entries[i]->d_name) - 4), entries[i]->d_name);
+        free(entries[i]);
+
+        int channel[2];
+        if (pipe(channel) < 0) error("Failed to create a pipe: %s\n", strerror(errno));
+
+        fflush(stdout);
+        pid_t pid = fork();
+
+        if (pid < 0) error("Failed to fork: %s\n", strerror(errno));
+
+        if (pid == 0) {
+            Report report = { 0 };
+
+            close(channel[0]);
+            run_workload(path, seconds, strict, &report);
+
+            ssize_t written = write(channel[1], &report, sizeof(report));
+            _exit(written == (ssize_t)sizeof(report) ? 0 : 1);
+        }
+
+        close(channel[1]);
+
+        Report report = { 0 };
+        if (read(channel[0], &report, sizeof(report)) != (ssize_t)sizeof(report)) fail(&report, "crashed");
+        close(channel[0]);
+
+        struct rusage usage;
+        int status;
+        wait4(pid, &status, 0, &usage);
+
+        double instructions = report.transactions == 0 ? 0 : (double)report.instructions / report.transactions;
+        double allocations = report.transactions == 0 ? 0 : (double)report.allocations / report.transactions;
+
+        printf("%-20s %12.0f %10.2f %10.0f %10.2f %8.1f KB %8.1f MB  %s\n", name,
+            report.elapsed > 0 ? report.transactions / report.elapsed : 0,
+            report.instructions > 0 ? report.elapsed * 1e9 / report.instructions : 0,
+            instructions, allocations, report.peak_heap / 1024.0, usage.ru_maxrss / 1024.0,
+            report.passed ? "ok" : report.message);
+
+        if (!report.passed) failures++;
+    }
+
+    free(entries);
+    return failures > 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+/**
+ * Bulk genesis loading at 1 to N analysis threads, with the time
+ * each phase takes. The genesis file holds distinct contracts with
+ * a few storage slots each, written from a VM built by hand
+ *
+ * Usage: genesis [contracts] [max threads] [path]
+ */
+
+#include <unistd.h>
+
+#include "genesis.h"
+
+#define CODE_SIZE 8192
+#define SLOTS 16
+
+static void fill_code(uint8_t *code, size_t i) {
+    static const uint8_t OPS[] = { OP_ADD, OP_MUL, OP_SLOAD, OP_POP, OP_JUMPDEST, OP_DUP1, OP_SWAP1, OP_PUSH1, OP_PUSH2, OP_CALLDATALOAD };
+    uint64_t state = i * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (size_t pc = 0; pc < CODE_SIZE; pc++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        code[pc] = OPS[state % sizeof(OPS)];
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t contracts = argc > 1 ? (size_t)atol(argv[1]) : 2000;
+    size_t max_threads = argc > 2 ? (size_t)atol(argv[2]) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *path = argc > 3 ? argv[3] : "cevm.genesis";
+
+    VM vm;
+    VM_init(&vm);
+
+    uint8_t *code = (uint8_t*)malloc(CODE_SIZE);
+
+    for (size_t i = 0; i < contracts; i++) {
+        Address address = { { 0xC0, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i } };
+        Account *account = Accounts_insert(&vm.accounts, &address);
+
+        fill_code(code, i);
+        account->code = CodeCache_insert(&vm.codes, code, CODE_SIZE);
+        account->balance = UInt256_from(i);
+
+        for (size_t j = 0; j < SLOTS; j++) {
+            UInt256 key = UInt256_from(j), value = UInt256_from(i + j);
+            Storage_insert(account->storage, &key, &value);
+        }
+    }
+
+    Genesis_write(&vm, path);
+
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+    free(code);
+
+    printf("%-8s %10s %10s %10s %10s %10s\n", "threads", "map ms", "analyze ms", "build ms", "total ms", "accounts");
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        VM_init(&vm);
+
+        Genesis genesis;
+        GenesisStats stats;
+
+        if (!Genesis_load(&vm, path, threads, &genesis, &stats)) error("Failed to load %s\n", path);
+
+        if (stats.accounts != contracts || stats.codes != contracts || stats.slots != contracts * SLOTS)
+            error("Loaded %zu accounts, %zu codes, %zu slots\n", stats.accounts, stats.codes, stats.slots);
+
+        printf("%-8zu %10.2f %10.2f %10.2f %10.2f %10zu\n", threads, stats.map * 1e3, stats.analyze * 1e3,
+            stats.build * 1e3, stats.total * 1e3, stats.accounts);
+
+        Accounts_free(&vm.accounts);
+        CodeCache_free(&vm.codes);
+        Genesis_close(&genesis);
+    }
+
+    unlink(path);
+
+    return 0;
+}
\ No newline at end of file
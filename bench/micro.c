@@ -0,0 +1,635 @@
+/**
+ * Microbenchmarks: opcode families run through the interpreter in
+ * synthetic loops, the UInt256 kernels, Keccak at several input
+ * sizes, Storage insert/get at several table sizes and Memory
+ * growth. Each benchmark is calibrated to run about TARGET_SECONDS
+ * and the best of REPETITIONS is kept, in ns per operation.
+ * Results are written as JSON, one benchmark per line in a fixed
+ * order, and can be compared against a saved run: anything slower
+ * than the threshold is measured again, up to RETRIES times, to rule
+ * out noise, then flagged and the exit status is 1
+ *
+ * Usage: micro [--filter substring] [--output file] [--compare baseline] [--threshold percent]
+ */
+
+#include <time.h>
+
+#include "vm.h"
+
+#define TARGET_SECONDS 0.02
+#define REPETITIONS 5
+#define RETRIES 2
+#define MAX_RESULTS 256
+
+/* Copies of an opcode body per loop iteration, to drown the loop overhead */
+#define UNROLL 16
+
+/* Opcodes operate on copies of this, left at the bottom of the stack */
+#define OPERAND 0xF3, 0x1E, 0x5B, 0x07, 0xA9, 0x44, 0xC2, 0x8D, 0x16, 0x7F, 0x30, 0xE1, 0x92, 0x4C, 0xB8, 0x65, \
+                0x0D, 0xFA, 0x27, 0x83, 0x5E, 0xC9, 0x71, 0x3A, 0xD4, 0x0B, 0x96, 0x68, 0x2F, 0xE5, 0x1C, 0xB3
+
+typedef double (*Kernel)(void *arg, uint64_t operations);
+
+typedef struct {
+    char name[48];
+    double ns;
+} Result;
+
+/*
+ * Loop body for one opcode, leaving the stack as it found it:
+ * [operand, counter] with the counter on top. DUP2 pushes the operand
+ */
+typedef struct {
+    const char *name;
+    uint8_t body[12];
+    uint8_t size;
+
+    /* Offset of a PUSH2 immediate to point at the JUMPDEST ending the body, 0 if none */
+    uint8_t target;
+} OpBench;
+
+#define BODY(...) .body = { __VA_ARGS__ }, .size = sizeof((uint8_t[]){ __VA_ARGS__ })
+#define UNARY(op) BODY(0x81, op, 0x50)
+#define BINARY(op) BODY(0x81, 0x82, op, 0x50)
+#define TERNARY(op) BODY(0x81, 0x82, 0x83, op, 0x50)
+#define SHIFT(op) BODY(0x81, 0x60, 0x07, op, 0x50)
+
+static const OpBench OP_BENCHES[] = {
+    { "vm.stack.PUSH1", BODY(0x60, 0x01, 0x50) },
+    { "vm.stack.DUP2", BODY(0x81, 0x50) },
+    { "vm.stack.SWAP1", BODY(0x90, 0x90) },
+
+    { "vm.arithmetic.ADD", BINARY(0x01) },
+    { "vm.arithmetic.MUL", BINARY(0x02) },
+    { "vm.arithmetic.SUB", BINARY(0x03) },
+    { "vm.arithmetic.DIV", BINARY(0x04) },
+    { "vm.arithmetic.SDIV", BINARY(0x05) },
+    { "vm.arithmetic.MOD", BINARY(0x06) },
+    { "vm.arithmetic.ADDMOD", TERNARY(0x08) },
+    { "vm.arithmetic.MULMOD", TERNARY(0x09) },
+    { "vm.arithmetic.EXP", BINARY(0x0A) },
+    { "vm.arithmetic.SIGNEXTEND", SHIFT(0x0B) },
+
+    { "vm.comparison.LT", BINARY(0x10) },
+    { "vm.comparison.SLT", BINARY(0x12) },
+    { "vm.comparison.EQ", BINARY(0x14) },
+    { "vm.comparison.ISZERO", UNARY(0x15) },
+
+    { "vm.bitwise.AND", BINARY(0x16) },
+    { "vm.bitwise.XOR", BINARY(0x18) },
+    { "vm.bitwise.NOT", UNARY(0x19) },
+    { "vm.bitwise.BYTE", SHIFT(0x1A) },
+    { "vm.bitwise.SHL", SHIFT(0x1B) },
+    { "vm.bitwise.SHR", SHIFT(0x1C) },
+    { "vm.bitwise.SAR", SHIFT(0x1D) },
+
+    { "vm.sha3.SHA3_64", BODY(0x60, 0x40, 0x60, 0x00, 0x20, 0x50) },
+
+    { "vm.environment.ADDRESS", BODY(0x30, 0x50) },
+    { "vm.environment.CALLER", BODY(0x33, 0x50) },
+    { "vm.environment.CALLDATALOAD", BODY(0x60, 0x00, 0x35, 0x50) },
+    { "vm.environment.BALANCE", BODY(0x30, 0x31, 0x50) },
+
+    { "vm.memory.MLOAD", BODY(0x60, 0x00, 0x51, 0x50) },
+    { "vm.memory.MSTORE", BODY(0x81, 0x60, 0x00, 0x52) },
+    { "vm.memory.MSTORE8", BODY(0x81, 0x60, 0x00, 0x53) },
+    { "vm.memory.MCOPY", BODY(0x60, 0x20, 0x60, 0x00, 0x60, 0x20, 0x5E) },
+
+    { "vm.storage.SLOAD", BODY(0x60, 0x00, 0x54, 0x50) },
+    { "vm.storage.SSTORE", BODY(0x81, 0x60, 0x00, 0x55) },
+    { "vm.storage.TLOAD", BODY(0x60, 0x00, 0x5C, 0x50) },
+    { "vm.storage.TSTORE", BODY(0x81, 0x60, 0x00, 0x5D) },
+
+    { "vm.control.JUMP", BODY(0x61, 0x00, 0x00, 0x56, 0x5B), .target = 1 },
+    { "vm.control.JUMPI", BODY(0x60, 0x01, 0x61, 0x00, 0x00, 0x57, 0x5B), .target = 3 },
+};
+
+static const size_t KECCAK_SIZES[] = { 32, 64, 136, 1024, 4096 };
+static const size_t STORAGE_SIZES[] = { 16, 1024, 65536, 1048576 };
+static const size_t MEMORY_SIZES[] = { 4096, 65536, 1048576 };
+
+static Result results[MAX_RESULTS];
+static size_t results_length;
+
+static const char *filter;
+
+/* Earlier run to compare against, see read_json */
+static Result baseline[MAX_RESULTS];
+static size_t baseline_length;
+static double threshold = 10;
+
+/* Keeps kernel results alive */
+static volatile uint64_t sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static const Result *find_baseline(const char *name) {
+    for (size_t i = 0; i < baseline_length; i++)
+        if (strcmp(baseline[i].name, name) == 0) return &baseline[i];
+
+    return NULL;
+}
+
+/* Size the run to TARGET_SECONDS, then keep the best of REPETITIONS */
+static void measure(const char *name, Kernel kernel, void *arg) {
+    if (filter != NULL && strstr(name, filter) == NULL) return;
+    if (results_length == MAX_RESULTS) error("Too many benchmarks\n");
+
+    uint64_t operations = 1;
+    double elapsed;
+
+    while ((elapsed = kernel(arg, operations)) < TARGET_SECONDS / 16)
+        operations *= 2;
+
+    double scale = TARGET_SECONDS / elapsed;
+    while (scale >= 2) {
+        operations *= 2;
+        scale /= 2;
+    }
+
+    const Result *before = find_baseline(name);
+    double best = 0;
+
+    for (int attempt = 0; attempt <= RETRIES; attempt++) {
+        for (int i = 0; i < REPETITIONS; i++) {
+            double ns = kernel(arg, operations) / operations * 1e9;
+            if ((attempt == 0 && i == 0) || ns < best) best = ns;
+        }
+
+        if (before == NULL || best <= before->ns * (1 + threshold / 100)) break;
+    }
+
+    Result *result = &results[results_length++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->ns = best;
+
+    fprintf(stderr, "%-36s %12.3f ns\n", name, result->ns);
+}
+
+/* Opcodes: one transaction loops calldata[0] times over UNROLL bodies */
+
+typedef struct {
+    VM *vm;
+    Transaction *transaction;
+    StateView *view;
+    TransientStorage *transient;
+} OpRun;
+
+static double run_op(void *arg, uint64_t operations) {
+    OpRun *run = (OpRun*)arg;
+    uint8_t calldata[32] = { 0 };
+    uint64_t iterations = (operations + UNROLL - 1) / UNROLL;
+
+    for (int i = 0; i < 8; i++) calldata[31 - i] = (uint8_t)(iterations >> (8 * i));
+
+    run->transaction->calldata = calldata;
+    run->transaction->calldata_size = sizeof(calldata);
+
+    StateView_reset(run->view, false);
+
+    Receipt receipt;
+    double start = now();
+    Status status = VM_execute(run->vm, run->transaction, run->view, run->transient, &receipt);
+    double elapsed = now() - start;
+
+    if (status != STATUS_SUCCESS) error("Benchmark loop failed: %s\n", STATUS_TO_NAME[status]);
+
+    Receipt_free(&receipt);
+    TransientStorage_clear(run->transient);
+
+    return elapsed * operations / (iterations * UNROLL);
+}
+
+/* PUSH32 operand, counter from calldata, then the loop: body * UNROLL, counter - 1, loop while non-zero */
+static size_t assemble(const OpBench *bench, uint8_t *code) {
+    static const uint8_t PROLOGUE[] = { 0x7F, OPERAND, 0x60, 0x00, 0x35, 0x5B };
+    size_t size = 0;
+
+    memcpy(code, PROLOGUE, sizeof(PROLOGUE));
+    size += sizeof(PROLOGUE);
+
+    size_t loop = size - 1;
+
+    for (int i = 0; i < UNROLL; i++) {
+        memcpy(code + size, bench->body, bench->size);
+
+        if (bench->target != 0) {
+            size_t destination = size + bench->size - 1;
+            code[size + bench->target] = (uint8_t)(destination >> 8);
+            code[size + bench->target + 1] = (uint8_t)destination;
+        }
+
+        size += bench->size;
+    }
+
+    const uint8_t epilogue[] = { 0x60, 0x01, 0x90, 0x03, 0x80, 0x60, (uint8_t)loop, 0x57, 0x00 };
+    memcpy(code + size, epilogue, sizeof(epilogue));
+
+    return size + sizeof(epilogue);
+}
+
+static void bench_ops(void) {
+    VM vm;
+    VM_init(&vm);
+
+    Address contract = { { 0xC0, 0xDE } };
+    Account *account = Accounts_insert(&vm.accounts, &contract);
+
+    Transaction transaction = { .sender = { { 0xCA, 0x11 } }, .to = contract };
+
+    StateView view;
+    StateView_init(&view, false);
+
+    TransientStorage transient;
+    TransientStorage_init(&transient);
+
+    OpRun run = { &vm, &transaction, &view, &transient };
+
+    for (size_t i = 0; i < sizeof(OP_BENCHES) / sizeof(OP_BENCHES[0]); i++) {
+        uint8_t code[64 + UNROLL * sizeof(OP_BENCHES[i].body)];
+        size_t size = assemble(&OP_BENCHES[i], code);
+
+        account->code = CodeCache_insert(&vm.codes, code, size);
+        measure(OP_BENCHES[i].name, run_op, &run);
+        CodeCache_release(&vm.codes, account->code);
+        account->code = NULL;
+    }
+
+    StateView_free(&view);
+    TransientStorage_free(&transient);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+}
+
+/* UInt256 kernels over a rotating set of operands */
+
+#define OPERANDS 64
+
+typedef struct {
+    UInt256 a[OPERANDS];
+
+    /* Half width, so division and remainder do real work */
+    UInt256 b[OPERANDS];
+
+    uint8_t bytes[OPERANDS][32];
+} Operands;
+
+#define BINARY_KERNEL(name, call) \
+    static double name(void *arg, uint64_t operations) { \
+        const Operands *o = (const Operands*)arg; \
+        uint64_t folded = 0; \
+        double start = now(); \
+        for (uint64_t i = 0; i < operations; i++) { \
+            UInt256 x = o->a[i % OPERANDS]; \
+            call(&x, &o->b[(i + 1) % OPERANDS]); \
+            folded ^= x.elements[3]; \
+        } \
+        double elapsed = now() - start; \
+        sink = folded; \
+        return elapsed; \
+    }
+
+BINARY_KERNEL(kernel_add, UInt256_add)
+BINARY_KERNEL(kernel_sub, UInt256_sub)
+BINARY_KERNEL(kernel_mult, UInt256_mult)
+BINARY_KERNEL(kernel_div, UInt256_div)
+BINARY_KERNEL(kernel_rem, UInt256_rem)
+BINARY_KERNEL(kernel_and, UInt256_and)
+BINARY_KERNEL(kernel_or, UInt256_or)
+BINARY_KERNEL(kernel_xor, UInt256_xor)
+
+static void pow_small(UInt256 *x, const UInt256 *exponent) {
+    UInt256 e = UInt256_from(exponent->elements[3] & 0xFF);
+    UInt256_pow(x, &e);
+}
+
+static void shift_left(UInt256 *x, const UInt256 *op) {
+    UInt256_shiftleft(x, (uint32_t)(op->elements[3] & 0xFF));
+}
+
+static void shift_right(UInt256 *x, const UInt256 *op) {
+    UInt256_shiftright(x, (uint32_t)(op->elements[3] & 0xFF));
+}
+
+static void compare(UInt256 *x, const UInt256 *op) {
+    x->elements[3] += (uint64_t)UInt256_cmp(x, op);
+}
+
+BINARY_KERNEL(kernel_pow, pow_small)
+BINARY_KERNEL(kernel_shiftleft, shift_left)
+BINARY_KERNEL(kernel_shiftright, shift_right)
+BINARY_KERNEL(kernel_cmp, compare)
+
+static double kernel_load(void *arg, uint64_t operations) {
+    const Operands *o = (const Operands*)arg;
+    uint64_t folded = 0;
+    UInt256 x;
+
+    double start = now();
+    for (uint64_t i = 0; i < operations; i++) {
+        UInt256_load(&x, o->bytes[i % OPERANDS]);
+        folded ^= x.elements[i % 4];
+    }
+    double elapsed = now() - start;
+
+    sink = folded;
+    return elapsed;
+}
+
+static double kernel_store(void *arg, uint64_t operations) {
+    const Operands *o = (const Operands*)arg;
+    uint64_t folded = 0;
+    uint8_t bytes[32];
+
+    double start = now();
+    for (uint64_t i = 0; i < operations; i++) {
+        UInt256_store(&o->a[i % OPERANDS], bytes);
+        folded ^= bytes[i % 32];
+    }
+    double elapsed = now() - start;
+
+    sink = folded;
+    return elapsed;
+}
+
+static void bench_uint256(void) {
+    Operands *o = (Operands*)malloc(sizeof(Operands));
+    uint64_t state = 1;
+
+    for (int i = 0; i < OPERANDS; i++) {
+        for (int j = 0; j < 4; j++) {
+            o->a[i].elements[j] = next_random(&state);
+            o->b[i].elements[j] = j < 2 ? 0 : next_random(&state);
+        }
+
+        UInt256_store(&o->a[i], o->bytes[i]);
+    }
+
+    measure("uint256.add", kernel_add, o);
+    measure("uint256.sub", kernel_sub, o);
+    measure("uint256.mult", kernel_mult, o);
+    measure("uint256.div", kernel_div, o);
+    measure("uint256.rem", kernel_rem, o);
+    measure("uint256.pow", kernel_pow, o);
+    measure("uint256.and", kernel_and, o);
+    measure("uint256.or", kernel_or, o);
+    measure("uint256.xor", kernel_xor, o);
+    measure("uint256.shiftleft", kernel_shiftleft, o);
+    measure("uint256.shiftright", kernel_shiftright, o);
+    measure("uint256.cmp", kernel_cmp, o);
+    measure("uint256.load", kernel_load, o);
+    measure("uint256.store", kernel_store, o);
+
+    free(o);
+}
+
+/* Keccak of `size` bytes, per hash */
+
+typedef struct {
+    const uint8_t *input;
+    size_t size;
+} KeccakRun;
+
+static double kernel_keccak(void *arg, uint64_t operations) {
+    const KeccakRun *run = (const KeccakRun*)arg;
+    uint64_t folded = 0;
+    UInt256 hash;
+
+    double start = now();
+    for (uint64_t i = 0; i < operations; i++) {
+        UInt256_keccak(&hash, run->input, run->size);
+        folded ^= hash.elements[3];
+    }
+    double elapsed = now() - start;
+
+    sink = folded;
+    return elapsed;
+}
+
+static void bench_keccak(void) {
+    uint8_t input[4096];
+    uint64_t state = 2;
+
+    for (size_t i = 0; i < sizeof(input); i++) input[i] = (uint8_t)next_random(&state);
+
+    for (size_t i = 0; i < sizeof(KECCAK_SIZES) / sizeof(KECCAK_SIZES[0]); i++) {
+        char name[48];
+        KeccakRun run = { input, KECCAK_SIZES[i] };
+
+        snprintf(name, sizeof(name), "keccak.%zu", KECCAK_SIZES[i]);
+        measure(name, kernel_keccak, &run);
+    }
+}
+
+/* Storage with `size` random keys: inserts into a fresh table, gets from a full one */
+
+typedef struct {
+    const UInt256 *keys;
+    size_t size;
+    Storage *full;
+} StorageRun;
+
+static double kernel_storage_insert(void *arg, uint64_t operations) {
+    const StorageRun *run = (const StorageRun*)arg;
+    double elapsed = 0;
+
+    for (uint64_t done = 0; done < operations; ) {
+        uint64_t count = operations - done < run->size ? operations - done : run->size;
+
+        Storage *storage = (Storage*)malloc(sizeof(Storage));
+        Storage_init(storage);
+
+        double start = now();
+        for (uint64_t i = 0; i < count; i++) Storage_insert(storage, &run->keys[i], &run->keys[i]);
+        elapsed += now() - start;
+
+        Storage_free(storage);
+        done += count;
+    }
+
+    return elapsed;
+}
+
+static double kernel_storage_get(void *arg, uint64_t operations) {
+    const StorageRun *run = (const StorageRun*)arg;
+    uint64_t folded = 0;
+
+    double start = now();
+    for (uint64_t i = 0; i < operations; i++) folded ^= Storage_get(run->full, &run->keys[i % run->size])->elements[3];
+    double elapsed = now() - start;
+
+    sink = folded;
+    return elapsed;
+}
+
+static void bench_storage(void) {
+    size_t largest = STORAGE_SIZES[sizeof(STORAGE_SIZES) / sizeof(STORAGE_SIZES[0]) - 1];
+    UInt256 *keys = (UInt256*)malloc(sizeof(UInt256) * largest);
+    uint64_t state = 3;
+
+    for (size_t i = 0; i < largest; i++)
+        for (int j = 0; j < 4; j++) keys[i].elements[j] = next_random(&state);
+
+    for (size_t i = 0; i < sizeof(STORAGE_SIZES) / sizeof(STORAGE_SIZES[0]); i++) {
+        char name[48];
+        StorageRun run = { keys, STORAGE_SIZES[i] };
+
+        snprintf(name, sizeof(name), "storage.insert.%zu", run.size);
+        measure(name, kernel_storage_insert, &run);
+
+        snprintf(name, sizeof(name), "storage.get.%zu", run.size);
+        if (filter != NULL && strstr(name, filter) == NULL) continue;
+
+        run.full = (Storage*)malloc(sizeof(Storage));
+        Storage_init(run.full);
+        for (size_t j = 0; j < run.size; j++) Storage_insert(run.full, &keys[j], &keys[j]);
+
+        measure(name, kernel_storage_get, &run);
+        Storage_free(run.full);
+    }
+
+    free(keys);
+}
+
+/* Memory grown a word at a time up to `size` bytes, like a run of MSTOREs, per word */
+
+static double kernel_memory(void *arg, uint64_t operations) {
+    size_t words = *(const size_t*)arg / 32;
+    double elapsed = 0;
+
+    for (uint64_t done = 0; done < operations; ) {
+        uint64_t count = operations - done < words ? operations - done : words;
+
+        Memory *memory = (Memory*)malloc(sizeof(Memory));
+        double start = now();
+
+        Memory_init(memory);
+        for (uint64_t i = 0; i < count; i++) Memory_expand(memory, i * 32, 32)[31] = (uint8_t)i;
+
+        elapsed += now() - start;
+
+        Memory_free(memory);
+        done += count;
+    }
+
+    return elapsed;
+}
+
+static void bench_memory(void) {
+    for (size_t i = 0; i < sizeof(MEMORY_SIZES) / sizeof(MEMORY_SIZES[0]); i++) {
+        char name[48];
+        size_t size = MEMORY_SIZES[i];
+
+        snprintf(name, sizeof(name), "memory.grow.%zu", size);
+        measure(name, kernel_memory, &size);
+    }
+}
+
+static void write_json(FILE *file) {
+    fprintf(file, "{\n  \"unit\": \"ns_per_op\",\n  \"benchmarks\": [\n");
+
+    for (size_t i = 0; i < results_length; i++)
+        fprintf(file, "    { \"name\": \"%s\", \"ns\": %.3f }%s\n", results[i].name, results[i].ns, i + 1 < results_length ? "," : "");
+
+    fprintf(file, "  ]\n}\n");
+}
+
+/* Reads back what write_json wrote: every `"name": ..., "ns": ...` pair */
+static void read_json(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) error("Failed to open %s\n", path);
+
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != NULL && baseline_length < MAX_RESULTS) {
+        const char *name = strstr(line, "\"name\": \"");
+        const char *ns = strstr(line, "\"ns\": ");
+        if (name == NULL || ns == NULL) continue;
+
+        name += strlen("\"name\": \"");
+        const char *end = strchr(name, '"');
+        if (end == NULL || (size_t)(end - name) >= sizeof(baseline->name)) continue;
+
+        Result *result = &baseline[baseline_length++];
+
+        memcpy(result->name, name, (size_t)(end - name));
+        result->name[end - name] = '\0';
+        result->ns = strtod(ns + strlen("\"ns\": "), NULL);
+    }
+
+    fclose(file);
+}
+
+/* Print each benchmark against the baseline, returns the number slower by more than `threshold` percent */
+static size_t compare_results(void) {
+    size_t regressions = 0;
+
+    fprintf(stderr, "\n%-36s %12s %12s %9s\n", "benchmark", "baseline", "current", "change");
+
+    for (size_t i = 0; i < results_length; i++) {
+        const Result *current = &results[i];
+        const Result *before = find_baseline(current->name);
+
+        if (before == NULL || before->ns <= 0) {
+            fprintf(stderr, "%-36s %12s %12.3f %9s\n", current->name, "-", current->ns, "new");
+            continue;
+        }
+
+        double change = (current->ns - before->ns) / before->ns * 100;
+        const char *flag = change > threshold ? "  REGRESSION" : change < -threshold ? "  improved" : "";
+
+        if (change > threshold) regressions++;
+
+        fprintf(stderr, "%-36s %12.3f %12.3f %+8.1f%%%s\n", current->name, before->ns, current->ns, change, flag);
+    }
+
+    fprintf(stderr, "\n%zu regression%s over %.1f%%\n", regressions, regressions == 1 ? "" : "s", threshold);
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL, *baseline_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (value == NULL) error("Missing value for %s\n", option);
+        i++;
+
+        if (strcmp(option, "--filter") == 0) filter = value;
+        else if (strcmp(option, "--output") == 0) output = value;
+        else if (strcmp(option, "--compare") == 0) baseline_path = value;
+        else if (strcmp(option, "--threshold") == 0) threshold = strtod(value, NULL);
+        else error("Unknown option %s\n", option);
+    }
+
+    /* Read first, the output may replace it */
+    if (baseline_path != NULL) read_json(baseline_path);
+
+    bench_ops();
+    bench_uint256();
+    bench_keccak();
+    bench_storage();
+    bench_memory();
+
+    FILE *file = output == NULL ? stdout : fopen(output, "w");
+    if (file == NULL) error("Failed to open %s\n", output);
+
+    write_json(file);
+    if (file != stdout) fclose(file);
+
+    size_t regressions = baseline_path == NULL ? 0 : compare_results();
+
+    return regressions > 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+/**
+ * Serial against pipelined block execution. Every transaction
+ * installs its own contract (a short SSTORE loop padded out with
+ * unreachable code, so decoding and analysis have real work) and
+ * calls it with some calldata
+ *
+ * Usage: pipeline [transactions] [queue capacity] [code size]
+ */
+
+#include "pipeline.h"
+
+static const char HEX[] = "0123456789abcdef";
+
+static void hex_byte(char *out, uint8_t byte) {
+    out[0] = HEX[byte >> 4];
+    out[1] = HEX[byte & 0xF];
+}
+
+/* counter = iterations; do { SSTORE(counter, counter); counter-- } while (counter != 0); STOP; padding */
+static char *contract(size_t iterations, size_t size) {
+    const uint8_t loop[] = {
+        0x61, (uint8_t)(iterations >> 8), (uint8_t)iterations,
+        0x5B, 0x80, 0x80, 0x55,
+        0x60, 0x01, 0x90, 0x03,
+        0x80, 0x60, 0x03, 0x57,
+        0x00,
+    };
+
+    if (size < sizeof(loop)) size = sizeof(loop);
+
+    char *hex = (char*)malloc(size * 2 + 1);
+
+    for (size_t i = 0; i < size; i++)
+        hex_byte(hex + i * 2, i < sizeof(loop) ? loop[i] : (uint8_t)(0x60 + i % 0x20));
+
+    hex[size * 2] = '\0';
+
+    return hex;
+}
+
+static void report(const char *title, const PipelineStats *stats, size_t length) {
+    printf("%s: %.3fs, %.0f tx/s\n", title, stats->elapsed, length / stats->elapsed);
+    printf("  %-8s %8s %12s %10s %10s %10s %10s\n", "stage", "items", "items/s", "starved", "blocked", "depth max", "depth avg");
+
+    for (Stage stage = 0; stage < PIPELINE_STAGES; stage++) {
+        const StageStats *s = &stats->stages[stage];
+
+        printf("  %-8s %8zu %12.0f %9.3fs %9.3fs %10zu %10.2f\n", STAGE_TO_NAME[stage], s->items,
+            s->busy > 0 ? s->items / s->busy : 0, s->starved, s->blocked, s->depth_max, s->depth_mean);
+    }
+}
+
+static void run(const char *title, const RawTransaction *transactions, size_t length, size_t capacity) {
+    VM vm;
+    VM_init(&vm);
+
+    Receipt *receipts = (Receipt*)malloc(sizeof(Receipt) * length);
+
+    LocationMap changes;
+    LocationMap_init(&changes);
+
+    PipelineStats stats;
+    Pipeline_run_block(&vm, transactions, length, capacity, receipts, &changes, &stats);
+
+    report(title, &stats, length);
+    printf("  %zu locations changed\n", changes.length);
+
+    for (size_t i = 0; i < length; i++) {
+        if (receipts[i].status != STATUS_SUCCESS) error("Transaction %zu failed with status %d\n", i, (int)receipts[i].status);
+        Receipt_free(&receipts[i]);
+    }
+
+    free(receipts);
+    LocationMap_free(&changes);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+}
+
+int main(int argc, char **argv) {
+    size_t length = argc > 1 ? (size_t)atol(argv[1]) : 2000;
+    size_t capacity = argc > 2 ? (size_t)atol(argv[2]) : 64;
+    size_t code_size = argc > 3 ? (size_t)atol(argv[3]) : 8192;
+
+    RawTransaction *transactions = (RawTransaction*)calloc(length, sizeof(RawTransaction));
+
+    char *calldata = (char*)malloc(1024 * 2 + 1);
+    for (size_t i = 0; i < 1024; i++) hex_byte(calldata + i * 2, (uint8_t)i);
+    calldata[1024 * 2] = '\0';
+
+    for (size_t i = 0; i < length; i++) {
+        transactions[i].to = (Address){ { 0xC0, (uint8_t)(i >> 8), (uint8_t)i } };
+        transactions[i].calldata = calldata;
+
+        /* Distinct iteration counts give distinct code hashes */
+        transactions[i].code = contract(16 + i % 4096, code_size);
+    }
+
+    run("serial", transactions, length, 0);
+    run("pipelined", transactions, length, capacity);
+
+    for (size_t i = 0; i < length; i++)
+        free((char*)transactions[i].code);
+
+    free(transactions);
+    free(calldata);
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+/**
+ * Throughput of read-only calls through the work-stealing runner
+ * at 1 to N threads. Every call loops over an SLOAD of the same
+ * contract, so all threads read shared state concurrently
+ *
+ * Usage: runner [max threads] [calls per batch]
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include "runner.h"
+
+#define ITERATIONS 1000
+#define BATCHES 5
+
+/* counter = ITERATIONS; do { SLOAD(0); counter-- } while (counter != 0) */
+static const uint8_t LOOP[] = {
+    0x61, ITERATIONS >> 8, ITERATIONS & 0xFF,   /* PUSH2 ITERATIONS */
+    0x5B,                                       /* JUMPDEST         */
+    0x60, 0x00, 0x54, 0x50,                     /* PUSH1 0 SLOAD POP */
+    0x60, 0x01, 0x90, 0x03,                     /* PUSH1 1 SWAP1 SUB */
+    0x80, 0x60, 0x03, 0x57,                     /* DUP1 PUSH1 3 JUMPI */
+    0x00,                                       /* STOP             */
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t max_threads = argc > 1 ? (size_t)atol(argv[1]) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t length = argc > 2 ? (size_t)atol(argv[2]) : 10000;
+
+    VM vm;
+    VM_init(&vm);
+
+    Address contract = { { 0xC0, 0xDE } };
+    Account *account = Accounts_insert(&vm.accounts, &contract);
+    account->code = CodeCache_insert(&vm.codes, LOOP, sizeof(LOOP));
+
+    UInt256 key = UInt256_from(0), value = UInt256_from(42);
+    Storage_insert(account->storage, &key, &value);
+
+    Transaction *calls = (Transaction*)calloc(length, sizeof(Transaction));
+    Receipt *results = (Receipt*)malloc(sizeof(Receipt) * length);
+
+    for (size_t i = 0; i < length; i++)
+        calls[i].to = contract;
+
+    printf("%-8s %14s %10s %8s\n", "threads", "calls/s", "speedup", "steals");
+
+    double base = 0;
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        Runner runner;
+        Runner_init(&runner, &vm, threads);
+
+        double best = 0;
+
+        for (int batch = 0; batch < BATCHES; batch++) {
+            double start = now();
+            Runner_run(&runner, calls, length, results);
+            double elapsed = now() - start;
+
+            for (size_t i = 0; i < length; i++) {
+                if (results[i].status != STATUS_SUCCESS) error("Call %zu failed with status %d\n", i, (int)results[i].status);
+                Receipt_free(&results[i]);
+            }
+
+            if (length / elapsed > best) best = length / elapsed;
+        }
+
+        if (threads == 1) base = best;
+
+        printf("%-8zu %14.0f %9.2fx %8zu\n", threads, best, best / base, runner.steals);
+
+        Runner_free(&runner);
+
+        /* Always finish on the requested maximum */
+        if (threads < max_threads && threads * 2 > max_threads) threads = max_threads / 2;
+    }
+
+    free(calls);
+    free(results);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+/**
+ * Hiding backend latency by switching between calls. Every call
+ * loads four cold slots from a KVStore with simulated latency and
+ * then does some compute. Concurrency 1 is the blocking baseline.
+ * Each concurrency runs once as is and once with the slots
+ * predicted from calldata fetched on admission
+ *
+ * Usage: scheduler [calls] [latency us] [store threads]
+ */
+
+#include <time.h>
+
+#include "scheduler.h"
+#include "kvstore.h"
+
+#define SLICE 1000
+
+/*
+ * a, b, c = calldata words; SLOAD(balances[a]); SLOAD(balances[b]);
+ * SLOAD(c); SLOAD(2); for 200 iterations: nothing. balances is the
+ * mapping at slot 1, laid out the way Solidity hashes it
+ */
+static const uint8_t CONTRACT[] = {
+    0x60, 0x00, 0x35, 0x60, 0x00, 0x52, /* PUSH1 0 CALLDATALOAD PUSH1 0 MSTORE  */
+    0x60, 0x01, 0x60, 0x20, 0x52,       /* PUSH1 1 PUSH1 32 MSTORE              */
+    0x60, 0x40, 0x60, 0x00, 0x20,       /* PUSH1 64 PUSH1 0 SHA3                */
+    0x54, 0x50,                         /* SLOAD POP                            */
+    0x60, 0x20, 0x35, 0x60, 0x00, 0x52, /* PUSH1 32 CALLDATALOAD PUSH1 0 MSTORE */
+    0x60, 0x40, 0x60, 0x00, 0x20,       /* PUSH1 64 PUSH1 0 SHA3                */
+    0x54, 0x50,                         /* SLOAD POP                            */
+    0x60, 0x40, 0x35, 0x54, 0x50,       /* PUSH1 64 CALLDATALOAD SLOAD POP      */
+    0x60, 0x02, 0x54, 0x50,             /* PUSH1 2 SLOAD POP                    */
+    0x61, 0x00, 0xC8,                   /* PUSH2 200                            */
+    0x5B,                               /* JUMPDEST                             */
+    0x60, 0x01, 0x90, 0x03,             /* PUSH1 1 SWAP1 SUB                    */
+    0x80, 0x60, 0x2B, 0x57,             /* DUP1 PUSH1 43 JUMPI                  */
+    0x00,                               /* STOP                                 */
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(size_t length, size_t concurrency, bool prefetch, unsigned latency, size_t threads) {
+    VM vm;
+    VM_init(&vm);
+
+    Address contract = { { 0xC0, 0xDE } };
+    Account *account = Accounts_insert(&vm.accounts, &contract);
+    account->code = CodeCache_insert(&vm.codes, CONTRACT, sizeof(CONTRACT));
+
+    KVStore store;
+    KVStore_init(&store, threads, latency);
+
+    /* Balances are left out, they read as zero after the same latency */
+    for (size_t i = 0; i < length; i++) {
+        UInt256 key = UInt256_from(i + 1000), value = UInt256_from(i + 1);
+        KVStore_put(&store, account->storage, &key, &value);
+    }
+
+    UInt256 supply_key = UInt256_from(2), supply = UInt256_from(length);
+    KVStore_put(&store, account->storage, &supply_key, &supply);
+
+    Transaction *calls = (Transaction*)calloc(length, sizeof(Transaction));
+    uint8_t *calldata = (uint8_t*)calloc(length, 96);
+    Receipt *results = (Receipt*)malloc(sizeof(Receipt) * length);
+
+    for (size_t i = 0; i < length; i++) {
+        UInt256 a = UInt256_from(i * 2), b = UInt256_from(i * 2 + 1), c = UInt256_from(i + 1000);
+        UInt256_store(&a, calldata + i * 96);
+        UInt256_store(&b, calldata + i * 96 + 32);
+        UInt256_store(&c, calldata + i * 96 + 64);
+
+        calls[i].to = contract;
+        calls[i].calldata = calldata + i * 96;
+        calls[i].calldata_size = 96;
+    }
+
+    SchedulerStats stats;
+
+    double start = now();
+    Scheduler_run(&vm, &store.backend, calls, length, concurrency, SLICE, prefetch, results, &stats);
+    double elapsed = now() - start;
+
+    for (size_t i = 0; i < length; i++) {
+        if (results[i].status != STATUS_SUCCESS) error("Call %zu failed with status %d\n", i, (int)results[i].status);
+        Receipt_free(&results[i]);
+    }
+
+    double hit_rate = stats.predicted == 0 ? 0 : 100.0 * stats.prefetch_hits / stats.predicted;
+
+    printf("%-12zu %-9s %10.0f %8zu %8zu %8zu %12zu %8.1f%% %10.1f\n", concurrency, prefetch ? "yes" : "no", length / elapsed,
+        stats.loads, stats.joins, stats.slices, stats.waiting_max, hit_rate, stats.stall * 1e3);
+
+    KVStore_free(&store);
+    free(calls);
+    free(calldata);
+    free(results);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+}
+
+int main(int argc, char **argv) {
+    size_t length = argc > 1 ? (size_t)atol(argv[1]) : 2000;
+    unsigned latency = argc > 2 ? (unsigned)atoi(argv[2]) : 100;
+    size_t threads = argc > 3 ? (size_t)atol(argv[3]) : 16;
+
+    printf("%-12s %-9s %10s %8s %8s %8s %12s %9s %10s\n", "concurrency", "prefetch", "calls/s", "loads", "joins", "slices",
+        "waiting max", "hit rate", "stall ms");
+
+    for (size_t concurrency = 1; concurrency <= 64; concurrency *= 4) {
+        run(length, concurrency, false, latency, threads);
+        run(length, concurrency, true, latency, threads);
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,312 @@
+/**
+ * Request throughput of `cevm serve` over its Unix socket, at
+ * different pipeline depths (requests in flight per connection).
+ * The server runs on its own thread in this process. Also checks
+ * that bad requests come back as faults, code that runs out of
+ * memory as results, overrides aren't kept, and the server carries on.
+ * Then kills the worker of a call that never ends and checks only
+ * that call fails
+ *
+ * Usage: server [requests] [socket path] [workers]
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+#define BUDGET 100000
+
+/* return calldata[0] + SLOAD(0) */
+static const uint8_t CONTRACT[] = {
+    0x60, 0x00, 0x35, 0x60, 0x00, 0x54, 0x01,   /* PUSH1 0 CALLDATALOAD PUSH1 0 SLOAD ADD */
+    0x60, 0x00, 0x52, 0x60, 0x20, 0x60, 0x00,   /* PUSH1 0 MSTORE PUSH1 32 PUSH1 0       */
+    0xF3,                                       /* RETURN                                */
+};
+
+/* JUMPDEST PUSH1 0 JUMP, forever */
+static const uint8_t LOOP[] = { 0x5B, 0x60, 0x00, 0x56 };
+
+/* PUSH1 1 PUSH8 offset MSTORE, with offsets past MEMORY_MAX and past 2^64 words */
+static const uint8_t HUGE_STORE[] = { 0x60, 0x01, 0x67, 0x40, 0, 0, 0, 0, 0, 0, 0, 0x52 };
+static const uint8_t WRAPPING_STORE[] = { 0x60, 0x01, 0x67, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x52 };
+
+static const Address CONTRACT_ADDRESS = { { 0xC0, 0xDE } };
+static const Address LOOP_ADDRESS = { { 0x10, 0x09 } };
+static const Address HUGE_ADDRESS = { { 0x0E, 0x01 } };
+static const Address WRAPPING_ADDRESS = { { 0x0E, 0x02 } };
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *serve(void *arg) {
+    Server_run((Server*)arg);
+    return NULL;
+}
+
+static void put_le(uint8_t *p, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+static void send_all(int fd, const uint8_t *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) error("Send failed\n");
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+}
+
+static void receive_all(int fd, uint8_t *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received <= 0) error("Receive failed\n");
+        bytes += received;
+        size -= (size_t)received;
+    }
+}
+
+/* Write a call to `to` with a one word calldata, returns its size. Overrides slot 0 of `override` with `value` unless it's NULL */
+static size_t encode_call_override(uint8_t *p, uint64_t id, const Address *to, uint64_t word, const Address *override, uint64_t value) {
+    size_t size = 1 + 8 + 1 + 20 + 20 + 4 + 32 + 2 + (override != NULL ? 20 + 32 + 32 : 0);
+
+    put_le(p, size, 4);
+    p[4] = SERVER_CALL;
+    put_le(p + 5, id, 8);
+    p[13] = SERVER_TARGET_ADDRESS;
+    memcpy(p + 14, to->bytes, 20);
+    memset(p + 34, 0xCA, 20);
+    put_le(p + 54, 32, 4);
+    memset(p + 58, 0, 32);
+    put_le(p + 58 + 24, __builtin_bswap64(word), 8);
+    put_le(p + 90, override != NULL, 2);
+
+    if (override != NULL) {
+        memcpy(p + 92, override->bytes, 20);
+        memset(p + 112, 0, 64);
+        put_le(p + 112 + 32 + 24, __builtin_bswap64(value), 8);
+    }
+
+    return 4 + size;
+}
+
+static size_t encode_call(uint8_t *p, uint64_t id, const Address *to, uint64_t word) {
+    return encode_call_override(p, id, to, word, NULL, 0);
+}
+
+static size_t encode_deploy(uint8_t *p, uint64_t id, const Address *address, const uint8_t *code, size_t code_size) {
+    size_t size = 1 + 8 + 20 + 4 + code_size;
+
+    put_le(p, size, 4);
+    p[4] = SERVER_DEPLOY;
+    put_le(p + 5, id, 8);
+    memcpy(p + 13, address->bytes, 20);
+    put_le(p + 33, code_size, 4);
+    memcpy(p + 37, code, code_size);
+
+    return 4 + size;
+}
+
+static int connect_to(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) error("Couldn't connect to %s\n", path);
+
+    return fd;
+}
+
+/* Read one reply into `reply`, returns its size */
+static size_t receive_reply(int fd, uint8_t *reply) {
+    uint8_t header[4];
+    receive_all(fd, header, 4);
+
+    size_t size = get_le(header, 4);
+    receive_all(fd, reply, size);
+
+    return size;
+}
+
+int main(int argc, char **argv) {
+    size_t length = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+    const char *path = argc > 2 ? argv[2] : "cevm-bench.sock";
+    size_t workers = argc > 3 ? (size_t)atol(argv[3]) : 0;
+
+    VM vm;
+    VM_init(&vm);
+
+    Server server;
+    Server_init(&server, &vm, path, BUDGET);
+    if (workers > 0) Server_start_workers(&server, workers);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, serve, &server);
+
+    int fd = connect_to(path);
+
+    uint8_t request[256], reply[256];
+
+    send_all(fd, request, encode_deploy(request, 0, &CONTRACT_ADDRESS, CONTRACT, sizeof(CONTRACT)));
+    receive_reply(fd, reply);
+    send_all(fd, request, encode_deploy(request, 0, &LOOP_ADDRESS, LOOP, sizeof(LOOP)));
+    receive_reply(fd, reply);
+
+    /* A call that never ends and one to an address without code, both faults */
+    send_all(fd, request, encode_call(request, 1, &LOOP_ADDRESS, 0));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_FAULT) error("Endless call wasn't stopped\n");
+
+    Address nobody = { { 0x0B } };
+    send_all(fd, request, encode_call(request, 2, &nobody, 0));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_FAULT) error("Call without code didn't fault\n");
+
+    /* Code touching memory it can't have stops with a status */
+    send_all(fd, request, encode_deploy(request, 0, &HUGE_ADDRESS, HUGE_STORE, sizeof(HUGE_STORE)));
+    receive_reply(fd, reply);
+    send_all(fd, request, encode_deploy(request, 0, &WRAPPING_ADDRESS, WRAPPING_STORE, sizeof(WRAPPING_STORE)));
+    receive_reply(fd, reply);
+
+    send_all(fd, request, encode_call(request, 3, &HUGE_ADDRESS, 0));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_RESULT || reply[9] != STATUS_OUT_OF_MEMORY) error("Huge memory store didn't stop\n");
+
+    send_all(fd, request, encode_call(request, 4, &WRAPPING_ADDRESS, 0));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_RESULT || reply[9] != STATUS_OUT_OF_MEMORY) error("Wrapping memory store didn't stop\n");
+
+    /* Overrides are seen by the call only, and don't create accounts */
+    size_t accounts = vm.accounts.length;
+
+    send_all(fd, request, encode_call_override(request, 5, &CONTRACT_ADDRESS, 1, &CONTRACT_ADDRESS, 41));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_RESULT || reply[10 + 4 + 31] != 42) error("Override wasn't seen\n");
+
+    send_all(fd, request, encode_call_override(request, 6, &CONTRACT_ADDRESS, 1, &nobody, 41));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_RESULT || vm.accounts.length != accounts) error("Override created an account\n");
+
+    send_all(fd, request, encode_call(request, 7, &CONTRACT_ADDRESS, 1));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_RESULT || reply[10 + 4 + 31] != 1) error("Override was kept\n");
+
+    printf("%-8s %12s\n", "depth", "requests/s");
+
+    uint8_t *batch = (uint8_t*)malloc(256 * 128);
+
+    for (size_t depth = 1; depth <= 256; depth *= 4) {
+        double start = now();
+        uint64_t id = 0;
+
+        for (size_t sent = 0; sent < length; sent += depth) {
+            size_t size = 0;
+
+            for (size_t i = 0; i < depth; i++) {
+                id++;
+                size += encode_call(batch + size, id, &CONTRACT_ADDRESS, id);
+            }
+
+            send_all(fd, batch, size);
+
+            for (size_t i = 0; i < depth; i++) {
+                receive_reply(fd, reply);
+
+                uint64_t expected = id - depth + 1 + i;
+                if (get_le(reply, 8) != expected || reply[8] != SERVER_RESULT || reply[9] != STATUS_SUCCESS || reply[10 + 4 + 31] != (uint8_t)expected)
+                    error("Bad reply to request %llu\n", (unsigned long long)expected);
+            }
+        }
+
+        printf("%-8zu %12.0f\n", depth, (length / depth * depth) / (now() - start));
+    }
+
+    size_t size = 4 + 1 + 8;
+    put_le(request, 9, 4);
+    request[4] = SERVER_STATS;
+    put_le(request + 5, 3, 8);
+    send_all(fd, request, size);
+    receive_reply(fd, reply);
+
+    const uint8_t *data = reply + 8 + 1 + 1 + 4;
+    printf("\nserver: %llu requests, %llu faults, %llu batches, p50 %llu ns, p99 %llu ns\n",
+        (unsigned long long)get_le(data, 8), (unsigned long long)get_le(data + 8, 8), (unsigned long long)get_le(data + 16, 8),
+        (unsigned long long)get_le(data + 24, 8), (unsigned long long)get_le(data + 32, 8));
+
+    close(fd);
+    free(batch);
+
+    Server_stop(&server);
+    pthread_join(thread, NULL);
+    Server_free(&server);
+
+    /* Without a budget nothing stops LOOP but killing its worker */
+    Server crashing;
+    Server_init(&crashing, &vm, path, 0);
+    Server_start_workers(&crashing, 1);
+    pthread_create(&thread, NULL, serve, &crashing);
+
+    fd = connect_to(path);
+
+    send_all(fd, request, encode_call(request, 1, &LOOP_ADDRESS, 0));
+    usleep(100000);
+    kill(crashing.pool->workers[0].pid, SIGKILL);
+
+    receive_reply(fd, reply);
+    if (get_le(reply, 8) != 1 || reply[8] != SERVER_FAULT) error("Call didn't fail with its worker\n");
+
+    send_all(fd, request, encode_call(request, 2, &CONTRACT_ADDRESS, 7));
+    receive_reply(fd, reply);
+    if (reply[8] != SERVER_RESULT || reply[10 + 4 + 31] != 7) error("Worker wasn't forked again\n");
+    if (crashing.pool->crashes != 1) error("Expected 1 crash, got %zu\n", crashing.pool->crashes);
+
+    close(fd);
+
+    Server_stop(&crashing);
+    pthread_join(thread, NULL);
+    Server_free(&crashing);
+
+    printf("killed worker: its call failed, the next ran on a new worker\n");
+
+    /* The same workers running plain calls into receipts */
+    ForkPool pool;
+    ForkPool_init(&pool, &vm, 2);
+
+    uint8_t calldata[8][32] = { { 0 } };
+    Transaction calls[8];
+    Receipt receipts[8];
+
+    for (size_t i = 0; i < 8; i++) {
+        calldata[i][31] = (uint8_t)i;
+        calls[i] = (Transaction){ .to = CONTRACT_ADDRESS, .calldata = calldata[i], .calldata_size = 32 };
+    }
+
+    ForkPool_run(&pool, calls, 8, receipts);
+
+    for (size_t i = 0; i < 8; i++) {
+        if (receipts[i].status != STATUS_SUCCESS || receipts[i].return_data_size != 32 || receipts[i].return_data[31] != i)
+            error("Bad receipt for pool call %zu\n", i);
+
+        Receipt_free(&receipts[i]);
+    }
+
+    ForkPool_free(&pool);
+
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,179 @@
+/**
+ * Reader scaling of SharedStorage against Storage behind a
+ * reader-writer lock. One writer keeps inserting and publishing
+ * while 1 to N readers look up random keys in batches
+ *
+ * Usage: shared [max readers] [keys]
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared.h"
+#include "storage.h"
+
+#define DURATION 0.5
+#define LOOKUPS 64      /* Lookups per read section */
+#define WRITES 128      /* Inserts per publish */
+
+typedef struct {
+    SharedStorage shared;
+
+    Storage locked;
+    pthread_rwlock_t lock;
+
+    bool use_lock;
+    size_t keys;
+    bool stopping;
+} Bench;
+
+typedef struct {
+    Bench *bench;
+    unsigned seed;
+    uint64_t reads;
+    pthread_t thread;
+} Reader;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *read_loop(void *arg) {
+    Reader *reader = (Reader*)arg;
+    Bench *bench = reader->bench;
+
+    SharedReader *slot = bench->use_lock ? NULL : SharedReader_register(&bench->shared);
+    uint64_t sum = 0;
+
+    while (!__atomic_load_n(&bench->stopping, __ATOMIC_RELAXED)) {
+        if (bench->use_lock) {
+            pthread_rwlock_rdlock(&bench->lock);
+
+            for (int i = 0; i < LOOKUPS; i++) {
+                UInt256 key = UInt256_from(rand_r(&reader->seed) % bench->keys);
+                sum += Storage_get(&bench->locked, &key)->elements[3];
+            }
+
+            pthread_rwlock_unlock(&bench->lock);
+        } else {
+            const SharedVersion *version = SharedReader_begin(&bench->shared, slot);
+
+            for (int i = 0; i < LOOKUPS; i++) {
+                UInt256 key = UInt256_from(rand_r(&reader->seed) % bench->keys);
+                sum += SharedVersion_get(version, &key)->elements[3];
+            }
+
+            SharedReader_end(slot);
+        }
+
+        reader->reads += LOOKUPS;
+    }
+
+    if (slot != NULL) SharedReader_unregister(slot);
+
+    /* Keep lookups from being optimised out */
+    if (sum == 1) printf(" ");
+
+    return NULL;
+}
+
+static void *write_loop(void *arg) {
+    Bench *bench = (Bench*)arg;
+    unsigned seed = 1;
+
+    while (!__atomic_load_n(&bench->stopping, __ATOMIC_RELAXED)) {
+        if (bench->use_lock) pthread_rwlock_wrlock(&bench->lock);
+
+        for (int i = 0; i < WRITES; i++) {
+            UInt256 key = UInt256_from(rand_r(&seed) % bench->keys), value = UInt256_from(rand_r(&seed));
+
+            if (bench->use_lock) Storage_insert(&bench->locked, &key, &value);
+            else SharedStorage_insert(&bench->shared, &key, &value);
+        }
+
+        if (bench->use_lock) pthread_rwlock_unlock(&bench->lock);
+        else SharedStorage_publish(&bench->shared);
+    }
+
+    return NULL;
+}
+
+/* Lookups per second summed over `readers` threads */
+static double measure(Bench *bench, size_t readers, bool use_lock) {
+    bench->use_lock = use_lock;
+    bench->stopping = false;
+
+    Reader *threads = (Reader*)calloc(readers, sizeof(Reader));
+    pthread_t writer;
+
+    pthread_create(&writer, NULL, write_loop, bench);
+
+    for (size_t i = 0; i < readers; i++) {
+        threads[i].bench = bench;
+        threads[i].seed = (unsigned)i + 7;
+        pthread_create(&threads[i].thread, NULL, read_loop, &threads[i]);
+    }
+
+    double start = now();
+    usleep((useconds_t)(DURATION * 1e6));
+    __atomic_store_n(&bench->stopping, true, __ATOMIC_RELAXED);
+
+    uint64_t reads = 0;
+
+    for (size_t i = 0; i < readers; i++) {
+        pthread_join(threads[i].thread, NULL);
+        reads += threads[i].reads;
+    }
+
+    double elapsed = now() - start;
+
+    pthread_join(writer, NULL);
+    free(threads);
+
+    return reads / elapsed;
+}
+
+int main(int argc, char **argv) {
+    size_t max_readers = argc > 1 ? (size_t)atol(argv[1]) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t keys = argc > 2 ? (size_t)atol(argv[2]) : 100000;
+
+    if (max_readers > SHARED_READERS_MAX) max_readers = SHARED_READERS_MAX;
+
+    Bench bench;
+    bench.keys = keys;
+
+    SharedStorage_init(&bench.shared);
+    Storage_init(&bench.locked);
+    pthread_rwlock_init(&bench.lock, NULL);
+
+    for (size_t i = 0; i < keys; i++) {
+        UInt256 key = UInt256_from(i), value = UInt256_from(i);
+        SharedStorage_insert(&bench.shared, &key, &value);
+        Storage_insert(&bench.locked, &key, &value);
+    }
+
+    SharedStorage_publish(&bench.shared);
+
+    printf("%-8s %16s %16s\n", "readers", "shared reads/s", "rwlock reads/s");
+
+    for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+        double shared = measure(&bench, readers, false);
+        double locked = measure(&bench, readers, true);
+
+        printf("%-8zu %16.0f %16.0f\n", readers, shared, locked);
+
+        /* Always finish on the requested maximum */
+        if (readers < max_readers && readers * 2 > max_readers) readers = max_readers / 2;
+    }
+
+    SharedStorage_free(&bench.shared);
+    pthread_rwlock_destroy(&bench.lock);
+
+    /* Storage_free also frees the struct */
+    free(bench.locked.entries);
+
+    return 0;
+}
\ No newline at end of file
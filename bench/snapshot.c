@@ -0,0 +1,153 @@
+/**
+ * Warm startup from a VM snapshot against rebuilding the same
+ * state (inserting and analyzing every contract, filling storage).
+ * Also writes a snapshot in the background while the parent keeps
+ * changing state, and checks the snapshot has the state from the
+ * moment it was started
+ *
+ * Usage: snapshot [contracts] [slots per contract] [path]
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+#define CODE_SIZE 4096
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Address contract_address(size_t i) {
+    Address address = { { 0xC0, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i } };
+    return address;
+}
+
+/* Deterministic bytecode, mostly PUSHes and arithmetic with JUMPDESTs sprinkled in */
+static void fill_code(uint8_t *code, size_t i) {
+    static const uint8_t OPS[] = { OP_ADD, OP_MUL, OP_SLOAD, OP_POP, OP_JUMPDEST, OP_DUP1, OP_SWAP1, OP_PUSH1, OP_PUSH2 };
+    uint64_t state = i * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (size_t pc = 0; pc < CODE_SIZE; pc++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        code[pc] = OPS[state % sizeof(OPS)];
+    }
+}
+
+static void build(VM *vm, size_t contracts, size_t slots) {
+    uint8_t code[CODE_SIZE];
+
+    for (size_t i = 0; i < contracts; i++) {
+        Address address = contract_address(i);
+        Account *account = Accounts_insert(&vm->accounts, &address);
+
+        fill_code(code, i);
+        account->code = CodeCache_insert(&vm->codes, code, sizeof(code));
+        account->nonce = 1;
+
+        for (size_t j = 0; j < slots; j++) {
+            UInt256 key = UInt256_from(j), value = UInt256_from(i * slots + j);
+            Storage_insert(account->storage, &key, &value);
+        }
+    }
+}
+
+static void free_vm(VM *vm) {
+    Accounts_free(&vm->accounts);
+    CodeCache_free(&vm->codes);
+}
+
+/* Whether every contract in `vm` has the code and slot values `build` gives */
+static bool verify(const VM *vm, size_t contracts, size_t slots) {
+    uint8_t code[CODE_SIZE];
+
+    for (size_t i = 0; i < contracts; i++) {
+        Address address = contract_address(i);
+        const Account *account = Accounts_get(&vm->accounts, &address);
+
+        fill_code(code, i);
+
+        if (account == NULL || account->code == NULL || account->code->size != CODE_SIZE ||
+                memcmp(account->code->bytes, code, CODE_SIZE) != 0 || account->storage->length != slots)
+            return false;
+
+        for (size_t j = 0; j < slots; j++) {
+            UInt256 key = UInt256_from(j), value = UInt256_from(i * slots + j);
+            if (!UInt256_equals(Storage_get(account->storage, &key), &value)) return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    size_t contracts = argc > 1 ? (size_t)atol(argv[1]) : 2000;
+    size_t slots = argc > 2 ? (size_t)atol(argv[2]) : 100;
+    const char *path = argc > 3 ? argv[3] : "cevm.snapshot";
+
+    VM vm;
+    VM_init(&vm);
+
+    double start = now();
+    build(&vm, contracts, slots);
+    printf("%-28s %10.2f ms\n", "rebuild", (now() - start) * 1e3);
+
+    start = now();
+    if (!Snapshot_write(&vm, path)) error("Failed to write %s: %s\n", path, strerror(errno));
+    printf("%-28s %10.2f ms\n", "write", (now() - start) * 1e3);
+
+    VM loaded;
+    VM_init(&loaded);
+
+    Snapshot snapshot;
+
+    start = now();
+    if (!Snapshot_load(&loaded, path, &snapshot)) error("Failed to load %s\n", path);
+    printf("%-28s %10.2f ms (%zu bytes)\n", "load", (now() - start) * 1e3, snapshot.size);
+
+    if (!verify(&loaded, contracts, slots)) error("Loaded snapshot doesn't match\n");
+
+    free_vm(&loaded);
+    Snapshot_close(&snapshot);
+
+    /* Keep changing every slot while a child writes the snapshot */
+    start = now();
+    pid_t writer;
+    if (!Snapshot_write_background(&vm, path, &writer)) error("Failed to fork: %s\n", strerror(errno));
+    printf("%-28s %10.2f ms\n", "background write, fork", (now() - start) * 1e3);
+
+    size_t changes = 0;
+
+    for (size_t i = 0; i < contracts; i++) {
+        Address address = contract_address(i);
+        Storage *storage = Accounts_get(&vm.accounts, &address)->storage;
+
+        for (size_t j = 0; j < slots; j++, changes++) {
+            UInt256 key = UInt256_from(j);
+            Storage_insert(storage, &key, &ZERO);
+        }
+    }
+
+    if (!Snapshot_wait(writer)) error("Background write failed\n");
+    printf("%-28s %10.2f ms (%zu slots changed meanwhile)\n", "background write, total", (now() - start) * 1e3, changes);
+
+    VM_init(&loaded);
+
+    if (!Snapshot_load(&loaded, path, &snapshot) || !verify(&loaded, contracts, slots))
+        error("Background snapshot doesn't hold the state at the fork\n");
+
+    printf("background snapshot consistent\n");
+
+    free_vm(&loaded);
+    Snapshot_close(&snapshot);
+    free_vm(&vm);
+    unlink(path);
+
+    return 0;
+}
\ No newline at end of file
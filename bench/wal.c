@@ -0,0 +1,148 @@
+/**
+ * Commit throughput of the write-ahead log in each durability
+ * mode, with 1 to 64 threads committing at once. Every commit logs
+ * four slot writes. Group commit lets commits that arrive during
+ * one sync share the next, sync mode pays a sync per commit. Ends
+ * with recovery and checkpoint timings for the log left behind
+ *
+ * Usage: wal [commits] [directory]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+#define ACCOUNTS 64
+#define WRITES 4
+
+typedef struct {
+    VM *vm;
+    Wal *wal;
+    size_t first;
+    size_t length;
+} Committer;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *commit(void *arg) {
+    Committer *committer = (Committer*)arg;
+    Accounts *accounts = &committer->vm->accounts;
+
+    LocationMap writes;
+    LocationMap_init(&writes);
+
+    for (size_t i = committer->first; i < committer->first + committer->length; i++) {
+        Storage *storage = accounts->accounts[i % ACCOUNTS].storage;
+
+        for (size_t j = 0; j < WRITES; j++) {
+            Location location = { .kind = LOCATION_SLOT, .space = storage, .key = UInt256_from(i * WRITES + j) };
+            UInt256 value = UInt256_from(i);
+            LocationMap_set(&writes, &location, &value);
+        }
+
+        if (!Wal_wait(committer->wal, Wal_append(committer->wal, committer->vm, &writes)))
+            error("Failed to log a commit: %s\n", strerror(errno));
+        LocationMap_clear(&writes);
+    }
+
+    LocationMap_free(&writes);
+
+    return NULL;
+}
+
+static void remove_files(const char *directory) {
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/log", directory);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/snapshot", directory);
+    unlink(path);
+}
+
+static void setup(VM *vm) {
+    VM_init(vm);
+
+    for (size_t i = 0; i < ACCOUNTS; i++) {
+        Address address = { { 0xAC, (uint8_t)i } };
+        Accounts_insert(&vm->accounts, &address);
+    }
+}
+
+static void run(const char *directory, WalMode mode, size_t committers, size_t length) {
+    VM vm;
+    setup(&vm);
+    remove_files(directory);
+
+    Wal wal;
+    if (!Wal_init(&wal, &vm, directory, mode)) error("Failed to open the log in %s: %s\n", directory, strerror(errno));
+
+    pthread_t threads[64];
+    Committer work[64];
+
+    double start = now();
+
+    for (size_t i = 0; i < committers; i++) {
+        work[i] = (Committer){ &vm, &wal, length / committers * i, length / committers };
+        pthread_create(&threads[i], NULL, commit, &work[i]);
+    }
+
+    for (size_t i = 0; i < committers; i++)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = now() - start;
+
+    printf("%-6s %10zu %12.0f %8zu %14.1f\n", WAL_MODE_TO_NAME[mode], committers, wal.commits / elapsed, wal.syncs,
+        wal.syncs == 0 ? 0.0 : (double)wal.commits / wal.syncs);
+
+    Wal_free(&wal);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+}
+
+int main(int argc, char **argv) {
+    size_t length = argc > 1 ? (size_t)atol(argv[1]) : 2048;
+    const char *directory = argc > 2 ? argv[2] : "wal-bench";
+
+    printf("%-6s %10s %12s %8s %14s\n", "mode", "committers", "commits/s", "syncs", "commits/sync");
+
+    for (WalMode mode = WAL_ASYNC; mode <= WAL_SYNC; mode++)
+        for (size_t committers = 1; committers <= 64; committers *= 4)
+            run(directory, mode, committers, length);
+
+    /* The last run left a full log, time replaying it and folding it into a snapshot */
+    VM vm;
+    setup(&vm);
+
+    Wal wal;
+    if (!Wal_init(&wal, &vm, directory, WAL_GROUP)) error("Failed to open the log in %s: %s\n", directory, strerror(errno));
+
+    printf("\nrecovered %zu commits in %.2f ms\n", wal.recovered, wal.recovery_seconds * 1e3);
+
+    double start = now();
+    if (!Wal_checkpoint(&wal, &vm)) error("Failed to checkpoint %s: %s\n", directory, strerror(errno));
+    printf("checkpoint in %.2f ms\n", (now() - start) * 1e3);
+
+    Wal_free(&wal);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+
+    setup(&vm);
+    if (!Wal_init(&wal, &vm, directory, WAL_GROUP)) error("Failed to open the log in %s: %s\n", directory, strerror(errno));
+    printf("recovered from snapshot in %.2f ms\n", wal.recovery_seconds * 1e3);
+
+    Wal_free(&wal);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+
+    remove_files(directory);
+    rmdir(directory);
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,225 @@
+/**
+ * Account table keyed by 160-bit address. Records live in a
+ * dense array and are found through an open-addressed index
+ * using linear probing. Pointers to records are invalidated
+ * by the next insert or remove
+ */
+
+#include "accounts.h"
+#include "alloc.h"
+
+#define DEFAULT_CAPACITY 64 /* Must be a power of 2 */
+#define GROWTH_RATE 2
+
+UInt256 Address_to_uint256(const Address *address) {
+    UInt256 integer;
+    UInt256_load_partial(&integer, address->bytes, sizeof(address->bytes), 0, sizeof(address->bytes));
+    return integer;
+}
+
+/* Addresses are the low-order 160 bits of a word */
+Address Address_from_uint256(const UInt256 *integer) {
+    uint8_t word[32];
+    UInt256_store(integer, word);
+
+    Address address;
+    memcpy(address.bytes, word + 12, sizeof(address.bytes));
+    return address;
+}
+
+bool Address_equals(const Address *a, const Address *b) {
+    return memcmp(a->bytes, b->bytes, sizeof(a->bytes)) == 0;
+}
+
+/* keccak(rlp([sender, nonce]))[12:] */
+Address Address_create(const Address *sender, uint64_t nonce) {
+    uint8_t rlp[1 + 21 + 9];
+    size_t length = 1;
+
+    rlp[length++] = 0x80 + sizeof(sender->bytes);
+    memcpy(rlp + length, sender->bytes, sizeof(sender->bytes));
+    length += sizeof(sender->bytes);
+
+    if (nonce == 0) {
+        rlp[length++] = 0x80;
+    } else if (nonce < 0x80) {
+        rlp[length++] = (uint8_t)nonce;
+    } else {
+        int nonce_length = 8 - __builtin_clzll(nonce) / 8;
+
+        rlp[length++] = 0x80 + nonce_length;
+        for (int i = nonce_length - 1; i >= 0; i--)
+            rlp[length++] = (uint8_t)(nonce >> (i * 8));
+    }
+
+    /* List prefix, payload is always shorter than 56 bytes */
+    rlp[0] = 0xC0 + (length - 1);
+
+    UInt256 hash;
+    UInt256_keccak(&hash, rlp, length);
+    return Address_from_uint256(&hash);
+}
+
+/* keccak(0xff ++ sender ++ salt ++ code_hash)[12:] */
+Address Address_create2(const Address *sender, const UInt256 *salt, const UInt256 *code_hash) {
+    uint8_t buffer[1 + 20 + 32 + 32];
+
+    buffer[0] = 0xFF;
+    memcpy(buffer + 1, sender->bytes, sizeof(sender->bytes));
+    UInt256_store(salt, buffer + 21);
+
+    UInt256_store(code_hash, buffer + 53);
+
+    UInt256 hash;
+    UInt256_keccak(&hash, buffer, sizeof(buffer));
+    return Address_from_uint256(&hash);
+}
+
+static uint64_t hash(const Address *address) {
+    uint64_t a, b;
+    uint32_t c;
+
+    memcpy(&a, address->bytes, 8);
+    memcpy(&b, address->bytes + 8, 8);
+    memcpy(&c, address->bytes + 16, 4);
+
+    uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)c << 32)) * 0xFF51AFD7ED558CCDULL;
+    return h ^ (h >> 29);
+}
+
+/* Index of the slot holding `address`, or of the empty slot it would go in */
+static size_t find(const Accounts *accounts, const Address *address, uint64_t h) {
+    size_t mask = accounts->capacity - 1,
+            index = (size_t)(h >> 32) & mask;
+    uint32_t tag = (uint32_t)h;
+
+    while (accounts->slots[index].position != 0) {
+        const AccountSlot *slot = &accounts->slots[index];
+
+        if (slot->tag == tag && Address_equals(&accounts->accounts[slot->position - 1].address, address))
+            break;
+
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+void Accounts_init(Accounts *accounts) {
+    accounts->capacity = DEFAULT_CAPACITY;
+    accounts->slots = (AccountSlot*)Alloc_calloc(ALLOC_ACCOUNTS, sizeof(AccountSlot), accounts->capacity);
+
+    accounts->accounts_capacity = DEFAULT_CAPACITY / 2;
+    accounts->accounts = (Account*)Alloc_malloc(ALLOC_ACCOUNTS, sizeof(Account) * accounts->accounts_capacity);
+    accounts->length = 0;
+}
+
+static void resize(Accounts *accounts) {
+    Alloc_free(accounts->slots);
+
+    accounts->capacity *= GROWTH_RATE;
+    accounts->slots = (AccountSlot*)Alloc_calloc(ALLOC_ACCOUNTS, sizeof(AccountSlot), accounts->capacity);
+
+    /* Rebuild the index, records stay where they are */
+    for (size_t i = 0; i < accounts->length; i++) {
+        uint64_t h = hash(&accounts->accounts[i].address);
+        size_t index = find(accounts, &accounts->accounts[i].address, h);
+
+        accounts->slots[index] = (AccountSlot){ .tag = (uint32_t)h, .position = (uint32_t)(i + 1) };
+    }
+
+    accounts->accounts_capacity = accounts->capacity / 2;
+    accounts->accounts = Alloc_realloc(ALLOC_ACCOUNTS, accounts->accounts, sizeof(Account) * accounts->accounts_capacity);
+}
+
+/* Return account at `address`, NULL if it doesn't exist */
+Account *Accounts_get(const Accounts *accounts, const Address *address) {
+    const AccountSlot *slot = &accounts->slots[find(accounts, address, hash(address))];
+
+    return slot->position == 0 ? NULL : &accounts->accounts[slot->position - 1];
+}
+
+/* Return account at `address`, creating an empty one if it doesn't exist */
+Account *Accounts_insert(Accounts *accounts, const Address *address) {
+    uint64_t h = hash(address);
+    size_t index = find(accounts, address, h);
+
+    if (accounts->slots[index].position != 0)
+        return &accounts->accounts[accounts->slots[index].position - 1];
+
+    Account *account = &accounts->accounts[accounts->length];
+
+    account->address = *address;
+    account->code = NULL;
+    account->balance = ZERO;
+    account->nonce = 0;
+    account->storage = (Storage*)Alloc_malloc(ALLOC_ACCOUNTS, sizeof(Storage));
+    Storage_init(account->storage);
+
+    accounts->slots[index] = (AccountSlot){ .tag = (uint32_t)h, .position = (uint32_t)(++accounts->length) };
+
+    /* Keep load factor at or below 0.5 */
+    if (accounts->length == accounts->accounts_capacity) {
+        size_t position = account - accounts->accounts;
+        resize(accounts);
+        account = &accounts->accounts[position];
+    }
+
+    return account;
+}
+
+/*
+ * Delete the account at `address` and its storage, moving the last
+ * record into its place. Returns its code for the caller to release
+ * to the CodeCache, NULL if it had none or didn't exist
+ */
+Code *Accounts_remove(Accounts *accounts, const Address *address) {
+    size_t mask = accounts->capacity - 1,
+            index = find(accounts, address, hash(address));
+
+    if (accounts->slots[index].position == 0)
+        return NULL;
+
+    size_t position = accounts->slots[index].position - 1;
+    accounts->slots[index].position = 0;
+
+    /* Shift back following slots so probe chains stay intact */
+    for (size_t next = (index + 1) & mask; accounts->slots[next].position != 0; next = (next + 1) & mask) {
+        AccountSlot slot = accounts->slots[next];
+        const Address *shifted = &accounts->accounts[slot.position - 1].address;
+
+        accounts->slots[next].position = 0;
+        accounts->slots[find(accounts, shifted, hash(shifted))] = slot;
+    }
+
+    Account *removed = &accounts->accounts[position];
+    Code *code = removed->code;
+    Storage_free(removed->storage);
+
+    /* Fill the hole with the last record */
+    size_t last = accounts->length - 1;
+
+    if (position != last) {
+        const Address *moved = &accounts->accounts[last].address;
+        accounts->slots[find(accounts, moved, hash(moved))].position = (uint32_t)(position + 1);
+        *removed = accounts->accounts[last];
+    }
+
+    accounts->length--;
+    return code;
+}
+
+/* Grow ahead of time so `length` accounts fit without resizing */
+void Accounts_reserve(Accounts *accounts, size_t length) {
+    while (length >= accounts->accounts_capacity)
+        resize(accounts);
+}
+
+void Accounts_free(Accounts *accounts) {
+    /* Code is owned by the CodeCache */
+    for (size_t i = 0; i < accounts->length; i++)
+        Storage_free(accounts->accounts[i].storage);
+
+    Alloc_free(accounts->slots);
+    Alloc_free(accounts->accounts);
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef ACCOUNTS_H
+#define ACCOUNTS_H
+
+#include "common.h"
+#include "storage.h"
+#include "code.h"
+
+typedef struct {
+    uint8_t bytes[20];
+} Address;
+
+typedef struct {
+    Address address;
+
+    /* Shared through the VM's CodeCache, NULL if account has no code */
+    Code *code;
+
+    UInt256 balance;
+    uint64_t nonce;
+
+    Storage *storage;
+} Account;
+
+/*
+ * Accounts are stored inline in a dense array, with an
+ * open-addressed index of (hash tag, position) pairs so
+ * that probing only touches 8 bytes per slot
+ */
+typedef struct {
+    uint32_t tag;
+    uint32_t position; /* Index into accounts + 1, 0 if empty */
+} AccountSlot;
+
+typedef struct {
+    AccountSlot *slots;
+    size_t capacity;
+
+    Account *accounts;
+    size_t length;
+    size_t accounts_capacity;
+} Accounts;
+
+UInt256 Address_to_uint256(const Address *address);
+Address Address_from_uint256(const UInt256 *integer);
+bool Address_equals(const Address *a, const Address *b);
+Address Address_create(const Address *sender, uint64_t nonce);
+Address Address_create2(const Address *sender, const UInt256 *salt, const UInt256 *code_hash);
+
+void Accounts_init(Accounts *accounts);
+Account *Accounts_get(const Accounts *accounts, const Address *address);
+Account *Accounts_insert(Accounts *accounts, const Address *address);
+Code *Accounts_remove(Accounts *accounts, const Address *address);
+void Accounts_reserve(Accounts *accounts, size_t length);
+void Accounts_free(Accounts *accounts);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,229 @@
+/**
+ * Allocation accounting, see alloc.h. Like the opcode profiler each
+ * thread counts into its own AllocStats, registered on a list so
+ * they can be summed. When a thread exits its counts are added to
+ * those of threads gone before and its AllocStats is freed
+ */
+
+#include "alloc.h"
+#include "sampler.h"
+#include "vm.h"
+
+#include <pthread.h>
+
+const char *ALLOC_SUBSYSTEM_TO_NAME[] = {
+    [ALLOC_FRAME] = "frame",
+    [ALLOC_MEMORY] = "memory",
+    [ALLOC_RETURN] = "return",
+    [ALLOC_LOGS] = "logs",
+    [ALLOC_STORAGE] = "storage",
+    [ALLOC_STATE] = "state",
+    [ALLOC_TRANSIENT] = "transient",
+    [ALLOC_ACCOUNTS] = "accounts",
+    [ALLOC_CODE] = "code",
+};
+
+volatile bool Alloc_tracking = false;
+
+static volatile bool sealed = false;
+
+static __thread AllocStats *current = NULL;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static AllocStats *stats = NULL;
+
+/* Counts of threads that have exited */
+static AllocStats retired;
+
+static pthread_key_t key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/* Add one thread's counts to `total`, the first violation being the earliest added */
+static void add(AllocStats *total, const AllocStats *thread) {
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        total->counts[i] += thread->counts[i];
+        total->bytes[i] += thread->bytes[i];
+    }
+
+    for (int op = 0; op <= ALLOC_OUTSIDE; op++) {
+        total->opcode_counts[op] += thread->opcode_counts[op];
+        total->opcode_bytes[op] += thread->opcode_bytes[op];
+    }
+
+    if (thread->violations > 0 && total->violations == 0) {
+        total->violation_subsystem = thread->violation_subsystem;
+        total->violation_opcode = thread->violation_opcode;
+    }
+
+    total->violations += thread->violations;
+    total->live += thread->live;
+    total->calls += thread->calls;
+    total->peak_sum += thread->peak_sum;
+    if (thread->peak_max > total->peak_max) total->peak_max = thread->peak_max;
+}
+
+/* Thread exit hook */
+static void retire(void *data) {
+    AllocStats *thread = (AllocStats*)data;
+
+    pthread_mutex_lock(&lock);
+
+    AllocStats **link = &stats;
+    while (*link != thread) link = &(*link)->next;
+    *link = thread->next;
+
+    add(&retired, thread);
+
+    pthread_mutex_unlock(&lock);
+
+    current = NULL;
+    free(thread);
+}
+
+static void create_key(void) {
+    pthread_key_create(&key, retire);
+}
+
+static AllocStats *local(void) {
+    if (current != NULL) return current;
+
+    /* Not through the wrappers, it isn't the execution's memory */
+    AllocStats *local = (AllocStats*)calloc(1, sizeof(AllocStats));
+
+    pthread_once(&once, create_key);
+    pthread_setspecific(key, local);
+
+    pthread_mutex_lock(&lock);
+    local->next = stats;
+    stats = local;
+    pthread_mutex_unlock(&lock);
+
+    return current = local;
+}
+
+/* Opcode the thread is running, ALLOC_OUTSIDE between executions */
+static int running_opcode(void) {
+    const SamplerSite *site = Sampler_site();
+    const Execution *execution = site->execution;
+
+    if (execution == NULL || execution->frame == NULL) return ALLOC_OUTSIDE;
+
+    const Code *code = execution->frame->code;
+    if (code == NULL) return OP_STOP;
+
+    return site->pc < code->size ? code->bytes[site->pc] : OP_STOP;
+}
+
+void Alloc_record(AllocSubsystem subsystem, size_t size) {
+    AllocStats *thread = local();
+    int opcode = running_opcode();
+
+    thread->counts[subsystem]++;
+    thread->bytes[subsystem] += size;
+    thread->opcode_counts[opcode]++;
+    thread->opcode_bytes[opcode] += size;
+
+    thread->live += (int64_t)size;
+    if (thread->live > thread->peak) thread->peak = thread->live;
+
+    if (sealed && thread->violations++ == 0) {
+        thread->violation_subsystem = subsystem;
+        thread->violation_opcode = opcode;
+    }
+}
+
+void Alloc_release(size_t size) {
+    local()->live -= (int64_t)size;
+}
+
+static void clear(AllocStats *thread) {
+    AllocStats *next = thread->next;
+    memset(thread, 0, sizeof(AllocStats));
+    thread->next = next;
+}
+
+/* Count from now on, forgetting earlier counts */
+void Alloc_start(void) {
+    pthread_mutex_lock(&lock);
+    for (AllocStats *thread = stats; thread != NULL; thread = thread->next) clear(thread);
+    memset(&retired, 0, sizeof(AllocStats));
+    pthread_mutex_unlock(&lock);
+
+    sealed = false;
+    Alloc_tracking = true;
+}
+
+void Alloc_stop(void) {
+    Alloc_tracking = false;
+    sealed = false;
+}
+
+/* Whether any allocation from now on is a violation, warm-up being over */
+void Alloc_seal(bool seal) {
+    sealed = seal;
+}
+
+/* Measure the calling thread's peak heap use from here to Alloc_call_end */
+void Alloc_call_begin(void) {
+    AllocStats *thread = local();
+    thread->baseline = thread->peak = thread->live;
+}
+
+/* Peak bytes above what was live at Alloc_call_begin */
+uint64_t Alloc_call_end(void) {
+    AllocStats *thread = local();
+    uint64_t peak = (uint64_t)(thread->peak - thread->baseline);
+
+    thread->calls++;
+    thread->peak_sum += peak;
+    if (peak > thread->peak_max) thread->peak_max = peak;
+
+    return peak;
+}
+
+/* Sum of every thread's counts, gone ones included, the first violation being any thread's */
+void Alloc_collect(AllocStats *total) {
+    memset(total, 0, sizeof(AllocStats));
+
+    pthread_mutex_lock(&lock);
+
+    add(total, &retired);
+
+    for (const AllocStats *thread = stats; thread != NULL; thread = thread->next)
+        add(total, thread);
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* Name of an opcode as recorded, including allocations outside any execution */
+const char *Alloc_opcode_name(int opcode) {
+    if (opcode == ALLOC_OUTSIDE) return "(outside)";
+    return OPCODE_TO_NAME[opcode] != NULL ? OPCODE_TO_NAME[opcode] : "?";
+}
+
+/* Allocations by subsystem and by opcode, then peak heap per call */
+void Alloc_print(FILE *file, const AllocStats *stats) {
+    fprintf(file, "%-14s %12s %14s\n", "subsystem", "allocations", "bytes");
+
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        if (stats->counts[i] == 0) continue;
+        fprintf(file, "%-14s %12llu %14llu\n", ALLOC_SUBSYSTEM_TO_NAME[i],
+            (unsigned long long)stats->counts[i], (unsigned long long)stats->bytes[i]);
+    }
+
+    fprintf(file, "\n%-14s %12s %14s\n", "opcode", "allocations", "bytes");
+
+    for (int op = 0; op <= ALLOC_OUTSIDE; op++) {
+        if (stats->opcode_counts[op] == 0) continue;
+        fprintf(file, "%-14s %12llu %14llu\n", Alloc_opcode_name(op),
+            (unsigned long long)stats->opcode_counts[op], (unsigned long long)stats->opcode_bytes[op]);
+    }
+
+    if (stats->calls > 0)
+        fprintf(file, "\npeak heap per call: %.0f bytes average, %llu max over %llu calls\n",
+            (double)stats->peak_sum / stats->calls, (unsigned long long)stats->peak_max, (unsigned long long)stats->calls);
+
+    if (stats->violations > 0)
+        fprintf(file, "%llu allocations after warm-up, the first by %s during %s\n", (unsigned long long)stats->violations,
+            ALLOC_SUBSYSTEM_TO_NAME[stats->violation_subsystem], Alloc_opcode_name(stats->violation_opcode));
+}
\ No newline at end of file
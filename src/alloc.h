@@ -0,0 +1,110 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+/*
+ * Allocation accounting. Heap use on the execution path goes
+ * through these wrappers, tagged with the subsystem asking. While
+ * Alloc_start is in effect each thread counts allocations and bytes
+ * per subsystem and per opcode running at the time (see sampler.h
+ * for how the opcode is known), and tracks live bytes so a call's
+ * peak can be read with Alloc_call_begin/end. Otherwise a wrapper
+ * costs one predictable branch.
+ *
+ * Alloc_seal marks the end of warm-up: from then on every allocation
+ * counts as a violation, which strict callers (cevm run
+ * --strict-allocs, the corpus benchmark) report as a failure
+ */
+
+#include <malloc.h>
+
+#include "common.h"
+
+typedef enum {
+    ALLOC_FRAME,
+    ALLOC_MEMORY,
+    ALLOC_RETURN,
+    ALLOC_LOGS,
+    ALLOC_STORAGE,
+    ALLOC_STATE,
+    ALLOC_TRANSIENT,
+    ALLOC_ACCOUNTS,
+    ALLOC_CODE,
+    ALLOC_SUBSYSTEMS,
+} AllocSubsystem;
+
+extern const char *ALLOC_SUBSYSTEM_TO_NAME[];
+
+/* Opcode slot for allocations made outside Execution_run */
+#define ALLOC_OUTSIDE 256
+
+typedef struct AllocStats {
+    uint64_t counts[ALLOC_SUBSYSTEMS];
+    uint64_t bytes[ALLOC_SUBSYSTEMS];
+
+    uint64_t opcode_counts[ALLOC_OUTSIDE + 1];
+    uint64_t opcode_bytes[ALLOC_OUTSIDE + 1];
+
+    /* Heap held by the thread's allocations less its frees (summed, by all threads), and the high mark since Alloc_call_begin */
+    int64_t live;
+    int64_t peak;
+    int64_t baseline;
+
+    /* Calls measured and their peaks above the live bytes they started with */
+    uint64_t calls;
+    uint64_t peak_max;
+    uint64_t peak_sum;
+
+    /* Allocations while sealed, and where the first one came from */
+    uint64_t violations;
+    AllocSubsystem violation_subsystem;
+    int violation_opcode;
+
+    struct AllocStats *next;
+} AllocStats;
+
+extern volatile bool Alloc_tracking;
+
+void Alloc_record(AllocSubsystem subsystem, size_t size);
+void Alloc_release(size_t size);
+
+static inline void *Alloc_malloc(AllocSubsystem subsystem, size_t size) {
+    void *block = malloc(size);
+    if (Alloc_tracking && block != NULL) Alloc_record(subsystem, malloc_usable_size(block));
+    return block;
+}
+
+static inline void *Alloc_calloc(AllocSubsystem subsystem, size_t count, size_t size) {
+    void *block = calloc(count, size);
+    if (Alloc_tracking && block != NULL) Alloc_record(subsystem, malloc_usable_size(block));
+    return block;
+}
+
+/* Counts as an allocation of the new size and a free of the old one */
+static inline void *Alloc_realloc(AllocSubsystem subsystem, void *block, size_t size) {
+    size_t old = Alloc_tracking && block != NULL ? malloc_usable_size(block) : 0;
+
+    block = realloc(block, size);
+
+    if (Alloc_tracking && block != NULL) {
+        Alloc_release(old);
+        Alloc_record(subsystem, malloc_usable_size(block));
+    }
+
+    return block;
+}
+
+static inline void Alloc_free(void *block) {
+    if (Alloc_tracking && block != NULL) Alloc_release(malloc_usable_size(block));
+    free(block);
+}
+
+void Alloc_start(void);
+void Alloc_stop(void);
+void Alloc_seal(bool sealed);
+void Alloc_call_begin(void);
+uint64_t Alloc_call_end(void);
+void Alloc_collect(AllocStats *total);
+const char *Alloc_opcode_name(int opcode);
+void Alloc_print(FILE *file, const AllocStats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "backend.h"
+
+void Backend_init(Backend *backend, void (*load)(Backend *backend, Load *load)) {
+    backend->load = load;
+
+    pthread_mutex_init(&backend->lock, NULL);
+    pthread_cond_init(&backend->completed, NULL);
+
+    backend->head = NULL;
+    backend->tail = NULL;
+}
+
+/* Hand a finished load back to the execution thread, safe from any thread */
+void Backend_complete(Backend *backend, Load *load) {
+    load->next = NULL;
+
+    pthread_mutex_lock(&backend->lock);
+
+    if (backend->tail == NULL) backend->head = load;
+    else backend->tail->next = load;
+
+    backend->tail = load;
+
+    pthread_cond_signal(&backend->completed);
+    pthread_mutex_unlock(&backend->lock);
+}
+
+/* Oldest completed load, NULL if there is none and `wait` is false */
+Load *Backend_next_completed(Backend *backend, bool wait) {
+    pthread_mutex_lock(&backend->lock);
+
+    while (wait && backend->head == NULL)
+        pthread_cond_wait(&backend->completed, &backend->lock);
+
+    Load *load = backend->head;
+
+    if (load != NULL) {
+        backend->head = load->next;
+        if (backend->head == NULL) backend->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&backend->lock);
+
+    return load;
+}
+
+void Backend_free(Backend *backend) {
+    pthread_mutex_destroy(&backend->lock);
+    pthread_cond_destroy(&backend->completed);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <pthread.h>
+
+#include "common.h"
+#include "storage.h"
+
+/* One slot being fetched from a Backend */
+typedef struct Load {
+    Storage *storage;
+    UInt256 key;
+
+    /* Filled in by the backend before completing */
+    UInt256 value;
+
+    /* Whoever waits on the load, e.g. a suspended Execution */
+    void *context;
+
+    struct Load *next;
+} Load;
+
+/*
+ * Asynchronous source of storage slots that aren't in memory yet
+ * (disk, a key-value store). Implementations embed Backend as their
+ * first member, start fetches in `load` without blocking and report
+ * them through Backend_complete from any thread. Completions are
+ * collected by the thread running executions, which is the only
+ * one that writes the loaded values into Storage
+ */
+typedef struct Backend {
+    void (*load)(struct Backend *backend, Load *load);
+
+    pthread_mutex_t lock;
+    pthread_cond_t completed;
+
+    /* Completed loads, oldest first */
+    Load *head;
+    Load *tail;
+} Backend;
+
+void Backend_init(Backend *backend, void (*load)(Backend *backend, Load *load));
+void Backend_complete(Backend *backend, Load *load);
+Load *Backend_next_completed(Backend *backend, bool wait);
+void Backend_free(Backend *backend);
+
+#endif
\ No newline at end of file
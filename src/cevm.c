@@ -0,0 +1,274 @@
+/**
+ * libcevm: the VM behind a handle, for hosts that embed it (Lua
+ * through its C API, or anything with a C FFI). Batches amortize
+ * crossing into the library: read-only batches run on the Runner's
+ * threads, committed ones through the optimistic block executor.
+ * Return data is copied out into buffers the host owns, logs stay
+ * in the receipts until the next batch
+ */
+
+#include "cevm.h"
+#include "vm.h"
+#include "runner.h"
+#include "executor.h"
+#include "genesis.h"
+#include "snapshot.h"
+
+struct CEVM {
+    VM vm;
+
+    Runner runner;
+    size_t threads;
+
+    /* Reused from batch to batch */
+    Transaction *transactions;
+    Receipt *receipts;
+    size_t capacity;
+
+    /* Receipts of the last batch, kept so its logs can be read */
+    size_t receipts_length;
+
+    /* Files code was loaded from in place, unmapped on destroy */
+    Genesis *genesis;
+    size_t genesis_length;
+
+    Snapshot *snapshots;
+    size_t snapshots_length;
+};
+
+static const int STATUS_TO_API[] = {
+    [STATUS_SUCCESS] = CEVM_SUCCESS,
+    [STATUS_REVERT] = CEVM_REVERT,
+    [STATUS_STACK_UNDERFLOW] = CEVM_STACK_UNDERFLOW,
+    [STATUS_STACK_OVERFLOW] = CEVM_STACK_OVERFLOW,
+    [STATUS_INVALID_JUMP] = CEVM_INVALID_JUMP,
+    [STATUS_INVALID_OPCODE] = CEVM_INVALID_OPCODE,
+    [STATUS_UNSUPPORTED_OPCODE] = CEVM_UNSUPPORTED_OPCODE,
+    [STATUS_OUT_OF_MEMORY] = CEVM_OUT_OF_MEMORY,
+    [STATUS_ABORTED] = CEVM_ABORTED,
+    [STATUS_CRASHED] = CEVM_ABORTED,
+};
+
+static void release_receipts(CEVM *cevm) {
+    for (size_t i = 0; i < cevm->receipts_length; i++) Receipt_free(&cevm->receipts[i]);
+    cevm->receipts_length = 0;
+}
+
+static Address to_address(const uint8_t bytes[20]) {
+    Address address;
+    memcpy(address.bytes, bytes, 20);
+    return address;
+}
+
+unsigned CEVM_version(void) {
+    return CEVM_API_VERSION;
+}
+
+const char *CEVM_status_name(int status) {
+    static const Status API_TO_STATUS[] = {
+        [CEVM_SUCCESS] = STATUS_SUCCESS,
+        [CEVM_REVERT] = STATUS_REVERT,
+        [CEVM_STACK_UNDERFLOW] = STATUS_STACK_UNDERFLOW,
+        [CEVM_STACK_OVERFLOW] = STATUS_STACK_OVERFLOW,
+        [CEVM_INVALID_JUMP] = STATUS_INVALID_JUMP,
+        [CEVM_INVALID_OPCODE] = STATUS_INVALID_OPCODE,
+        [CEVM_UNSUPPORTED_OPCODE] = STATUS_UNSUPPORTED_OPCODE,
+        [CEVM_ABORTED] = STATUS_ABORTED,
+        [CEVM_OUT_OF_MEMORY] = STATUS_OUT_OF_MEMORY,
+    };
+
+    if (status < CEVM_SUCCESS || status > CEVM_OUT_OF_MEMORY) return "unknown";
+    return STATUS_TO_NAME[API_TO_STATUS[status]];
+}
+
+/* Empty VM running read-only batches on `threads` threads (the caller's included) */
+CEVM *CEVM_create(size_t threads) {
+    CEVM *cevm = (CEVM*)calloc(1, sizeof(CEVM));
+    if (cevm == NULL) return NULL;
+
+    if (threads == 0) threads = 1;
+
+    VM_init(&cevm->vm);
+    Runner_init(&cevm->runner, &cevm->vm, threads);
+    cevm->threads = threads;
+
+    return cevm;
+}
+
+void CEVM_destroy(CEVM *cevm) {
+    if (cevm == NULL) return;
+
+    release_receipts(cevm);
+    Runner_free(&cevm->runner);
+    Accounts_free(&cevm->vm.accounts);
+    CodeCache_free(&cevm->vm.codes);
+
+    for (size_t i = 0; i < cevm->genesis_length; i++) Genesis_close(&cevm->genesis[i]);
+    for (size_t i = 0; i < cevm->snapshots_length; i++) Snapshot_close(&cevm->snapshots[i]);
+
+    free(cevm->genesis);
+    free(cevm->snapshots);
+    free(cevm->transactions);
+    free(cevm->receipts);
+    free(cevm);
+}
+
+/* Create or overwrite an account. `balance` may be NULL for zero, `code` NULL for none */
+int CEVM_set_account(CEVM *cevm, const uint8_t address[20], const uint8_t balance[32], uint64_t nonce, const uint8_t *code, size_t code_size) {
+    Address key = to_address(address);
+    Account *account = Accounts_insert(&cevm->vm.accounts, &key);
+
+    account->balance = ZERO;
+    if (balance != NULL) UInt256_load_padded(&account->balance, balance, 32, 0);
+
+    account->nonce = nonce;
+
+    if (account->code != NULL) CodeCache_release(&cevm->vm.codes, account->code);
+    account->code = code == NULL || code_size == 0 ? NULL : CodeCache_insert(&cevm->vm.codes, code, code_size);
+
+    return 0;
+}
+
+/* Set a slot, creating the account if needed */
+int CEVM_set_storage(CEVM *cevm, const uint8_t address[20], const uint8_t key[32], const uint8_t value[32]) {
+    Address owner = to_address(address);
+    UInt256 slot, word;
+
+    UInt256_load_padded(&slot, key, 32, 0);
+    UInt256_load_padded(&word, value, 32, 0);
+
+    Storage_insert(Accounts_insert(&cevm->vm.accounts, &owner)->storage, &slot, &word);
+
+    return 0;
+}
+
+/* Read a slot, -1 if the account doesn't exist */
+int CEVM_get_storage(const CEVM *cevm, const uint8_t address[20], const uint8_t key[32], uint8_t value[32]) {
+    Address owner = to_address(address);
+    const Account *account = Accounts_get(&cevm->vm.accounts, &owner);
+
+    if (account == NULL) return -1;
+
+    UInt256 slot;
+    UInt256_load_padded(&slot, key, 32, 0);
+    UInt256_store(Storage_get(account->storage, &slot), value);
+
+    return 0;
+}
+
+/* Add the accounts of a genesis file, see genesis.c for the format */
+int CEVM_load_genesis(CEVM *cevm, const char *path) {
+    Genesis genesis;
+    GenesisStats stats;
+
+    /* Room first: once loaded, accounts point into the mapping and it has to stay */
+    Genesis *list = (Genesis*)realloc(cevm->genesis, sizeof(Genesis) * (cevm->genesis_length + 1));
+    if (list == NULL) return -1;
+    cevm->genesis = list;
+
+    if (!Genesis_load(&cevm->vm, path, cevm->threads, &genesis, &stats)) return -1;
+
+    cevm->genesis[cevm->genesis_length++] = genesis;
+
+    return 0;
+}
+
+int CEVM_load_snapshot(CEVM *cevm, const char *path) {
+    Snapshot snapshot;
+
+    Snapshot *list = (Snapshot*)realloc(cevm->snapshots, sizeof(Snapshot) * (cevm->snapshots_length + 1));
+    if (list == NULL) return -1;
+    cevm->snapshots = list;
+
+    if (!Snapshot_load(&cevm->vm, path, &snapshot)) return -1;
+
+    cevm->snapshots[cevm->snapshots_length++] = snapshot;
+
+    return 0;
+}
+
+/* -1 with errno set if it couldn't be written, `path` is left as it was then */
+int CEVM_save_snapshot(const CEVM *cevm, const char *path) {
+    return Snapshot_write(&cevm->vm, path) ? 0 : -1;
+}
+
+/*
+ * Run `length` calls, filling results[i] for calls[i]. Without
+ * CEVM_COMMIT calls are independent and their changes discarded,
+ * with it they apply in order as if run one after another.
+ * Return data is copied from each receipt's buffer into the
+ * result's output, anything past output_capacity is cut off.
+ * Logs are read with CEVM_get_log until the next batch
+ */
+int CEVM_execute_batch(CEVM *cevm, const CEVM_Call *calls, size_t length, CEVM_Result *results, unsigned flags) {
+    if (length >= UINT32_MAX) return -1;
+    if (length == 0) return 0;
+
+    release_receipts(cevm);
+
+    if (length > cevm->capacity) {
+        Transaction *transactions = (Transaction*)realloc(cevm->transactions, sizeof(Transaction) * length);
+        if (transactions == NULL) return -1;
+        cevm->transactions = transactions;
+
+        Receipt *receipts = (Receipt*)realloc(cevm->receipts, sizeof(Receipt) * length);
+        if (receipts == NULL) return -1;
+        cevm->receipts = receipts;
+
+        cevm->capacity = length;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        const CEVM_Call *call = &calls[i];
+        Transaction *transaction = &cevm->transactions[i];
+
+        transaction->to = to_address(call->to);
+        transaction->sender = to_address(call->sender);
+        UInt256_load_padded(&transaction->value, call->value, 32, 0);
+        transaction->calldata = call->calldata;
+        transaction->calldata_size = call->calldata == NULL ? 0 : call->calldata_size;
+    }
+
+    bool logged = true;
+
+    if (flags & CEVM_COMMIT) {
+        BlockStats stats;
+        logged = Executor_run_block(&cevm->vm, cevm->transactions, length, cevm->threads, cevm->receipts, &stats);
+    } else {
+        Runner_run(&cevm->runner, cevm->transactions, length, cevm->receipts);
+    }
+
+    cevm->receipts_length = length;
+
+    for (size_t i = 0; i < length; i++) {
+        Receipt *receipt = &cevm->receipts[i];
+        CEVM_Result *result = &results[i];
+
+        size_t copied = receipt->return_data_size < result->output_capacity ? receipt->return_data_size : result->output_capacity;
+        if (copied > 0) memcpy(result->output, receipt->return_data, copied);
+
+        result->output_size = receipt->return_data_size;
+        result->logs = (uint32_t)receipt->logs.length;
+        result->status = STATUS_TO_API[receipt->status];
+    }
+
+    return logged ? 0 : -1;
+}
+
+/* Log `index` of call `call` in the last batch, its data points into the VM */
+int CEVM_get_log(const CEVM *cevm, size_t call, size_t index, CEVM_Log *log) {
+    if (call >= cevm->receipts_length) return -1;
+
+    const Logs *logs = &cevm->receipts[call].logs;
+    if (index >= logs->length) return -1;
+
+    const Log *source = logs->elements[index];
+
+    log->topics_length = (uint32_t)source->topics_length;
+    for (size_t i = 0; i < source->topics_length; i++) UInt256_store(&source->topics[i], log->topics[i]);
+
+    log->data = source->data;
+    log->data_size = source->size;
+
+    return 0;
+}
\ No newline at end of file
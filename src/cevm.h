@@ -0,0 +1,98 @@
+#ifndef CEVM_H
+#define CEVM_H
+
+/*
+ * Public C API of libcevm. Only this header is needed to embed the
+ * VM, it doesn't expose any internal type. Addresses are 20 bytes,
+ * words 32 bytes big-endian. Functions returning int give 0 on
+ * success and -1 on failure
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define CEVM_EXPORT __attribute__((visibility("default")))
+#else
+#define CEVM_EXPORT
+#endif
+
+#define CEVM_API_VERSION 2
+
+/* Outcome of a call. Values are part of the API and never change */
+#define CEVM_SUCCESS 0
+#define CEVM_REVERT 1
+#define CEVM_STACK_UNDERFLOW 2
+#define CEVM_STACK_OVERFLOW 3
+#define CEVM_INVALID_JUMP 4
+#define CEVM_INVALID_OPCODE 5
+#define CEVM_UNSUPPORTED_OPCODE 6
+#define CEVM_ABORTED 7
+#define CEVM_OUT_OF_MEMORY 8
+
+/* CEVM_execute_batch flags: keep the calls' state changes, applied in order */
+#define CEVM_COMMIT 1
+
+typedef struct CEVM CEVM;
+
+typedef struct {
+    uint8_t to[20];
+    uint8_t sender[20];
+    uint8_t value[32];
+
+    const uint8_t *calldata;
+    size_t calldata_size;
+} CEVM_Call;
+
+/*
+ * Return data is produced in the VM's own buffers, then copied into
+ * `output` once the batch has run. Capacity bounds the copy, not
+ * the call
+ */
+typedef struct {
+    /* Set by the caller: where return data goes, may be NULL with capacity 0 */
+    uint8_t *output;
+    size_t output_capacity;
+
+    /* Full size of the return data, only output_capacity bytes of it are written */
+    size_t output_size;
+
+    uint32_t logs;
+    int32_t status;
+} CEVM_Result;
+
+/* A log emitted by a call, `data` is valid until the next batch or destroy */
+typedef struct {
+    uint32_t topics_length;
+    uint8_t topics[4][32];
+
+    const uint8_t *data;
+    size_t data_size;
+} CEVM_Log;
+
+CEVM_EXPORT unsigned CEVM_version(void);
+CEVM_EXPORT const char *CEVM_status_name(int status);
+
+CEVM_EXPORT CEVM *CEVM_create(size_t threads);
+CEVM_EXPORT void CEVM_destroy(CEVM *cevm);
+
+CEVM_EXPORT int CEVM_set_account(CEVM *cevm, const uint8_t address[20], const uint8_t balance[32], uint64_t nonce, const uint8_t *code, size_t code_size);
+CEVM_EXPORT int CEVM_set_storage(CEVM *cevm, const uint8_t address[20], const uint8_t key[32], const uint8_t value[32]);
+CEVM_EXPORT int CEVM_get_storage(const CEVM *cevm, const uint8_t address[20], const uint8_t key[32], uint8_t value[32]);
+
+CEVM_EXPORT int CEVM_load_genesis(CEVM *cevm, const char *path);
+CEVM_EXPORT int CEVM_load_snapshot(CEVM *cevm, const char *path);
+CEVM_EXPORT int CEVM_save_snapshot(const CEVM *cevm, const char *path);
+
+CEVM_EXPORT int CEVM_execute_batch(CEVM *cevm, const CEVM_Call *calls, size_t length, CEVM_Result *results, unsigned flags);
+CEVM_EXPORT int CEVM_get_log(const CEVM *cevm, size_t call, size_t index, CEVM_Log *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,267 @@
+/**
+ * Content-addressed code store. Bytecode is keyed by its
+ * keccak hash in an open-addressed table (linear probing),
+ * analyzed once and reference counted
+ */
+
+#include "code.h"
+#include "prefetch.h"
+#include "alloc.h"
+
+#define DEFAULT_CAPACITY 64 /* Must be a power of 2 */
+#define GROWTH_RATE 2
+
+static bool ends_block(uint8_t opcode) {
+    switch (opcode) {
+        case OP_STOP:
+        case OP_JUMP:
+        case OP_JUMPI:
+        case OP_RETURN:
+        case OP_REVERT:
+        case OP_INVALID:
+        case OP_SELFDESTRUCT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Decode instruction stream, JUMPDEST bitmap and basic blocks */
+static void analyze(Code *code) {
+    code->jumpdests = (uint8_t*)Alloc_calloc(ALLOC_CODE, 1, code->size / 8 + 1);
+    code->instructions = (Instruction*)Alloc_malloc(ALLOC_CODE, sizeof(Instruction) * (code->size + 1));
+    code->blocks = (Block*)Alloc_malloc(ALLOC_CODE, sizeof(Block) * (code->size + 1));
+
+    size_t n = 0, blocks = 0;
+    bool block_open = false;
+
+    for (size_t pc = 0; pc < code->size; pc++) {
+        uint8_t opcode = code->bytes[pc];
+
+        /* JUMPDEST always starts a new block */
+        if (opcode == OP_JUMPDEST) {
+            code->jumpdests[pc / 8] |= 1 << (pc % 8);
+
+            if (block_open) {
+                code->blocks[blocks - 1].end = (uint32_t)pc;
+                block_open = false;
+            }
+        }
+
+        if (!block_open) {
+            code->blocks[blocks++] = (Block){
+                .start = (uint32_t)pc,
+                .first_instruction = (uint32_t)n,
+            };
+            block_open = true;
+        }
+
+        code->instructions[n++] = (Instruction){ .pc = (uint32_t)pc, .opcode = opcode };
+        code->blocks[blocks - 1].instructions_length++;
+
+        /* Skip immediate data */
+        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH32)
+            pc += opcode - OP_PUSH1 + 1;
+
+        if (ends_block(opcode)) {
+            code->blocks[blocks - 1].end = (uint32_t)(pc + 1 < code->size ? pc + 1 : code->size);
+            block_open = false;
+        }
+    }
+
+    if (block_open)
+        code->blocks[blocks - 1].end = (uint32_t)code->size;
+
+    code->instructions_length = n;
+    code->instructions = Alloc_realloc(ALLOC_CODE, code->instructions, sizeof(Instruction) * (n + 1));
+
+    code->blocks_length = blocks;
+    code->blocks = Alloc_realloc(ALLOC_CODE, code->blocks, sizeof(Block) * (blocks + 1));
+}
+
+bool Code_is_jumpdest(const Code *code, size_t pc) {
+    return pc < code->size && (code->jumpdests[pc / 8] >> (pc % 8)) & 1;
+}
+
+/* Index of the block containing `pc` */
+size_t Code_block_at(const Code *code, size_t pc) {
+    size_t low = 0, high = code->blocks_length;
+
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+
+        if (code->blocks[middle].start <= pc) low = middle;
+        else high = middle;
+    }
+
+    return low;
+}
+
+static size_t find(const CodeCache *cache, const UInt256 *hash) {
+    size_t mask = cache->capacity - 1,
+            index = (size_t)hash->elements[3] & mask;
+
+    while (cache->entries[index] != NULL && !UInt256_equals(&cache->entries[index]->hash, hash))
+        index = (index + 1) & mask;
+
+    return index;
+}
+
+void CodeCache_init(CodeCache *cache) {
+    cache->capacity = DEFAULT_CAPACITY;
+    cache->entries = (Code**)Alloc_calloc(ALLOC_CODE, sizeof(Code*), cache->capacity);
+    cache->length = 0;
+}
+
+static void resize(CodeCache *cache) {
+    Code **old_entries = cache->entries;
+    size_t old_capacity = cache->capacity;
+
+    cache->capacity = old_capacity * GROWTH_RATE;
+    cache->entries = (Code**)Alloc_calloc(ALLOC_CODE, sizeof(Code*), cache->capacity);
+
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old_entries[i] != NULL)
+            cache->entries[find(cache, &old_entries[i]->hash)] = old_entries[i];
+
+    Alloc_free(old_entries);
+}
+
+static Code *create(const UInt256 *hash, const uint8_t *bytes, size_t size) {
+    Code *code = (Code*)Alloc_malloc(ALLOC_CODE, sizeof(Code));
+
+    code->hash = *hash;
+    code->size = size;
+    code->bytes = (uint8_t*)Alloc_malloc(ALLOC_CODE, size + 1);
+    memcpy(code->bytes, bytes, size);
+    code->mapped = false;
+    code->bytes_mapped = false;
+    code->references = 0;
+
+    analyze(code);
+    Prefetch_analyze(code);
+
+    return code;
+}
+
+/*
+ * Copy and analyze `bytes` outside of any cache, so it can be
+ * done ahead of time on another thread. Hand the result to
+ * CodeCache_adopt or Code_free
+ */
+Code *Code_create(const uint8_t *bytes, size_t size) {
+    UInt256 hash;
+    UInt256_keccak(&hash, bytes, size);
+
+    return create(&hash, bytes, size);
+}
+
+/* Like Code_create, but analyzes `bytes` in place. They have to outlive the Code */
+Code *Code_create_mapped(const uint8_t *bytes, size_t size) {
+    Code *code = (Code*)Alloc_malloc(ALLOC_CODE, sizeof(Code));
+
+    UInt256_keccak(&code->hash, bytes, size);
+    code->size = size;
+    code->bytes = (uint8_t*)bytes;
+    code->mapped = false;
+    code->bytes_mapped = true;
+    code->references = 0;
+
+    analyze(code);
+    Prefetch_analyze(code);
+
+    return code;
+}
+
+void Code_free(Code *code) {
+    if (code->mapped) {
+        Alloc_free(code);
+        return;
+    }
+
+    if (!code->bytes_mapped) Alloc_free(code->bytes);
+    Alloc_free(code->jumpdests);
+    Alloc_free(code->instructions);
+    Alloc_free(code->blocks);
+    Alloc_free(code->slot_keys);
+    Alloc_free(code);
+}
+
+static Code *intern(CodeCache *cache, size_t index, Code *code) {
+    code->references = 1;
+    cache->entries[index] = code;
+
+    if (++cache->length * 2 >= cache->capacity)
+        resize(cache);
+
+    return code;
+}
+
+/*
+ * Return shared entry for `bytes`, copying and analyzing them
+ * only if no account uses this code yet. The caller owns one
+ * reference to the result
+ */
+Code *CodeCache_insert(CodeCache *cache, const uint8_t *bytes, size_t size) {
+    UInt256 hash;
+    UInt256_keccak(&hash, bytes, size);
+
+    size_t index = find(cache, &hash);
+
+    if (cache->entries[index] != NULL) {
+        cache->entries[index]->references++;
+        return cache->entries[index];
+    }
+
+    return intern(cache, index, create(&hash, bytes, size));
+}
+
+/*
+ * Like CodeCache_insert for code from Code_create. Takes ownership
+ * of `code`, which is freed if the cache already has the same code
+ */
+Code *CodeCache_adopt(CodeCache *cache, Code *code) {
+    size_t index = find(cache, &code->hash);
+
+    if (cache->entries[index] != NULL) {
+        Code_free(code);
+        cache->entries[index]->references++;
+        return cache->entries[index];
+    }
+
+    return intern(cache, index, code);
+}
+
+/* Look up code by hash, NULL if no account has it */
+Code *CodeCache_get(const CodeCache *cache, const UInt256 *hash) {
+    return cache->entries[find(cache, hash)];
+}
+
+/* Drop one reference, removing the entry once it's unused */
+void CodeCache_release(CodeCache *cache, Code *code) {
+    if (--code->references > 0)
+        return;
+
+    size_t mask = cache->capacity - 1,
+            index = find(cache, &code->hash);
+
+    cache->entries[index] = NULL;
+    cache->length--;
+
+    /* Shift back following entries so probe chains stay intact */
+    for (size_t next = (index + 1) & mask; cache->entries[next] != NULL; next = (next + 1) & mask) {
+        Code *entry = cache->entries[next];
+        cache->entries[next] = NULL;
+        cache->entries[find(cache, &entry->hash)] = entry;
+    }
+
+    Code_free(code);
+}
+
+void CodeCache_free(CodeCache *cache) {
+    for (size_t i = 0; i < cache->capacity; i++)
+        if (cache->entries[i] != NULL)
+            Code_free(cache->entries[i]);
+
+    Alloc_free(cache->entries);
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include "common.h"
+#include "ops.h"
+
+typedef struct {
+    uint32_t pc;
+    uint8_t opcode;
+} Instruction;
+
+/* Straight-line run of instructions ending in a jump, halt or before a JUMPDEST */
+typedef struct {
+    uint32_t start;
+    uint32_t end; /* pc past the last instruction */
+
+    uint32_t first_instruction;
+    uint32_t instructions_length;
+} Block;
+
+typedef enum {
+    SLOT_KEY_UNKNOWN,
+    SLOT_KEY_CONSTANT,
+
+    /* Word of calldata at `offset` */
+    SLOT_KEY_CALLDATA,
+
+    /* keccak(key || slot) of a Solidity mapping at slot `value` */
+    SLOT_KEY_MAPPING,
+} SlotKeyKind;
+
+/* Storage key an SLOAD uses, in terms of what's known before running */
+typedef struct {
+    SlotKeyKind kind;
+
+    /* SLOT_KEY_CONSTANT: the key. SLOT_KEY_MAPPING: the mapping's slot */
+    UInt256 value;
+
+    /* SLOT_KEY_CALLDATA, and SLOT_KEY_MAPPING keyed by calldata */
+    uint32_t offset;
+
+    /* SLOT_KEY_MAPPING keyed by a constant instead */
+    bool constant_key;
+    UInt256 key;
+} SlotKey;
+
+/*
+ * One copy of a piece of bytecode and everything derived from
+ * it, shared by every account whose code has the same hash
+ */
+typedef struct {
+    UInt256 hash;
+
+    uint8_t *bytes;
+    size_t size;
+
+    /* Bitmap of pcs that hold a JUMPDEST opcode (not PUSH data) */
+    uint8_t *jumpdests;
+
+    Instruction *instructions;
+    size_t instructions_length;
+
+    Block *blocks;
+    size_t blocks_length;
+
+    /* Keys of SLOADs that can be worked out from calldata alone */
+    SlotKey *slot_keys;
+    size_t slot_keys_length;
+
+    /* Arrays above point into a mapped snapshot and aren't owned */
+    bool mapped;
+
+    /* Only the bytes are borrowed, e.g. from a mapped genesis file */
+    bool bytes_mapped;
+
+    size_t references;
+} Code;
+
+typedef struct {
+    Code **entries;
+    size_t capacity;
+    size_t length;
+} CodeCache;
+
+bool Code_is_jumpdest(const Code *code, size_t pc);
+size_t Code_block_at(const Code *code, size_t pc);
+Code *Code_create(const uint8_t *bytes, size_t size);
+Code *Code_create_mapped(const uint8_t *bytes, size_t size);
+void Code_free(Code *code);
+
+void CodeCache_init(CodeCache *cache);
+Code *CodeCache_insert(CodeCache *cache, const uint8_t *bytes, size_t size);
+Code *CodeCache_adopt(CodeCache *cache, Code *code);
+Code *CodeCache_get(const CodeCache *cache, const UInt256 *hash);
+void CodeCache_release(CodeCache *cache, Code *code);
+void CodeCache_free(CodeCache *cache);
+
+#endif
\ No newline at end of file
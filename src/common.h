@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
@@ -13,6 +14,13 @@
 #include "keccak/keccak256.h"
 
 // TODO: Better error handling
-#define error(args...) fprintf(stderr, args); exit(1);
+#define error(args...) do { fprintf(stderr, args); exit(1); } while (0)
+
+/* Debug output, build with -DTRACE to enable */
+#ifdef TRACE
+#define trace(args...) fprintf(stderr, args)
+#else
+#define trace(args...)
+#endif
 
 #endif
\ No newline at end of file
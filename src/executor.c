@@ -0,0 +1,129 @@
+/**
+ * Optimistic parallel block execution. Every transaction first
+ * runs speculatively against the pre-block state on a pool of
+ * threads, recording what it read and buffering what it wrote.
+ * Results are then validated in block order: a transaction whose
+ * reads were overwritten by an earlier one is re-executed against
+ * the up to date state, so the outcome matches serial execution
+ */
+
+#include <errno.h>
+#include <pthread.h>
+
+#include "executor.h"
+#include "wal.h"
+
+typedef struct {
+    VM *vm;
+    const Transaction *transactions;
+    size_t length;
+
+    StateView *views;
+    Receipt *receipts;
+
+    /* Next transaction to pick up */
+    size_t next;
+} Speculation;
+
+static void *speculate(void *arg) {
+    Speculation *speculation = (Speculation*)arg;
+
+    TransientStorage transient;
+    TransientStorage_init(&transient);
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&speculation->next, 1, __ATOMIC_RELAXED);
+        if (i >= speculation->length) break;
+
+        VM_execute(speculation->vm, &speculation->transactions[i], &speculation->views[i], &transient, &speculation->receipts[i]);
+        TransientStorage_clear(&transient);
+    }
+
+    TransientStorage_free(&transient);
+
+    return NULL;
+}
+
+/*
+ * Execute a block of transactions on up to `threads` threads,
+ * filling one receipt per transaction. With a Wal on the VM,
+ * returns once the block's commits are logged. False with errno
+ * set if the Wal failed, the block is still applied to `vm`
+ */
+bool Executor_run_block(VM *vm, const Transaction *transactions, size_t length, size_t threads, Receipt *receipts, BlockStats *stats) {
+    StateView *views = (StateView*)malloc(sizeof(StateView) * (length + 1));
+
+    for (size_t i = 0; i < length; i++)
+        StateView_init(&views[i], true);
+
+    Speculation speculation = {
+        .vm = vm,
+        .transactions = transactions,
+        .length = length,
+        .views = views,
+        .receipts = receipts,
+        .next = 0,
+    };
+
+    /* Speculative phase, state is only read */
+    if (threads <= 1) {
+        speculate(&speculation);
+    } else {
+        pthread_t *workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+
+        for (size_t i = 0; i < threads; i++)
+            pthread_create(&workers[i], NULL, speculate, &speculation);
+
+        for (size_t i = 0; i < threads; i++)
+            pthread_join(workers[i], NULL);
+
+        free(workers);
+    }
+
+    /* Validation phase, in block order */
+    LocationMap written;
+    LocationMap_init(&written);
+
+    TransientStorage transient;
+    TransientStorage_init(&transient);
+
+    stats->reexecuted = 0;
+    stats->aborted = 0;
+
+    uint64_t logged = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        StateView *view = &views[i];
+
+        if (view->aborted || StateView_conflicts(view, &written)) {
+            stats->aborted += view->aborted;
+            stats->reexecuted++;
+
+            /* Rerun against current state, writing straight through */
+            Receipt_free(&receipts[i]);
+            StateView_reset(view, false);
+
+            VM_execute(vm, &transactions[i], view, &transient, &receipts[i]);
+            TransientStorage_clear(&transient);
+        } else {
+            StateView_commit(view);
+        }
+
+        if (vm->wal != NULL)
+            logged = Wal_append(vm->wal, vm, &view->writes);
+
+        LocationMap_merge(&written, &view->writes);
+        StateView_free(view);
+    }
+
+    /* One wait for the whole block, its commits share syncs */
+    bool logged_all = vm->wal == NULL || Wal_wait(vm->wal, logged);
+    int saved = errno;
+
+    TransientStorage_free(&transient);
+    LocationMap_free(&written);
+    free(views);
+
+    errno = saved;
+    return logged_all;
+}
\ No newline at end of file
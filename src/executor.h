@@ -0,0 +1,17 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "common.h"
+#include "vm.h"
+
+typedef struct {
+    /* Speculative results conflicted with an earlier transaction */
+    size_t reexecuted;
+
+    /* Speculation gave up on the transaction (e.g. CREATE) */
+    size_t aborted;
+} BlockStats;
+
+bool Executor_run_block(VM *vm, const Transaction *transactions, size_t length, size_t threads, Receipt *receipts, BlockStats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,420 @@
+/**
+ * Fork-server worker pool. Requests and replies travel as length
+ * prefixed messages over one AF_UNIX socket pair per worker, the
+ * parent keeps a single request in flight on each worker and waits
+ * for answers with poll. The built-in handler runs calls read-only
+ * in a buffered view like Runner does, so a worker's private copy of
+ * the state never drifts from the parent's. Only the forking thread
+ * survives in the child, it mustn't need locks other threads held
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "forkpool.h"
+
+#define GROWTH_RATE 2
+
+/* State of the built-in call handler, each worker changes its own copy */
+typedef struct {
+    VM *vm;
+    StateView view;
+    TransientStorage transient;
+} CallRunner;
+
+void ForkMessage_put(ForkMessage *message, const void *data, size_t size) {
+    if (message->length + size > message->capacity) {
+        while (message->length + size > message->capacity)
+            message->capacity = message->capacity == 0 ? 256 : message->capacity * GROWTH_RATE;
+
+        message->bytes = (uint8_t*)realloc(message->bytes, message->capacity);
+    }
+
+    memcpy(message->bytes + message->length, data, size);
+    message->length += size;
+}
+
+static void put_size(ForkMessage *message, size_t size) {
+    uint64_t value = size;
+    ForkMessage_put(message, &value, sizeof(value));
+}
+
+static void get(const uint8_t **cursor, void *data, size_t size) {
+    memcpy(data, *cursor, size);
+    *cursor += size;
+}
+
+static size_t get_size(const uint8_t **cursor) {
+    uint64_t value;
+    get(cursor, &value, sizeof(value));
+    return (size_t)value;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        /* A dead peer shows up as EPIPE instead of SIGPIPE */
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool read_all(int fd, uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = read(fd, data, size);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        data += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool send_message(int fd, const uint8_t *bytes, size_t size) {
+    uint64_t length = size;
+    return write_all(fd, (const uint8_t*)&length, sizeof(length)) && write_all(fd, bytes, size);
+}
+
+/* Next message as a new buffer, NULL once the peer is gone */
+static uint8_t *receive_message(int fd, size_t *size) {
+    uint64_t length;
+    if (!read_all(fd, (uint8_t*)&length, sizeof(length))) return NULL;
+
+    uint8_t *bytes = (uint8_t*)malloc(length + 1);
+
+    if (!read_all(fd, bytes, length)) {
+        free(bytes);
+        return NULL;
+    }
+
+    *size = (size_t)length;
+
+    return bytes;
+}
+
+static void encode_call(ForkMessage *message, const Transaction *call) {
+    ForkMessage_put(message, &call->sender, sizeof(Address));
+    ForkMessage_put(message, &call->to, sizeof(Address));
+    ForkMessage_put(message, &call->value, sizeof(UInt256));
+    ForkMessage_put(message, call->calldata, call->calldata_size);
+}
+
+static void encode_receipt(ForkMessage *message, const Receipt *receipt) {
+    uint8_t status = (uint8_t)receipt->status;
+    ForkMessage_put(message, &status, sizeof(status));
+
+    put_size(message, receipt->return_data_size);
+    ForkMessage_put(message, receipt->return_data, receipt->return_data_size);
+
+    put_size(message, receipt->logs.length);
+
+    for (size_t i = 0; i < receipt->logs.length; i++) {
+        const Log *log = receipt->logs.elements[i];
+
+        put_size(message, log->topics_length);
+        ForkMessage_put(message, log->topics, sizeof(UInt256) * log->topics_length);
+
+        put_size(message, log->size);
+        ForkMessage_put(message, log->data, log->size);
+    }
+}
+
+static void decode_receipt(const uint8_t *cursor, Receipt *receipt) {
+    uint8_t status;
+    get(&cursor, &status, sizeof(status));
+    receipt->status = (Status)status;
+
+    receipt->return_data_size = receipt->return_capacity = get_size(&cursor);
+    receipt->return_data = (uint8_t*)malloc(receipt->return_data_size);
+    get(&cursor, receipt->return_data, receipt->return_data_size);
+
+    Logs_init(&receipt->logs);
+
+    for (size_t i = 0, length = get_size(&cursor); i < length; i++) {
+        UInt256 topics[LOG_TOPICS_MAX];
+        size_t topics_length = get_size(&cursor);
+
+        get(&cursor, topics, sizeof(UInt256) * topics_length);
+
+        Log *log = Logs_append(&receipt->logs, topics_length, get_size(&cursor));
+
+        memcpy(log->topics, topics, sizeof(UInt256) * topics_length);
+        get(&cursor, log->data, log->size);
+    }
+}
+
+/* Built-in handler, runs an encoded call and replies with its receipt */
+static void run_call(void *context, const uint8_t *request, size_t size, ForkMessage *reply) {
+    CallRunner *runner = (CallRunner*)context;
+
+    Transaction call;
+    const uint8_t *cursor = request;
+
+    get(&cursor, &call.sender, sizeof(Address));
+    get(&cursor, &call.to, sizeof(Address));
+    get(&cursor, &call.value, sizeof(UInt256));
+
+    call.calldata = cursor;
+    call.calldata_size = size - (size_t)(cursor - request);
+
+    /* Writes are discarded, the next call sees the inherited state */
+    StateView_reset(&runner->view, true);
+
+    Receipt receipt;
+    VM_execute(runner->vm, &call, &runner->view, &runner->transient, &receipt);
+    TransientStorage_clear(&runner->transient);
+
+    encode_receipt(reply, &receipt);
+    Receipt_free(&receipt);
+}
+
+/* Worker process main loop, runs until the parent hangs up */
+static void serve(ForkPool *pool, int fd) {
+    if (pool->start != NULL) pool->start(pool->context);
+
+    ForkMessage reply = { NULL, 0, 0 };
+
+    for (;;) {
+        size_t size;
+        uint8_t *request = receive_message(fd, &size);
+        if (request == NULL) break;
+
+        reply.length = 0;
+        pool->handler(pool->context, request, size, &reply);
+        free(request);
+
+        if (!send_message(fd, reply.bytes, reply.length)) break;
+    }
+
+    _exit(0);
+}
+
+static void spawn(ForkPool *pool, size_t index) {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        error("Couldn't create socket pair for worker %zu\n", index);
+
+    /* Don't let the child flush output the parent buffered */
+    fflush(NULL);
+
+    pid_t pid = fork();
+
+    if (pid < 0) error("Couldn't fork worker %zu\n", index);
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        /* Sockets of the other workers belong to the parent */
+        for (size_t i = 0; i < pool->length; i++)
+            if (i != index && pool->workers[i].socket >= 0)
+                close(pool->workers[i].socket);
+
+        serve(pool, fds[1]);
+    }
+
+    close(fds[1]);
+
+    ForkWorker *worker = &pool->workers[index];
+
+    worker->pid = pid;
+    worker->socket = fds[0];
+    worker->exchange = SIZE_MAX;
+}
+
+/* Kill a worker, reap it and fork a fresh one in its place */
+static void replace(ForkPool *pool, size_t index) {
+    ForkWorker *worker = &pool->workers[index];
+
+    close(worker->socket);
+    worker->socket = -1;
+
+    kill(worker->pid, SIGKILL);
+    waitpid(worker->pid, NULL, 0);
+
+    spawn(pool, index);
+}
+
+static void respawn(ForkPool *pool, size_t index) {
+    pool->crashes++;
+    replace(pool, index);
+}
+
+static void crashed(Receipt *receipt) {
+    receipt->status = STATUS_CRASHED;
+    receipt->return_data = NULL;
+    receipt->return_data_size = 0;
+    receipt->return_capacity = 0;
+    Logs_init(&receipt->logs);
+}
+
+/* Fork `workers` processes running calls against the current state of `vm` */
+void ForkPool_init(ForkPool *pool, VM *vm, size_t workers) {
+    CallRunner *runner = (CallRunner*)malloc(sizeof(CallRunner));
+
+    runner->vm = vm;
+    StateView_init(&runner->view, true);
+    TransientStorage_init(&runner->transient);
+
+    ForkPool_init_handler(pool, workers, run_call, NULL, runner);
+}
+
+/* Fork `workers` processes answering requests with `handler`. `start` may be NULL */
+void ForkPool_init_handler(ForkPool *pool, size_t workers, ForkHandler handler, ForkStart start, void *context) {
+    if (workers == 0) workers = 1;
+
+    pool->length = workers;
+    pool->handler = handler;
+    pool->start = start;
+    pool->context = context;
+    pool->crashes = 0;
+    pool->workers = (ForkWorker*)malloc(sizeof(ForkWorker) * workers);
+
+    for (size_t i = 0; i < workers; i++)
+        pool->workers[i].socket = -1;
+
+    for (size_t i = 0; i < workers; i++)
+        spawn(pool, i);
+}
+
+/*
+ * Run `length` independent calls on the workers, filling one receipt
+ * per call. Calls whose worker died come back as STATUS_CRASHED.
+ * Receipts are owned by the caller
+ */
+void ForkPool_run(ForkPool *pool, const Transaction *calls, size_t length, Receipt *results) {
+    ForkExchange *exchanges = (ForkExchange*)malloc(sizeof(ForkExchange) * length);
+    ForkMessage message = { NULL, 0, 0 };
+
+    /* Encode every call into one buffer, then point the exchanges into it */
+    size_t *ends = (size_t*)malloc(sizeof(size_t) * length);
+
+    for (size_t i = 0; i < length; i++) {
+        encode_call(&message, &calls[i]);
+        ends[i] = message.length;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        size_t start = i == 0 ? 0 : ends[i - 1];
+        exchanges[i] = (ForkExchange){ .request = message.bytes + start, .request_size = ends[i] - start };
+    }
+
+    ForkPool_exchange(pool, exchanges, length);
+
+    for (size_t i = 0; i < length; i++) {
+        if (exchanges[i].reply == NULL) {
+            crashed(&results[i]);
+        } else {
+            decode_receipt(exchanges[i].reply, &results[i]);
+            free(exchanges[i].reply);
+        }
+    }
+
+    free(message.bytes);
+    free(ends);
+    free(exchanges);
+}
+
+/*
+ * Send each request to some worker and collect the replies, up to one
+ * request in flight per worker. Requests whose worker died get a NULL
+ * reply and the worker is forked again
+ */
+void ForkPool_exchange(ForkPool *pool, ForkExchange *exchanges, size_t length) {
+    struct pollfd *fds = (struct pollfd*)malloc(sizeof(struct pollfd) * pool->length);
+    size_t *polled = (size_t*)malloc(sizeof(size_t) * pool->length);
+
+    size_t next = 0, done = 0;
+
+    while (done < length) {
+        /* Hand out requests to idle workers */
+        for (size_t i = 0; i < pool->length && next < length; i++) {
+            ForkWorker *worker = &pool->workers[i];
+            if (worker->exchange != SIZE_MAX) continue;
+
+            ForkExchange *exchange = &exchanges[next];
+
+            if (send_message(worker->socket, exchange->request, exchange->request_size)) {
+                worker->exchange = next++;
+            } else {
+                exchange->reply = NULL;
+                exchange->reply_size = 0;
+                next++;
+                done++;
+                respawn(pool, i);
+            }
+        }
+
+        size_t busy = 0;
+
+        for (size_t i = 0; i < pool->length; i++) {
+            if (pool->workers[i].exchange == SIZE_MAX) continue;
+
+            fds[busy] = (struct pollfd){ .fd = pool->workers[i].socket, .events = POLLIN };
+            polled[busy++] = i;
+        }
+
+        if (busy == 0) continue;
+
+        if (poll(fds, busy, -1) < 0) {
+            if (errno == EINTR) continue;
+            error("Couldn't poll workers\n");
+        }
+
+        for (size_t j = 0; j < busy; j++) {
+            if (fds[j].revents == 0) continue;
+
+            ForkWorker *worker = &pool->workers[polled[j]];
+            ForkExchange *exchange = &exchanges[worker->exchange];
+
+            exchange->reply_size = 0;
+            exchange->reply = receive_message(worker->socket, &exchange->reply_size);
+
+            worker->exchange = SIZE_MAX;
+            done++;
+
+            if (exchange->reply == NULL) respawn(pool, polled[j]);
+        }
+    }
+
+    free(fds);
+    free(polled);
+}
+
+/* Fork every worker again, so they see state the parent changed since */
+void ForkPool_restart(ForkPool *pool) {
+    for (size_t i = 0; i < pool->length; i++)
+        replace(pool, i);
+}
+
+void ForkPool_free(ForkPool *pool) {
+    /* Workers exit once they read end of file */
+    for (size_t i = 0; i < pool->length; i++)
+        close(pool->workers[i].socket);
+
+    for (size_t i = 0; i < pool->length; i++)
+        waitpid(pool->workers[i].pid, NULL, 0);
+
+    free(pool->workers);
+
+    if (pool->handler == run_call) {
+        CallRunner *runner = (CallRunner*)pool->context;
+
+        StateView_free(&runner->view);
+        TransientStorage_free(&runner->transient);
+        free(runner);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef FORKPOOL_H
+#define FORKPOOL_H
+
+#include <sys/types.h>
+
+#include "common.h"
+#include "vm.h"
+
+/* Growable byte buffer a worker writes its reply into */
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+    size_t capacity;
+} ForkMessage;
+
+void ForkMessage_put(ForkMessage *message, const void *data, size_t size);
+
+/* Answers one request inside a worker, appending the reply to `reply` */
+typedef void (*ForkHandler)(void *context, const uint8_t *request, size_t size, ForkMessage *reply);
+
+/* Runs once in each new worker, to drop what it inherited but doesn't need */
+typedef void (*ForkStart)(void *context);
+
+/* A request to run on some worker and the reply it got */
+typedef struct {
+    const uint8_t *request;
+    size_t request_size;
+
+    /* Owned by the caller once set, NULL if the worker died */
+    uint8_t *reply;
+    size_t reply_size;
+} ForkExchange;
+
+typedef struct {
+    pid_t pid;
+
+    /* Parent's end of the socket pair shared with the worker */
+    int socket;
+
+    /* Index of the exchange in flight, SIZE_MAX while idle */
+    size_t exchange;
+} ForkWorker;
+
+/*
+ * Pool of worker processes forked from a parent that has already
+ * loaded state. Workers inherit the VM copy-on-write, answer requests
+ * sent over a socket pair and stream replies back. A worker that dies
+ * only fails its own request and is forked again
+ */
+typedef struct {
+    ForkWorker *workers;
+    size_t length;
+
+    ForkHandler handler;
+    ForkStart start;
+    void *context;
+
+    /* Workers lost over the pool's lifetime */
+    size_t crashes;
+} ForkPool;
+
+void ForkPool_init(ForkPool *pool, VM *vm, size_t workers);
+void ForkPool_init_handler(ForkPool *pool, size_t workers, ForkHandler handler, ForkStart start, void *context);
+void ForkPool_run(ForkPool *pool, const Transaction *calls, size_t length, Receipt *results);
+void ForkPool_exchange(ForkPool *pool, ForkExchange *exchanges, size_t length);
+void ForkPool_restart(ForkPool *pool);
+void ForkPool_free(ForkPool *pool);
+
+#endif
\ No newline at end of file
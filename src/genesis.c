@@ -0,0 +1,274 @@
+/**
+ * Bulk loading of accounts from a genesis file. Integers are
+ * little-endian, 256-bit words big-endian:
+ *
+ *   header:  "CEVMGENS", version u32, 0 u32, accounts u64
+ *   account: address[20], balance[32], nonce u64, code size u32,
+ *            storage length u32, code, storage (key[32], value[32])*
+ *
+ * Loading maps the file and indexes the records, hashes and
+ * analyzes every contract's code in place on a pool of threads,
+ * then fills the account table (sized up front) in one pass
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "genesis.h"
+
+#define MAGIC "CEVMGENS"
+#define VERSION 1
+
+#define HEADER_SIZE (8 + 4 + 4 + 8)
+#define ACCOUNT_SIZE (20 + 32 + 8 + 4 + 4)
+#define SLOT_SIZE (32 + 32)
+
+typedef struct {
+    const uint8_t *record;
+
+    const uint8_t *code_bytes;
+    uint32_t code_size;
+
+    const uint8_t *storage;
+    uint32_t storage_length;
+
+    /* Filled in by the analysis */
+    Code *code;
+} GenesisEntry;
+
+typedef struct {
+    GenesisEntry *entries;
+    size_t length;
+
+    /* Next entry to pick up */
+    size_t next;
+} Analysis;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)p[i] << (8 * i);
+    return value;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+static void *analyze(void *arg) {
+    Analysis *analysis = (Analysis*)arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&analysis->next, 1, __ATOMIC_RELAXED);
+        if (i >= analysis->length) break;
+
+        GenesisEntry *entry = &analysis->entries[i];
+
+        if (entry->code_size > 0)
+            entry->code = Code_create_mapped(entry->code_bytes, entry->code_size);
+    }
+
+    return NULL;
+}
+
+/* Write every account in `vm` to `path` as a genesis file */
+void Genesis_write(const VM *vm, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) error("Failed to open %s: %s\n", path, strerror(errno));
+
+    uint8_t header[HEADER_SIZE] = MAGIC;
+    put_u32(header + 8, VERSION);
+    put_u32(header + 12, 0);
+    put_u64(header + 16, vm->accounts.length);
+
+    fwrite(header, 1, sizeof(header), file);
+
+    for (size_t i = 0; i < vm->accounts.length; i++) {
+        const Account *account = &vm->accounts.accounts[i];
+        const Storage *storage = account->storage;
+        uint8_t record[ACCOUNT_SIZE];
+
+        memcpy(record, account->address.bytes, 20);
+        UInt256_store(&account->balance, record + 20);
+        put_u64(record + 52, account->nonce);
+        put_u32(record + 60, account->code == NULL ? 0 : (uint32_t)account->code->size);
+        put_u32(record + 64, (uint32_t)storage->length);
+
+        fwrite(record, 1, sizeof(record), file);
+
+        if (account->code != NULL)
+            fwrite(account->code->bytes, 1, account->code->size, file);
+
+        for (size_t j = 0; j < storage->capacity; j++) {
+            if (!storage->entries[j].used) continue;
+
+            uint8_t slot[SLOT_SIZE];
+            UInt256_store(&storage->entries[j].key, slot);
+            UInt256_store(&storage->entries[j].value, slot + 32);
+
+            fwrite(slot, 1, sizeof(slot), file);
+        }
+    }
+
+    if (ferror(file) || fclose(file) != 0) error("Failed to write %s\n", path);
+}
+
+/*
+ * Add the accounts in the genesis file at `path` to `vm`, analyzing
+ * code on `threads` threads. Returns false if the file is missing
+ * or malformed, in which case `vm` is left as it was
+ */
+bool Genesis_load(VM *vm, const char *path, size_t threads, Genesis *genesis, GenesisStats *stats) {
+    if (threads == 0) threads = 1;
+
+    memset(stats, 0, sizeof(GenesisStats));
+
+    double start = now();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    genesis->size = (size_t)st.st_size;
+    genesis->base = mmap(NULL, genesis->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (genesis->base == MAP_FAILED) return false;
+
+    const uint8_t *base = (const uint8_t*)genesis->base;
+    const uint8_t *end = base + genesis->size;
+
+    uint64_t length = get_u64(base + 16);
+
+    /* Every account takes at least ACCOUNT_SIZE bytes, which bounds a bogus count */
+    if (memcmp(base, MAGIC, 8) != 0 || get_u32(base + 8) != VERSION || length > genesis->size / ACCOUNT_SIZE) {
+        Genesis_close(genesis);
+        return false;
+    }
+
+    madvise(genesis->base, genesis->size, MADV_WILLNEED);
+
+    /* Index the records, checking they fit in the file */
+    GenesisEntry *entries = (GenesisEntry*)calloc(length + 1, sizeof(GenesisEntry));
+    const uint8_t *p = base + HEADER_SIZE;
+
+    for (size_t i = 0; i < length; i++) {
+        GenesisEntry *entry = &entries[i];
+
+        if ((size_t)(end - p) < ACCOUNT_SIZE) goto malformed;
+
+        entry->record = p;
+        entry->code_size = get_u32(p + 60);
+        entry->storage_length = get_u32(p + 64);
+        p += ACCOUNT_SIZE;
+
+        if ((size_t)(end - p) < entry->code_size) goto malformed;
+
+        entry->code_bytes = p;
+        p += entry->code_size;
+
+        if ((size_t)(end - p) / SLOT_SIZE < entry->storage_length) goto malformed;
+
+        entry->storage = p;
+        p += (size_t)entry->storage_length * SLOT_SIZE;
+    }
+
+    stats->map = now() - start;
+
+    double phase = now();
+
+    Analysis analysis = { .entries = entries, .length = length, .next = 0 };
+    pthread_t *workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+
+    /* The calling thread is one of the workers */
+    for (size_t i = 1; i < threads; i++)
+        pthread_create(&workers[i], NULL, analyze, &analysis);
+
+    analyze(&analysis);
+
+    for (size_t i = 1; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+
+    stats->analyze = now() - phase;
+    phase = now();
+
+    size_t codes_before = vm->codes.length;
+
+    Accounts_reserve(&vm->accounts, vm->accounts.length + length);
+
+    for (size_t i = 0; i < length; i++) {
+        GenesisEntry *entry = &entries[i];
+
+        Address address;
+        memcpy(address.bytes, entry->record, 20);
+
+        Account *account = Accounts_insert(&vm->accounts, &address);
+
+        UInt256_load_padded(&account->balance, entry->record, ACCOUNT_SIZE, 20);
+        account->nonce = get_u64(entry->record + 52);
+
+        if (entry->code != NULL) {
+            if (account->code != NULL) CodeCache_release(&vm->codes, account->code);
+            account->code = CodeCache_adopt(&vm->codes, entry->code);
+        }
+
+        Storage_reserve(account->storage, account->storage->length + entry->storage_length);
+
+        for (size_t j = 0; j < entry->storage_length; j++) {
+            UInt256 key, value;
+            UInt256_load_padded(&key, entry->storage, (size_t)entry->storage_length * SLOT_SIZE, j * SLOT_SIZE);
+            UInt256_load_padded(&value, entry->storage, (size_t)entry->storage_length * SLOT_SIZE, j * SLOT_SIZE + 32);
+
+            Storage_insert(account->storage, &key, &value);
+        }
+
+        stats->slots += entry->storage_length;
+    }
+
+    stats->build = now() - phase;
+    stats->total = now() - start;
+    stats->accounts = length;
+    stats->codes = vm->codes.length - codes_before;
+
+    free(entries);
+
+    return true;
+
+malformed:
+    free(entries);
+    Genesis_close(genesis);
+    return false;
+}
+
+void Genesis_close(Genesis *genesis) {
+    munmap(genesis->base, genesis->size);
+    genesis->base = NULL;
+    genesis->size = 0;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef GENESIS_H
+#define GENESIS_H
+
+#include "common.h"
+#include "vm.h"
+
+/*
+ * A genesis file mapped into memory. Loaded code uses its bytes
+ * in place, so close it only after the VM is freed
+ */
+typedef struct {
+    void *base;
+    size_t size;
+} Genesis;
+
+typedef struct {
+    size_t accounts;
+    size_t codes;
+    size_t slots;
+
+    /* Seconds spent mapping and indexing the file, analyzing code and filling the VM */
+    double map;
+    double analyze;
+    double build;
+    double total;
+} GenesisStats;
+
+void Genesis_write(const VM *vm, const char *path);
+bool Genesis_load(VM *vm, const char *path, size_t threads, Genesis *genesis, GenesisStats *stats);
+void Genesis_close(Genesis *genesis);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+/**
+ * Hex decoding, either case. On x86 the bulk of the input goes
+ * through SSE2 (32 digits at a time) or AVX2 (64 digits at a time),
+ * picked at runtime, and the remainder through the scalar loop
+ */
+
+#include "hex.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEX_SIMD
+#include <immintrin.h>
+#endif
+
+/* Value of a hex digit, -1 if `ch` isn't one */
+static int nibble(uint8_t ch) {
+    if ((unsigned)(ch - '0') < 10) return ch - '0';
+
+    ch |= 0x20;
+    if ((unsigned)(ch - 'a') < 6) return ch - 'a' + 10;
+
+    return -1;
+}
+
+static bool decode_scalar(const char *hex, size_t length, uint8_t *bytes) {
+    for (size_t i = 0; i < length; i++) {
+        int high = nibble((uint8_t)hex[2 * i]), low = nibble((uint8_t)hex[2 * i + 1]);
+        if ((high | low) < 0) return false;
+
+        bytes[i] = (uint8_t)(high << 4 | low);
+    }
+
+    return true;
+}
+
+#ifdef HEX_SIMD
+
+/*
+ * Digit values of 16 characters, lanes that aren't a digit are
+ * cleared in `valid`. Signed compares are fine, bytes past 0x7F
+ * are negative and fail both ranges
+ */
+static __m128i nibbles_sse2(__m128i chars, __m128i *valid) {
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+    *valid = _mm_and_si128(*valid, _mm_or_si128(digit, letter));
+
+    return _mm_or_si128(
+        _mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+        _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)))
+    );
+}
+
+/* Join digit pairs, high digit first in memory, into the low byte of each 16-bit lane */
+static __m128i join_sse2(__m128i nibbles) {
+    return _mm_or_si128(
+        _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4),
+        _mm_srli_epi16(nibbles, 8)
+    );
+}
+
+/* Decodes whole blocks of 16 bytes, returns how many bytes or SIZE_MAX if a digit is bad */
+static size_t decode_sse2(const char *hex, size_t length, uint8_t *bytes) {
+    size_t blocks = length / 16;
+    __m128i valid = _mm_set1_epi8(-1);
+
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i first = nibbles_sse2(_mm_loadu_si128((const __m128i*)(hex + 32 * i)), &valid);
+        __m128i second = nibbles_sse2(_mm_loadu_si128((const __m128i*)(hex + 32 * i + 16)), &valid);
+
+        _mm_storeu_si128((__m128i*)(bytes + 16 * i), _mm_packus_epi16(join_sse2(first), join_sse2(second)));
+    }
+
+    return _mm_movemask_epi8(valid) == 0xFFFF ? blocks * 16 : SIZE_MAX;
+}
+
+__attribute__((target("avx2")))
+static __m256i nibbles_avx2(__m256i chars, __m256i *valid) {
+    __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+
+    *valid = _mm256_and_si256(*valid, _mm256_or_si256(digit, letter));
+
+    return _mm256_or_si256(
+        _mm256_and_si256(digit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+        _mm256_and_si256(letter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)))
+    );
+}
+
+__attribute__((target("avx2")))
+static __m256i join_avx2(__m256i nibbles) {
+    return _mm256_or_si256(
+        _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0x00FF)), 4),
+        _mm256_srli_epi16(nibbles, 8)
+    );
+}
+
+/* Like decode_sse2 with blocks of 32 bytes */
+__attribute__((target("avx2")))
+static size_t decode_avx2(const char *hex, size_t length, uint8_t *bytes) {
+    size_t blocks = length / 32;
+    __m256i valid = _mm256_set1_epi8(-1);
+
+    for (size_t i = 0; i < blocks; i++) {
+        __m256i first = nibbles_avx2(_mm256_loadu_si256((const __m256i*)(hex + 64 * i)), &valid);
+        __m256i second = nibbles_avx2(_mm256_loadu_si256((const __m256i*)(hex + 64 * i + 32)), &valid);
+
+        /* Packing works within 128-bit halves, put the quarters back in order */
+        __m256i packed = _mm256_packus_epi16(join_avx2(first), join_avx2(second));
+        _mm256_storeu_si256((__m256i*)(bytes + 32 * i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+
+    return (uint32_t)_mm256_movemask_epi8(valid) == UINT32_MAX ? blocks * 32 : SIZE_MAX;
+}
+
+#endif
+
+/*
+ * Decode the first `size` characters of `hex` (an even number)
+ * into `bytes`. Returns false if any of them isn't a hex digit
+ */
+bool Hex_decode_into(const char *hex, size_t size, uint8_t *bytes) {
+    size_t length = size / 2, done = 0;
+
+    if (size % 2 != 0) return false;
+
+#ifdef HEX_SIMD
+    done = __builtin_cpu_supports("avx2") ? decode_avx2(hex, length, bytes) : decode_sse2(hex, length, bytes);
+    if (done == SIZE_MAX) return false;
+#endif
+
+    return decode_scalar(hex + 2 * done, length - done, bytes + done);
+}
+
+/* Decode a hex string into a new buffer, NULL (and length 0) if it isn't valid hex */
+uint8_t *Hex_decode(const char *hex, size_t *length) {
+    size_t size = strlen(hex);
+    uint8_t *bytes = (uint8_t*)malloc(size / 2 + 1);
+
+    if (!Hex_decode_into(hex, size, bytes)) {
+        free(bytes);
+        *length = 0;
+        return NULL;
+    }
+
+    *length = size / 2;
+    return bytes;
+}
+
+/* Write `size` bytes as lowercase hex to `hex`, which needs room for 2 * size + 1 characters */
+void Hex_encode(const uint8_t *bytes, size_t size, char *hex) {
+    static const char DIGITS[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = DIGITS[bytes[i] >> 4];
+        hex[2 * i + 1] = DIGITS[bytes[i] & 0xF];
+    }
+
+    hex[2 * size] = '\0';
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include "common.h"
+
+bool Hex_decode_into(const char *hex, size_t size, uint8_t *bytes);
+uint8_t *Hex_decode(const char *hex, size_t *length);
+void Hex_encode(const uint8_t *bytes, size_t size, char *hex);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,419 @@
+/**
+ * Hot pc, basic block and source line reports from a samples file,
+ * see hotspots.h. Each report sorts (key, count) rows by key, merges
+ * equal keys and sorts again by count
+ */
+
+#include "hotspots.h"
+#include "hex.h"
+
+/* A row of a report: what was hot and how many samples landed there */
+typedef struct {
+    const HotSample *sample;
+    uint32_t block;
+    int32_t file;
+    size_t line;
+    uint64_t count;
+} Row;
+
+static bool parse_hex(const char *hex, uint8_t *bytes, size_t size) {
+    return strlen(hex) == 2 * size && Hex_decode_into(hex, 2 * size, bytes);
+}
+
+static bool parse_hash(const char *hex, UInt256 *hash) {
+    uint8_t bytes[32];
+    if (!parse_hex(hex, bytes, 32)) return false;
+
+    UInt256_load(hash, bytes);
+    return true;
+}
+
+/* Whole file, NUL terminated */
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    size_t capacity = 4096, length = 0;
+    char *text = (char*)malloc(capacity);
+
+    for (;;) {
+        length += fread(text + length, 1, capacity - length - 1, file);
+        if (length < capacity - 1) break;
+
+        capacity *= 2;
+        text = (char*)realloc(text, capacity);
+    }
+
+    fclose(file);
+
+    text[length] = '\0';
+    *size = length;
+    return text;
+}
+
+/* Read a file written by Sampler_save */
+bool Hotspots_load(Hotspots *hotspots, const char *path) {
+    memset(hotspots, 0, sizeof(Hotspots));
+    CodeCache_init(&hotspots->codes);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char *line = NULL;
+    size_t line_capacity = 0, capacity = 0;
+    bool ok = true;
+
+    while (ok && getline(&line, &line_capacity, file) > 0) {
+        char *fields[5] = { NULL };
+        size_t n = 0;
+
+        for (char *token = strtok(line, " \n"); token != NULL && n < 5; token = strtok(NULL, " \n")) fields[n++] = token;
+
+        if (n == 0 || fields[0][0] == '#') continue;
+
+        if (strcmp(fields[0], "hz") == 0 && n == 2) {
+            hotspots->hz = (unsigned)strtoul(fields[1], NULL, 10);
+        } else if (strcmp(fields[0], "samples") == 0 && n == 5) {
+            hotspots->total = strtoull(fields[1], NULL, 10);
+            hotspots->outside = strtoull(fields[2], NULL, 10);
+            hotspots->dropped = strtoull(fields[4], NULL, 10);
+        } else if (strcmp(fields[0], "code") == 0 && n >= 2) {
+            /* Empty code has no bytes field */
+            size_t size = 0;
+            uint8_t *bytes = n > 2 ? Hex_decode(fields[2], &size) : NULL;
+
+            if (n > 2 && bytes == NULL) ok = false;
+            else CodeCache_insert(&hotspots->codes, bytes, size);
+
+            free(bytes);
+        } else if (strcmp(fields[0], "sample") == 0 && n == 5) {
+            HotSample sample;
+
+            ok = parse_hash(fields[1], &sample.sample.code_hash) && parse_hex(fields[2], sample.sample.address.bytes, 20);
+            sample.sample.pc = (uint32_t)strtoul(fields[3], NULL, 10);
+            sample.count = strtoull(fields[4], NULL, 10);
+
+            if (hotspots->samples_length == capacity) {
+                capacity = capacity == 0 ? 256 : 2 * capacity;
+                hotspots->samples = (HotSample*)realloc(hotspots->samples, sizeof(HotSample) * capacity);
+            }
+
+            hotspots->samples[hotspots->samples_length++] = sample;
+        } else {
+            ok = false;
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    return ok;
+}
+
+/* solc's compressed "s:l:f:j:m;..." map, an empty field repeats the previous instruction's */
+static SourceRange *parse_source_map(const char *text, size_t size, size_t *length) {
+    SourceRange current = { 0, 0, -1 };
+    SourceRange *ranges = NULL;
+    size_t n = 0, capacity = 0;
+    const char *p = text, *end = text + size;
+
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '"')) end--;
+    while (p < end && (*p == ' ' || *p == '"')) p++;
+
+    while (p < end) {
+        for (int field = 0; p < end && *p != ';'; field++) {
+            const char *start = p;
+            while (p < end && *p != ':' && *p != ';') p++;
+
+            if (p > start && field < 3) {
+                int32_t value = (int32_t)strtol(start, NULL, 10);
+
+                if (field == 0) current.start = value;
+                else if (field == 1) current.length = value;
+                else current.file = value;
+            }
+
+            if (p < end && *p == ':') p++;
+        }
+
+        if (n == capacity) {
+            capacity = capacity == 0 ? 1024 : 2 * capacity;
+            ranges = (SourceRange*)realloc(ranges, sizeof(SourceRange) * capacity);
+        }
+
+        ranges[n++] = current;
+
+        if (p < end) p++;
+    }
+
+    *length = n;
+    return ranges;
+}
+
+/* Map pcs of `target`, an address (20 bytes hex) or code hash (32), to source with the map in `path` */
+bool Hotspots_add_source_map(Hotspots *hotspots, const char *target, const char *path) {
+    SourceMap map = { 0 };
+
+    if (target[0] == '0' && (target[1] == 'x' || target[1] == 'X')) target += 2;
+
+    if (parse_hex(target, map.address.bytes, 20)) map.by_address = true;
+    else if (!parse_hash(target, &map.code_hash)) return false;
+
+    size_t size;
+    char *text = read_file(path, &size);
+    if (text == NULL) return false;
+
+    map.ranges = parse_source_map(text, size, &map.ranges_length);
+    free(text);
+
+    hotspots->maps = (SourceMap*)realloc(hotspots->maps, sizeof(SourceMap) * (hotspots->maps_length + 1));
+    hotspots->maps[hotspots->maps_length++] = map;
+
+    return true;
+}
+
+/* Next source file in solc's source list */
+bool Hotspots_add_source(Hotspots *hotspots, const char *path) {
+    Source source = { 0 };
+
+    source.text = read_file(path, &source.size);
+    if (source.text == NULL) return false;
+
+    source.path = strdup(path);
+    source.lines = (size_t*)malloc(sizeof(size_t));
+    source.lines[source.lines_length++] = 0;
+
+    for (size_t i = 0; i < source.size; i++) {
+        if (source.text[i] != '\n') continue;
+
+        source.lines = (size_t*)realloc(source.lines, sizeof(size_t) * (source.lines_length + 1));
+        source.lines[source.lines_length++] = i + 1;
+    }
+
+    hotspots->sources = (Source*)realloc(hotspots->sources, sizeof(Source) * (hotspots->sources_length + 1));
+    hotspots->sources[hotspots->sources_length++] = source;
+
+    return true;
+}
+
+static const SourceMap *source_map(const Hotspots *hotspots, const Sample *sample) {
+    for (size_t i = 0; i < hotspots->maps_length; i++)
+        if (hotspots->maps[i].by_address && Address_equals(&hotspots->maps[i].address, &sample->address)) return &hotspots->maps[i];
+
+    for (size_t i = 0; i < hotspots->maps_length; i++)
+        if (!hotspots->maps[i].by_address && UInt256_equals(&hotspots->maps[i].code_hash, &sample->code_hash)) return &hotspots->maps[i];
+
+    return NULL;
+}
+
+/* Source range the instruction at `pc` came from, NULL if unknown */
+static const SourceRange *source_range(const Hotspots *hotspots, const Sample *sample) {
+    const SourceMap *map = source_map(hotspots, sample);
+    const Code *code = CodeCache_get(&hotspots->codes, &sample->code_hash);
+
+    if (map == NULL || code == NULL) return NULL;
+
+    size_t low = 0, high = code->instructions_length;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+
+        if (code->instructions[middle].pc < sample->pc) low = middle + 1;
+        else high = middle;
+    }
+
+    if (low >= code->instructions_length || code->instructions[low].pc != sample->pc || low >= map->ranges_length) return NULL;
+
+    const SourceRange *range = &map->ranges[low];
+    if (range->file < 0 || (size_t)range->file >= hotspots->sources_length) return NULL;
+
+    return range;
+}
+
+/* Zero-based line holding byte `offset` */
+static size_t line_at(const Source *source, size_t offset) {
+    size_t low = 0, high = source->lines_length;
+
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+
+        if (source->lines[middle] <= offset) low = middle;
+        else high = middle;
+    }
+
+    return low;
+}
+
+static int compare_keys(const Row *a, const Row *b) {
+    int c = memcmp(&a->sample->sample.code_hash, &b->sample->sample.code_hash, sizeof(UInt256));
+    if (c == 0) c = memcmp(&a->sample->sample.address, &b->sample->sample.address, sizeof(Address));
+    return c;
+}
+
+static int by_block(const void *x, const void *y) {
+    const Row *a = (const Row*)x, *b = (const Row*)y;
+    int c = compare_keys(a, b);
+    return c != 0 ? c : a->block < b->block ? -1 : a->block > b->block;
+}
+
+static int by_line(const void *x, const void *y) {
+    const Row *a = (const Row*)x, *b = (const Row*)y;
+    if (a->file != b->file) return a->file < b->file ? -1 : 1;
+    return a->line < b->line ? -1 : a->line > b->line;
+}
+
+static int by_count(const void *x, const void *y) {
+    uint64_t a = ((const Row*)x)->count, b = ((const Row*)y)->count;
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+/* Sort `rows` by key, add up equal keys and sort by count, returns how many are left */
+static size_t merge(Row *rows, size_t length, int (*by_key)(const void*, const void*)) {
+    if (length == 0) return 0;
+
+    qsort(rows, length, sizeof(Row), by_key);
+
+    size_t n = 0;
+
+    for (size_t i = 1; i < length; i++) {
+        if (by_key(&rows[n], &rows[i]) == 0) rows[n].count += rows[i].count;
+        else rows[++n] = rows[i];
+    }
+
+    qsort(rows, n + 1, sizeof(Row), by_count);
+    return n + 1;
+}
+
+static void print_address(FILE *file, const Address *address) {
+    fprintf(file, "0x");
+    for (int i = 0; i < 20; i++) fprintf(file, "%02x", address->bytes[i]);
+}
+
+/* Line's text without indentation, at most `width` characters */
+static void print_line(FILE *file, const Source *source, size_t line, int width) {
+    size_t start = source->lines[line], end = line + 1 < source->lines_length ? source->lines[line + 1] : source->size;
+
+    while (start < end && (source->text[start] == ' ' || source->text[start] == '\t')) start++;
+    while (end > start && (source->text[end - 1] == '\n' || source->text[end - 1] == '\r')) end--;
+
+    fprintf(file, "%.*s", (int)(end - start) < width ? (int)(end - start) : width, source->text + start);
+}
+
+/* Top `top` pcs, blocks and source lines by samples */
+void Hotspots_print(FILE *file, const Hotspots *hotspots, size_t top) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < hotspots->samples_length; i++) total += hotspots->samples[i].count;
+
+    /* The kernel may fire less often than asked, at most once per scheduler tick */
+    fprintf(file, "%llu samples (%u Hz asked for) in %zu codes, %llu outside executions, %llu dropped\n",
+        (unsigned long long)total, hotspots->hz, hotspots->codes.length,
+        (unsigned long long)hotspots->outside, (unsigned long long)hotspots->dropped);
+
+    if (total == 0) return;
+
+    size_t length = hotspots->samples_length;
+    Row *rows = (Row*)malloc(sizeof(Row) * length);
+
+    /* Hot pcs */
+    for (size_t i = 0; i < length; i++) rows[i] = (Row){ .sample = &hotspots->samples[i], .count = hotspots->samples[i].count };
+    qsort(rows, length, sizeof(Row), by_count);
+
+    fprintf(file, "\n%10s %8s  %-42s %6s  %-14s %s\n", "samples", "share", "address", "pc", "opcode", "source");
+
+    for (size_t i = 0; i < length && i < top; i++) {
+        const Sample *sample = &rows[i].sample->sample;
+        const Code *code = CodeCache_get(&hotspots->codes, &sample->code_hash);
+        const char *name = "?";
+
+        if (code != NULL) {
+            const char *op = sample->pc < code->size ? OPCODE_TO_NAME[code->bytes[sample->pc]] : "STOP";
+            name = op != NULL ? op : "INVALID";
+        }
+
+        fprintf(file, "%10llu %7.2f%%  ", (unsigned long long)rows[i].count, 100.0 * rows[i].count / total);
+        print_address(file, &sample->address);
+        fprintf(file, " %6u  %-14s ", sample->pc, name);
+
+        const SourceRange *range = source_range(hotspots, sample);
+        if (range != NULL) {
+            const Source *source = &hotspots->sources[range->file];
+            fprintf(file, "%s:%zu", source->path, line_at(source, (size_t)range->start) + 1);
+        }
+
+        fprintf(file, "\n");
+    }
+
+    /* Hot basic blocks, of samples whose code is in the file */
+    size_t n = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        const Code *code = CodeCache_get(&hotspots->codes, &hotspots->samples[i].sample.code_hash);
+        if (code == NULL || code->blocks_length == 0) continue;
+
+        rows[n++] = (Row){
+            .sample = &hotspots->samples[i],
+            .block = (uint32_t)Code_block_at(code, hotspots->samples[i].sample.pc),
+            .count = hotspots->samples[i].count,
+        };
+    }
+
+    n = merge(rows, n, by_block);
+
+    fprintf(file, "\n%10s %8s  %-42s %13s %12s\n", "samples", "share", "address", "block", "instructions");
+
+    for (size_t i = 0; i < n && i < top; i++) {
+        const Code *code = CodeCache_get(&hotspots->codes, &rows[i].sample->sample.code_hash);
+        const Block *block = &code->blocks[rows[i].block];
+
+        fprintf(file, "%10llu %7.2f%%  ", (unsigned long long)rows[i].count, 100.0 * rows[i].count / total);
+        print_address(file, &rows[i].sample->sample.address);
+        fprintf(file, " %6u-%-6u %12u\n", block->start, block->end, block->instructions_length);
+    }
+
+    /* Hot source lines, of samples with a source map */
+    n = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        const SourceRange *range = source_range(hotspots, &hotspots->samples[i].sample);
+        if (range == NULL) continue;
+
+        rows[n++] = (Row){
+            .sample = &hotspots->samples[i],
+            .file = range->file,
+            .line = line_at(&hotspots->sources[range->file], (size_t)range->start),
+            .count = hotspots->samples[i].count,
+        };
+    }
+
+    n = merge(rows, n, by_line);
+
+    if (n > 0) fprintf(file, "\n%10s %8s  %-32s %s\n", "samples", "share", "line", "source");
+
+    for (size_t i = 0; i < n && i < top; i++) {
+        const Source *source = &hotspots->sources[rows[i].file];
+        char location[256];
+
+        snprintf(location, sizeof(location), "%s:%zu", source->path, rows[i].line + 1);
+        fprintf(file, "%10llu %7.2f%%  %-32s ", (unsigned long long)rows[i].count, 100.0 * rows[i].count / total, location);
+        print_line(file, source, rows[i].line, 60);
+        fprintf(file, "\n");
+    }
+
+    free(rows);
+}
+
+void Hotspots_free(Hotspots *hotspots) {
+    CodeCache_free(&hotspots->codes);
+    free(hotspots->samples);
+
+    for (size_t i = 0; i < hotspots->maps_length; i++) free(hotspots->maps[i].ranges);
+    free(hotspots->maps);
+
+    for (size_t i = 0; i < hotspots->sources_length; i++) {
+        free(hotspots->sources[i].path);
+        free(hotspots->sources[i].text);
+        free(hotspots->sources[i].lines);
+    }
+
+    free(hotspots->sources);
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef HOTSPOTS_H
+#define HOTSPOTS_H
+
+/*
+ * Offline side of the sampling profiler (sampler.h): reads a samples
+ * file and reports the hottest pcs, the hottest basic blocks and,
+ * given solc source maps, the hottest lines of Solidity source
+ */
+
+#include "common.h"
+#include "code.h"
+#include "sampler.h"
+
+typedef struct {
+    Sample sample;
+    uint64_t count;
+} HotSample;
+
+/* One entry of a solc source map, per instruction, offsets into `file` of the sources list */
+typedef struct {
+    int32_t start;
+    int32_t length;
+    int32_t file;
+} SourceRange;
+
+/* Source map for the code at an address, or any address running code with that hash */
+typedef struct {
+    bool by_address;
+    Address address;
+    UInt256 code_hash;
+
+    SourceRange *ranges;
+    size_t ranges_length;
+} SourceMap;
+
+typedef struct {
+    char *path;
+    char *text;
+    size_t size;
+
+    /* Offset each line starts at */
+    size_t *lines;
+    size_t lines_length;
+} Source;
+
+typedef struct {
+    unsigned hz;
+    uint64_t total;
+    uint64_t outside;
+    uint64_t dropped;
+
+    /* Bytecode the samples ran */
+    CodeCache codes;
+
+    HotSample *samples;
+    size_t samples_length;
+
+    SourceMap *maps;
+    size_t maps_length;
+
+    /* In the order of solc's source list, which source map file indices refer to */
+    Source *sources;
+    size_t sources_length;
+} Hotspots;
+
+bool Hotspots_load(Hotspots *hotspots, const char *path);
+bool Hotspots_add_source_map(Hotspots *hotspots, const char *target, const char *path);
+bool Hotspots_add_source(Hotspots *hotspots, const char *path);
+void Hotspots_print(FILE *file, const Hotspots *hotspots, size_t top);
+void Hotspots_free(Hotspots *hotspots);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include <unistd.h>
+
+#include "kvstore.h"
+
+static void *serve(void *arg) {
+    KVStore *store = (KVStore*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&store->lock);
+
+        while (store->head == NULL && !store->stopping)
+            pthread_cond_wait(&store->pending, &store->lock);
+
+        if (store->head == NULL) {
+            pthread_mutex_unlock(&store->lock);
+            break;
+        }
+
+        Load *load = store->head;
+        store->head = load->next;
+        if (store->head == NULL) store->tail = NULL;
+
+        store->reads++;
+
+        pthread_mutex_unlock(&store->lock);
+
+        if (store->latency > 0) usleep(store->latency);
+
+        Location location = { .kind = LOCATION_SLOT, .space = load->storage, .key = load->key };
+        UInt256 *value = LocationMap_get(&store->values, &location);
+
+        load->value = value == NULL ? ZERO : *value;
+
+        Backend_complete(&store->backend, load);
+    }
+
+    return NULL;
+}
+
+/* Queue the load for the next free thread */
+static void load(Backend *backend, Load *load) {
+    KVStore *store = (KVStore*)backend;
+
+    load->next = NULL;
+
+    pthread_mutex_lock(&store->lock);
+
+    if (store->tail == NULL) store->head = load;
+    else store->tail->next = load;
+
+    store->tail = load;
+
+    pthread_cond_signal(&store->pending);
+    pthread_mutex_unlock(&store->lock);
+}
+
+void KVStore_init(KVStore *store, size_t threads, unsigned latency) {
+    if (threads == 0) threads = 1;
+
+    Backend_init(&store->backend, load);
+    LocationMap_init(&store->values);
+
+    store->latency = latency;
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->pending, NULL);
+    store->head = NULL;
+    store->tail = NULL;
+    store->stopping = false;
+    store->reads = 0;
+
+    store->threads_length = threads;
+    store->threads = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+
+    for (size_t i = 0; i < threads; i++)
+        pthread_create(&store->threads[i], NULL, serve, store);
+}
+
+/* Put a slot in the store, `storage` now has to load missing keys from it */
+void KVStore_put(KVStore *store, Storage *storage, const UInt256 *key, const UInt256 *value) {
+    Location location = { .kind = LOCATION_SLOT, .space = storage, .key = *key };
+    LocationMap_set(&store->values, &location, value);
+
+    storage->backed = true;
+}
+
+/* Waits for loads already queued to be served */
+void KVStore_free(KVStore *store) {
+    pthread_mutex_lock(&store->lock);
+    store->stopping = true;
+    pthread_cond_broadcast(&store->pending);
+    pthread_mutex_unlock(&store->lock);
+
+    for (size_t i = 0; i < store->threads_length; i++)
+        pthread_join(store->threads[i], NULL);
+
+    free(store->threads);
+    pthread_mutex_destroy(&store->lock);
+    pthread_cond_destroy(&store->pending);
+
+    LocationMap_free(&store->values);
+    Backend_free(&store->backend);
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef KVSTORE_H
+#define KVSTORE_H
+
+#include "common.h"
+#include "backend.h"
+#include "view.h"
+
+/*
+ * In-memory stand-in for a key-value store behind a Backend. A pool
+ * of threads serves loads after sleeping for a fixed latency, the
+ * way reads from a disk or a remote store would take time
+ */
+typedef struct {
+    Backend backend;
+
+    /* Slot values by (storage, key), fill in before loads start */
+    LocationMap values;
+
+    /* Simulated time one read takes, in microseconds */
+    unsigned latency;
+
+    pthread_t *threads;
+    size_t threads_length;
+
+    /* Loads not picked up by a thread yet */
+    pthread_mutex_t lock;
+    pthread_cond_t pending;
+    Load *head;
+    Load *tail;
+    bool stopping;
+
+    size_t reads;
+} KVStore;
+
+void KVStore_init(KVStore *store, size_t threads, unsigned latency);
+void KVStore_put(KVStore *store, Storage *storage, const UInt256 *key, const UInt256 *value);
+void KVStore_free(KVStore *store);
+
+#endif
\ No newline at end of file
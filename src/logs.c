@@ -1,28 +1,145 @@
+/**
+ * Logs of a transaction. Log records and element arrays are
+ * recycled through per-thread free lists rather than freed, so a
+ * warm thread emits logs without allocating. Whichever thread frees
+ * a receipt gets its logs back for reuse, until it exits
+ */
+
+#include <pthread.h>
+
 #include "logs.h"
+#include "alloc.h"
 
 #define DEFAULT_CAPACITY 10
 
-static void *recalloc(void *ptr, size_t current_size, size_t new_size) {
-    void *new_ptr = realloc(ptr, new_size);
+/* Spare logs kept per thread, and the largest data buffer worth keeping */
+#define SPARE_LOGS_MAX 1024
+#define SPARE_DATA_MAX 65536
+
+static __thread Log **spare_logs = NULL;
+static __thread size_t spare_logs_length = 0;
+
+/* An element array of a freed Logs, handed to the next one that needs one */
+static __thread Log **spare_elements = NULL;
+static __thread size_t spare_elements_capacity = 0;
+
+/* Whether the thread's spares are freed at its exit yet */
+static __thread bool spares_held = false;
+
+static pthread_key_t spares_key;
+static pthread_once_t spares_once = PTHREAD_ONCE_INIT;
+
+/* Thread exit hook */
+static void free_spares(void *unused) {
+    (void)unused;
+
+    while (spare_logs_length > 0) {
+        Log *log = spare_logs[--spare_logs_length];
+        Alloc_free(log->data);
+        Alloc_free(log);
+    }
+
+    Alloc_free(spare_logs);
+    spare_logs = NULL;
 
-    for (size_t i = current_size; i < new_size; i++)
-        ((uint8_t*)ptr)[i] = 0;
+    Alloc_free(spare_elements);
+    spare_elements = NULL;
+    spare_elements_capacity = 0;
 
-    return new_ptr;
+    spares_held = false;
 }
 
+static void create_spares_key(void) {
+    pthread_key_create(&spares_key, free_spares);
+}
+
+/* Before the thread keeps anything, so it's freed when the thread exits */
+static inline void hold_spares(void) {
+    if (spares_held) return;
+
+    pthread_once(&spares_once, create_spares_key);
+    pthread_setspecific(spares_key, &spares_held);
+    spares_held = true;
+}
+
+/* No allocation until the first log */
 void Logs_init(Logs *logs) {
-    logs->capacity = DEFAULT_CAPACITY;
-    logs->elements = calloc(sizeof(Log), logs->capacity);
+    logs->capacity = 0;
+    logs->elements = NULL;
     logs->length = 0;
 }
 
-void Logs_push(Logs *logs, Log *log) {
-    logs->elements[logs->length++] = log;
+static Log *take_log(void) {
+    if (spare_logs_length > 0) return spare_logs[--spare_logs_length];
+
+    Log *log = (Log*)Alloc_malloc(ALLOC_LOGS, sizeof(Log));
+    log->data = NULL;
+    log->capacity = 0;
+
+    return log;
+}
 
+static void give_log(Log *log) {
+    if (spare_logs == NULL) {
+        spare_logs = (Log**)Alloc_malloc(ALLOC_LOGS, sizeof(Log*) * SPARE_LOGS_MAX);
+        hold_spares();
+    }
+
+    if (spare_logs_length == SPARE_LOGS_MAX || log->capacity > SPARE_DATA_MAX) {
+        Alloc_free(log->data);
+        Alloc_free(log);
+        return;
+    }
+
+    spare_logs[spare_logs_length++] = log;
+}
+
+/* Add a log with room for `topics_length` topics and `size` bytes of data, for the caller to fill in */
+Log *Logs_append(Logs *logs, size_t topics_length, size_t size) {
     if (logs->length == logs->capacity) {
-        size_t new_capacity = logs->capacity * 2;
-        logs->elements = recalloc(logs->elements, sizeof(Log) * new_capacity, logs->capacity);
-        logs->capacity = new_capacity;
+        if (logs->capacity == 0 && spare_elements != NULL) {
+            logs->elements = spare_elements;
+            logs->capacity = spare_elements_capacity;
+            spare_elements = NULL;
+            spare_elements_capacity = 0;
+        } else {
+            logs->capacity = logs->capacity == 0 ? DEFAULT_CAPACITY : logs->capacity * 2;
+            logs->elements = (Log**)Alloc_realloc(ALLOC_LOGS, logs->elements, sizeof(Log*) * logs->capacity);
+        }
     }
+
+    Log *log = take_log();
+
+    if (log->capacity < size) {
+        log->data = (uint8_t*)Alloc_realloc(ALLOC_LOGS, log->data, size);
+        log->capacity = size;
+    }
+
+    log->size = size;
+    log->topics_length = topics_length;
+
+    logs->elements[logs->length++] = log;
+    return log;
+}
+
+/* Drop logs from `length` onwards (logs of reverted frames) */
+void Logs_truncate(Logs *logs, size_t length) {
+    while (logs->length > length)
+        give_log(logs->elements[--logs->length]);
+}
+
+void Logs_free(Logs *logs) {
+    Logs_truncate(logs, 0);
+
+    if (logs->capacity > spare_elements_capacity) {
+        hold_spares();
+        Alloc_free(spare_elements);
+        spare_elements = logs->elements;
+        spare_elements_capacity = logs->capacity;
+    } else {
+        Alloc_free(logs->elements);
+    }
+
+    logs->elements = NULL;
+    logs->capacity = 0;
 }
\ No newline at end of file
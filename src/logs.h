@@ -3,12 +3,17 @@
 
 #include "common.h"
 
+#define LOG_TOPICS_MAX 4
+
 typedef struct {
     uint8_t *data;
     size_t size;
 
     size_t topics_length;
-    UInt256 *topics;
+    UInt256 topics[LOG_TOPICS_MAX];
+
+    /* Bytes `data` has room for, kept when the log is recycled */
+    size_t capacity;
 } Log;
 
 typedef struct {
@@ -18,6 +23,8 @@ typedef struct {
 } Logs;
 
 void Logs_init(Logs *logs);
-void Logs_push(Logs *logs, Log *log);
+Log *Logs_append(Logs *logs, size_t topics_length, size_t size);
+void Logs_truncate(Logs *logs, size_t length);
+void Logs_free(Logs *logs);
 
 #endif
\ No newline at end of file
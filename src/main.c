@@ -1,129 +1,466 @@
+/**
+ * Command line entry point
+ *
+ *   cevm run [options]    run bytecode as a contract and time it
+ *   cevm serve [options]  answer requests on a Unix socket, see server.h
+ *   cevm hotspots FILE    report on samples run or serve took, see hotspots.h
+ *
+ * Bytecode and calldata are hex, either given on the command line
+ * or read from a file (mapped, not copied), with or without 0x
+ * and surrounding whitespace, as solc --bin writes them
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
-#include <assert.h>
-#include <stdarg.h>
-#include <string.h>
-#include <ctype.h>
+#include <unistd.h>
 
-#include <keccak/keccak256.h>
 #include "vm.h"
+#include "hex.h"
+#include "server.h"
+#include "genesis.h"
+#include "snapshot.h"
+#include "profile.h"
+#include "sampler.h"
+#include "hotspots.h"
+#include "alloc.h"
+
+static const char *USAGE =
+    "Usage: cevm <command> [options]\n"
+    "\n"
+    "Commands:\n"
+    "  run       Run bytecode as the code of a contract\n"
+    "  serve     Answer requests on a Unix socket until interrupted\n"
+    "  hotspots  Report the hottest pcs, blocks and source lines of a samples file\n"
+    "\n"
+    "Options for run:\n"
+    "  --code HEX              Bytecode to run\n"
+    "  --code-file PATH        File holding the bytecode\n"
+    "  --calldata HEX          Calldata for the call\n"
+    "  --calldata-file PATH    File holding the calldata\n"
+    "  --iterations N          Times to run the call, against the same state (default 1)\n"
+    "  --profile table|json|folded\n"
+    "                          Print time per opcode and call frame afterwards, folded\n"
+    "                          stacks for flame graphs, needs a make PROFILE=1 build\n"
+    "  --samples PATH          Sample where time goes, cheaply, and save it to PATH\n"
+    "  --sample-hz N           Samples per second of CPU time (default 997)\n"
+    "  --allocs                Count heap allocations per subsystem and opcode after\n"
+    "                          the first iteration, and peak heap per iteration\n"
+    "  --strict-allocs         Fail if anything allocates after the first iteration\n"
+    "\n"
+    "Options for serve:\n"
+    "  --socket PATH           Socket to listen on (default cevm.sock)\n"
+    "  --genesis PATH          Load accounts from a genesis file first\n"
+    "  --snapshot PATH         Load a VM snapshot first\n"
+    "  --budget N              Instructions a call may run (default 100000000)\n"
+    "  --workers N             Run calls in N forked processes, a call that crashes\n"
+    "                          fails alone (default 0, calls run in the server)\n"
+    "  --samples PATH          Sample where time goes and save it to PATH on exit\n"
+    "  --sample-hz N           Samples per second of CPU time (default 997)\n"
+    "\n"
+    "Options for hotspots FILE:\n"
+    "  --top N                 Rows per report (default 20)\n"
+    "  --sources A.sol,B.sol   Sources in the order of solc's source list\n"
+    "  --source-map TARGET=PATH\n"
+    "                          solc srcmap-runtime string for the code at an address,\n"
+    "                          or with a code hash, repeatable\n";
+
+/* Server the signal handler stops */
+static Server *serving = NULL;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-const char *program = "608060405234801561001057600080fd5b5061017c806100206000396000f3fe608060405234801561001057600080fd5b506004361061002b5760003560e01c8063c605f76c14610030575b600080fd5b61003861004e565b6040516100459190610124565b60405180910390f35b60606040518060400160405280600d81526020017f48656c6c6f2c20576f726c642100000000000000000000000000000000000000815250905090565b600081519050919050565b600082825260208201905092915050565b60005b838110156100c55780820151818401526020810190506100aa565b838111156100d4576000848401525b50505050565b6000601f19601f8301169050919050565b60006100f68261008b565b6101008185610096565b93506101108185602086016100a7565b610119816100da565b840191505092915050565b6000602082019050818103600083015261013e81846100eb565b90509291505056fea2646970667358221220ce6cc94ce286d0931a98df4f00040eb03e2ea63ebae695416170c2acd6584c2064736f6c63430008090033";
+/* Decode hex with optional 0x and surrounding whitespace */
+static uint8_t *decode(const char *hex, size_t size, size_t *length, const char *what) {
+    while (size > 0 && (hex[0] == ' ' || hex[0] == '\t' || hex[0] == '\n' || hex[0] == '\r')) hex++, size--;
+    while (size > 0 && (hex[size - 1] == ' ' || hex[size - 1] == '\t' || hex[size - 1] == '\n' || hex[size - 1] == '\r')) size--;
 
-uint8_t hex_to_dec(char ch) {
-    return isdigit(ch) 
-        ? (uint8_t)ch - (uint8_t)'0'
-        : (uint8_t)ch - (uint8_t)'a' + 10;
-}
+    if (size >= 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) hex += 2, size -= 2;
 
-uint8_t *hex_to_opcodes(const char *hex, size_t *length) {
-    size_t code_length = strlen(hex) / 2; // Every 2 hex chars is one byte
+    uint8_t *bytes = (uint8_t*)malloc(size / 2 + 1);
 
-    uint8_t *code = malloc(code_length);
+    if (!Hex_decode_into(hex, size, bytes)) error("%s is not valid hex\n", what);
 
-    size_t char_i;
-    char c1, c2;
+    *length = size / 2;
+    return bytes;
+}
 
-    for (size_t i = 0; i < code_length; i++) {
-        char_i = i * 2;
+static uint8_t *decode_file(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) error("Failed to open %s: %s\n", path, strerror(errno));
 
-        c1 = hex[char_i], c2 = hex[char_i + 1];
+    struct stat st;
+    if (fstat(fd, &st) < 0) error("Failed to stat %s: %s\n", path, strerror(errno));
 
-        code[i] = hex_to_dec(c1) * 16 + hex_to_dec(c2);
+    if (st.st_size == 0) {
+        close(fd);
+        *length = 0;
+        return (uint8_t*)malloc(1);
     }
 
-    *length = code_length;
+    const char *hex = (const char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (hex == MAP_FAILED) error("Failed to map %s: %s\n", path, strerror(errno));
+
+    uint8_t *bytes = decode(hex, (size_t)st.st_size, length, path);
+    munmap((void*)hex, (size_t)st.st_size);
+
+    return bytes;
+}
 
-    return code;
+static void print_hex(const char *label, const uint8_t *bytes, size_t size) {
+    char *hex = (char*)malloc(2 * size + 1);
+    Hex_encode(bytes, size, hex);
+    printf("%s0x%s\n", label, hex);
+    free(hex);
 }
 
-int main() {
-    srand(time(NULL));
+static int run(int argc, char **argv) {
+    uint8_t *code = NULL, *calldata = NULL;
+    size_t code_size = 0, calldata_size = 0;
+    size_t iterations = 1;
+    const char *profile = NULL, *samples = NULL;
+    unsigned sample_hz = SAMPLER_DEFAULT_HZ;
+    bool allocs = false, strict_allocs = false;
+
+    for (int i = 0; i < argc; i++) {
+        const char *option = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        /* Flags without a value */
+        if (strcmp(option, "--allocs") == 0) {
+            allocs = true;
+            continue;
+        }
+
+        if (strcmp(option, "--strict-allocs") == 0) {
+            strict_allocs = true;
+            continue;
+        }
+
+        if (value == NULL) error("Missing value for %s\n%s", option, USAGE);
+        i++;
+
+        if (strcmp(option, "--code") == 0) code = decode(value, strlen(value), &code_size, "--code");
+        else if (strcmp(option, "--code-file") == 0) code = decode_file(value, &code_size);
+        else if (strcmp(option, "--calldata") == 0) calldata = decode(value, strlen(value), &calldata_size, "--calldata");
+        else if (strcmp(option, "--calldata-file") == 0) calldata = decode_file(value, &calldata_size);
+        else if (strcmp(option, "--iterations") == 0) iterations = (size_t)strtoull(value, NULL, 10);
+        else if (strcmp(option, "--profile") == 0) profile = value;
+        else if (strcmp(option, "--samples") == 0) samples = value;
+        else if (strcmp(option, "--sample-hz") == 0) sample_hz = (unsigned)strtoul(value, NULL, 10);
+        else error("Unknown option %s\n%s", option, USAGE);
+    }
+
+    if (profile != NULL && strcmp(profile, "table") != 0 && strcmp(profile, "json") != 0 && strcmp(profile, "folded") != 0)
+        error("--profile takes table, json or folded\n");
+
+#ifdef PROFILE
+    Profile_enable_perf(profile != NULL);
+#else
+    if (profile != NULL) error("Built without profiling, rebuild with make clean && make PROFILE=1\n");
+#endif
+
+    if (code == NULL) error("No code given\n%s", USAGE);
+    if (iterations == 0) iterations = 1;
 
     VM vm;
     VM_init(&vm);
 
-    Logs logs;
-    Logs_init(&logs);
-
-    uint8_t code[] = { 
-        OP_PUSH1, 0x66,  // [ value ]
-        OP_PUSH1, 0x00,  // [ value, offset ]
-        OP_MSTORE8,      // []
-        OP_PUSH1, 0x01,  // [ size ]
-        OP_PUSH1, 0x00,  // [ size, offset ]
-        OP_LOG0,         // []
-        OP_STOP,
+    Address contract = { { 0xC0, 0xDE } };
+    Account *account = Accounts_insert(&vm.accounts, &contract);
+    account->code = CodeCache_insert(&vm.codes, code, code_size);
+
+    Transaction transaction = {
+        .sender = { { 0xCA, 0x11 } },
+        .to = contract,
+        .calldata = calldata,
+        .calldata_size = calldata_size,
     };
 
-    size_t hello_world_sol_length;
-    uint8_t *hello_world_sol = hex_to_opcodes(program, &hello_world_sol_length);
+    StateView view;
+    StateView_init(&view, false);
+
+    TransientStorage transient;
+    TransientStorage_init(&transient);
+
+    Receipt receipt;
+    uint64_t executed = 0;
 
-    for (size_t i = 0; i < hello_world_sol_length; i++) {
-        uint8_t opcode = hello_world_sol[i];
+    if (samples != NULL && !Sampler_start(sample_hz)) error("Couldn't start sampling: %s\n", strerror(errno));
+
+    if (allocs || strict_allocs) Alloc_start();
+
+    double start = now();
+
+    for (size_t i = 0; i < iterations; i++) {
+        Execution execution;
+
+        /* The first iteration warms up, count from the second on if there is one */
+        if ((allocs || strict_allocs) && i == 1) {
+            Alloc_start();
+            Alloc_seal(strict_allocs);
+        }
 
-        const char *name = OPCODE_TO_NAME[hello_world_sol[i]];
-        printf("%s\n", name);
+        if (allocs || strict_allocs) Alloc_call_begin();
 
-        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH32) {
-            printf("Is push opcode\n");
-            size_t values = opcode - OP_PUSH1 + 1;
+        StateView_reset(&view, false);
+        VM_begin(&vm, &transaction, &view, &transient, &execution);
+        Execution_run(&execution, UINT64_MAX);
 
-            printf("0x");
+        executed += execution.executed;
 
-            // Each value is 2 hex chars
-            for (size_t j = 0; j < values * 2; j++) {
-                char ch = program[i * 2 + j];
-                printf("%c", ch);
+        Execution_finish(&execution, &receipt);
+        TransientStorage_clear(&transient);
+
+        /* Undo everything the call changed, so each iteration starts from the same state */
+        StateView_revert(&view, 0, &vm.codes);
+
+        /* Keep the last receipt to print */
+        if (i + 1 < iterations) Receipt_free(&receipt);
+
+        if (allocs || strict_allocs) Alloc_call_end();
+    }
+
+    double elapsed = now() - start;
+
+    AllocStats alloc_stats;
+
+    if (allocs || strict_allocs) {
+        Alloc_stop();
+        Alloc_collect(&alloc_stats);
+    }
+
+    if (samples != NULL) {
+        Sampler_stop();
+        if (!Sampler_save(samples, &vm.codes)) error("Couldn't write %s: %s\n", samples, strerror(errno));
+    }
+
+    /* Folded stacks go straight into flame graph tools, alone */
+    bool folded = profile != NULL && strcmp(profile, "folded") == 0;
+
+    if (!folded) {
+        printf("status        %s\n", STATUS_TO_NAME[receipt.status]);
+        print_hex("return        ", receipt.return_data, receipt.return_data_size);
+        printf("logs          %zu\n", receipt.logs.length);
+
+        for (size_t i = 0; i < receipt.logs.length; i++) {
+            const Log *log = receipt.logs.elements[i];
+
+            printf("  log %zu\n", i);
+
+            for (size_t j = 0; j < log->topics_length; j++) {
+                uint8_t topic[32];
+                UInt256_store(&log->topics[j], topic);
+                print_hex("    topic     ", topic, sizeof(topic));
             }
 
-            printf("\n");
+            print_hex("    data      ", log->data, log->size);
+        }
 
-            i += values / 2 + 1;
+        printf("iterations    %zu\n", iterations);
+        printf("time          %.3f ms (%.3f us per iteration)\n", elapsed * 1e3, elapsed * 1e6 / iterations);
+        printf("instructions  %llu per iteration (%.1f M/s)\n", (unsigned long long)(executed / iterations), executed / elapsed / 1e6);
+    }
+
+#ifdef PROFILE
+    if (profile != NULL) {
+        Profile *total = (Profile*)malloc(sizeof(Profile));
+        Profile_collect(total);
+
+        if (folded) Profile_write_folded(stdout, total, true);
+        else if (strcmp(profile, "json") == 0) {
+            printf("\n");
+            Profile_write_json(stdout, total);
+        } else {
+            printf("\n");
+            Profile_print(stdout, total);
+            printf("\n");
+            Profile_print_calls(stdout, total);
         }
+
+        Profile_release(total);
+        free(total);
     }
+#endif
 
-    Context context = (Context){
-        .code = hello_world_sol,
-        .code_size = hello_world_sol_length,
+    int status = 0;
 
-        .address = 0,
+    if (allocs) {
+        printf("\n");
+        Alloc_print(stdout, &alloc_stats);
+    }
 
-        .sender = 0,
+    if (strict_allocs && alloc_stats.violations > 0) {
+        fflush(stdout);
+        fprintf(stderr, "%llu allocations after warm-up, the first by %s during %s\n",
+            (unsigned long long)alloc_stats.violations, ALLOC_SUBSYSTEM_TO_NAME[alloc_stats.violation_subsystem],
+            Alloc_opcode_name(alloc_stats.violation_opcode));
+        status = 1;
+    }
 
-        .stack_top = context.stack,
+    Receipt_free(&receipt);
+    StateView_free(&view);
+    TransientStorage_free(&transient);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+    free(code);
+    free(calldata);
 
-        .memory = (Memory*)malloc(sizeof(Memory)),
+    return status;
+}
 
-        .storage = (Storage*)malloc(sizeof(Storage)),
+static void stop(int signal) {
+    (void)signal;
+    if (serving != NULL) Server_stop(serving);
+}
 
-        .calldata = NULL,
-        .calldata_size = 0,
+static int serve(int argc, char **argv) {
+    const char *socket_path = "cevm.sock", *genesis_path = NULL, *snapshot_path = NULL, *samples = NULL;
+    uint64_t budget = 100000000;
+    size_t workers = 0;
+    unsigned sample_hz = SAMPLER_DEFAULT_HZ;
+
+    for (int i = 0; i < argc; i++) {
+        const char *option = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (value == NULL) error("Missing value for %s\n%s", option, USAGE);
+        i++;
+
+        if (strcmp(option, "--socket") == 0) socket_path = value;
+        else if (strcmp(option, "--genesis") == 0) genesis_path = value;
+        else if (strcmp(option, "--snapshot") == 0) snapshot_path = value;
+        else if (strcmp(option, "--budget") == 0) budget = strtoull(value, NULL, 10);
+        else if (strcmp(option, "--workers") == 0) workers = (size_t)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--samples") == 0) samples = value;
+        else if (strcmp(option, "--sample-hz") == 0) sample_hz = (unsigned)strtoul(value, NULL, 10);
+        else error("Unknown option %s\n%s", option, USAGE);
+    }
 
-        .return_data = NULL,
-        .return_data_size = 0,
-    };
+    VM vm;
+    VM_init(&vm);
+
+    Snapshot snapshot = { NULL, 0 };
+    Genesis genesis = { NULL, 0 };
 
-    Memory_init(context.memory);
-    Storage_init(context.storage);
+    if (snapshot_path != NULL && !Snapshot_load(&vm, snapshot_path, &snapshot))
+        error("Couldn't load snapshot %s\n", snapshot_path);
 
-    VM_call(&vm, &context, &logs);
+    if (genesis_path != NULL) {
+        GenesisStats stats;
 
-    printf("Logs length: %zu\n", logs.length);
+        if (!Genesis_load(&vm, genesis_path, (size_t)sysconf(_SC_NPROCESSORS_ONLN), &genesis, &stats))
+            error("Couldn't load genesis %s\n", genesis_path);
 
-    for (size_t i = 0; i < logs.length; i++) {
-        Log *log = logs.elements[i];
-        printf("LOG%d:\n", (int)log->topics_length);
+        fprintf(stderr, "loaded %zu accounts in %.1f ms\n", stats.accounts, stats.total * 1e3);
+    }
 
-        printf("  topics:\n");
+    Server server;
+    Server_init(&server, &vm, socket_path, budget);
 
-        for (size_t j = 0; j < log->topics_length; j++) {
-            printf("    "); UInt256_print(&log->topics[j]); printf("\n");
-        }
+    /* Workers aren't sampled, fork doesn't carry the profiling timer over */
+    if (workers > 0) Server_start_workers(&server, workers);
+
+    serving = &server;
+
+    struct sigaction action = { .sa_handler = stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (samples != NULL && !Sampler_start(sample_hz)) error("Couldn't start sampling: %s\n", strerror(errno));
+
+    fprintf(stderr, "listening on %s\n", socket_path);
+
+    Server_run(&server);
+
+    if (samples != NULL) {
+        Sampler_stop();
+        if (!Sampler_save(samples, &vm.codes)) error("Couldn't write %s: %s\n", samples, strerror(errno));
+        fprintf(stderr, "samples written to %s\n", samples);
+    }
+
+    const ServerStats *stats = &server.stats;
+
+    fprintf(stderr, "%zu requests, %zu faults, %zu batches, %zu connections, p50 %llu ns, p99 %llu ns\n",
+        stats->requests, stats->faults, stats->batches, stats->connections,
+        (unsigned long long)ServerStats_percentile(stats, 50), (unsigned long long)ServerStats_percentile(stats, 99));
 
-        printf("  data: (%d)\n", (int)log->size);
+    serving = NULL;
+    Server_free(&server);
 
-        for (size_t j = 0; j < log->size; j++) {
-            printf("    %d\n", (int)log->data[j]);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+
+    if (snapshot.base != NULL) Snapshot_close(&snapshot);
+    if (genesis.base != NULL) Genesis_close(&genesis);
+
+    return 0;
+}
+
+static int hotspots(int argc, char **argv) {
+    if (argc < 1) error("No samples file given\n%s", USAGE);
+
+    Hotspots hotspots;
+    size_t top = 20;
+
+    if (!Hotspots_load(&hotspots, argv[0])) error("Couldn't read samples from %s\n", argv[0]);
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (value == NULL) error("Missing value for %s\n%s", option, USAGE);
+        i++;
+
+        if (strcmp(option, "--top") == 0) {
+            top = (size_t)strtoull(value, NULL, 10);
+        } else if (strcmp(option, "--sources") == 0) {
+            char *list = strdup(value);
+
+            for (char *path = strtok(list, ","); path != NULL; path = strtok(NULL, ","))
+                if (!Hotspots_add_source(&hotspots, path)) error("Couldn't read %s: %s\n", path, strerror(errno));
+
+            free(list);
+        } else if (strcmp(option, "--source-map") == 0) {
+            char *target = strdup(value), *path = strchr(target, '=');
+            if (path == NULL) error("--source-map takes TARGET=PATH\n");
+
+            *path++ = '\0';
+            if (!Hotspots_add_source_map(&hotspots, target, path)) error("Couldn't load source map %s for %s\n", path, target);
+
+            free(target);
+        } else {
+            error("Unknown option %s\n%s", option, USAGE);
         }
     }
+
+    Hotspots_print(stdout, &hotspots, top);
+    Hotspots_free(&hotspots);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "run") == 0) return run(argc - 2, argv + 2);
+    if (strcmp(argv[1], "serve") == 0) return serve(argc - 2, argv + 2);
+    if (strcmp(argv[1], "hotspots") == 0) return hotspots(argc - 2, argv + 2);
+
+    if (strcmp(argv[1], "help") == 0 || strcmp(argv[1], "--help") == 0) {
+        fputs(USAGE, stdout);
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown command %s\n%s", argv[1], USAGE);
+    return 1;
 }
\ No newline at end of file
@@ -1,32 +1,120 @@
 #include "memory.h"
+#include "alloc.h"
 
 #define DEFAULT_CAPACITY 1024
 #define GROWTH_FACTOR 2
 
 void Memory_init(Memory *memory) {
     memory->capacity = DEFAULT_CAPACITY;
-    memory->array = (uint8_t*)calloc(sizeof(uint8_t), memory->capacity);
+    memory->array = (uint8_t*)Alloc_calloc(ALLOC_MEMORY, sizeof(uint8_t), memory->capacity);
     memory->length = 0;
 }
 
-static void resize(Memory *memory) {
-    uint64_t old_capacity = memory->capacity;
+/*
+ * Empty memory for reuse by another frame, keeping its capacity. Bytes
+ * past `length` are always zero, so only the used part is cleared
+ */
+void Memory_reset(Memory *memory) {
+    memset(memory->array, 0, memory->length < memory->capacity ? memory->length : memory->capacity);
+    memory->length = 0;
+}
+
+/* `required` is at most MEMORY_MAX, so doubling can't overflow */
+static bool resize(Memory *memory, uint64_t required) {
+    uint64_t old_capacity = memory->capacity, capacity = old_capacity;
+
+    while (capacity < required)
+        capacity = capacity * GROWTH_FACTOR;
 
-    memory->capacity = memory->capacity * GROWTH_FACTOR;
-    memory->array = realloc(memory->array, sizeof(uint8_t) * memory->capacity);
+    uint8_t *array = Alloc_realloc(ALLOC_MEMORY, memory->array, sizeof(uint8_t) * capacity);
+    if (array == NULL) return false;
+
+    memory->array = array;
+    memory->capacity = capacity;
 
     // Zero out new memory
-    for (int i = old_capacity; i < memory->capacity; i++)
-        memory->array[i] = 0;
+    memset(memory->array + old_capacity, 0, memory->capacity - old_capacity);
+    return true;
+}
+
+/*
+ * Make [offset, offset + size) addressable, growing the active
+ * length in 32-byte words like the EVM does, and return a pointer
+ * to `offset`. NULL if the range reaches past MEMORY_MAX or can't
+ * be allocated. Empty ranges touch nothing, whatever their offset
+ */
+uint8_t *Memory_expand(Memory *memory, uint64_t offset, uint64_t size) {
+    if (size == 0)
+        return memory->array;
+
+    if (size > MEMORY_MAX || offset > MEMORY_MAX - size)
+        return NULL;
+
+    uint64_t end = offset + size;
+
+    if (end > memory->capacity && !resize(memory, end))
+        return NULL;
+
+    if (end > memory->length)
+        memory->length = (end + 31) / 32 * 32;
+
+    return memory->array + offset;
 }
 
-void Memory_insert(Memory *memory, uint64_t offset, uint8_t *buffer, size_t length) {
-    // TODO: Maybe return if resized?
-    if (offset + length > memory->length)
-        resize(memory);
+bool Memory_insert(Memory *memory, uint64_t offset, uint8_t *buffer, size_t length) {
+    uint8_t *dest = Memory_expand(memory, offset, length);
+    if (dest == NULL) return false;
+
+    memcpy(dest, buffer, length);
+    return true;
+}
+
+/*
+ * Copy `size` bytes of `src` starting at `offset` into memory at
+ * `dest_offset`, zero filling whatever lies past the end of `src`
+ * (CALLDATACOPY, CODECOPY, EXTCODECOPY, RETURNDATACOPY). False if
+ * the destination can't be expanded
+ */
+bool Memory_write(Memory *memory, uint64_t dest_offset, const uint8_t *src, size_t src_size, uint64_t offset, uint64_t size) {
+    if (size == 0)
+        return true;
+
+    uint8_t *dest = Memory_expand(memory, dest_offset, size);
+    if (dest == NULL) return false;
+
+    uint64_t available = offset < src_size ? src_size - offset : 0;
+    if (available > size) available = size;
+
+    if (available > 0)
+        memcpy(dest, src + offset, available);
+
+    memset(dest + available, 0, size - available);
+    return true;
+}
+
+/* Copy `size` bytes at `offset` out of memory (RETURN, LOG, CREATE) */
+bool Memory_read(Memory *memory, uint64_t offset, uint64_t size, uint8_t *dest) {
+    if (size == 0)
+        return true;
+
+    const uint8_t *src = Memory_expand(memory, offset, size);
+    if (src == NULL) return false;
+
+    memcpy(dest, src, size);
+    return true;
+}
+
+/* Copy within memory, regions may overlap (MCOPY) */
+bool Memory_mcopy(Memory *memory, uint64_t dest_offset, uint64_t offset, uint64_t size) {
+    if (size == 0)
+        return true;
+
+    /* Expand once to cover both regions, the higher one bounds both */
+    if (Memory_expand(memory, dest_offset > offset ? dest_offset : offset, size) == NULL)
+        return false;
 
-    for (size_t i = 0; i < length; i++)
-        memory->array[offset + i] = buffer[i];
+    memmove(memory->array + dest_offset, memory->array + offset, size);
+    return true;
 }
 
 uint8_t *Memory_offset(Memory *memory, uint64_t offset) {
@@ -35,20 +123,20 @@ uint8_t *Memory_offset(Memory *memory, uint64_t offset) {
 
 void Memory_copy(const Memory *src, Memory *dest) {
     dest->capacity = src->capacity;
-    dest->array = (uint8_t*)calloc(sizeof(uint8_t), src->capacity);
+    dest->array = (uint8_t*)Alloc_calloc(ALLOC_MEMORY, sizeof(uint8_t), src->capacity);
     for (size_t i = 0; i < src->length; i++)
         dest->array[i] = src->array[i];
     dest->length = src->length;
 }
 
 void Memory_free(Memory *memory) {
-    free(memory->array);
-    free(memory);
+    Alloc_free(memory->array);
+    Alloc_free(memory);
 }
 
 void Memory_move(Memory *from, Memory *to) {
     // Data of destination is no longer needed
-    free(to->array);
+    Alloc_free(to->array);
 
     to->array = from->array;
     to->capacity = from->capacity;
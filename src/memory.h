@@ -3,6 +3,12 @@
 
 #include "common.h"
 
+/*
+ * Bytes a frame's memory may span. Without gas nothing else bounds
+ * it, so touching memory past this fails the frame instead
+ */
+#define MEMORY_MAX ((uint64_t)32 << 20)
+
 typedef struct {
     uint8_t *array;
     uint64_t capacity;
@@ -10,7 +16,12 @@ typedef struct {
 } Memory;
 
 void Memory_init(Memory *memory);
-void Memory_insert(Memory *memory, uint64_t offset, uint8_t *buffer, size_t length);
+void Memory_reset(Memory *memory);
+uint8_t *Memory_expand(Memory *memory, uint64_t offset, uint64_t size);
+bool Memory_insert(Memory *memory, uint64_t offset, uint8_t *buffer, size_t length);
+bool Memory_write(Memory *memory, uint64_t dest_offset, const uint8_t *src, size_t src_size, uint64_t offset, uint64_t size);
+bool Memory_read(Memory *memory, uint64_t offset, uint64_t size, uint8_t *dest);
+bool Memory_mcopy(Memory *memory, uint64_t dest_offset, uint64_t offset, uint64_t size);
 uint8_t *Memory_offset(Memory *memory, uint64_t offset);
 void Memory_copy(const Memory *src, Memory *dest);
 void Memory_free(Memory *memory);
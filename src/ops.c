@@ -65,6 +65,9 @@ const char *OPCODE_TO_NAME[] = {
     [0x59] = "MSIZE",
     [0x5A] = "GAS",
     [0x5B] = "JUMPDEST",
+    [0x5C] = "TLOAD",
+    [0x5D] = "TSTORE",
+    [0x5E] = "MCOPY",
     [0x60] = "PUSH1",
     [0x61] = "PUSH2",
     [0x62] = "PUSH3",
@@ -144,4 +147,154 @@ const char *OPCODE_TO_NAME[] = {
     [0xFD] = "REVERT",
     [0xFE] = "INVALID",
     [0xFF] =  "SELFDESTRUCT",
+};
+
+/* Stack items each opcode pops and pushes */
+const StackEffect OPCODE_STACK_EFFECT[] = {
+    [0x00] = { 0, 0 }, /* STOP */
+    [0x01] = { 2, 1 }, /* ADD */
+    [0x02] = { 2, 1 }, /* MUL */
+    [0x03] = { 2, 1 }, /* SUB */
+    [0x04] = { 2, 1 }, /* DIV */
+    [0x05] = { 2, 1 }, /* SDIV */
+    [0x06] = { 2, 1 }, /* MOD */
+    [0x07] = { 2, 1 }, /* SMOD */
+    [0x08] = { 3, 1 }, /* ADDMOD */
+    [0x09] = { 3, 1 }, /* MULMOD */
+    [0x0A] = { 2, 1 }, /* EXP */
+    [0x0B] = { 2, 1 }, /* SIGNEXTEND */
+    [0x10] = { 2, 1 }, /* LT */
+    [0x11] = { 2, 1 }, /* GT */
+    [0x12] = { 2, 1 }, /* SLT */
+    [0x13] = { 2, 1 }, /* SGT */
+    [0x14] = { 2, 1 }, /* EQ */
+    [0x15] = { 1, 1 }, /* ISZERO */
+    [0x16] = { 2, 1 }, /* AND */
+    [0x17] = { 2, 1 }, /* OR */
+    [0x18] = { 2, 1 }, /* XOR */
+    [0x19] = { 1, 1 }, /* NOT */
+    [0x1A] = { 2, 1 }, /* BYTE */
+    [0x1B] = { 2, 1 }, /* SHL */
+    [0x1C] = { 2, 1 }, /* SHR */
+    [0x1D] = { 2, 1 }, /* SAR */
+    [0x20] = { 2, 1 }, /* SHA3 */
+    [0x30] = { 0, 1 }, /* ADDRESS */
+    [0x31] = { 1, 1 }, /* BALANCE */
+    [0x32] = { 0, 1 }, /* ORIGIN */
+    [0x33] = { 0, 1 }, /* CALLER */
+    [0x34] = { 0, 1 }, /* CALLVALUE */
+    [0x35] = { 1, 1 }, /* CALLDATALOAD */
+    [0x36] = { 0, 1 }, /* CALLDATASIZE */
+    [0x37] = { 3, 0 }, /* CALLDATACOPY */
+    [0x38] = { 0, 1 }, /* CODESIZE */
+    [0x39] = { 3, 0 }, /* CODECOPY */
+    [0x3A] = { 0, 1 }, /* GASPRICE */
+    [0x3B] = { 1, 1 }, /* EXTCODESIZE */
+    [0x3C] = { 4, 0 }, /* EXTCODECOPY */
+    [0x3D] = { 0, 1 }, /* RETURNDATASIZE */
+    [0x3E] = { 3, 0 }, /* RETURNDATACOPY */
+    [0x3F] = { 1, 1 }, /* EXTCODEHASH */
+    [0x40] = { 1, 1 }, /* BLOCKHASH */
+    [0x41] = { 0, 1 }, /* COINBASE */
+    [0x42] = { 0, 1 }, /* TIMESTAMP */
+    [0x43] = { 0, 1 }, /* NUMBER */
+    [0x44] = { 0, 1 }, /* DIFFICULTY */
+    [0x45] = { 0, 1 }, /* GASLIMIT */
+    [0x46] = { 0, 1 }, /* CHAINID */
+    [0x47] = { 0, 1 }, /* SELFBALANCE */
+    [0x48] = { 0, 1 }, /* BASEFEE */
+    [0x50] = { 1, 0 }, /* POP */
+    [0x51] = { 1, 1 }, /* MLOAD */
+    [0x52] = { 2, 0 }, /* MSTORE */
+    [0x53] = { 2, 0 }, /* MSTORE8 */
+    [0x54] = { 1, 1 }, /* SLOAD */
+    [0x55] = { 2, 0 }, /* SSTORE */
+    [0x56] = { 1, 0 }, /* JUMP */
+    [0x57] = { 2, 0 }, /* JUMPI */
+    [0x58] = { 0, 1 }, /* PC */
+    [0x59] = { 0, 1 }, /* MSIZE */
+    [0x5A] = { 0, 1 }, /* GAS */
+    [0x5B] = { 0, 0 }, /* JUMPDEST */
+    [0x5C] = { 1, 1 }, /* TLOAD */
+    [0x5D] = { 2, 0 }, /* TSTORE */
+    [0x5E] = { 3, 0 }, /* MCOPY */
+    [0x60] = { 0, 1 }, /* PUSH1 */
+    [0x61] = { 0, 1 }, /* PUSH2 */
+    [0x62] = { 0, 1 }, /* PUSH3 */
+    [0x63] = { 0, 1 }, /* PUSH4 */
+    [0x64] = { 0, 1 }, /* PUSH5 */
+    [0x65] = { 0, 1 }, /* PUSH6 */
+    [0x66] = { 0, 1 }, /* PUSH7 */
+    [0x67] = { 0, 1 }, /* PUSH8 */
+    [0x68] = { 0, 1 }, /* PUSH9 */
+    [0x69] = { 0, 1 }, /* PUSH10 */
+    [0x6A] = { 0, 1 }, /* PUSH11 */
+    [0x6B] = { 0, 1 }, /* PUSH12 */
+    [0x6C] = { 0, 1 }, /* PUSH13 */
+    [0x6D] = { 0, 1 }, /* PUSH14 */
+    [0x6E] = { 0, 1 }, /* PUSH15 */
+    [0x6F] = { 0, 1 }, /* PUSH16 */
+    [0x70] = { 0, 1 }, /* PUSH17 */
+    [0x71] = { 0, 1 }, /* PUSH18 */
+    [0x72] = { 0, 1 }, /* PUSH19 */
+    [0x73] = { 0, 1 }, /* PUSH20 */
+    [0x74] = { 0, 1 }, /* PUSH21 */
+    [0x75] = { 0, 1 }, /* PUSH22 */
+    [0x76] = { 0, 1 }, /* PUSH23 */
+    [0x77] = { 0, 1 }, /* PUSH24 */
+    [0x78] = { 0, 1 }, /* PUSH25 */
+    [0x79] = { 0, 1 }, /* PUSH26 */
+    [0x7A] = { 0, 1 }, /* PUSH27 */
+    [0x7B] = { 0, 1 }, /* PUSH28 */
+    [0x7C] = { 0, 1 }, /* PUSH29 */
+    [0x7D] = { 0, 1 }, /* PUSH30 */
+    [0x7E] = { 0, 1 }, /* PUSH31 */
+    [0x7F] = { 0, 1 }, /* PUSH32 */
+    [0x80] = { 1, 2 }, /* DUP1 */
+    [0x81] = { 2, 3 }, /* DUP2 */
+    [0x82] = { 3, 4 }, /* DUP3 */
+    [0x83] = { 4, 5 }, /* DUP4 */
+    [0x84] = { 5, 6 }, /* DUP5 */
+    [0x85] = { 6, 7 }, /* DUP6 */
+    [0x86] = { 7, 8 }, /* DUP7 */
+    [0x87] = { 8, 9 }, /* DUP8 */
+    [0x88] = { 9, 10 }, /* DUP9 */
+    [0x89] = { 10, 11 }, /* DUP10 */
+    [0x8A] = { 11, 12 }, /* DUP11 */
+    [0x8B] = { 12, 13 }, /* DUP12 */
+    [0x8C] = { 13, 14 }, /* DUP13 */
+    [0x8D] = { 14, 15 }, /* DUP14 */
+    [0x8E] = { 15, 16 }, /* DUP15 */
+    [0x8F] = { 16, 17 }, /* DUP16 */
+    [0x90] = { 2, 2 }, /* SWAP1 */
+    [0x91] = { 3, 3 }, /* SWAP2 */
+    [0x92] = { 4, 4 }, /* SWAP3 */
+    [0x93] = { 5, 5 }, /* SWAP4 */
+    [0x94] = { 6, 6 }, /* SWAP5 */
+    [0x95] = { 7, 7 }, /* SWAP6 */
+    [0x96] = { 8, 8 }, /* SWAP7 */
+    [0x97] = { 9, 9 }, /* SWAP8 */
+    [0x98] = { 10, 10 }, /* SWAP9 */
+    [0x99] = { 11, 11 }, /* SWAP10 */
+    [0x9A] = { 12, 12 }, /* SWAP11 */
+    [0x9B] = { 13, 13 }, /* SWAP12 */
+    [0x9C] = { 14, 14 }, /* SWAP13 */
+    [0x9D] = { 15, 15 }, /* SWAP14 */
+    [0x9E] = { 16, 16 }, /* SWAP15 */
+    [0x9F] = { 17, 17 }, /* SWAP16 */
+    [0xA0] = { 2, 0 }, /* LOG0 */
+    [0xA1] = { 3, 0 }, /* LOG1 */
+    [0xA2] = { 4, 0 }, /* LOG2 */
+    [0xA3] = { 5, 0 }, /* LOG3 */
+    [0xA4] = { 6, 0 }, /* LOG4 */
+    [0xF0] = { 3, 1 }, /* CREATE */
+    [0xF1] = { 7, 1 }, /* CALL */
+    [0xF2] = { 7, 1 }, /* CALLCODE */
+    [0xF3] = { 2, 0 }, /* RETURN */
+    [0xF4] = { 6, 1 }, /* DELEGATECALL */
+    [0xF5] = { 4, 1 }, /* CREATE2 */
+    [0xFA] = { 6, 1 }, /* STATICCALL */
+    [0xFD] = { 2, 0 }, /* REVERT */
+    [0xFE] = { 0, 0 }, /* INVALID */
+    [0xFF] = { 1, 0 }, /* SELFDESTRUCT */
 };
\ No newline at end of file
@@ -1,8 +1,17 @@
 #ifndef OPS_H
 #define OPS_H
 
+#include <stdint.h>
+
 extern const char *OPCODE_TO_NAME[];
 
+typedef struct {
+    uint8_t inputs;
+    uint8_t outputs;
+} StackEffect;
+
+extern const StackEffect OPCODE_STACK_EFFECT[];
+
 typedef enum {
     OP_STOP = 0x00,
     OP_ADD = 0x01,
@@ -68,6 +77,9 @@ typedef enum {
     OP_MSIZE = 0x59,
     OP_GAS = 0x5A,
     OP_JUMPDEST = 0x5B,
+    OP_TLOAD = 0x5C,
+    OP_TSTORE = 0x5D,
+    OP_MCOPY = 0x5E,
     OP_PUSH1 = 0x60,
     OP_PUSH2 = 0x61,
     OP_PUSH3 = 0x62,
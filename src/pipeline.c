@@ -0,0 +1,327 @@
+/**
+ * Block execution as a pipeline of four stages, one thread each:
+ *
+ *   decode  -> hex calldata and code into bytes
+ *   analyze -> hash and analyze new code outside the code cache
+ *   execute -> install code, run the transaction against state
+ *   retire  -> fold its writes into the block's changes, free it
+ *
+ * Stages pass transaction indices through bounded queues, so while
+ * transaction N executes, N+1 is being decoded and analyzed and N-1
+ * retired. Only the execute stage touches the VM, writing through a
+ * direct view, so transactions see each other's writes in block
+ * order without waiting for the one before to be retired
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "hex.h"
+
+const char *STAGE_TO_NAME[] = {
+    [STAGE_DECODE] = "decode",
+    [STAGE_ANALYZE] = "analyze",
+    [STAGE_EXECUTE] = "execute",
+    [STAGE_RETIRE] = "retire",
+};
+
+/* Everything a transaction picks up on its way through the stages */
+typedef struct {
+    uint8_t *calldata;
+    size_t calldata_size;
+
+    uint8_t *code_bytes;
+    size_t code_size;
+
+    Code *code;
+
+    StateView view;
+} Job;
+
+typedef struct {
+    size_t *items;
+    size_t capacity;
+    size_t head;
+    size_t length;
+    bool closed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    size_t depth_max;
+    uint64_t depth_total;
+    uint64_t takes;
+} Queue;
+
+typedef struct {
+    VM *vm;
+    const RawTransaction *transactions;
+    size_t length;
+
+    Job *jobs;
+    Receipt *receipts;
+    LocationMap *changes;
+
+    /* queues[i] feeds stage i + 1 */
+    Queue queues[PIPELINE_STAGES - 1];
+
+    TransientStorage transient;
+
+    PipelineStats *stats;
+} Pipeline;
+
+typedef struct {
+    Pipeline *pipeline;
+    Stage stage;
+} StageWorker;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void queue_init(Queue *queue, size_t capacity) {
+    queue->items = (size_t*)malloc(sizeof(size_t) * capacity);
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->length = 0;
+    queue->closed = false;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    queue->depth_max = 0;
+    queue->depth_total = 0;
+    queue->takes = 0;
+}
+
+static void queue_push(Queue *queue, size_t item, double *blocked) {
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->length == queue->capacity) {
+        double start = now();
+
+        while (queue->length == queue->capacity)
+            pthread_cond_wait(&queue->not_full, &queue->lock);
+
+        *blocked += now() - start;
+    }
+
+    queue->items[(queue->head + queue->length++) % queue->capacity] = item;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Take the oldest item, false once the queue is closed and drained */
+static bool queue_take(Queue *queue, size_t *item, double *starved) {
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->length == 0 && !queue->closed) {
+        double start = now();
+
+        while (queue->length == 0 && !queue->closed)
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+
+        *starved += now() - start;
+    }
+
+    if (queue->length == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+
+    if (queue->length > queue->depth_max) queue->depth_max = queue->length;
+    queue->depth_total += queue->length;
+    queue->takes++;
+
+    *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->length--;
+
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    return true;
+}
+
+/* No more items will be pushed */
+static void queue_close(Queue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void queue_free(Queue *queue) {
+    free(queue->items);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+static void decode(Pipeline *pipeline, size_t i) {
+    const RawTransaction *transaction = &pipeline->transactions[i];
+    Job *job = &pipeline->jobs[i];
+
+    job->calldata = transaction->calldata == NULL ? NULL : Hex_decode(transaction->calldata, &job->calldata_size);
+    job->code_bytes = transaction->code == NULL ? NULL : Hex_decode(transaction->code, &job->code_size);
+}
+
+static void analyze(Pipeline *pipeline, size_t i) {
+    Job *job = &pipeline->jobs[i];
+
+    if (job->code_bytes == NULL)
+        return;
+
+    job->code = Code_create(job->code_bytes, job->code_size);
+
+    free(job->code_bytes);
+    job->code_bytes = NULL;
+}
+
+static void execute(Pipeline *pipeline, size_t i) {
+    VM *vm = pipeline->vm;
+    const RawTransaction *raw = &pipeline->transactions[i];
+    Job *job = &pipeline->jobs[i];
+
+    if (job->code != NULL) {
+        Account *account = Accounts_insert(&vm->accounts, &raw->to);
+        Code *code = CodeCache_adopt(&vm->codes, job->code);
+
+        if (account->code != NULL) CodeCache_release(&vm->codes, account->code);
+        account->code = code;
+    }
+
+    Transaction transaction = {
+        .sender = raw->sender,
+        .to = raw->to,
+        .value = raw->value,
+        .calldata = job->calldata,
+        .calldata_size = job->calldata == NULL ? 0 : job->calldata_size,
+    };
+
+    StateView_init(&job->view, false);
+
+    VM_execute(vm, &transaction, &job->view, &pipeline->transient, &pipeline->receipts[i]);
+    TransientStorage_clear(&pipeline->transient);
+}
+
+/* State is already written, only the bookkeeping is left */
+static void retire(Pipeline *pipeline, size_t i) {
+    Job *job = &pipeline->jobs[i];
+
+    if (pipeline->changes != NULL)
+        LocationMap_merge(pipeline->changes, &job->view.writes);
+
+    StateView_free(&job->view);
+    free(job->calldata);
+}
+
+static void (*const STAGES[])(Pipeline*, size_t) = {
+    [STAGE_DECODE] = decode,
+    [STAGE_ANALYZE] = analyze,
+    [STAGE_EXECUTE] = execute,
+    [STAGE_RETIRE] = retire,
+};
+
+static void *run_stage(void *arg) {
+    StageWorker *worker = (StageWorker*)arg;
+    Pipeline *pipeline = worker->pipeline;
+    Stage stage = worker->stage;
+
+    StageStats *stats = &pipeline->stats->stages[stage];
+    Queue *input = stage == STAGE_DECODE ? NULL : &pipeline->queues[stage - 1];
+    Queue *output = stage == STAGE_RETIRE ? NULL : &pipeline->queues[stage];
+
+    size_t next = 0;
+
+    for (;;) {
+        size_t i;
+
+        /* First stage reads straight from the block */
+        if (input == NULL) {
+            if (next == pipeline->length) break;
+            i = next++;
+        } else if (!queue_take(input, &i, &stats->starved)) {
+            break;
+        }
+
+        double start = now();
+        STAGES[stage](pipeline, i);
+        stats->busy += now() - start;
+        stats->items++;
+
+        if (output != NULL) queue_push(output, i, &stats->blocked);
+    }
+
+    if (output != NULL) queue_close(output);
+
+    return NULL;
+}
+
+/*
+ * Decode, analyze, execute and retire a block, filling one receipt per
+ * transaction and adding every location written to `changes` (if not
+ * NULL). A `queue_capacity` of 0 runs each transaction through all
+ * stages on the calling thread instead, as a baseline
+ */
+void Pipeline_run_block(VM *vm, const RawTransaction *transactions, size_t length, size_t queue_capacity, Receipt *receipts, LocationMap *changes, PipelineStats *stats) {
+    Pipeline pipeline = {
+        .vm = vm,
+        .transactions = transactions,
+        .length = length,
+        .jobs = (Job*)calloc(length, sizeof(Job)),
+        .receipts = receipts,
+        .changes = changes,
+        .stats = stats,
+    };
+
+    memset(stats, 0, sizeof(PipelineStats));
+    TransientStorage_init(&pipeline.transient);
+
+    double start = now();
+
+    if (queue_capacity == 0) {
+        for (size_t i = 0; i < length; i++) {
+            for (Stage stage = 0; stage < PIPELINE_STAGES; stage++) {
+                double begin = now();
+                STAGES[stage](&pipeline, i);
+                stats->stages[stage].busy += now() - begin;
+                stats->stages[stage].items++;
+            }
+        }
+    } else {
+        pthread_t threads[PIPELINE_STAGES];
+        StageWorker workers[PIPELINE_STAGES];
+
+        for (size_t i = 0; i < PIPELINE_STAGES - 1; i++)
+            queue_init(&pipeline.queues[i], queue_capacity);
+
+        for (Stage stage = 0; stage < PIPELINE_STAGES; stage++) {
+            workers[stage] = (StageWorker){ .pipeline = &pipeline, .stage = stage };
+            pthread_create(&threads[stage], NULL, run_stage, &workers[stage]);
+        }
+
+        for (Stage stage = 0; stage < PIPELINE_STAGES; stage++)
+            pthread_join(threads[stage], NULL);
+
+        for (Stage stage = STAGE_ANALYZE; stage < PIPELINE_STAGES; stage++) {
+            Queue *queue = &pipeline.queues[stage - 1];
+
+            stats->stages[stage].depth_max = queue->depth_max;
+            stats->stages[stage].depth_mean = queue->takes == 0 ? 0 : (double)queue->depth_total / queue->takes;
+
+            queue_free(queue);
+        }
+    }
+
+    stats->elapsed = now() - start;
+
+    TransientStorage_free(&pipeline.transient);
+    free(pipeline.jobs);
+}
\ No newline at end of file
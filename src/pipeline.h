@@ -0,0 +1,50 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "common.h"
+#include "vm.h"
+
+/* Transaction as it arrives, before decoding */
+typedef struct {
+    Address sender;
+    Address to;
+    UInt256 value;
+
+    /* Hex, NULL for none */
+    const char *calldata;
+
+    /* Hex code installed at `to` before the call, NULL keeps the account's code */
+    const char *code;
+} RawTransaction;
+
+typedef enum {
+    STAGE_DECODE,
+    STAGE_ANALYZE,
+    STAGE_EXECUTE,
+    STAGE_RETIRE,
+    PIPELINE_STAGES,
+} Stage;
+
+extern const char *STAGE_TO_NAME[];
+
+typedef struct {
+    size_t items;
+
+    /* Seconds spent working, waiting for input and waiting for room downstream */
+    double busy;
+    double starved;
+    double blocked;
+
+    /* Length of the stage's input queue, sampled at every take */
+    size_t depth_max;
+    double depth_mean;
+} StageStats;
+
+typedef struct {
+    StageStats stages[PIPELINE_STAGES];
+    double elapsed;
+} PipelineStats;
+
+void Pipeline_run_block(VM *vm, const RawTransaction *transactions, size_t length, size_t queue_capacity, Receipt *receipts, LocationMap *changes, PipelineStats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+/**
+ * Static prediction of storage keys. Each basic block is run over
+ * an abstract stack of SlotKeys, tracking constants, calldata words
+ * and the two scratch memory words Solidity hashes for mapping
+ * lookups (key at 0x00, slot at 0x20). Every SLOAD whose key comes
+ * out known is recorded, to be turned into concrete keys once the
+ * calldata of a call is known and fetched before the call needs them
+ */
+
+#include "prefetch.h"
+#include "alloc.h"
+
+#define ABSTRACT_STACK_MAX 64
+
+static const SlotKey UNKNOWN = { .kind = SLOT_KEY_UNKNOWN };
+
+static bool is_constant(const SlotKey *symbol, uint64_t value) {
+    return symbol->kind == SLOT_KEY_CONSTANT &&
+        !(symbol->value.elements[0] | symbol->value.elements[1] | symbol->value.elements[2]) &&
+        symbol->value.elements[3] == value;
+}
+
+static bool equals(const SlotKey *a, const SlotKey *b) {
+    if (a->kind != b->kind) return false;
+
+    switch (a->kind) {
+        case SLOT_KEY_CONSTANT:
+            return UInt256_equals(&a->value, &b->value);
+        case SLOT_KEY_CALLDATA:
+            return a->offset == b->offset;
+        case SLOT_KEY_MAPPING:
+            return UInt256_equals(&a->value, &b->value) && a->constant_key == b->constant_key &&
+                (a->constant_key ? UInt256_equals(&a->key, &b->key) : a->offset == b->offset);
+        default:
+            return true;
+    }
+}
+
+static void record(Code *code, const SlotKey *key, size_t *capacity) {
+    for (size_t i = 0; i < code->slot_keys_length; i++)
+        if (equals(&code->slot_keys[i], key))
+            return;
+
+    if (code->slot_keys_length == *capacity) {
+        *capacity = *capacity == 0 ? 4 : *capacity * 2;
+        code->slot_keys = (SlotKey*)Alloc_realloc(ALLOC_CODE, code->slot_keys, sizeof(SlotKey) * *capacity);
+    }
+
+    code->slot_keys[code->slot_keys_length++] = *key;
+}
+
+static void analyze_block(Code *code, const Block *block, size_t *capacity) {
+    SlotKey stack[ABSTRACT_STACK_MAX];
+    size_t height = 0;
+
+    /* Scratch words at 0x00 and 0x20 */
+    SlotKey words[2] = { UNKNOWN, UNKNOWN };
+
+    /* Values from before the block are unknown */
+    #define POP() (height > 0 ? stack[--height] : UNKNOWN)
+    #define PUSH(symbol) do { if (height == ABSTRACT_STACK_MAX) return; stack[height++] = symbol; } while (0)
+
+    for (size_t i = 0; i < block->instructions_length; i++) {
+        const Instruction *instruction = &code->instructions[block->first_instruction + i];
+        uint8_t opcode = instruction->opcode;
+
+        if (OPCODE_TO_NAME[opcode] == NULL) return;
+
+        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH32) {
+            SlotKey symbol = { .kind = SLOT_KEY_CONSTANT };
+            UInt256_load_partial(&symbol.value, code->bytes, code->size, instruction->pc + 1, opcode - OP_PUSH1 + 1);
+            PUSH(symbol);
+            continue;
+        }
+
+        if (opcode >= OP_DUP1 && opcode <= OP_DUP16) {
+            size_t n = opcode - OP_DUP1 + 1;
+            SlotKey symbol = n <= height ? stack[height - n] : UNKNOWN;
+            PUSH(symbol);
+            continue;
+        }
+
+        if (opcode >= OP_SWAP1 && opcode <= OP_SWAP16) {
+            size_t n = opcode - OP_SWAP1 + 1;
+
+            if (n < height) {
+                SlotKey top = stack[height - 1];
+                stack[height - 1] = stack[height - 1 - n];
+                stack[height - 1 - n] = top;
+            } else if (height > 0) {
+                /* Swapped with something from before the block */
+                stack[height - 1] = UNKNOWN;
+            }
+
+            continue;
+        }
+
+        switch (opcode) {
+            case OP_CALLDATALOAD: {
+                SlotKey offset = POP();
+
+                if (offset.kind == SLOT_KEY_CONSTANT && UInt256_lt(&offset.value, &(UInt256){ { 0, 0, 0, UINT32_MAX } }))
+                    PUSH(((SlotKey){ .kind = SLOT_KEY_CALLDATA, .offset = (uint32_t)offset.value.elements[3] }));
+                else
+                    PUSH(UNKNOWN);
+
+                break;
+            }
+
+            case OP_ADD: {
+                SlotKey a = POP(), b = POP();
+
+                if (a.kind == SLOT_KEY_CONSTANT && b.kind == SLOT_KEY_CONSTANT) {
+                    UInt256_add(&a.value, &b.value);
+                    PUSH(a);
+                } else {
+                    PUSH(UNKNOWN);
+                }
+
+                break;
+            }
+
+            case OP_MSTORE: {
+                SlotKey offset = POP(), value = POP();
+
+                if (is_constant(&offset, 0)) words[0] = value;
+                else if (is_constant(&offset, 32)) words[1] = value;
+                else if (offset.kind != SLOT_KEY_CONSTANT) words[0] = words[1] = UNKNOWN;
+
+                break;
+            }
+
+            case OP_SHA3: {
+                SlotKey offset = POP(), size = POP();
+                SlotKey *key = &words[0], *slot = &words[1];
+
+                if (is_constant(&offset, 0) && is_constant(&size, 64) && slot->kind == SLOT_KEY_CONSTANT &&
+                        (key->kind == SLOT_KEY_CONSTANT || key->kind == SLOT_KEY_CALLDATA)) {
+                    PUSH(((SlotKey){
+                        .kind = SLOT_KEY_MAPPING,
+                        .value = slot->value,
+                        .offset = key->offset,
+                        .constant_key = key->kind == SLOT_KEY_CONSTANT,
+                        .key = key->value,
+                    }));
+                } else {
+                    PUSH(UNKNOWN);
+                }
+
+                break;
+            }
+
+            case OP_SLOAD: {
+                SlotKey key = POP();
+
+                if (key.kind != SLOT_KEY_UNKNOWN)
+                    record(code, &key, capacity);
+
+                PUSH(UNKNOWN);
+                break;
+            }
+
+            case OP_MSTORE8:
+            case OP_CALLDATACOPY:
+            case OP_CODECOPY:
+            case OP_EXTCODECOPY:
+            case OP_RETURNDATACOPY:
+            case OP_MCOPY:
+            case OP_CALL:
+            case OP_CALLCODE:
+            case OP_DELEGATECALL:
+            case OP_STATICCALL:
+            case OP_CREATE:
+            case OP_CREATE2: {
+                /* Could write anywhere in memory */
+                words[0] = words[1] = UNKNOWN;
+            }
+            /* Fall through */
+
+            default: {
+                const StackEffect *effect = &OPCODE_STACK_EFFECT[opcode];
+
+                for (size_t j = 0; j < effect->inputs; j++) POP();
+                for (size_t j = 0; j < effect->outputs; j++) PUSH(UNKNOWN);
+            }
+        }
+    }
+
+    #undef POP
+    #undef PUSH
+}
+
+/* Find the SLOAD keys of `code` that calldata determines, fills slot_keys */
+void Prefetch_analyze(Code *code) {
+    size_t capacity = 0;
+
+    code->slot_keys = NULL;
+    code->slot_keys_length = 0;
+
+    for (size_t i = 0; i < code->blocks_length; i++)
+        analyze_block(code, &code->blocks[i], &capacity);
+}
+
+/*
+ * Concrete keys `code` is predicted to load when called with
+ * `calldata`, up to `capacity` of them. Returns how many were written
+ */
+size_t Prefetch_keys(const Code *code, const uint8_t *calldata, size_t calldata_size, UInt256 *keys, size_t capacity) {
+    size_t length = 0;
+
+    for (size_t i = 0; i < code->slot_keys_length && length < capacity; i++) {
+        const SlotKey *symbol = &code->slot_keys[i];
+        UInt256 *key = &keys[length++];
+
+        switch (symbol->kind) {
+            case SLOT_KEY_CONSTANT: {
+                *key = symbol->value;
+                break;
+            }
+
+            case SLOT_KEY_CALLDATA: {
+                UInt256_load_padded(key, calldata, calldata_size, symbol->offset);
+                break;
+            }
+
+            case SLOT_KEY_MAPPING: {
+                UInt256 mapping_key = symbol->key;
+
+                if (!symbol->constant_key)
+                    UInt256_load_padded(&mapping_key, calldata, calldata_size, symbol->offset);
+
+                uint8_t buffer[64];
+                UInt256_store(&mapping_key, buffer);
+                UInt256_store(&symbol->value, buffer + 32);
+
+                UInt256_keccak(key, buffer, sizeof(buffer));
+                break;
+            }
+
+            default: {
+                length--;
+            }
+        }
+    }
+
+    return length;
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "common.h"
+#include "code.h"
+
+void Prefetch_analyze(Code *code);
+size_t Prefetch_keys(const Code *code, const uint8_t *calldata, size_t calldata_size, UInt256 *keys, size_t capacity);
+
+#endif
\ No newline at end of file
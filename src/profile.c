@@ -0,0 +1,525 @@
+/**
+ * Opcode profiler, see profile.h. Each thread records into its own
+ * Profile, registered on a list so they can be summed. Hardware
+ * counters come from a perf_event group per thread (instructions,
+ * cache misses, branch misses), read once before and once after
+ * every Execution_run.
+ *
+ * Call graph nodes are created in the tree of the thread that
+ * entered the frame; an execution resumed on another thread keeps
+ * counting into them, so such counts are approximate
+ */
+
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include "vm.h"
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *PROFILE_COUNTER_TO_NAME[] = {
+    [PROFILE_INSTRUCTIONS] = "instructions",
+    [PROFILE_CACHE_MISSES] = "cache_misses",
+    [PROFILE_BRANCH_MISSES] = "branch_misses",
+};
+
+static const uint64_t COUNTER_CONFIG[] = {
+    [PROFILE_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [PROFILE_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    [PROFILE_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+__thread Profile *Profile_current = NULL;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Profile *profiles = NULL;
+static bool perf_enabled = false;
+
+/* Smallest gap between two back to back reads of the cycle counter */
+static uint64_t measure_overhead(void) {
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = Profile_cycles();
+        uint64_t gap = Profile_cycles() - start;
+        if (gap < best) best = gap;
+    }
+
+    return best;
+}
+
+/* Create and register the calling thread's profile. Never freed, threads may be gone before it's read */
+Profile *Profile_local(void) {
+    if (Profile_current != NULL) return Profile_current;
+
+    Profile *profile = (Profile*)calloc(1, sizeof(Profile));
+
+    profile->overhead = measure_overhead();
+    for (int i = 0; i < PROFILE_COUNTERS; i++) profile->perf_fds[i] = -1;
+
+    pthread_mutex_lock(&lock);
+    profile->next = profiles;
+    profiles = profile;
+    pthread_mutex_unlock(&lock);
+
+    return Profile_current = profile;
+}
+
+static bool is_create(OpCode kind) {
+    return kind == OP_CREATE || kind == OP_CREATE2;
+}
+
+/* Child of `parent` for the frame, created on first use */
+static CallNode *child(CallNode *parent, const Address *address, uint32_t selector, bool has_selector, OpCode kind) {
+    for (CallNode *node = parent->children; node != NULL; node = node->next) {
+        if (node->has_selector == has_selector && node->selector == selector &&
+            is_create(node->kind) == is_create(kind) && Address_equals(&node->address, address)) return node;
+    }
+
+    CallNode *node = (CallNode*)calloc(1, sizeof(CallNode));
+
+    node->address = *address;
+    node->selector = selector;
+    node->has_selector = has_selector;
+    node->kind = kind;
+    node->pc_min = SIZE_MAX;
+
+    node->next = parent->children;
+    parent->children = node;
+
+    return node;
+}
+
+/* Node for a frame running `address`'s code, under `parent` or the thread's root when NULL */
+CallNode *Profile_enter(CallNode *parent, const Address *address, const uint8_t *calldata, size_t calldata_size, OpCode kind) {
+    uint32_t selector = 0;
+    bool has_selector = calldata_size >= 4;
+
+    if (has_selector) selector = (uint32_t)calldata[0] << 24 | (uint32_t)calldata[1] << 16 | (uint32_t)calldata[2] << 8 | calldata[3];
+    if (parent == NULL) parent = &Profile_local()->calls;
+
+    CallNode *node = child(parent, address, selector, has_selector, kind);
+    node->calls++;
+
+    return node;
+}
+
+/* Read hardware counters around runs from now on, where perf_event_open is allowed */
+void Profile_enable_perf(bool enabled) {
+    perf_enabled = enabled;
+}
+
+static bool open_perf(Profile *profile) {
+    profile->perf_tried = true;
+
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = COUNTER_CONFIG[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : profile->perf_fds[0], 0);
+
+        if (fd < 0) {
+            for (int j = 0; j < i; j++) close(profile->perf_fds[j]);
+            for (int j = 0; j < i; j++) profile->perf_fds[j] = -1;
+            return false;
+        }
+
+        profile->perf_fds[i] = fd;
+    }
+
+    return true;
+}
+
+static bool read_perf(const Profile *profile, uint64_t *counters) {
+    uint64_t values[1 + PROFILE_COUNTERS];
+
+    if (read(profile->perf_fds[0], values, sizeof(values)) != (ssize_t)sizeof(values)) return false;
+
+    memcpy(counters, values + 1, sizeof(uint64_t) * PROFILE_COUNTERS);
+    return true;
+}
+
+/* Snapshot the counters into `counters` (PROFILE_COUNTERS of them) before a run */
+void Profile_run_begin(uint64_t *counters) {
+    Profile *profile = Profile_local();
+
+    memset(counters, 0, sizeof(uint64_t) * PROFILE_COUNTERS);
+
+    if (!perf_enabled) return;
+    if (!profile->perf_tried) open_perf(profile);
+    if (profile->perf_fds[0] >= 0) read_perf(profile, counters);
+}
+
+/* Add what the counters moved since Profile_run_begin */
+void Profile_run_end(const uint64_t *counters) {
+    Profile *profile = Profile_local();
+    uint64_t now[PROFILE_COUNTERS];
+
+    profile->runs++;
+
+    if (!perf_enabled || profile->perf_fds[0] < 0 || !read_perf(profile, now)) return;
+
+    for (int i = 0; i < PROFILE_COUNTERS; i++) profile->counters[i] += now[i] - counters[i];
+    profile->perf = true;
+}
+
+/* Add `from`'s subtree into `into`'s */
+static void merge(CallNode *into, const CallNode *from) {
+    for (const CallNode *node = from->children; node != NULL; node = node->next) {
+        CallNode *target = child(into, &node->address, node->selector, node->has_selector, node->kind);
+
+        target->calls += node->calls;
+        target->instructions += node->instructions;
+        target->cycles += node->cycles;
+        if (node->pc_min < target->pc_min) target->pc_min = node->pc_min;
+        if (node->pc_max > target->pc_max) target->pc_max = node->pc_max;
+
+        merge(target, node);
+    }
+}
+
+static void free_children(CallNode *parent) {
+    CallNode *node = parent->children;
+
+    while (node != NULL) {
+        CallNode *next = node->next;
+        free_children(node);
+        free(node);
+        node = next;
+    }
+
+    parent->children = NULL;
+}
+
+static void clear(CallNode *parent) {
+    for (CallNode *node = parent->children; node != NULL; node = node->next) {
+        node->calls = node->instructions = node->cycles = 0;
+        node->pc_min = SIZE_MAX;
+        node->pc_max = 0;
+        clear(node);
+    }
+}
+
+/* Sum of every thread's profile. Threads still running may be mid-update. Profile_release frees it */
+void Profile_collect(Profile *total) {
+    memset(total, 0, sizeof(Profile));
+
+    pthread_mutex_lock(&lock);
+
+    for (const Profile *profile = profiles; profile != NULL; profile = profile->next) {
+        for (int op = 0; op < 256; op++) {
+            total->counts[op] += profile->counts[op];
+            total->cycles[op] += profile->cycles[op];
+
+            for (int b = 0; b < PROFILE_BUCKETS; b++) total->histogram[op][b] += profile->histogram[op][b];
+        }
+
+        for (int i = 0; i < PROFILE_COUNTERS; i++) total->counters[i] += profile->counters[i];
+
+        total->runs += profile->runs;
+        total->perf |= profile->perf;
+
+        merge(&total->calls, &profile->calls);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* Free the call graph of a Profile_collect result */
+void Profile_release(Profile *total) {
+    free_children(&total->calls);
+}
+
+void Profile_reset(void) {
+    pthread_mutex_lock(&lock);
+
+    for (Profile *profile = profiles; profile != NULL; profile = profile->next) {
+        memset(profile->counts, 0, sizeof(profile->counts));
+        memset(profile->cycles, 0, sizeof(profile->cycles));
+        memset(profile->histogram, 0, sizeof(profile->histogram));
+        memset(profile->counters, 0, sizeof(profile->counters));
+        profile->runs = 0;
+        profile->perf = false;
+
+        /* Frames in flight still point into the tree, so keep the nodes */
+        clear(&profile->calls);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* Upper bound in cycles of the bucket holding the `fraction` quantile */
+static uint64_t percentile(const uint64_t *histogram, uint64_t count, double fraction) {
+    uint64_t target = (uint64_t)(count * fraction), seen = 0;
+
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen > target) return b == 0 ? 0 : (uint64_t)1 << b;
+    }
+
+    return (uint64_t)1 << (PROFILE_BUCKETS - 1);
+}
+
+static int by_cycles(const void *a, const void *b, void *arg) {
+    const Profile *profile = (const Profile*)arg;
+    uint64_t x = profile->cycles[*(const int*)a], y = profile->cycles[*(const int*)b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Opcodes by total cycles, then the histogram over all instructions and any perf counters */
+void Profile_print(FILE *file, const Profile *profile) {
+    int order[256];
+    uint64_t instructions = 0, cycles = 0, histogram[PROFILE_BUCKETS] = { 0 };
+
+    for (int op = 0; op < 256; op++) {
+        order[op] = op;
+        instructions += profile->counts[op];
+        cycles += profile->cycles[op];
+
+        for (int b = 0; b < PROFILE_BUCKETS; b++) histogram[b] += profile->histogram[op][b];
+    }
+
+    qsort_r(order, 256, sizeof(int), by_cycles, (void*)profile);
+
+    fprintf(file, "%-14s %14s %16s %8s %10s %8s %8s\n", "opcode", "count", "cycles", "cycles%", "avg", "p50", "p99");
+
+    for (int i = 0; i < 256; i++) {
+        int op = order[i];
+        uint64_t count = profile->counts[op];
+
+        if (count == 0) continue;
+
+        fprintf(file, "%-14s %14llu %16llu %7.2f%% %10.1f %8llu %8llu\n",
+            OPCODE_TO_NAME[op] != NULL ? OPCODE_TO_NAME[op] : "?", (unsigned long long)count,
+            (unsigned long long)profile->cycles[op], cycles == 0 ? 0 : 100.0 * profile->cycles[op] / cycles,
+            (double)profile->cycles[op] / count, (unsigned long long)percentile(profile->histogram[op], count, 0.5),
+            (unsigned long long)percentile(profile->histogram[op], count, 0.99));
+    }
+
+    fprintf(file, "\n%llu instructions, %llu cycles, %.1f cycles per instruction, %llu runs\n",
+        (unsigned long long)instructions, (unsigned long long)cycles,
+        instructions == 0 ? 0 : (double)cycles / instructions, (unsigned long long)profile->runs);
+
+    fprintf(file, "\n%-22s %14s %8s\n", "cycles", "instructions", "share");
+
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        if (histogram[b] == 0) continue;
+
+        char range[32];
+        if (b == 0) snprintf(range, sizeof(range), "0");
+        else if (b == PROFILE_BUCKETS - 1) snprintf(range, sizeof(range), ">= %llu", 1ULL << (b - 1));
+        else snprintf(range, sizeof(range), "%llu - %llu", 1ULL << (b - 1), (1ULL << b) - 1);
+
+        fprintf(file, "%-22s %14llu %7.2f%%\n", range, (unsigned long long)histogram[b], 100.0 * histogram[b] / instructions);
+    }
+
+    if (!profile->perf) return;
+
+    fprintf(file, "\n");
+
+    for (int i = 0; i < PROFILE_COUNTERS; i++)
+        fprintf(file, "%-14s %16llu  %.2f per EVM instruction\n", PROFILE_COUNTER_TO_NAME[i],
+            (unsigned long long)profile->counters[i], instructions == 0 ? 0 : (double)profile->counters[i] / instructions);
+}
+
+/* Frame name as flame graph tools take it: no spaces or semicolons */
+static void label(const CallNode *node, char *buffer, size_t size) {
+    int n = snprintf(buffer, size, "0x");
+
+    for (int i = 0; i < 20; i++) n += snprintf(buffer + n, size - n, "%02x", node->address.bytes[i]);
+
+    if (is_create(node->kind)) n += snprintf(buffer + n, size - n, ":create");
+    else if (node->has_selector) n += snprintf(buffer + n, size - n, ":%08x", node->selector);
+    else n += snprintf(buffer + n, size - n, ":-");
+
+    if (node->instructions > 0) snprintf(buffer + n, size - n, "@%zx-%zx", node->pc_min, node->pc_max);
+}
+
+static void inclusive(const CallNode *node, uint64_t *instructions, uint64_t *cycles) {
+    *instructions += node->instructions;
+    *cycles += node->cycles;
+
+    for (const CallNode *c = node->children; c != NULL; c = c->next) inclusive(c, instructions, cycles);
+}
+
+typedef struct {
+    const CallNode *node;
+    uint64_t cycles;
+} Ranked;
+
+static int by_inclusive(const void *a, const void *b) {
+    uint64_t x = ((const Ranked*)a)->cycles, y = ((const Ranked*)b)->cycles;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Children of `parent` by inclusive cycles, caller frees */
+static Ranked *ranked(const CallNode *parent, size_t *length) {
+    size_t count = 0;
+    for (const CallNode *node = parent->children; node != NULL; node = node->next) count++;
+
+    Ranked *children = (Ranked*)malloc(sizeof(Ranked) * (count + 1));
+    count = 0;
+
+    for (const CallNode *node = parent->children; node != NULL; node = node->next) {
+        uint64_t instructions = 0;
+        children[count].node = node;
+        children[count].cycles = 0;
+        inclusive(node, &instructions, &children[count].cycles);
+        count++;
+    }
+
+    qsort(children, count, sizeof(Ranked), by_inclusive);
+
+    *length = count;
+    return children;
+}
+
+static void print_calls(FILE *file, const CallNode *parent, int depth, uint64_t total) {
+    size_t length;
+    Ranked *children = ranked(parent, &length);
+
+    for (size_t i = 0; i < length; i++) {
+        const CallNode *node = children[i].node;
+        uint64_t instructions = 0, cycles = 0;
+        char name[96];
+
+        inclusive(node, &instructions, &cycles);
+        label(node, name, sizeof(name));
+
+        fprintf(file, "%10llu %14llu %14llu %16llu %16llu %7.2f%%  %*s%s\n",
+            (unsigned long long)node->calls, (unsigned long long)instructions, (unsigned long long)node->instructions,
+            (unsigned long long)cycles, (unsigned long long)node->cycles, total == 0 ? 0 : 100.0 * cycles / total,
+            depth * 2, "", name);
+
+        print_calls(file, node, depth + 1, total);
+    }
+
+    free(children);
+}
+
+/* Call tree with inclusive and exclusive (self) instructions and cycles per frame */
+void Profile_print_calls(FILE *file, const Profile *profile) {
+    uint64_t instructions = 0, cycles = 0;
+    inclusive(&profile->calls, &instructions, &cycles);
+
+    fprintf(file, "%10s %14s %14s %16s %16s %8s  %s\n", "calls", "instructions", "self", "cycles", "self", "cycles%", "frame");
+    print_calls(file, &profile->calls, 0, cycles);
+}
+
+static void write_calls(FILE *file, const CallNode *parent, int depth) {
+    size_t length;
+    Ranked *children = ranked(parent, &length);
+
+    fprintf(file, "[");
+
+    for (size_t i = 0; i < length; i++) {
+        const CallNode *node = children[i].node;
+        uint64_t instructions = 0, cycles = 0;
+
+        inclusive(node, &instructions, &cycles);
+
+        fprintf(file, "%s\n%*s{ \"address\": \"0x", i == 0 ? "" : ",", depth * 2 + 4, "");
+        for (int b = 0; b < 20; b++) fprintf(file, "%02x", node->address.bytes[b]);
+
+        if (node->has_selector && !is_create(node->kind)) fprintf(file, "\", \"selector\": \"0x%08x\"", node->selector);
+        else fprintf(file, "\", \"selector\": null");
+
+        fprintf(file, ", \"kind\": \"%s\", \"calls\": %llu, \"instructions\": %llu, \"self_instructions\": %llu, "
+            "\"cycles\": %llu, \"self_cycles\": %llu, ",
+            node->kind == OP_STOP ? "transaction" : OPCODE_TO_NAME[node->kind], (unsigned long long)node->calls, (unsigned long long)instructions,
+            (unsigned long long)node->instructions, (unsigned long long)cycles, (unsigned long long)node->cycles);
+
+        if (node->instructions > 0) fprintf(file, "\"pc\": [%zu, %zu], \"children\": ", node->pc_min, node->pc_max);
+        else fprintf(file, "\"pc\": null, \"children\": ");
+
+        write_calls(file, node, depth + 1);
+        fprintf(file, " }");
+    }
+
+    if (length > 0) fprintf(file, "\n%*s", depth * 2 + 2, "");
+    fprintf(file, "]");
+
+    free(children);
+}
+
+static void write_folded(FILE *file, const CallNode *parent, char *stack, size_t used, size_t size, bool cycles) {
+    for (const CallNode *node = parent->children; node != NULL; node = node->next) {
+        size_t n = used;
+
+        if (n > 0 && n < size) stack[n++] = ';';
+        if (n < size) label(node, stack + n, size - n);
+        n += strlen(stack + n);
+
+        uint64_t value = cycles ? node->cycles : node->instructions;
+        if (value > 0) fprintf(file, "%s %llu\n", stack, (unsigned long long)value);
+
+        write_folded(file, node, stack, n, size, cycles);
+        stack[used] = '\0';
+    }
+}
+
+/*
+ * One line per call path, "frame;frame;frame count", the count being
+ * the path's exclusive cycles, or instructions when `cycles` is false.
+ * flamegraph.pl and speedscope read it as is
+ */
+void Profile_write_folded(FILE *file, const Profile *profile, bool cycles) {
+    /* Room for the deepest possible path */
+    size_t size = CALL_DEPTH_MAX * 96;
+    char *stack = (char*)malloc(size);
+
+    stack[0] = '\0';
+    write_folded(file, &profile->calls, stack, 0, size, cycles);
+
+    free(stack);
+}
+
+
+void Profile_write_json(FILE *file, const Profile *profile) {
+    fprintf(file, "{\n  \"runs\": %llu,\n  \"opcodes\": [\n", (unsigned long long)profile->runs);
+
+    bool first = true;
+
+    for (int op = 0; op < 256; op++) {
+        if (profile->counts[op] == 0) continue;
+
+        fprintf(file, "%s    { \"opcode\": \"%s\", \"count\": %llu, \"cycles\": %llu, \"histogram\": [",
+            first ? "" : ",\n", OPCODE_TO_NAME[op] != NULL ? OPCODE_TO_NAME[op] : "?",
+            (unsigned long long)profile->counts[op], (unsigned long long)profile->cycles[op]);
+
+        for (int b = 0; b < PROFILE_BUCKETS; b++)
+            fprintf(file, "%s%llu", b == 0 ? "" : ", ", (unsigned long long)profile->histogram[op][b]);
+
+        fprintf(file, "] }");
+        first = false;
+    }
+
+    fprintf(file, "\n  ],\n  \"calls\": ");
+    write_calls(file, &profile->calls, 0);
+    fprintf(file, ",\n  \"perf\": ");
+
+    if (!profile->perf) {
+        fprintf(file, "null\n}\n");
+        return;
+    }
+
+    fprintf(file, "{");
+
+    for (int i = 0; i < PROFILE_COUNTERS; i++)
+        fprintf(file, "%s\"%s\": %llu", i == 0 ? " " : ", ", PROFILE_COUNTER_TO_NAME[i], (unsigned long long)profile->counters[i]);
+
+    fprintf(file, " }\n}\n");
+}
+
+#endif
\ No newline at end of file
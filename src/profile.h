@@ -0,0 +1,162 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Where interpreter time goes: executions and cycles per opcode, a
+ * log2 histogram of each instruction's cost, a call graph of the
+ * contracts and functions that ran and, optionally, hardware
+ * counters around each run. Build with -DPROFILE (make PROFILE=1) to
+ * enable; otherwise the hooks in vm.c expand to nothing
+ */
+
+#include "common.h"
+#include "ops.h"
+#include "accounts.h"
+
+#ifdef PROFILE
+
+#include <time.h>
+
+/* Bucket b > 0 holds instructions that took [2^(b-1), 2^b) cycles, the last one everything above */
+#define PROFILE_BUCKETS 32
+
+typedef enum {
+    PROFILE_INSTRUCTIONS,
+    PROFILE_CACHE_MISSES,
+    PROFILE_BRANCH_MISSES,
+    PROFILE_COUNTERS,
+} ProfileCounter;
+
+extern const char *PROFILE_COUNTER_TO_NAME[];
+
+/*
+ * Calling context tree: a node per distinct path of frames, a frame
+ * being the code of `address` entered with `selector` (the first
+ * four bytes of calldata). Counts are exclusive, children add up to
+ * the inclusive ones
+ */
+typedef struct CallNode {
+    Address address;
+    uint32_t selector;
+    bool has_selector;
+    OpCode kind;
+
+    uint64_t calls;
+    uint64_t instructions;
+    uint64_t cycles;
+
+    /* Lowest and highest pc executed */
+    size_t pc_min;
+    size_t pc_max;
+
+    struct CallNode *children;
+    struct CallNode *next;
+} CallNode;
+
+typedef struct Profile {
+    uint64_t counts[256];
+    uint64_t cycles[256];
+    uint64_t histogram[256][PROFILE_BUCKETS];
+
+    /* Outermost frames are its children */
+    CallNode calls;
+
+    /* perf_event counts summed over `runs`, zero unless `perf` */
+    uint64_t counters[PROFILE_COUNTERS];
+    uint64_t runs;
+    bool perf;
+
+    /* Cost of reading the cycle counter, taken off every sample */
+    uint64_t overhead;
+
+    /* Thread's perf_event group, leader first, -1 if not open */
+    int perf_fds[PROFILE_COUNTERS];
+    bool perf_tried;
+
+    struct Profile *next;
+} Profile;
+
+/* This thread's profile, NULL until Profile_local first runs on it */
+extern __thread Profile *Profile_current;
+
+Profile *Profile_local(void);
+
+static inline uint64_t Profile_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Instruction at `pc` of `node`'s frame took `cycles` */
+static inline void Profile_record(OpCode opcode, CallNode *node, size_t pc, uint64_t cycles) {
+    Profile *profile = Profile_current != NULL ? Profile_current : Profile_local();
+    int bucket = 0;
+
+    cycles = cycles > profile->overhead ? cycles - profile->overhead : 0;
+
+    if (cycles > 0) bucket = 64 - __builtin_clzll(cycles);
+    if (bucket >= PROFILE_BUCKETS) bucket = PROFILE_BUCKETS - 1;
+
+    profile->counts[opcode]++;
+    profile->cycles[opcode] += cycles;
+    profile->histogram[opcode][bucket]++;
+
+    node->instructions++;
+    node->cycles += cycles;
+    if (pc < node->pc_min) node->pc_min = pc;
+    if (pc > node->pc_max) node->pc_max = pc;
+}
+
+CallNode *Profile_enter(CallNode *parent, const Address *address, const uint8_t *calldata, size_t calldata_size, OpCode kind);
+
+void Profile_enable_perf(bool enabled);
+void Profile_run_begin(uint64_t *counters);
+void Profile_run_end(const uint64_t *counters);
+void Profile_collect(Profile *total);
+void Profile_release(Profile *total);
+void Profile_reset(void);
+void Profile_print(FILE *file, const Profile *profile);
+void Profile_print_calls(FILE *file, const Profile *profile);
+void Profile_write_json(FILE *file, const Profile *profile);
+void Profile_write_folded(FILE *file, const Profile *profile, bool cycles);
+
+/*
+ * An instruction's cost is the time from its fetch to the next one,
+ * or to leaving the interpreter, and goes to the frame it ran in
+ */
+#define PROFILE_BEGIN() \
+    uint64_t profile_start = 0; \
+    OpCode profile_opcode = OP_STOP; \
+    CallNode *profile_node = NULL; \
+    size_t profile_pc = 0
+#define PROFILE_INSTRUCTION(opcode, node, pc) do { \
+        uint64_t profile_now = Profile_cycles(); \
+        if (profile_start != 0) Profile_record(profile_opcode, profile_node, profile_pc, profile_now - profile_start); \
+        profile_opcode = (opcode); \
+        profile_node = (node); \
+        profile_pc = (pc); \
+        profile_start = profile_now; \
+    } while (0)
+#define PROFILE_END() do { \
+        if (profile_start != 0) Profile_record(profile_opcode, profile_node, profile_pc, Profile_cycles() - profile_start); \
+    } while (0)
+
+/* `frame` is about to run `address`'s code, called from `caller` (NULL for the outermost frame) */
+#define PROFILE_FRAME(frame, caller, address) \
+    ((frame)->profile_node = Profile_enter((caller) == NULL ? NULL : (caller)->profile_node, (address), \
+        (frame)->calldata, (frame)->calldata_size, (frame)->kind))
+
+#else
+
+#define PROFILE_BEGIN()
+#define PROFILE_INSTRUCTION(opcode, node, pc)
+#define PROFILE_END()
+#define PROFILE_FRAME(frame, caller, address)
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+/**
+ * Work-stealing runner for independent calls (eth_call fan-out).
+ * State is only read: every call runs in a buffered view that is
+ * reset afterwards, so calls can't observe each other and the VM
+ * can be shared between threads without locking. A batch is split
+ * into one contiguous slice per worker. Owners take calls from the
+ * front of their slice and thieves take the back half, both with a
+ * compare-and-swap on the packed range
+ */
+
+#include "runner.h"
+
+#define RANGE(begin, end) (((uint64_t)(begin) << 32) | (uint64_t)(end))
+#define RANGE_BEGIN(range) ((size_t)((range) >> 32))
+#define RANGE_END(range) ((size_t)((range) & UINT32_MAX))
+
+/* Take the next call from the front of own slice, SIZE_MAX once empty */
+static size_t take(Worker *worker) {
+    uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        size_t begin = RANGE_BEGIN(range), end = RANGE_END(range);
+        if (begin >= end) return SIZE_MAX;
+
+        if (__atomic_compare_exchange_n(&worker->range, &range, RANGE(begin + 1, end), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return begin;
+    }
+}
+
+/* Move the back half of some other worker's slice into own, false if all are empty */
+static bool steal(Worker *thief) {
+    Runner *runner = thief->runner;
+
+    for (size_t i = 1; i < runner->threads; i++) {
+        Worker *victim = &runner->workers[(thief->index + i) % runner->threads];
+        uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            size_t begin = RANGE_BEGIN(range), end = RANGE_END(range);
+            if (begin >= end) break;
+
+            size_t half = (end - begin + 1) / 2;
+
+            if (__atomic_compare_exchange_n(&victim->range, &range, RANGE(begin, end - half), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&thief->range, RANGE(end - half, end), __ATOMIC_RELEASE);
+                __atomic_fetch_add(&runner->steals, half, __ATOMIC_RELAXED);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void run_slice(Worker *worker) {
+    Runner *runner = worker->runner;
+
+    do {
+        size_t i;
+
+        while ((i = take(worker)) != SIZE_MAX) {
+            StateView_reset(&worker->view, true);
+
+            VM_execute(runner->vm, &runner->calls[i], &worker->view, &worker->transient, &runner->results[i]);
+            TransientStorage_clear(&worker->transient);
+        }
+    } while (steal(worker));
+}
+
+static void *work(void *arg) {
+    Worker *worker = (Worker*)arg;
+    Runner *runner = worker->runner;
+
+    uint64_t batch = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&runner->lock);
+
+        while (runner->batch == batch && !runner->stopping)
+            pthread_cond_wait(&runner->started, &runner->lock);
+
+        if (runner->stopping) {
+            pthread_mutex_unlock(&runner->lock);
+            break;
+        }
+
+        batch = runner->batch;
+        pthread_mutex_unlock(&runner->lock);
+
+        run_slice(worker);
+
+        pthread_mutex_lock(&runner->lock);
+        if (--runner->running == 0) pthread_cond_signal(&runner->finished);
+        pthread_mutex_unlock(&runner->lock);
+    }
+
+    return NULL;
+}
+
+/* Start `threads` - 1 helper threads, the caller of Runner_run is the last worker */
+void Runner_init(Runner *runner, VM *vm, size_t threads) {
+    if (threads == 0) threads = 1;
+
+    runner->vm = vm;
+    runner->threads = threads;
+    runner->workers = (Worker*)calloc(threads, sizeof(Worker));
+
+    runner->calls = NULL;
+    runner->results = NULL;
+
+    pthread_mutex_init(&runner->lock, NULL);
+    pthread_cond_init(&runner->started, NULL);
+    pthread_cond_init(&runner->finished, NULL);
+
+    runner->batch = 0;
+    runner->running = 0;
+    runner->stopping = false;
+    runner->steals = 0;
+
+    for (size_t i = 0; i < threads; i++) {
+        Worker *worker = &runner->workers[i];
+
+        worker->range = RANGE(0, 0);
+        worker->index = i;
+        worker->runner = runner;
+
+        StateView_init(&worker->view, true);
+        TransientStorage_init(&worker->transient);
+
+        if (i > 0) pthread_create(&worker->thread, NULL, work, worker);
+    }
+}
+
+/*
+ * Run `length` calls, filling one receipt per call. Calls must not
+ * depend on each other, state changes they make are discarded and
+ * a CREATE comes back as STATUS_ABORTED. Receipts are owned by the caller
+ */
+void Runner_run(Runner *runner, const Transaction *calls, size_t length, Receipt *results) {
+    if (length >= UINT32_MAX) error("Runner batch of %zu calls is too large\n", length);
+
+    runner->calls = calls;
+    runner->results = results;
+
+    /* Even split, stealing evens out calls that take longer */
+    for (size_t i = 0; i < runner->threads; i++) {
+        size_t begin = length * i / runner->threads, end = length * (i + 1) / runner->threads;
+        __atomic_store_n(&runner->workers[i].range, RANGE(begin, end), __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&runner->lock);
+    runner->running = runner->threads - 1;
+    runner->batch++;
+    pthread_cond_broadcast(&runner->started);
+    pthread_mutex_unlock(&runner->lock);
+
+    run_slice(&runner->workers[0]);
+
+    pthread_mutex_lock(&runner->lock);
+    while (runner->running > 0)
+        pthread_cond_wait(&runner->finished, &runner->lock);
+    pthread_mutex_unlock(&runner->lock);
+}
+
+void Runner_free(Runner *runner) {
+    pthread_mutex_lock(&runner->lock);
+    runner->stopping = true;
+    pthread_cond_broadcast(&runner->started);
+    pthread_mutex_unlock(&runner->lock);
+
+    for (size_t i = 0; i < runner->threads; i++) {
+        Worker *worker = &runner->workers[i];
+
+        if (i > 0) pthread_join(worker->thread, NULL);
+
+        StateView_free(&worker->view);
+        TransientStorage_free(&worker->transient);
+    }
+
+    pthread_mutex_destroy(&runner->lock);
+    pthread_cond_destroy(&runner->started);
+    pthread_cond_destroy(&runner->finished);
+
+    free(runner->workers);
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <pthread.h>
+
+#include "common.h"
+#include "vm.h"
+
+struct Runner;
+
+typedef struct {
+    /* Calls left to run, packed as begin << 32 | end */
+    uint64_t range;
+
+    /* Reused for every call, writes are thrown away */
+    StateView view;
+    TransientStorage transient;
+
+    pthread_t thread;
+    size_t index;
+    struct Runner *runner;
+} Worker;
+
+/*
+ * Pool of threads running batches of independent read-only calls
+ * against shared state. Each worker owns a slice of the batch and
+ * steals half of another's remaining slice once its own runs dry
+ */
+typedef struct Runner {
+    VM *vm;
+
+    /* Worker 0 is the thread calling Runner_run */
+    Worker *workers;
+    size_t threads;
+
+    const Transaction *calls;
+    Receipt *results;
+
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+
+    /* Bumped for every batch so workers know there is new work */
+    uint64_t batch;
+    size_t running;
+    bool stopping;
+
+    /* Calls taken from another worker's slice, over the runner's lifetime */
+    size_t steals;
+} Runner;
+
+void Runner_init(Runner *runner, VM *vm, size_t threads);
+void Runner_run(Runner *runner, const Transaction *calls, size_t length, Receipt *results);
+void Runner_free(Runner *runner);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,291 @@
+/**
+ * Sampling profiler, see sampler.h. Sites are registered once per
+ * thread and never freed, the handler may still be looking at one
+ * as its thread exits. The signal handler touches only its own
+ * thread's site and ring: no locks, no allocation
+ */
+
+#include "sampler.h"
+#include "vm.h"
+#include "hex.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* How often the collector empties the rings */
+#define DRAIN_INTERVAL_NS 20000000
+
+typedef struct {
+    Sample sample;
+    uint64_t count;
+} Tally;
+
+__thread SamplerSite *Sampler_current = NULL;
+
+/* Site of threads attached while sampling was off, nothing reads it */
+static __thread SamplerSite idle;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static SamplerSite *sites = NULL;
+static volatile bool active = false;
+static unsigned rate = 0;
+
+/* Signals landing outside Execution_run */
+static uint64_t outside = 0;
+
+static pthread_t collector;
+static volatile bool collecting = false;
+
+/* Counts per distinct sample, open addressing, only the collector touches it while sampling */
+static Tally *entries = NULL;
+static size_t entries_capacity = 0;
+static size_t entries_length = 0;
+static uint64_t total = 0;
+
+SamplerSite *Sampler_attach(void) {
+    if (!active) return &idle;
+
+    SamplerSite *site = (SamplerSite*)calloc(1, sizeof(SamplerSite));
+    site->ring = (Sample*)malloc(sizeof(Sample) * SAMPLER_CAPACITY);
+
+    pthread_mutex_lock(&lock);
+    site->next = sites;
+    sites = site;
+    pthread_mutex_unlock(&lock);
+
+    return Sampler_current = site;
+}
+
+static void handle(int signal) {
+    (void)signal;
+
+    SamplerSite *site = Sampler_current;
+    Execution *execution = site != NULL ? site->execution : NULL;
+    const Context *frame = execution != NULL ? execution->frame : NULL;
+
+    if (frame == NULL) {
+        __atomic_fetch_add(&outside, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t head = site->head;
+
+    if (head - __atomic_load_n(&site->tail, __ATOMIC_ACQUIRE) >= SAMPLER_CAPACITY) {
+        site->dropped++;
+        return;
+    }
+
+    Sample *sample = &site->ring[head % SAMPLER_CAPACITY];
+
+    if (frame->code != NULL) sample->code_hash = frame->code->hash;
+    else memset(&sample->code_hash, 0, sizeof(UInt256));
+
+    sample->address = frame->address;
+    sample->pc = site->pc;
+
+    __atomic_store_n(&site->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t hash(const Sample *sample) {
+    uint64_t h = sample->code_hash.elements[3] ^ ((uint64_t)sample->pc * 0x9E3779B97F4A7C15ULL);
+
+    for (int i = 0; i < 20; i++) h = (h ^ sample->address.bytes[i]) * 0x100000001B3ULL;
+
+    return h;
+}
+
+static bool same(const Sample *a, const Sample *b) {
+    return a->pc == b->pc && UInt256_equals(&a->code_hash, &b->code_hash) && Address_equals(&a->address, &b->address);
+}
+
+static void insert(Tally *table, size_t capacity, const Sample *sample, uint64_t count) {
+    size_t i = hash(sample) & (capacity - 1);
+
+    while (table[i].count != 0 && !same(&table[i].sample, sample)) i = (i + 1) & (capacity - 1);
+
+    if (table[i].count == 0) {
+        table[i].sample = *sample;
+        entries_length++;
+    }
+
+    table[i].count += count;
+}
+
+static void count(const Sample *sample) {
+    if (2 * (entries_length + 1) > entries_capacity) {
+        size_t capacity = entries_capacity == 0 ? 1024 : 2 * entries_capacity;
+        Tally *table = (Tally*)calloc(capacity, sizeof(Tally));
+
+        entries_length = 0;
+
+        for (size_t i = 0; i < entries_capacity; i++)
+            if (entries[i].count != 0) insert(table, capacity, &entries[i].sample, entries[i].count);
+
+        free(entries);
+        entries = table;
+        entries_capacity = capacity;
+    }
+
+    insert(entries, entries_capacity, sample, 1);
+    total++;
+}
+
+/* Move whatever the handlers pushed into the counts */
+static void drain(void) {
+    pthread_mutex_lock(&lock);
+
+    for (SamplerSite *site = sites; site != NULL; site = site->next) {
+        uint64_t head = __atomic_load_n(&site->head, __ATOMIC_ACQUIRE), tail = site->tail;
+
+        for (; tail < head; tail++) count(&site->ring[tail % SAMPLER_CAPACITY]);
+
+        __atomic_store_n(&site->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static void *collect(void *arg) {
+    (void)arg;
+
+    struct timespec interval = { 0, DRAIN_INTERVAL_NS };
+
+    while (collecting) {
+        nanosleep(&interval, NULL);
+        drain();
+    }
+
+    return NULL;
+}
+
+/*
+ * Sample `hz` times per second of CPU time the process uses, until
+ * Sampler_stop. Starting again discards earlier samples. Only one
+ * SIGPROF user per process: not together with setitimer or gprof
+ */
+bool Sampler_start(unsigned hz) {
+    if (hz == 0) hz = SAMPLER_DEFAULT_HZ;
+
+    free(entries);
+    entries = NULL;
+    entries_capacity = entries_length = 0;
+    total = outside = 0;
+
+    pthread_mutex_lock(&lock);
+    for (SamplerSite *site = sites; site != NULL; site = site->next) site->tail = site->head, site->dropped = 0;
+    pthread_mutex_unlock(&lock);
+
+    struct sigaction action = { .sa_handler = handle, .sa_flags = SA_RESTART };
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, NULL) < 0) return false;
+
+    active = true;
+    rate = hz;
+
+    collecting = true;
+    if (pthread_create(&collector, NULL, collect, NULL) != 0) {
+        collecting = active = false;
+        return false;
+    }
+
+    long interval = 1000000 / hz > 0 ? 1000000 / hz : 1;
+    struct itimerval timer = { { interval / 1000000, interval % 1000000 }, { interval / 1000000, interval % 1000000 } };
+
+    if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+        Sampler_stop();
+        return false;
+    }
+
+    return true;
+}
+
+/* Stop the timer and collect what's left */
+void Sampler_stop(void) {
+    if (!active) return;
+
+    struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    /* A signal already on its way is dropped, not fatal */
+    signal(SIGPROF, SIG_IGN);
+
+    active = false;
+
+    collecting = false;
+    pthread_join(collector, NULL);
+    drain();
+}
+
+/*
+ * Write the counts, after Sampler_stop, as lines of text:
+ *
+ *   hz <rate>
+ *   samples <in executions> outside <elsewhere> dropped <ring full>
+ *   code <code hash> <bytecode>              for every sampled code in `codes`
+ *   sample <code hash> <address> <pc> <count>
+ *
+ * all hex but the numbers
+ */
+bool Sampler_save(const char *path, const CodeCache *codes) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock(&lock);
+    for (const SamplerSite *site = sites; site != NULL; site = site->next) dropped += site->dropped;
+    pthread_mutex_unlock(&lock);
+
+    fprintf(file, "# cevm samples\nhz %u\nsamples %llu outside %llu dropped %llu\n", rate,
+        (unsigned long long)total, (unsigned long long)outside, (unsigned long long)dropped);
+
+    char hash[65], address[41];
+    uint8_t bytes[32];
+
+    /* Each code once, there are far fewer of them than samples */
+    const Code **written = NULL;
+    size_t written_length = 0;
+
+    for (size_t i = 0; i < entries_capacity; i++) {
+        if (entries[i].count == 0) continue;
+
+        const UInt256 *code_hash = &entries[i].sample.code_hash;
+        const Code *code = CodeCache_get(codes, code_hash);
+        if (code == NULL) continue;
+
+        size_t j = 0;
+        while (j < written_length && written[j] != code) j++;
+        if (j < written_length) continue;
+
+        written = (const Code**)realloc(written, sizeof(Code*) * (written_length + 1));
+        written[written_length++] = code;
+
+        char *hex = (char*)malloc(2 * code->size + 1);
+
+        UInt256_store(code_hash, bytes);
+        Hex_encode(bytes, 32, hash);
+        Hex_encode(code->bytes, code->size, hex);
+
+        fprintf(file, "code %s %s\n", hash, hex);
+        free(hex);
+    }
+
+    free(written);
+
+    for (size_t i = 0; i < entries_capacity; i++) {
+        const Tally *entry = &entries[i];
+        if (entry->count == 0) continue;
+
+        UInt256_store(&entry->sample.code_hash, bytes);
+        Hex_encode(bytes, 32, hash);
+        Hex_encode(entry->sample.address.bytes, 20, address);
+
+        fprintf(file, "sample %s %s %u %llu\n", hash, address, entry->sample.pc, (unsigned long long)entry->count);
+    }
+
+    return fclose(file) == 0;
+}
\ No newline at end of file
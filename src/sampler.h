@@ -0,0 +1,60 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+/*
+ * Sampling profiler cheap enough to leave on: SIGPROF fires `hz`
+ * times per second of CPU time and the handler notes the code hash,
+ * address and pc of the frame the interrupted thread is running.
+ * The interpreter's only cost is storing pc before each instruction.
+ *
+ * Each thread has a single producer, single consumer ring the
+ * handler pushes to without locks, and a collector thread drains
+ * the rings into counts per (code, address, pc). Sampler_save writes
+ * those with the sampled bytecode for `cevm hotspots` to report on
+ * offline, see hotspots.h
+ */
+
+#include "common.h"
+#include "accounts.h"
+#include "code.h"
+
+/* Samples a thread can hold before the collector drains them, more are dropped */
+#define SAMPLER_CAPACITY 4096
+
+#define SAMPLER_DEFAULT_HZ 997
+
+typedef struct {
+    UInt256 code_hash;
+    Address address;
+    uint32_t pc;
+} Sample;
+
+typedef struct SamplerSite {
+    /* Execution the thread is in the middle of running, NULL outside Execution_run */
+    struct Execution *volatile execution;
+
+    /* Of the instruction about to run in the execution's innermost frame */
+    volatile uint32_t pc;
+
+    Sample *ring;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+
+    struct SamplerSite *next;
+} SamplerSite;
+
+extern __thread SamplerSite *Sampler_current;
+
+SamplerSite *Sampler_attach(void);
+
+/* The calling thread's site, one the handler never reads unless sampling has started */
+static inline SamplerSite *Sampler_site(void) {
+    return Sampler_current != NULL ? Sampler_current : Sampler_attach();
+}
+
+bool Sampler_start(unsigned hz);
+void Sampler_stop(void);
+bool Sampler_save(const char *path, const CodeCache *codes);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,273 @@
+/**
+ * Runs many independent read-only calls on one thread, switching
+ * between them. A call runs until its instruction slice is used up
+ * or it needs a slot from the backend, then the next ready call
+ * gets the thread. Calls waiting on a load are resumed once the
+ * backend completes it, so load latency is hidden behind other
+ * calls' compute as long as enough of them are in flight.
+ *
+ * With prefetching, the slots a call is predicted to load (see
+ * prefetch.c) are requested when it's admitted, so most of them
+ * are there by the time it gets to the SLOAD. A miss on a key that
+ * is already being fetched waits on that fetch instead of asking
+ * the backend again
+ */
+
+#include <time.h>
+
+#include "scheduler.h"
+#include "prefetch.h"
+
+#define PREFETCH_KEYS_MAX 16
+
+typedef struct {
+    /* First, loads point back to it through their context */
+    Execution execution;
+
+    StateView view;
+    TransientStorage transient;
+
+    size_t call;
+
+    /* Next slot waiting on the same prefetch, plus one */
+    size_t next_waiter;
+
+    double suspended;
+
+    /* Keys predicted for the call and the Storage they're in */
+    Storage *storage;
+    UInt256 predicted[PREFETCH_KEYS_MAX];
+    size_t predicted_length;
+} Slot;
+
+/*
+ * Stands between executions and the backend. Keys being prefetched
+ * map to the first slot waiting on them plus one in elements[3],
+ * elements[0] is set while the fetch is in flight
+ */
+typedef struct {
+    Backend backend;
+    Backend *target;
+
+    LocationMap inflight;
+
+    Slot *slots;
+    SchedulerStats *stats;
+} Demand;
+
+typedef struct {
+    size_t *items;
+    size_t capacity;
+    size_t head;
+    size_t length;
+} Ready;
+
+static void ready_push(Ready *ready, size_t slot) {
+    ready->items[(ready->head + ready->length++) % ready->capacity] = slot;
+}
+
+static size_t ready_pop(Ready *ready) {
+    size_t slot = ready->items[ready->head];
+    ready->head = (ready->head + 1) % ready->capacity;
+    ready->length--;
+    return slot;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Called by a suspending execution on the scheduler's thread */
+static void demand_load(Backend *backend, Load *load) {
+    Demand *demand = (Demand*)backend;
+
+    Location location = { .kind = LOCATION_SLOT, .space = load->storage, .key = load->key };
+    UInt256 *entry = LocationMap_get(&demand->inflight, &location);
+
+    if (entry != NULL && entry->elements[0] != 0) {
+        Slot *slot = (Slot*)load->context;
+
+        slot->next_waiter = entry->elements[3];
+        entry->elements[3] = (uint64_t)(slot - demand->slots) + 1;
+
+        demand->stats->joins++;
+        return;
+    }
+
+    demand->stats->loads++;
+    demand->target->load(demand->target, load);
+}
+
+/* Request the slots the call in `slot` will likely load, returns how many were sent */
+static size_t prefetch_slot(Demand *demand, Slot *slot) {
+    const Context *root = slot->execution.root;
+
+    slot->predicted_length = 0;
+
+    if (root == NULL || !root->storage->backed) return 0;
+
+    slot->storage = root->storage;
+    slot->predicted_length = Prefetch_keys(root->code, root->calldata, root->calldata_size, slot->predicted, PREFETCH_KEYS_MAX);
+
+    size_t sent = 0;
+
+    for (size_t i = 0; i < slot->predicted_length; i++) {
+        if (Storage_contains(root->storage, &slot->predicted[i])) continue;
+
+        Location location = { .kind = LOCATION_SLOT, .space = root->storage, .key = slot->predicted[i] };
+        UInt256 *entry = LocationMap_get(&demand->inflight, &location);
+
+        if (entry != NULL && entry->elements[0] != 0) continue;
+
+        LocationMap_set(&demand->inflight, &location, &(UInt256){ { 1, 0, 0, 0 } });
+
+        Load *load = (Load*)malloc(sizeof(Load));
+        *load = (Load){ .storage = root->storage, .key = slot->predicted[i], .context = NULL };
+
+        demand->target->load(demand->target, load);
+        sent++;
+    }
+
+    return sent;
+}
+
+/*
+ * Run `length` calls with up to `concurrency` of them in flight,
+ * `slice` instructions at a time, filling one receipt per call.
+ * Writes are discarded like with Runner, a CREATE comes back as
+ * STATUS_ABORTED. `prefetch` requests predicted slots on admission.
+ * Receipts are owned by the caller
+ */
+void Scheduler_run(VM *vm, Backend *backend, const Transaction *calls, size_t length, size_t concurrency, uint64_t slice, bool prefetch, Receipt *results, SchedulerStats *stats) {
+    if (concurrency == 0) concurrency = 1;
+    if (slice == 0) slice = UINT64_MAX;
+
+    Slot *slots = (Slot*)malloc(sizeof(Slot) * concurrency);
+
+    Ready ready = { (size_t*)malloc(sizeof(size_t) * concurrency), concurrency, 0, 0 };
+
+    /* Unused slots, as a stack */
+    size_t *free_slots = (size_t*)malloc(sizeof(size_t) * concurrency);
+    size_t free_length = concurrency;
+
+    for (size_t i = 0; i < concurrency; i++) {
+        StateView_init(&slots[i].view, true);
+        TransientStorage_init(&slots[i].transient);
+        free_slots[i] = concurrency - 1 - i;
+    }
+
+    memset(stats, 0, sizeof(SchedulerStats));
+
+    Demand demand = { .target = backend, .slots = slots, .stats = stats };
+    Backend_init(&demand.backend, demand_load);
+    LocationMap_init(&demand.inflight);
+
+    /* Prefetches not completed yet, they have to be collected before returning */
+    size_t prefetching = 0;
+
+    size_t next = 0, done = 0, waiting = 0;
+
+    while (done < length) {
+        /* Start new calls while there is room */
+        while (free_length > 0 && next < length) {
+            size_t i = free_slots[--free_length];
+            Slot *slot = &slots[i];
+
+            StateView_reset(&slot->view, true);
+            VM_begin(vm, &calls[next], &slot->view, &slot->transient, &slot->execution);
+
+            slot->execution.backend = backend == NULL ? NULL : &demand.backend;
+            slot->call = next++;
+            slot->predicted_length = 0;
+
+            if (prefetch && backend != NULL) {
+                size_t sent = prefetch_slot(&demand, slot);
+
+                stats->predicted += slot->predicted_length;
+                stats->prefetches += sent;
+                prefetching += sent;
+            }
+
+            ready_push(&ready, i);
+        }
+
+        /* Resume calls whose slot arrived, block only if nothing else can run */
+        Load *load;
+
+        while (backend != NULL && (load = Backend_next_completed(backend, ready.length == 0 && waiting > 0)) != NULL) {
+            Storage_insert(load->storage, &load->key, &load->value);
+
+            if (load->context != NULL) {
+                Slot *slot = (Slot*)load->context;
+
+                stats->stall += now() - slot->suspended;
+                ready_push(&ready, (size_t)(slot - slots));
+                waiting--;
+                continue;
+            }
+
+            /* A prefetch, wake everything that missed on it */
+            Location location = { .kind = LOCATION_SLOT, .space = load->storage, .key = load->key };
+            UInt256 *entry = LocationMap_get(&demand.inflight, &location);
+
+            for (size_t waiter = entry->elements[3]; waiter != 0; waiter = slots[waiter - 1].next_waiter) {
+                stats->stall += now() - slots[waiter - 1].suspended;
+                ready_push(&ready, waiter - 1);
+                waiting--;
+            }
+
+            *entry = ZERO;
+
+            free(load);
+            prefetching--;
+        }
+
+        if (ready.length == 0) continue;
+
+        size_t i = ready_pop(&ready);
+        Slot *slot = &slots[i];
+
+        stats->slices++;
+
+        if (Execution_run(&slot->execution, slice)) {
+            Execution_finish(&slot->execution, &results[slot->call]);
+            TransientStorage_clear(&slot->transient);
+
+            for (size_t j = 0; j < slot->predicted_length; j++) {
+                Location location = { .kind = LOCATION_SLOT, .space = slot->storage, .key = slot->predicted[j] };
+                if (LocationMap_get(&slot->view.reads, &location) != NULL) stats->prefetch_hits++;
+            }
+
+            free_slots[free_length++] = i;
+            done++;
+        } else if (slot->execution.waiting) {
+            slot->suspended = now();
+
+            if (++waiting > stats->waiting_max) stats->waiting_max = waiting;
+        } else {
+            ready_push(&ready, i);
+        }
+    }
+
+    while (prefetching > 0) {
+        Load *load = Backend_next_completed(backend, true);
+
+        Storage_insert(load->storage, &load->key, &load->value);
+        free(load);
+        prefetching--;
+    }
+
+    LocationMap_free(&demand.inflight);
+    Backend_free(&demand.backend);
+
+    for (size_t i = 0; i < concurrency; i++) {
+        StateView_free(&slots[i].view);
+        TransientStorage_free(&slots[i].transient);
+    }
+
+    free(slots);
+    free(ready.items);
+    free(free_slots);
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "vm.h"
+
+typedef struct {
+    /* Slots fetched from the backend */
+    size_t loads;
+
+    /* Times an execution was picked to run */
+    size_t slices;
+
+    /* Most executions waiting on loads at once */
+    size_t waiting_max;
+
+    /* Keys predicted from calldata, and how many of those the calls read */
+    size_t predicted;
+    size_t prefetch_hits;
+
+    /* Predicted keys fetched ahead, and misses that waited on one of those */
+    size_t prefetches;
+    size_t joins;
+
+    /* Seconds executions spent suspended on loads, summed */
+    double stall;
+} SchedulerStats;
+
+void Scheduler_run(VM *vm, Backend *backend, const Transaction *calls, size_t length, size_t concurrency, uint64_t slice, bool prefetch, Receipt *results, SchedulerStats *stats);
+
+#endif
\ No newline at end of file
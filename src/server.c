@@ -0,0 +1,626 @@
+/**
+ * `cevm serve`: requests over a Unix domain socket against a VM
+ * that stays warm between them. Clients may pipeline any number of
+ * requests, every read is answered with a single batch of replies.
+ * Anything wrong with a request comes back as a fault for that
+ * request, only a broken frame closes the connection
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+#define FRAME_MAX (16 << 20)
+#define BUFFER_CAPACITY 65536
+#define READ_SIZE 65536
+
+/* How often a blocked poll checks for Server_stop, in milliseconds */
+#define POLL_INTERVAL 100
+
+typedef struct {
+    const uint8_t *p;
+    size_t left;
+    bool ok;
+} Reader;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void put_u16(uint8_t *p, uint16_t value) {
+    for (int i = 0; i < 2; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+/* Next `size` bytes of the request, NULL once it runs short */
+static const uint8_t *take(Reader *reader, size_t size) {
+    if (!reader->ok || reader->left < size) {
+        reader->ok = false;
+        return NULL;
+    }
+
+    const uint8_t *start = reader->p;
+    reader->p += size;
+    reader->left -= size;
+    return start;
+}
+
+static uint64_t take_le(Reader *reader, int size) {
+    const uint8_t *p = take(reader, (size_t)size);
+    return p == NULL ? 0 : get_le(p, size);
+}
+
+static size_t bucket(uint64_t ns) {
+    if (ns < 8) return (size_t)ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    return (size_t)(msb - 2) * 8 + ((ns >> (msb - 3)) & 7);
+}
+
+/* Smallest latency that lands in bucket `index` */
+static uint64_t bucket_floor(size_t index) {
+    if (index < 8) return index;
+
+    int msb = (int)(index / 8) + 2;
+    return (uint64_t)(8 + index % 8) << (msb - 3);
+}
+
+/* Latency (upper end of its bucket) that `percentile` of requests stayed within */
+uint64_t ServerStats_percentile(const ServerStats *stats, double percentile) {
+    uint64_t total = 0, seen = 0;
+
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) total += stats->latency[i];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100 * total);
+    if (rank == 0) rank = 1;
+
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats->latency[i];
+        if (seen >= rank) return i + 1 < LATENCY_BUCKETS ? bucket_floor(i + 1) - 1 : UINT64_MAX;
+    }
+
+    return UINT64_MAX;
+}
+
+/* Room for `size` more bytes of output */
+static uint8_t *reserve(Connection *connection, size_t size) {
+    if (connection->output_length + size > connection->output_capacity) {
+        while (connection->output_length + size > connection->output_capacity)
+            connection->output_capacity *= 2;
+
+        connection->output = (uint8_t*)realloc(connection->output, connection->output_capacity);
+    }
+
+    uint8_t *start = connection->output + connection->output_length;
+    connection->output_length += size;
+    return start;
+}
+
+static void reply_fault(Server *server, Connection *connection, uint64_t id, const char *message) {
+    size_t length = strlen(message);
+    uint8_t *p = reserve(connection, 4 + 8 + 1 + 2 + length);
+
+    put_u32(p, (uint32_t)(8 + 1 + 2 + length));
+    put_u64(p + 4, id);
+    p[12] = SERVER_FAULT;
+    put_u16(p + 13, (uint16_t)length);
+    memcpy(p + 15, message, length);
+
+    server->stats.faults++;
+}
+
+/* Time the reply just added to the output, once it's written */
+static void track(Connection *connection, uint64_t parsed_at) {
+    if (connection->timings_length == connection->timings_capacity) {
+        connection->timings_capacity = connection->timings_capacity == 0 ? 16 : connection->timings_capacity * 2;
+        connection->timings = (ReplyTiming*)realloc(connection->timings, sizeof(ReplyTiming) * connection->timings_capacity);
+    }
+
+    connection->timings[connection->timings_length++] = (ReplyTiming){
+        .end = connection->written + connection->output_length,
+        .parsed_at = parsed_at,
+    };
+}
+
+static void reply_result(Connection *connection, uint64_t id, Status status, const uint8_t *data, size_t size, size_t logs) {
+    uint8_t *p = reserve(connection, 4 + 8 + 1 + 1 + 4 + size + 4);
+
+    put_u32(p, (uint32_t)(8 + 1 + 1 + 4 + size + 4));
+    put_u64(p + 4, id);
+    p[12] = SERVER_RESULT;
+    p[13] = (uint8_t)status;
+    put_u32(p + 14, (uint32_t)size);
+    if (size > 0) memcpy(p + 18, data, size);
+    put_u32(p + 18 + size, (uint32_t)logs);
+}
+
+static void call(Server *server, Connection *connection, uint64_t id, Reader *reader) {
+    VM *vm = server->vm;
+
+    uint8_t kind = (uint8_t)take_le(reader, 1);
+    const uint8_t *target = take(reader, kind == SERVER_TARGET_CODE_HASH ? 32 : 20);
+    const uint8_t *sender = take(reader, 20);
+    uint32_t calldata_size = (uint32_t)take_le(reader, 4);
+    const uint8_t *calldata = take(reader, calldata_size);
+    uint16_t overrides = (uint16_t)take_le(reader, 2);
+    const uint8_t *override_records = take(reader, (size_t)overrides * (20 + 32 + 32));
+
+    if (!reader->ok || reader->left != 0 || kind > SERVER_TARGET_CODE_HASH) {
+        reply_fault(server, connection, id, "malformed call");
+        return;
+    }
+
+    Transaction transaction = { .calldata = calldata, .calldata_size = calldata_size };
+    memcpy(transaction.sender.bytes, sender, 20);
+
+    Code *code = NULL;
+
+    if (kind == SERVER_TARGET_CODE_HASH) {
+        UInt256 hash;
+        UInt256_load_padded(&hash, target, 32, 0);
+
+        if ((code = CodeCache_get(&vm->codes, &hash)) == NULL) {
+            reply_fault(server, connection, id, "unknown code hash");
+            return;
+        }
+
+        transaction.to = server->scratch;
+    } else {
+        memcpy(transaction.to.bytes, target, 20);
+
+        const Account *account = Accounts_get(&vm->accounts, &transaction.to);
+
+        if (account == NULL || account->code == NULL) {
+            reply_fault(server, connection, id, "no code at address");
+            return;
+        }
+    }
+
+    StateView_reset(&server->view, true);
+
+    /* Overrides are buffered writes, thrown away with the view */
+    for (size_t i = 0; i < overrides; i++) {
+        const uint8_t *record = override_records + i * (20 + 32 + 32);
+
+        Address address;
+        UInt256 key, value;
+        memcpy(address.bytes, record, 20);
+        UInt256_load_padded(&key, record, 84, 20);
+        UInt256_load_padded(&value, record, 84, 52);
+
+        Account *account = Accounts_get(&vm->accounts, &address);
+        if (account != NULL) StateView_sstore(&server->view, account->storage, &key, &value);
+    }
+
+    /* Nothing inserts accounts while the call runs, buffered views abort on CREATE */
+    Account *scratch = code == NULL ? NULL : Accounts_get(&vm->accounts, &server->scratch);
+    if (scratch != NULL) scratch->code = code;
+
+    Execution execution;
+    Receipt receipt;
+
+    VM_begin(vm, &transaction, &server->view, &server->transient, &execution);
+
+    bool finished = Execution_run(&execution, server->budget);
+    if (!finished) Execution_abort(&execution);
+
+    Execution_finish(&execution, &receipt);
+    TransientStorage_clear(&server->transient);
+
+    if (scratch != NULL) scratch->code = NULL;
+
+    if (finished) reply_result(connection, id, receipt.status, receipt.return_data, receipt.return_data_size, receipt.logs.length);
+    else reply_fault(server, connection, id, "instruction budget exceeded");
+
+    Receipt_free(&receipt);
+}
+
+static void deploy(Server *server, Connection *connection, uint64_t id, Reader *reader) {
+    const uint8_t *address_bytes = take(reader, 20);
+    uint32_t size = (uint32_t)take_le(reader, 4);
+    const uint8_t *bytes = take(reader, size);
+
+    if (!reader->ok || reader->left != 0) {
+        reply_fault(server, connection, id, "malformed deploy");
+        return;
+    }
+
+    Address address;
+    memcpy(address.bytes, address_bytes, 20);
+
+    Account *account = Accounts_insert(&server->vm->accounts, &address);
+
+    if (account->code != NULL) CodeCache_release(&server->vm->codes, account->code);
+    account->code = size == 0 ? NULL : CodeCache_insert(&server->vm->codes, bytes, size);
+
+    /* Workers only see state from when they were forked */
+    if (server->pool != NULL) ForkPool_restart(server->pool);
+
+    reply_result(connection, id, STATUS_SUCCESS, NULL, 0, 0);
+}
+
+static void stats(Server *server, Connection *connection, uint64_t id, Reader *reader) {
+    if (reader->left != 0) {
+        reply_fault(server, connection, id, "malformed stats");
+        return;
+    }
+
+    const ServerStats *stats = &server->stats;
+    uint8_t data[5 * 8];
+
+    put_u64(data, stats->requests);
+    put_u64(data + 8, stats->faults);
+    put_u64(data + 16, stats->batches);
+    put_u64(data + 24, ServerStats_percentile(stats, 50));
+    put_u64(data + 32, ServerStats_percentile(stats, 99));
+
+    reply_result(connection, id, STATUS_SUCCESS, data, sizeof(data), 0);
+}
+
+/* Inside a worker: answer a call frame with the reply call() writes */
+static void work(void *context, const uint8_t *request, size_t size, ForkMessage *reply) {
+    Server *server = (Server*)context;
+
+    Reader reader = { request, size, true };
+    take_le(&reader, 1);
+    uint64_t id = take_le(&reader, 8);
+
+    Connection connection = {
+        .fd = -1,
+        .output = (uint8_t*)malloc(BUFFER_CAPACITY),
+        .output_capacity = BUFFER_CAPACITY,
+    };
+
+    call(server, &connection, id, &reader);
+
+    ForkMessage_put(reply, connection.output, connection.output_length);
+    free(connection.output);
+}
+
+/* Inside a new worker: close the sockets that belong to the parent */
+static void started(void *context) {
+    Server *server = (Server*)context;
+
+    close(server->listener);
+
+    for (size_t i = 0; i < server->connections_length; i++)
+        close(server->connections[i].fd);
+}
+
+/* Hold a call frame until the pending calls go to the workers */
+static void queue(Server *server, const uint8_t *frame, size_t size, uint64_t id, uint64_t parsed_at) {
+    if (server->pending_length == server->pending_capacity) {
+        server->pending_capacity = server->pending_capacity == 0 ? 64 : server->pending_capacity * 2;
+        server->exchanges = (ForkExchange*)realloc(server->exchanges, sizeof(ForkExchange) * server->pending_capacity);
+        server->pending = (PendingCall*)realloc(server->pending, sizeof(PendingCall) * server->pending_capacity);
+    }
+
+    server->exchanges[server->pending_length] = (ForkExchange){ .request = frame, .request_size = size };
+    server->pending[server->pending_length++] = (PendingCall){ .id = id, .parsed_at = parsed_at };
+}
+
+/* Run the pending calls on the workers and add their replies in order */
+static void run_pending(Server *server, Connection *connection) {
+    if (server->pending_length == 0) return;
+
+    ForkPool_exchange(server->pool, server->exchanges, server->pending_length);
+
+    for (size_t i = 0; i < server->pending_length; i++) {
+        ForkExchange *exchange = &server->exchanges[i];
+
+        if (exchange->reply == NULL) {
+            reply_fault(server, connection, server->pending[i].id, "call crashed its worker");
+        } else {
+            memcpy(reserve(connection, exchange->reply_size), exchange->reply, exchange->reply_size);
+
+            /* The worker counted its faults in its own copy of the stats */
+            if (exchange->reply_size > 12 && exchange->reply[12] == SERVER_FAULT) server->stats.faults++;
+
+            free(exchange->reply);
+        }
+
+        track(connection, server->pending[i].parsed_at);
+    }
+
+    server->pending_length = 0;
+}
+
+/* Run every complete request in the input, returns how many */
+static size_t handle(Server *server, Connection *connection) {
+    size_t offset = 0, handled = 0;
+
+    while (connection->input_length - offset >= 4) {
+        uint32_t size = (uint32_t)get_le(connection->input + offset, 4);
+
+        if (size > FRAME_MAX || size < 9) {
+            run_pending(server, connection);
+            reply_fault(server, connection, 0, size < 9 ? "frame too short" : "frame too large");
+            connection->closing = true;
+            break;
+        }
+
+        if (connection->input_length - offset - 4 < size) break;
+
+        uint64_t parsed_at = now_ns();
+
+        Reader reader = { connection->input + offset + 4, size, true };
+        uint8_t type = (uint8_t)take_le(&reader, 1);
+        uint64_t id = take_le(&reader, 8);
+
+        if (type == SERVER_CALL && server->pool != NULL) {
+            queue(server, connection->input + offset + 4, size, id, parsed_at);
+        } else {
+            /* Replies go out in request order */
+            run_pending(server, connection);
+
+            switch (type) {
+                case SERVER_CALL: call(server, connection, id, &reader); break;
+                case SERVER_DEPLOY: deploy(server, connection, id, &reader); break;
+                case SERVER_STATS: stats(server, connection, id, &reader); break;
+                default: reply_fault(server, connection, id, "unknown request type");
+            }
+
+            track(connection, parsed_at);
+        }
+
+        offset += 4 + size;
+        handled++;
+    }
+
+    /* Queued calls point into the input */
+    run_pending(server, connection);
+
+    memmove(connection->input, connection->input + offset, connection->input_length - offset);
+    connection->input_length -= offset;
+
+    return handled;
+}
+
+/* Write what output the socket takes, false if the peer is gone */
+static bool flush(Server *server, Connection *connection) {
+    size_t sent = 0;
+
+    while (sent < connection->output_length) {
+        ssize_t written = send(connection->fd, connection->output + sent, connection->output_length - sent, MSG_NOSIGNAL);
+
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+
+        sent += (size_t)written;
+    }
+
+    memmove(connection->output, connection->output + sent, connection->output_length - sent);
+    connection->output_length -= sent;
+    connection->written += sent;
+
+    /* Replies written in full */
+    size_t done = 0;
+    uint64_t at = 0;
+
+    for (; done < connection->timings_length && connection->timings[done].end <= connection->written; done++) {
+        if (at == 0) at = now_ns();
+        server->stats.latency[bucket(at - connection->timings[done].parsed_at)]++;
+    }
+
+    memmove(connection->timings, connection->timings + done, sizeof(ReplyTiming) * (connection->timings_length - done));
+    connection->timings_length -= done;
+
+    return true;
+}
+
+/* Read and answer what's available, false once the connection should close */
+static bool serve(Server *server, Connection *connection) {
+    bool open = true;
+
+    for (;;) {
+        if (connection->input_capacity - connection->input_length < READ_SIZE) {
+            connection->input_capacity *= 2;
+            connection->input = (uint8_t*)realloc(connection->input, connection->input_capacity);
+        }
+
+        ssize_t received = recv(connection->fd, connection->input + connection->input_length, READ_SIZE, 0);
+
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        if (received <= 0) {
+            open = false;
+            break;
+        }
+
+        connection->input_length += (size_t)received;
+
+        /* Don't let one connection buffer without bound */
+        if (connection->input_length > FRAME_MAX + 4) break;
+    }
+
+    size_t handled = connection->closing ? 0 : handle(server, connection);
+    server->stats.requests += handled;
+
+    if (connection->output_length > 0) {
+        if (!flush(server, connection)) return false;
+        server->stats.batches++;
+    }
+
+    return open && !(connection->closing && connection->output_length == 0);
+}
+
+static void close_connection(Server *server, size_t i) {
+    Connection *connection = &server->connections[i];
+
+    close(connection->fd);
+    free(connection->input);
+    free(connection->output);
+    free(connection->timings);
+
+    server->connections[i] = server->connections[--server->connections_length];
+}
+
+static void accept_connections(Server *server) {
+    int fd;
+
+    while ((fd = accept(server->listener, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        if (server->connections_length == server->connections_capacity) {
+            server->connections_capacity *= 2;
+            server->connections = (Connection*)realloc(server->connections, sizeof(Connection) * server->connections_capacity);
+        }
+
+        server->connections[server->connections_length++] = (Connection){
+            .fd = fd,
+            .input = (uint8_t*)malloc(BUFFER_CAPACITY),
+            .input_capacity = BUFFER_CAPACITY,
+            .output = (uint8_t*)malloc(BUFFER_CAPACITY),
+            .output_capacity = BUFFER_CAPACITY,
+        };
+
+        server->stats.connections++;
+    }
+}
+
+/* Listen on a Unix socket at `path`, replacing a stale one. Calls run at most `budget` instructions */
+void Server_init(Server *server, VM *vm, const char *path, uint64_t budget) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(address.sun_path)) error("Socket path %s is too long\n", path);
+    strcpy(address.sun_path, path);
+
+    server->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listener < 0) error("Couldn't create socket: %s\n", strerror(errno));
+
+    unlink(path);
+
+    if (bind(server->listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(server->listener, 64) < 0)
+        error("Couldn't listen on %s: %s\n", path, strerror(errno));
+
+    fcntl(server->listener, F_SETFL, fcntl(server->listener, F_GETFL) | O_NONBLOCK);
+
+    server->vm = vm;
+    server->path = strdup(path);
+    server->budget = budget == 0 ? UINT64_MAX : budget;
+
+    server->connections_capacity = 16;
+    server->connections_length = 0;
+    server->connections = (Connection*)malloc(sizeof(Connection) * server->connections_capacity);
+
+    server->scratch = (Address){ { 0xFF, 0xFF, 0xC0, 0xDE } };
+    Accounts_insert(&vm->accounts, &server->scratch);
+
+    StateView_init(&server->view, true);
+    TransientStorage_init(&server->transient);
+
+    server->pool = NULL;
+    server->exchanges = NULL;
+    server->pending = NULL;
+    server->pending_length = 0;
+    server->pending_capacity = 0;
+
+    server->stopping = 0;
+    memset(&server->stats, 0, sizeof(ServerStats));
+}
+
+/*
+ * Run calls on `workers` processes forked from this one, so a call that
+ * crashes only fails itself. The others keep running on the server's
+ * thread. Call before Server_run, once state is loaded
+ */
+void Server_start_workers(Server *server, size_t workers) {
+    server->pool = (ForkPool*)malloc(sizeof(ForkPool));
+    ForkPool_init_handler(server->pool, workers, work, started, server);
+}
+
+/* Serve until Server_stop */
+void Server_run(Server *server) {
+    struct pollfd *fds = NULL;
+    size_t fds_capacity = 0;
+
+    while (!server->stopping) {
+        size_t length = server->connections_length + 1;
+
+        if (length > fds_capacity) {
+            fds_capacity = length * 2;
+            fds = (struct pollfd*)realloc(fds, sizeof(struct pollfd) * fds_capacity);
+        }
+
+        fds[0] = (struct pollfd){ .fd = server->listener, .events = POLLIN };
+
+        for (size_t i = 0; i < server->connections_length; i++) {
+            const Connection *connection = &server->connections[i];
+            fds[i + 1] = (struct pollfd){ .fd = connection->fd, .events = POLLIN | (connection->output_length > 0 ? POLLOUT : 0) };
+        }
+
+        if (poll(fds, length, POLL_INTERVAL) < 0) {
+            if (errno == EINTR) continue;
+            error("Couldn't poll connections: %s\n", strerror(errno));
+        }
+
+        /* Newest first, closing moves the last connection into the freed spot */
+        for (size_t i = server->connections_length; i-- > 0;) {
+            Connection *connection = &server->connections[i];
+            short events = fds[i + 1].revents;
+            bool open = true;
+
+            if (events & POLLOUT) open = flush(server, connection) && !(connection->closing && connection->output_length == 0);
+            if (open && events & (POLLIN | POLLHUP | POLLERR)) open = serve(server, connection);
+
+            if (!open) close_connection(server, i);
+        }
+
+        if (fds[0].revents & POLLIN) accept_connections(server);
+    }
+
+    free(fds);
+}
+
+/* Ask Server_run to return. Safe from a signal handler or another thread */
+void Server_stop(Server *server) {
+    server->stopping = 1;
+}
+
+void Server_free(Server *server) {
+    while (server->connections_length > 0)
+        close_connection(server, server->connections_length - 1);
+
+    close(server->listener);
+    unlink(server->path);
+
+    free(server->connections);
+    free(server->path);
+
+    if (server->pool != NULL) {
+        ForkPool_free(server->pool);
+        free(server->pool);
+    }
+
+    free(server->exchanges);
+    free(server->pending);
+
+    StateView_free(&server->view);
+    TransientStorage_free(&server->transient);
+}
\ No newline at end of file
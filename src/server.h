@@ -0,0 +1,139 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <signal.h>
+
+#include "common.h"
+#include "forkpool.h"
+#include "vm.h"
+
+/*
+ * Protocol, integers little-endian. Every message is a frame of
+ * u32 size (of what follows) then the message. Requests:
+ *
+ *   call:   1, id u64, target kind u8 (0 address, 1 code hash),
+ *           target (20 or 32 bytes), sender[20], calldata size u32,
+ *           calldata, overrides u16, (address[20], key[32], value[32])*
+ *   deploy: 2, id u64, address[20], code size u32, code
+ *   stats:  3, id u64
+ *
+ * Replies carry the request's id:
+ *
+ *   result: id u64, 0, status u8, return size u32, return data, logs u32
+ *   fault:  id u64, 1, message size u16, message
+ *
+ * Calls see state overrides and their own writes only, nothing they
+ * do is kept. Overrides of accounts that don't exist are ignored,
+ * there's no code that could read them. Deploys replace an account's
+ * code for good. Stats come back as the return data of a result:
+ * requests, faults, batches, p50 and p99 latency in nanoseconds
+ * (u64 each). With workers, calls run in forked processes and one
+ * that takes its worker down is a fault, deploys fork them again
+ */
+#define SERVER_CALL 1
+#define SERVER_DEPLOY 2
+#define SERVER_STATS 3
+
+#define SERVER_RESULT 0
+#define SERVER_FAULT 1
+
+#define SERVER_TARGET_ADDRESS 0
+#define SERVER_TARGET_CODE_HASH 1
+
+/* Buckets of a log-linear histogram, 8 per power of two */
+#define LATENCY_BUCKETS 496
+
+typedef struct {
+    size_t requests;
+    size_t faults;
+
+    /* Writes of replies, each holding every reply ready at the time */
+    size_t batches;
+
+    size_t connections;
+
+    /* Nanoseconds from parsing a request to writing the last byte of its reply */
+    uint64_t latency[LATENCY_BUCKETS];
+} ServerStats;
+
+/* A call waiting for a worker, and when it was parsed */
+typedef struct {
+    uint64_t id;
+    uint64_t parsed_at;
+} PendingCall;
+
+/* Where a reply ends in a connection's output stream, and when its request was parsed */
+typedef struct {
+    uint64_t end;
+    uint64_t parsed_at;
+} ReplyTiming;
+
+typedef struct {
+    int fd;
+
+    uint8_t *input;
+    size_t input_length;
+    size_t input_capacity;
+
+    uint8_t *output;
+    size_t output_length;
+    size_t output_capacity;
+
+    /* Bytes of output written over the connection's life */
+    uint64_t written;
+
+    /* Replies not completely written yet, oldest first */
+    ReplyTiming *timings;
+    size_t timings_length;
+    size_t timings_capacity;
+
+    /* Set on a protocol error, closed once the output is flushed */
+    bool closing;
+} Connection;
+
+/*
+ * Long-lived server running requests against one warm VM. A single
+ * thread polls every connection, runs all complete requests it has
+ * read from one and answers them with one write
+ */
+typedef struct {
+    VM *vm;
+
+    char *path;
+    int listener;
+
+    Connection *connections;
+    size_t connections_length;
+    size_t connections_capacity;
+
+    /* Instructions a call may run before it's stopped with a fault */
+    uint64_t budget;
+
+    /* Account that runs code called by hash */
+    Address scratch;
+
+    StateView view;
+    TransientStorage transient;
+
+    volatile sig_atomic_t stopping;
+
+    /* Worker processes running calls, NULL to run them on the server's thread */
+    ForkPool *pool;
+
+    /* Calls of the connection being handled, sent to the workers together */
+    ForkExchange *exchanges;
+    PendingCall *pending;
+    size_t pending_length;
+    size_t pending_capacity;
+
+    ServerStats stats;
+} Server;
+
+void Server_init(Server *server, VM *vm, const char *path, uint64_t budget);
+void Server_start_workers(Server *server, size_t workers);
+void Server_run(Server *server);
+void Server_stop(Server *server);
+void Server_free(Server *server);
+uint64_t ServerStats_percentile(const ServerStats *stats, double percentile);
+
+#endif
\ No newline at end of file
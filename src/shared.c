@@ -0,0 +1,257 @@
+/**
+ * Read-mostly storage with RCU-style version swaps and epoch
+ * based reclamation. A version is a fixed array of pages, each
+ * an open-addressed table using linear probing. Publishing swaps
+ * the current version pointer, the version and pages it replaced
+ * are retired with the epoch they were unlinked in and freed once
+ * every reader in a read section entered in a later epoch
+ */
+
+#include "shared.h"
+
+#define PAGE_CAPACITY 8 /* Must be a power of 2 */
+#define LOAD_FACTOR 0.5
+#define GROWTH_RATE 2
+
+static uint64_t hash(const UInt256 *key) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+
+    for (int i = 0; i < 4; i++)
+        h = (h ^ key->elements[i]) * 0xFF51AFD7ED558CCDULL;
+
+    return h ^ (h >> 32);
+}
+
+/* Top bits pick the page, low bits the slot within it */
+static size_t page_index(uint64_t h) {
+    return (size_t)(h >> 58) & (SHARED_PAGES - 1);
+}
+
+static SharedPage *page_create(size_t capacity) {
+    SharedPage *page = (SharedPage*)calloc(1, sizeof(SharedPage) + sizeof(SharedEntry) * capacity);
+    page->capacity = capacity;
+    return page;
+}
+
+/* Index of entry with `key`, or of the empty slot it would go in */
+static size_t page_find(const SharedPage *page, const UInt256 *key, uint64_t h) {
+    size_t mask = page->capacity - 1, index = (size_t)h & mask;
+
+    while (page->entries[index].used && !UInt256_equals(&page->entries[index].key, key))
+        index = (index + 1) & mask;
+
+    return index;
+}
+
+/* Private copy of `page` with room for at least `capacity` entries */
+static SharedPage *page_copy(const SharedPage *page, size_t capacity) {
+    SharedPage *copy = page_create(capacity);
+
+    for (size_t i = 0; i < page->capacity; i++) {
+        const SharedEntry *entry = &page->entries[i];
+        if (!entry->used) continue;
+
+        copy->entries[page_find(copy, &entry->key, hash(&entry->key))] = *entry;
+    }
+
+    copy->length = page->length;
+
+    return copy;
+}
+
+static void retire(SharedStorage *storage, void *pointer) {
+    if (storage->retired_length == storage->retired_capacity) {
+        storage->retired_capacity *= GROWTH_RATE;
+        storage->retired = (SharedRetired*)realloc(storage->retired, sizeof(SharedRetired) * storage->retired_capacity);
+    }
+
+    storage->retired[storage->retired_length++] = (SharedRetired){
+        .pointer = pointer,
+        .epoch = storage->epoch,
+    };
+}
+
+/* Free whatever was retired before the oldest epoch still pinned by a reader */
+static void reclaim(SharedStorage *storage) {
+    uint64_t oldest = UINT64_MAX;
+
+    for (size_t i = 0; i < SHARED_READERS_MAX; i++) {
+        uint64_t epoch = __atomic_load_n(&storage->readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < storage->retired_length; i++) {
+        if (storage->retired[i].epoch < oldest) free(storage->retired[i].pointer);
+        else storage->retired[kept++] = storage->retired[i];
+    }
+
+    storage->retired_length = kept;
+}
+
+/* Writer's next draft starts out sharing every page with `version` */
+static SharedVersion *draft(const SharedVersion *version) {
+    SharedVersion *copy = (SharedVersion*)malloc(sizeof(SharedVersion));
+    *copy = *version;
+    return copy;
+}
+
+void SharedStorage_init(SharedStorage *storage) {
+    SharedVersion *version = (SharedVersion*)malloc(sizeof(SharedVersion));
+
+    for (size_t i = 0; i < SHARED_PAGES; i++) {
+        version->pages[i] = page_create(PAGE_CAPACITY);
+        version->pages[i]->published = true;
+    }
+
+    version->length = 0;
+
+    storage->current = version;
+
+    /* Reader slots use 0 for "not reading" */
+    storage->epoch = 1;
+
+    memset(storage->readers, 0, sizeof(storage->readers));
+
+    storage->draft = draft(version);
+    storage->staged = 0;
+
+    storage->replaced_capacity = SHARED_PAGES;
+    storage->replaced = (SharedPage**)malloc(sizeof(SharedPage*) * storage->replaced_capacity);
+    storage->replaced_length = 0;
+
+    storage->retired_capacity = SHARED_PAGES;
+    storage->retired = (SharedRetired*)malloc(sizeof(SharedRetired) * storage->retired_capacity);
+    storage->retired_length = 0;
+}
+
+/* Stage `value` at `key`, readers see it after the next publish */
+void SharedStorage_insert(SharedStorage *storage, const UInt256 *key, const UInt256 *value) {
+    uint64_t h = hash(key);
+    SharedPage **slot = &storage->draft->pages[page_index(h)];
+    SharedPage *page = *slot;
+
+    size_t capacity = page->capacity;
+    if ((double)(page->length + 1) / capacity >= LOAD_FACTOR) capacity *= GROWTH_RATE;
+
+    /* Copy on first write since the last publish, or when out of room */
+    if (page->published || capacity != page->capacity) {
+        SharedPage *copy = page_copy(page, capacity);
+
+        if (page->published) {
+            if (storage->replaced_length == storage->replaced_capacity) {
+                storage->replaced_capacity *= GROWTH_RATE;
+                storage->replaced = (SharedPage**)realloc(storage->replaced, sizeof(SharedPage*) * storage->replaced_capacity);
+            }
+
+            storage->replaced[storage->replaced_length++] = page;
+        } else {
+            /* Never seen by a reader */
+            free(page);
+        }
+
+        *slot = page = copy;
+    }
+
+    SharedEntry *entry = &page->entries[page_find(page, key, h)];
+
+    if (!entry->used) {
+        entry->used = true;
+        entry->key = *key;
+        page->length++;
+        storage->draft->length++;
+    }
+
+    entry->value = *value;
+    storage->staged++;
+}
+
+/* Writer's view, includes staged inserts */
+const UInt256 *SharedStorage_get(const SharedStorage *storage, const UInt256 *key) {
+    return SharedVersion_get(storage->draft, key);
+}
+
+/* Make every staged insert visible to readers at once */
+void SharedStorage_publish(SharedStorage *storage) {
+    if (storage->staged == 0) return;
+
+    SharedVersion *version = storage->draft;
+
+    for (size_t i = 0; i < SHARED_PAGES; i++)
+        version->pages[i]->published = true;
+
+    SharedVersion *old = storage->current;
+    __atomic_store_n(&storage->current, version, __ATOMIC_SEQ_CST);
+
+    /* Readers that loaded `old` pinned this epoch or an earlier one */
+    retire(storage, old);
+
+    for (size_t i = 0; i < storage->replaced_length; i++)
+        retire(storage, storage->replaced[i]);
+
+    storage->replaced_length = 0;
+
+    __atomic_store_n(&storage->epoch, storage->epoch + 1, __ATOMIC_SEQ_CST);
+
+    reclaim(storage);
+
+    storage->draft = draft(version);
+    storage->staged = 0;
+}
+
+/* Must not be called while readers are active */
+void SharedStorage_free(SharedStorage *storage) {
+    for (size_t i = 0; i < SHARED_PAGES; i++) {
+        if (storage->draft->pages[i] != storage->current->pages[i])
+            free(storage->draft->pages[i]);
+
+        free(storage->current->pages[i]);
+    }
+
+    for (size_t i = 0; i < storage->retired_length; i++)
+        free(storage->retired[i].pointer);
+
+    free(storage->draft);
+    free(storage->current);
+    free(storage->replaced);
+    free(storage->retired);
+}
+
+/* Claim a reader slot, NULL if all are taken */
+SharedReader *SharedReader_register(SharedStorage *storage) {
+    for (size_t i = 0; i < SHARED_READERS_MAX; i++) {
+        bool expected = false;
+
+        if (__atomic_compare_exchange_n(&storage->readers[i].registered, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return &storage->readers[i];
+    }
+
+    return NULL;
+}
+
+void SharedReader_unregister(SharedReader *reader) {
+    __atomic_store_n(&reader->registered, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Pin the current version, it stays valid and unchanged until
+ * SharedReader_end no matter what the writer publishes meanwhile
+ */
+const SharedVersion *SharedReader_begin(SharedStorage *storage, SharedReader *reader) {
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&storage->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&storage->current, __ATOMIC_SEQ_CST);
+}
+
+void SharedReader_end(SharedReader *reader) {
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Return reference to value that matches given key, ZERO if missing */
+const UInt256 *SharedVersion_get(const SharedVersion *version, const UInt256 *key) {
+    uint64_t h = hash(key);
+    const SharedPage *page = version->pages[page_index(h)];
+    const SharedEntry *entry = &page->entries[page_find(page, key, h)];
+
+    return entry->used ? &entry->value : &ZERO;
+}
\ No newline at end of file
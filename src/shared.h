@@ -0,0 +1,86 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "common.h"
+
+#define SHARED_PAGES 64 /* Must be a power of 2 */
+#define SHARED_READERS_MAX 64
+
+typedef struct {
+    UInt256 key;
+    UInt256 value;
+    bool used;
+} SharedEntry;
+
+/* Open-addressed table holding the keys whose hash selects this page */
+typedef struct {
+    size_t capacity;
+    size_t length;
+
+    /* Writer only, published pages are never modified again */
+    bool published;
+
+    SharedEntry entries[];
+} SharedPage;
+
+/* Immutable once published, pages are shared with neighbouring versions */
+typedef struct {
+    SharedPage *pages[SHARED_PAGES];
+    size_t length;
+} SharedVersion;
+
+typedef struct {
+    /* Epoch the reader entered in, 0 outside a read section */
+    uint64_t epoch;
+    bool registered;
+
+    /* Keep readers on their own cache lines */
+    uint8_t padding[64 - sizeof(uint64_t) - sizeof(bool)];
+} SharedReader;
+
+/* Memory to free once no reader can still reach it */
+typedef struct {
+    void *pointer;
+    uint64_t epoch;
+} SharedRetired;
+
+/*
+ * Storage read concurrently by any number of readers while a single
+ * writer updates it. Readers never lock: they pin an epoch, read one
+ * published version and unpin. The writer stages inserts in a private
+ * draft, copying only the pages it touches, and publishes the draft
+ * with one pointer swap
+ */
+typedef struct {
+    SharedVersion *current;
+    uint64_t epoch;
+
+    SharedReader readers[SHARED_READERS_MAX];
+
+    /* Writer only */
+    SharedVersion *draft;
+    size_t staged;
+
+    SharedPage **replaced;
+    size_t replaced_capacity;
+    size_t replaced_length;
+
+    SharedRetired *retired;
+    size_t retired_capacity;
+    size_t retired_length;
+} SharedStorage;
+
+void SharedStorage_init(SharedStorage *storage);
+void SharedStorage_insert(SharedStorage *storage, const UInt256 *key, const UInt256 *value);
+const UInt256 *SharedStorage_get(const SharedStorage *storage, const UInt256 *key);
+void SharedStorage_publish(SharedStorage *storage);
+void SharedStorage_free(SharedStorage *storage);
+
+SharedReader *SharedReader_register(SharedStorage *storage);
+void SharedReader_unregister(SharedReader *reader);
+const SharedVersion *SharedReader_begin(SharedStorage *storage, SharedReader *reader);
+void SharedReader_end(SharedReader *reader);
+
+const UInt256 *SharedVersion_get(const SharedVersion *version, const UInt256 *key);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,555 @@
+/**
+ * Whole-VM snapshots: accounts, storage, code and its analysis in
+ * one file laid out to be used in place once mapped. Every section
+ * is 8-byte aligned and found through offsets from the start of
+ * the file:
+ *
+ *   header | SnapshotAccount[] | SnapshotCode[] |
+ *   per code: bytes, jumpdests, instructions, blocks, slot keys |
+ *   per account: storage (key, value) pairs
+ *
+ * Structs are written in the VM's own layout, the header records
+ * their sizes so a snapshot from a different build is rejected.
+ * Loaded code points straight into the mapping and needs no
+ * analysis, storage is rebuilt into presized tables
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "alloc.h"
+
+#define MAGIC "CEVMSNAP"
+#define VERSION 1
+
+#define NO_CODE UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+
+    /* Sizes of the structs stored as is */
+    uint16_t instruction_size;
+    uint16_t block_size;
+    uint16_t slot_key_size;
+    uint16_t word_size;
+
+    uint64_t size;
+
+    uint64_t accounts_offset;
+    uint64_t accounts_length;
+
+    uint64_t codes_offset;
+    uint64_t codes_length;
+} SnapshotHeader;
+
+typedef struct {
+    uint8_t address[20];
+
+    /* Index into the codes, NO_CODE if none */
+    uint32_t code;
+
+    UInt256 balance;
+    uint64_t nonce;
+
+    uint64_t storage_offset;
+    uint64_t storage_length;
+} SnapshotAccount;
+
+typedef struct {
+    UInt256 hash;
+    uint64_t size;
+
+    uint64_t bytes_offset;
+    uint64_t jumpdests_offset;
+
+    uint64_t instructions_offset;
+    uint64_t instructions_length;
+
+    uint64_t blocks_offset;
+    uint64_t blocks_length;
+
+    uint64_t slot_keys_offset;
+    uint64_t slot_keys_length;
+} SnapshotCode;
+
+static uint64_t align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+/* Reserve `size` bytes at `*offset`, returns where they start */
+static uint64_t place(uint64_t *offset, uint64_t size) {
+    uint64_t start = *offset;
+    *offset = align(*offset + size);
+    return start;
+}
+
+/* Layout of a snapshot, worked out before anything is written */
+typedef struct {
+    SnapshotHeader header;
+
+    SnapshotAccount *account_records;
+    SnapshotCode *code_records;
+    const Code **code_list;
+
+    /* `path` with ".tmp" appended, written first and renamed over it */
+    char *temporary;
+} SnapshotPlan;
+
+#define WRITER_BUFFER 16384
+
+/*
+ * Sequential writes through a buffer of its own, with only write(2)
+ * underneath so a forked child can use it. False once a write failed,
+ * later calls do nothing then
+ */
+typedef struct {
+    int fd;
+    uint64_t position;
+    bool failed;
+
+    size_t used;
+    uint8_t buffer[WRITER_BUFFER];
+} SnapshotWriter;
+
+static void flush(SnapshotWriter *writer) {
+    const uint8_t *data = writer->buffer;
+
+    while (writer->used > 0 && !writer->failed) {
+        ssize_t written = write(writer->fd, data, writer->used);
+
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) { writer->failed = true; break; }
+
+        data += written;
+        writer->used -= (size_t)written;
+    }
+
+    writer->used = 0;
+}
+
+static void put(SnapshotWriter *writer, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t*)data;
+
+    while (size > 0 && !writer->failed) {
+        size_t chunk = WRITER_BUFFER - writer->used;
+        if (chunk > size) chunk = size;
+
+        /* NULL data writes zeros */
+        if (bytes == NULL) {
+            memset(writer->buffer + writer->used, 0, chunk);
+        } else {
+            memcpy(writer->buffer + writer->used, bytes, chunk);
+            bytes += chunk;
+        }
+
+        writer->used += chunk;
+        writer->position += chunk;
+        size -= chunk;
+
+        if (writer->used == WRITER_BUFFER) flush(writer);
+    }
+}
+
+static bool write_at(SnapshotWriter *writer, uint64_t offset, const void *data, size_t size) {
+    /* Sections are written in order, only alignment padding goes between them */
+    if (offset < writer->position) writer->failed = true;
+
+    put(writer, NULL, (size_t)(offset - writer->position));
+    put(writer, data, size);
+
+    return !writer->failed;
+}
+
+/* Work out where everything of `vm` goes in a snapshot at `path` */
+static void plan(const VM *vm, const char *path, SnapshotPlan *plan) {
+    const Accounts *accounts = &vm->accounts;
+    const CodeCache *codes = &vm->codes;
+
+    SnapshotAccount *account_records = (SnapshotAccount*)calloc(accounts->length + 1, sizeof(SnapshotAccount));
+    SnapshotCode *code_records = (SnapshotCode*)calloc(codes->length + 1, sizeof(SnapshotCode));
+    const Code **code_list = (const Code**)malloc(sizeof(Code*) * (codes->length + 1));
+
+    /* Number the codes by hash, for accounts to refer to */
+    LocationMap indices;
+    LocationMap_init(&indices);
+
+    size_t codes_length = 0;
+
+    for (size_t i = 0; i < codes->capacity; i++) {
+        if (codes->entries[i] == NULL) continue;
+
+        Location location = { .kind = LOCATION_SLOT, .space = NULL, .key = codes->entries[i]->hash };
+        UInt256 index = UInt256_from(codes_length);
+        LocationMap_set(&indices, &location, &index);
+
+        code_list[codes_length++] = codes->entries[i];
+    }
+
+    SnapshotHeader header = {
+        .magic = MAGIC,
+        .version = VERSION,
+        .instruction_size = sizeof(Instruction),
+        .block_size = sizeof(Block),
+        .slot_key_size = sizeof(SlotKey),
+        .word_size = sizeof(UInt256),
+        .accounts_length = accounts->length,
+        .codes_length = codes_length,
+    };
+
+    uint64_t offset = align(sizeof(SnapshotHeader));
+
+    header.accounts_offset = place(&offset, sizeof(SnapshotAccount) * accounts->length);
+    header.codes_offset = place(&offset, sizeof(SnapshotCode) * codes_length);
+
+    for (size_t i = 0; i < codes_length; i++) {
+        const Code *code = code_list[i];
+        SnapshotCode *record = &code_records[i];
+
+        record->hash = code->hash;
+        record->size = code->size;
+        record->instructions_length = code->instructions_length;
+        record->blocks_length = code->blocks_length;
+        record->slot_keys_length = code->slot_keys_length;
+
+        /* Room for the stop byte and sentinel entries the interpreter may look at */
+        record->bytes_offset = place(&offset, code->size + 1);
+        record->jumpdests_offset = place(&offset, code->size / 8 + 1);
+        record->instructions_offset = place(&offset, sizeof(Instruction) * (code->instructions_length + 1));
+        record->blocks_offset = place(&offset, sizeof(Block) * (code->blocks_length + 1));
+        record->slot_keys_offset = place(&offset, sizeof(SlotKey) * code->slot_keys_length);
+    }
+
+    for (size_t i = 0; i < accounts->length; i++) {
+        const Account *account = &accounts->accounts[i];
+        SnapshotAccount *record = &account_records[i];
+
+        memcpy(record->address, account->address.bytes, 20);
+        record->balance = account->balance;
+        record->nonce = account->nonce;
+        record->code = NO_CODE;
+
+        if (account->code != NULL) {
+            Location location = { .kind = LOCATION_SLOT, .space = NULL, .key = account->code->hash };
+            record->code = (uint32_t)LocationMap_get(&indices, &location)->elements[3];
+        }
+
+        record->storage_length = account->storage->length;
+        record->storage_offset = place(&offset, sizeof(UInt256) * 2 * account->storage->length);
+    }
+
+    header.size = offset;
+
+    size_t length = strlen(path) + sizeof(".tmp");
+    char *temporary = (char*)malloc(length);
+    snprintf(temporary, length, "%s.tmp", path);
+
+    LocationMap_free(&indices);
+
+    *plan = (SnapshotPlan){
+        .header = header,
+        .account_records = account_records,
+        .code_records = code_records,
+        .code_list = code_list,
+        .temporary = temporary,
+    };
+}
+
+static void plan_free(SnapshotPlan *plan) {
+    free(plan->account_records);
+    free(plan->code_records);
+    free(plan->code_list);
+    free(plan->temporary);
+}
+
+/*
+ * Write the planned snapshot to its temporary file and rename it to
+ * `path`. Doesn't allocate or touch stdio, so it's safe in a child
+ * forked from a multithreaded process. Leaves errno set on failure
+ */
+static bool emit(const VM *vm, const SnapshotPlan *plan, const char *path) {
+    const SnapshotHeader *header = &plan->header;
+    const Accounts *accounts = &vm->accounts;
+
+    SnapshotWriter writer = { .fd = open(plan->temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+    if (writer.fd < 0) return false;
+
+    write_at(&writer, 0, header, sizeof(SnapshotHeader));
+    write_at(&writer, header->accounts_offset, plan->account_records, sizeof(SnapshotAccount) * header->accounts_length);
+    write_at(&writer, header->codes_offset, plan->code_records, sizeof(SnapshotCode) * header->codes_length);
+
+    static const Instruction NO_INSTRUCTION = { 0 };
+    static const Block NO_BLOCK = { 0 };
+    static const uint8_t STOP = OP_STOP;
+
+    for (size_t i = 0; i < header->codes_length; i++) {
+        const Code *code = plan->code_list[i];
+        const SnapshotCode *record = &plan->code_records[i];
+
+        write_at(&writer, record->bytes_offset, code->bytes, code->size);
+        write_at(&writer, record->bytes_offset + code->size, &STOP, 1);
+        write_at(&writer, record->jumpdests_offset, code->jumpdests, code->size / 8 + 1);
+        write_at(&writer, record->instructions_offset, code->instructions, sizeof(Instruction) * code->instructions_length);
+        write_at(&writer, record->instructions_offset + sizeof(Instruction) * code->instructions_length, &NO_INSTRUCTION, sizeof(Instruction));
+        write_at(&writer, record->blocks_offset, code->blocks, sizeof(Block) * code->blocks_length);
+        write_at(&writer, record->blocks_offset + sizeof(Block) * code->blocks_length, &NO_BLOCK, sizeof(Block));
+        write_at(&writer, record->slot_keys_offset, code->slot_keys, sizeof(SlotKey) * code->slot_keys_length);
+    }
+
+    for (size_t i = 0; i < accounts->length; i++) {
+        const Storage *storage = accounts->accounts[i].storage;
+        uint64_t position = plan->account_records[i].storage_offset;
+
+        for (size_t j = 0; j < storage->capacity; j++) {
+            if (!storage->entries[j].used) continue;
+
+            write_at(&writer, position, &storage->entries[j].key, sizeof(UInt256));
+            write_at(&writer, position + sizeof(UInt256), &storage->entries[j].value, sizeof(UInt256));
+            position += 2 * sizeof(UInt256);
+        }
+    }
+
+    write_at(&writer, header->size, NULL, 0);
+    flush(&writer);
+
+    bool written = !writer.failed && fsync(writer.fd) == 0;
+    written = close(writer.fd) == 0 && written;
+    written = written && rename(plan->temporary, path) == 0;
+
+    if (!written) {
+        /* Callers report why the write failed, not the cleanup */
+        int saved = errno;
+        unlink(plan->temporary);
+        errno = saved;
+    }
+
+    return written;
+}
+
+/*
+ * Write `vm` to `path` (through a temporary file and a rename, so
+ * `path` always holds a complete snapshot). False if it couldn't
+ * be written, with errno set and `path` untouched
+ */
+bool Snapshot_write(const VM *vm, const char *path) {
+    SnapshotPlan layout;
+    plan(vm, path, &layout);
+
+    bool written = emit(vm, &layout, path);
+
+    int saved = errno;
+    plan_free(&layout);
+    errno = saved;
+
+    return written;
+}
+
+/*
+ * Write `vm` as it is now from a forked child, so the caller can
+ * keep changing it. The child sees the state at the fork and
+ * copy-on-write keeps it that way, call this between transactions
+ * from the thread that runs them. The layout is planned before the
+ * fork, the child only writes. False with errno set if there's no
+ * child, else `*writer` is it, for Snapshot_wait
+ */
+bool Snapshot_write_background(const VM *vm, const char *path, pid_t *writer) {
+    SnapshotPlan layout;
+    plan(vm, path, &layout);
+
+    pid_t pid = fork();
+
+    if (pid == 0) _exit(emit(vm, &layout, path) ? 0 : 1);
+
+    int saved = errno;
+    plan_free(&layout);
+    errno = saved;
+
+    if (pid < 0) return false;
+
+    *writer = pid;
+    return true;
+}
+
+/* Wait for a background write, true if the snapshot was written */
+bool Snapshot_wait(pid_t writer) {
+    int status;
+
+    while (waitpid(writer, &status, 0) < 0)
+        if (errno != EINTR) return false;
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Whether `length` items of `item_size` bytes at `offset` lie in the file, aligned */
+static bool within(const Snapshot *snapshot, uint64_t offset, uint64_t length, size_t item_size) {
+    return offset % 8 == 0 && offset <= snapshot->size && length <= (snapshot->size - offset) / item_size;
+}
+
+/*
+ * Check every record before anything is loaded, so a corrupt file
+ * is rejected instead of read out of bounds. The sentinel entries
+ * after bytes, instructions and blocks are part of what's checked
+ */
+static bool validate(const Snapshot *snapshot, const SnapshotHeader *header) {
+    const uint8_t *base = (const uint8_t*)snapshot->base;
+
+    if (!within(snapshot, header->accounts_offset, header->accounts_length, sizeof(SnapshotAccount)) ||
+            !within(snapshot, header->codes_offset, header->codes_length, sizeof(SnapshotCode)) ||
+            header->codes_length > NO_CODE)
+        return false;
+
+    const SnapshotCode *code_records = (const SnapshotCode*)(base + header->codes_offset);
+    const SnapshotAccount *account_records = (const SnapshotAccount*)(base + header->accounts_offset);
+
+    for (size_t i = 0; i < header->codes_length; i++) {
+        const SnapshotCode *record = &code_records[i];
+
+        if (record->size >= UINT32_MAX ||
+                !within(snapshot, record->bytes_offset, record->size + 1, 1) ||
+                !within(snapshot, record->jumpdests_offset, record->size / 8 + 1, 1) ||
+                record->instructions_length >= UINT32_MAX ||
+                !within(snapshot, record->instructions_offset, record->instructions_length + 1, sizeof(Instruction)) ||
+                record->blocks_length >= UINT32_MAX ||
+                !within(snapshot, record->blocks_offset, record->blocks_length + 1, sizeof(Block)) ||
+                !within(snapshot, record->slot_keys_offset, record->slot_keys_length, sizeof(SlotKey)))
+            return false;
+
+        /* Analysis is used as is, it has to agree with the bytes */
+        const Instruction *instructions = (const Instruction*)(base + record->instructions_offset);
+        const Block *blocks = (const Block*)(base + record->blocks_offset);
+
+        for (size_t j = 0; j < record->instructions_length; j++)
+            if (instructions[j].pc >= record->size) return false;
+
+        for (size_t j = 0; j < record->blocks_length; j++)
+            if (blocks[j].start > blocks[j].end || blocks[j].end > record->size ||
+                    blocks[j].first_instruction > record->instructions_length ||
+                    blocks[j].instructions_length > record->instructions_length - blocks[j].first_instruction)
+                return false;
+    }
+
+    for (size_t i = 0; i < header->accounts_length; i++) {
+        const SnapshotAccount *record = &account_records[i];
+
+        if ((record->code != NO_CODE && record->code >= header->codes_length) ||
+                record->storage_length > SIZE_MAX / 2 ||
+                !within(snapshot, record->storage_offset, record->storage_length * 2, sizeof(UInt256)))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Map the snapshot at `path` and add its accounts and code to
+ * `vm`. Returns false if there's no usable snapshot there
+ */
+bool Snapshot_load(VM *vm, const char *path, Snapshot *snapshot) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+
+    snapshot->size = (size_t)st.st_size;
+    snapshot->base = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (snapshot->base == MAP_FAILED) return false;
+
+    const uint8_t *base = (const uint8_t*)snapshot->base;
+    const SnapshotHeader *header = (const SnapshotHeader*)base;
+
+    if (memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 || header->version != VERSION ||
+            header->instruction_size != sizeof(Instruction) || header->block_size != sizeof(Block) ||
+            header->slot_key_size != sizeof(SlotKey) || header->word_size != sizeof(UInt256) ||
+            header->size != snapshot->size || !validate(snapshot, header)) {
+        Snapshot_close(snapshot);
+        return false;
+    }
+
+    const SnapshotCode *code_records = (const SnapshotCode*)(base + header->codes_offset);
+    const SnapshotAccount *account_records = (const SnapshotAccount*)(base + header->accounts_offset);
+
+    /* Borrow the mapped arrays, adopted into the cache on first use */
+    Code **codes = (Code**)malloc(sizeof(Code*) * (header->codes_length + 1));
+    bool *adopted = (bool*)calloc(header->codes_length + 1, sizeof(bool));
+
+    for (size_t i = 0; i < header->codes_length; i++) {
+        const SnapshotCode *record = &code_records[i];
+        Code *code = (Code*)Alloc_malloc(ALLOC_CODE, sizeof(Code));
+
+        code->hash = record->hash;
+        code->size = record->size;
+        code->bytes = (uint8_t*)(base + record->bytes_offset);
+        code->jumpdests = (uint8_t*)(base + record->jumpdests_offset);
+        code->instructions = (Instruction*)(base + record->instructions_offset);
+        code->instructions_length = record->instructions_length;
+        code->blocks = (Block*)(base + record->blocks_offset);
+        code->blocks_length = record->blocks_length;
+        code->slot_keys = (SlotKey*)(base + record->slot_keys_offset);
+        code->slot_keys_length = record->slot_keys_length;
+        code->mapped = true;
+        code->bytes_mapped = true;
+        code->references = 0;
+
+        codes[i] = code;
+    }
+
+    for (size_t i = 0; i < header->accounts_length; i++) {
+        const SnapshotAccount *record = &account_records[i];
+
+        Address address;
+        memcpy(address.bytes, record->address, 20);
+
+        Account *account = Accounts_insert(&vm->accounts, &address);
+
+        account->balance = record->balance;
+        account->nonce = record->nonce;
+
+        if (record->code != NO_CODE) {
+            uint32_t index = record->code;
+
+            if (account->code != NULL) CodeCache_release(&vm->codes, account->code);
+
+            if (adopted[index]) {
+                codes[index]->references++;
+            } else {
+                codes[index] = CodeCache_adopt(&vm->codes, codes[index]);
+                adopted[index] = true;
+            }
+
+            account->code = codes[index];
+        }
+
+        const UInt256 *pairs = (const UInt256*)(base + record->storage_offset);
+
+        Storage_reserve(account->storage, account->storage->length + record->storage_length);
+
+        for (size_t j = 0; j < record->storage_length; j++)
+            Storage_insert(account->storage, &pairs[2 * j], &pairs[2 * j + 1]);
+    }
+
+    /* Code no account uses */
+    for (size_t i = 0; i < header->codes_length; i++)
+        if (!adopted[i]) Code_free(codes[i]);
+
+    free(codes);
+    free(adopted);
+
+    return true;
+}
+
+void Snapshot_close(Snapshot *snapshot) {
+    munmap(snapshot->base, snapshot->size);
+    snapshot->base = NULL;
+    snapshot->size = 0;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <sys/types.h>
+
+#include "common.h"
+#include "vm.h"
+
+/*
+ * A snapshot file mapped into memory. Code loaded from it points
+ * into the mapping, so close it only after the VM is freed
+ */
+typedef struct {
+    void *base;
+    size_t size;
+} Snapshot;
+
+bool Snapshot_write(const VM *vm, const char *path);
+bool Snapshot_write_background(const VM *vm, const char *path, pid_t *writer);
+bool Snapshot_wait(pid_t writer);
+bool Snapshot_load(VM *vm, const char *path, Snapshot *snapshot);
+void Snapshot_close(Snapshot *snapshot);
+
+#endif
\ No newline at end of file
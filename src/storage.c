@@ -4,8 +4,9 @@
  */
 
 #include "storage.h"
+#include "alloc.h"
 
-#define DEFAULT_CAPACITY 10
+#define DEFAULT_CAPACITY 16 /* Must be a power of 2 */
 #define LOAD_FACTOR 0.5
 #define GROWTH_RATE 2
 
@@ -21,122 +22,109 @@ static uint64_t hash(const UInt256 *key) {
     );
 }
 
-/* Quadratic probing */
+/* Quadratic probing (triangular numbers visit every slot of a power of 2 table) */
 static size_t probe(size_t index, size_t probe_index) {
-    return index + probe_index * probe_index;
+    return index + probe_index;
+}
+
+/* Index of entry with `key`, or of the empty slot it would go in */
+static size_t find(const Storage *storage, const UInt256 *key) {
+    size_t mask = storage->capacity - 1,
+            index = (size_t)hash(key) & mask,
+            probe_index = 0;
+
+    while (storage->entries[index].used &&
+            !UInt256_equals(key, &storage->entries[index].key)) {
+        index = probe(index, ++probe_index) & mask;
+    }
+
+    return index;
 }
 
 void Storage_init(Storage *storage) {
     storage->capacity = DEFAULT_CAPACITY;
-    storage->entries = (Entry**)calloc(sizeof(Entry*), storage->capacity);
+    storage->entries = (Entry*)Alloc_calloc(ALLOC_STORAGE, sizeof(Entry), storage->capacity);
     storage->length = 0;
+    storage->backed = false;
 }
 
 void Storage_resize(Storage *storage) {
+    Entry *old_entries = storage->entries;
     size_t old_capacity = storage->capacity;
-    storage->capacity = (int)(((double) old_capacity) * GROWTH_RATE);
 
-    Entry **new_entries = realloc(storage->entries, sizeof(Entry) * storage->capacity);
-    for (int i = 0; i < old_capacity; i++)
-        new_entries[i] = storage->entries[i];
+    storage->capacity = old_capacity * GROWTH_RATE;
+    storage->entries = (Entry*)Alloc_calloc(ALLOC_STORAGE, sizeof(Entry), storage->capacity);
 
-    storage->entries = new_entries;
-}
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old_entries[i].used)
+            storage->entries[find(storage, &old_entries[i].key)] = old_entries[i];
 
-void Storage_insert(Storage *storage, const UInt256 *key, const UInt256 *value) {
-    size_t index = (size_t)(hash(key) % (uint64_t)storage->capacity),
-            probe_index = 0;
-    UInt256 *entry_key;
-
-    printf("Hash: %llu; Index: %lu\n", hash(key), index);
-
-    while (storage->entries[index] != NULL) {
-        entry_key = storage->entries[index]->key;
+    Alloc_free(old_entries);
+}
 
-        if (UInt256_equals(key, entry_key)) {
-            fprintf(stderr, "Key '");
-            UInt256_print_to(stderr, key);
-            fprintf(stderr, "' already exists in Storage\n");
-            exit(1);
-        }
+/* Grow ahead of time so `length` keys fit without resizing */
+void Storage_reserve(Storage *storage, size_t length) {
+    while ((double)length / storage->capacity >= LOAD_FACTOR)
+        Storage_resize(storage);
+}
 
-        index = probe(index, ++probe_index) % storage->capacity;
-    }
+/* Insert `value` at `key`, overwriting any existing value */
+void Storage_insert(Storage *storage, const UInt256 *key, const UInt256 *value) {
+    size_t index = find(storage, key);
+    Entry *entry = &storage->entries[index];
 
-    Entry* new_entry = (Entry*)malloc(sizeof(Entry));
+    trace("Storage insert at index %zu\n", index);
 
-    new_entry->key = UInt256_pfrom(0);
-    new_entry->value = UInt256_pfrom(0);
+    entry->value = *value;
 
-    UInt256_copy(key, new_entry->key);
-    UInt256_copy(value, new_entry->value);
+    if (entry->used)
+        return;
 
-    storage->entries[index] = new_entry;
+    entry->key = *key;
+    entry->used = true;
 
-    if (++storage->length / storage->capacity >= LOAD_FACTOR)
+    if ((double)++storage->length / storage->capacity >= LOAD_FACTOR)
         Storage_resize(storage);
 }
 
 /* Return reference to value that matches given key */
-UInt256 *Storage_get(Storage *storage, const UInt256 *key) {
-    size_t index = hash(key) % storage->capacity,
-            probe_index = 0;
-
-    printf("Index: %lu\n", index);
-
-    while (storage->entries[index] != NULL && 
-            storage->entries[index]->key != NULL &&
-            !UInt256_equals(key, storage->entries[index]->key)) {
-        index = probe(index, ++probe_index) % storage->capacity;
-    }
-    
-    Entry *entry = storage->entries[index];
+const UInt256 *Storage_get(const Storage *storage, const UInt256 *key) {
+    const Entry *entry = &storage->entries[find(storage, key)];
 
     // Return 0 if key does not exist
-    if (entry == NULL || !UInt256_equals(entry->key, key))
+    if (!entry->used)
         return &ZERO;
 
     // Else return retrieved value
-    return entry->value;
+    return &entry->value;
+}
+
+/* Whether `key` has been inserted, even if with zero */
+bool Storage_contains(const Storage *storage, const UInt256 *key) {
+    return storage->entries[find(storage, key)].used;
 }
 
 void Storage_copy(const Storage *src, Storage *dest) {
     dest->capacity = src->capacity;
     dest->length = src->length;
+    dest->backed = src->backed;
 
-    dest->entries = (Entry**)malloc(sizeof(Entry*) * src->capacity);
-
-    for (size_t i = 0; i < src->length; i++) {
-        dest->entries[i] = (Entry*)malloc(sizeof(Entry));
-        UInt256_copy(src->entries[i]->key, dest->entries[i]->key);
-        UInt256_copy(src->entries[i]->value, dest->entries[i]->value);
-    }
-}
-
-static void free_entries(Entry **entries, size_t capacity) {
-    for (size_t i = 0; i < capacity; i++) {
-        free(entries[i]->key);
-        free(entries[i]->value);
-        free(entries[i]);
-    }
-
-    free(entries);
+    dest->entries = (Entry*)Alloc_malloc(ALLOC_STORAGE, sizeof(Entry) * src->capacity);
+    memcpy(dest->entries, src->entries, sizeof(Entry) * src->capacity);
 }
 
 void Storage_free(Storage *storage) {
-    free_entries(storage->entries, storage->capacity);
-
-    free(storage->entries);
-    free(storage);
+    Alloc_free(storage->entries);
+    Alloc_free(storage);
 }
 
 void Storage_move(Storage *from, Storage *to) {
-    free_entries(to->entries, to->capacity);
+    Alloc_free(to->entries);
 
     to->length = from->length;
     to->capacity = from->capacity;
     to->entries = from->entries;
+    to->backed = from->backed;
 
     from->entries = NULL;
-}
-    
\ No newline at end of file
+}
\ No newline at end of file
@@ -5,21 +5,28 @@
 
 #include "common.h"
 
+/* Slot of the table, in place so lookups and inserts don't chase or allocate per key */
 typedef struct {
-    UInt256 *key;
-    UInt256 *value;
+    UInt256 key;
+    UInt256 value;
+    bool used;
 } Entry;
 
 typedef struct {
-    Entry **entries;
+    Entry *entries;
     size_t capacity;
     size_t length;
+
+    /* Missing keys may still hold a value in a Backend, load before use */
+    bool backed;
 } Storage;
 
 void Storage_init(Storage *storage);
 void Storage_resize(Storage *storage);
+void Storage_reserve(Storage *storage, size_t length);
 void Storage_insert(Storage *storage, const UInt256 *key, const UInt256 *value);
-UInt256 *Storage_get(Storage *storage, const UInt256 *key);
+const UInt256 *Storage_get(const Storage *storage, const UInt256 *key);
+bool Storage_contains(const Storage *storage, const UInt256 *key);
 void Storage_copy(const Storage *src, Storage *dest);
 void Storage_free(Storage *storage);
 void Storage_move(Storage *from, Storage *to);
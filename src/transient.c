@@ -0,0 +1,143 @@
+/**
+ * Transient storage implemented as open-addressed
+ * hash table using linear probing. Clearing bumps a
+ * generation counter instead of touching the entries
+ */
+
+#include "transient.h"
+#include "alloc.h"
+
+#define DEFAULT_CAPACITY 64 /* Must be a power of 2 */
+#define JOURNAL_CAPACITY 64
+#define GROWTH_RATE 2
+
+static uint64_t hash(const Address *address, const UInt256 *key) {
+    uint64_t h;
+    memcpy(&h, address->bytes + 12, sizeof(h));
+    h *= 0x9E3779B97F4A7C15ULL;
+
+    for (int i = 0; i < 4; i++)
+        h = (h ^ key->elements[i]) * 0xFF51AFD7ED558CCDULL;
+
+    return h ^ (h >> 32);
+}
+
+static bool is_live(const TransientStorage *transient, const TransientEntry *entry) {
+    return entry->generation == transient->generation;
+}
+
+/* Index of entry for (address, key), or of the empty slot it would go in */
+static size_t find(const TransientStorage *transient, const Address *address, const UInt256 *key) {
+    size_t mask = transient->capacity - 1,
+            index = hash(address, key) & mask;
+
+    while (is_live(transient, &transient->entries[index])) {
+        const TransientEntry *entry = &transient->entries[index];
+
+        if (Address_equals(&entry->address, address) && UInt256_equals(&entry->key, key))
+            break;
+
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+void TransientStorage_init(TransientStorage *transient) {
+    transient->capacity = DEFAULT_CAPACITY;
+    transient->entries = (TransientEntry*)Alloc_calloc(ALLOC_TRANSIENT, sizeof(TransientEntry), transient->capacity);
+    transient->length = 0;
+
+    /* Zeroed entries belong to generation 0 */
+    transient->generation = 1;
+
+    transient->journal_capacity = JOURNAL_CAPACITY;
+    transient->journal = (TransientJournalEntry*)Alloc_malloc(ALLOC_TRANSIENT, sizeof(TransientJournalEntry) * transient->journal_capacity);
+    transient->journal_length = 0;
+}
+
+static void resize(TransientStorage *transient) {
+    TransientEntry *old_entries = transient->entries;
+    size_t old_capacity = transient->capacity;
+
+    transient->capacity = old_capacity * GROWTH_RATE;
+    transient->entries = (TransientEntry*)Alloc_calloc(ALLOC_TRANSIENT, sizeof(TransientEntry), transient->capacity);
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!is_live(transient, &old_entries[i]))
+            continue;
+
+        size_t index = find(transient, &old_entries[i].address, &old_entries[i].key);
+        transient->entries[index] = old_entries[i];
+    }
+
+    Alloc_free(old_entries);
+}
+
+UInt256 TransientStorage_get(const TransientStorage *transient, const Address *address, const UInt256 *key) {
+    const TransientEntry *entry = &transient->entries[find(transient, address, key)];
+
+    return is_live(transient, entry) ? entry->value : ZERO;
+}
+
+static void set(TransientStorage *transient, const Address *address, const UInt256 *key, const UInt256 *value) {
+    TransientEntry *entry = &transient->entries[find(transient, address, key)];
+
+    if (is_live(transient, entry)) {
+        entry->value = *value;
+        return;
+    }
+
+    entry->address = *address;
+    entry->key = *key;
+    entry->value = *value;
+    entry->generation = transient->generation;
+
+    if (++transient->length * 2 >= transient->capacity)
+        resize(transient);
+}
+
+void TransientStorage_set(TransientStorage *transient, const Address *address, const UInt256 *key, const UInt256 *value) {
+    if (transient->journal_length == transient->journal_capacity) {
+        transient->journal_capacity *= GROWTH_RATE;
+        transient->journal = Alloc_realloc(ALLOC_TRANSIENT, transient->journal, sizeof(TransientJournalEntry) * transient->journal_capacity);
+    }
+
+    transient->journal[transient->journal_length++] = (TransientJournalEntry){
+        .address = *address,
+        .key = *key,
+        .value = TransientStorage_get(transient, address, key),
+    };
+
+    set(transient, address, key, value);
+}
+
+/* Journal position to pass to TransientStorage_revert */
+size_t TransientStorage_checkpoint(const TransientStorage *transient) {
+    return transient->journal_length;
+}
+
+/* Undo every write made since `checkpoint`, newest first */
+void TransientStorage_revert(TransientStorage *transient, size_t checkpoint) {
+    while (transient->journal_length > checkpoint) {
+        TransientJournalEntry *undo = &transient->journal[--transient->journal_length];
+        set(transient, &undo->address, &undo->key, &undo->value);
+    }
+}
+
+/* Drop all entries at the end of a transaction in O(1) */
+void TransientStorage_clear(TransientStorage *transient) {
+    transient->length = 0;
+    transient->journal_length = 0;
+
+    /* Stale generations would become live again on wrap around */
+    if (++transient->generation == 0) {
+        memset(transient->entries, 0, sizeof(TransientEntry) * transient->capacity);
+        transient->generation = 1;
+    }
+}
+
+void TransientStorage_free(TransientStorage *transient) {
+    Alloc_free(transient->entries);
+    Alloc_free(transient->journal);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef TRANSIENT_H
+#define TRANSIENT_H
+
+#include "common.h"
+#include "accounts.h"
+
+/*
+ * EIP-1153 transient storage, a flat open-addressed table
+ * keyed by (contract, key) that only lives for one transaction
+ */
+typedef struct {
+    Address address;
+    UInt256 key;
+    UInt256 value;
+
+    /* Entry is live only if it matches the table's generation */
+    uint32_t generation;
+} TransientEntry;
+
+/* Previous value of a slot, restored on REVERT */
+typedef struct {
+    Address address;
+    UInt256 key;
+    UInt256 value;
+} TransientJournalEntry;
+
+typedef struct {
+    TransientEntry *entries;
+    size_t capacity;
+    size_t length;
+
+    uint32_t generation;
+
+    TransientJournalEntry *journal;
+    size_t journal_capacity;
+    size_t journal_length;
+} TransientStorage;
+
+void TransientStorage_init(TransientStorage *transient);
+UInt256 TransientStorage_get(const TransientStorage *transient, const Address *address, const UInt256 *key);
+void TransientStorage_set(TransientStorage *transient, const Address *address, const UInt256 *key, const UInt256 *value);
+size_t TransientStorage_checkpoint(const TransientStorage *transient);
+void TransientStorage_revert(TransientStorage *transient, size_t checkpoint);
+void TransientStorage_clear(TransientStorage *transient);
+void TransientStorage_free(TransientStorage *transient);
+
+#endif
\ No newline at end of file
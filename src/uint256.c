@@ -1,7 +1,7 @@
 #include "uint256.h"
 
-UInt256 ZERO = (UInt256){ { 0, 0, 0, 0 } };
-UInt256 ONE = (UInt256){ { 0, 0, 0, 1 } };
+const UInt256 ZERO = (UInt256){ { 0, 0, 0, 0 } };
+const UInt256 ONE = (UInt256){ { 0, 0, 0, 1 } };
 
 bool UInt256_get(const UInt256 *integer, uint32_t index) {
     return (integer->elements[index / 64] >> (63 - (index % 64))) & 1;
@@ -135,7 +135,8 @@ void UInt256_shiftleft(UInt256 *integer, uint32_t op) {
 
         // Isolate bits that go on left word or right word
         // (shift could be split between two new words)
-        shift_left_side = element >> (64 - (op % 64));
+        // (a whole-word shift moves nothing across, and shifting by 64 is undefined)
+        shift_left_side = op % 64 == 0 ? 0 : element >> (64 - op % 64);
         shift_right_side = element << (op % 64);
 
         // If doesn't shift into current word, then all new bits are zero
@@ -159,8 +160,9 @@ void UInt256_shiftright(UInt256 *integer, uint32_t op) {
 
         // Isolate bits that go on left word or right word
         // (shift could be split between two new words)
+        // (a whole-word shift moves nothing across, and shifting by 64 is undefined)
         shift_left_side = element >> (op % 64);
-        shift_right_side = (element << (64 - op % 64)) >> (op % 64);
+        shift_right_side = op % 64 == 0 ? 0 : element << (64 - op % 64);
 
         // If doesn't shift into current word, then all new bits are zero
         integer->elements[i] = 0;
@@ -203,9 +205,11 @@ void UInt256_mult(UInt256 *integer, const UInt256 *op) {
 }
 
 static void UInt256_div_rem(UInt256 *integer, const UInt256 *op, UInt256 *rem) {
+    /* Division by zero yields zero, as in the EVM */
     if (UInt256_equals(op, &ZERO)) {
-        fprintf(stderr, "Tried to divide UInt256 by zero\n");
-        exit(1);
+        *integer = ZERO;
+        if (rem != NULL) *rem = ZERO;
+        return;
     }
 
     /* Binary long division (TODO: Karatsuba) */
@@ -243,7 +247,7 @@ void UInt256_rem(UInt256 *integer, const UInt256 *op) {
     UInt256_div_rem(integer, op, integer);
 }
 
-static UInt256 TWO = (UInt256){ { 0, 0, 0, 2 } };
+static const UInt256 TWO = (UInt256){ { 0, 0, 0, 2 } };
 
 void UInt256_pow(UInt256 *integer, const UInt256 *exp) {
     if (UInt256_equals(exp, &ZERO)) {
@@ -287,7 +291,85 @@ void UInt256_copy(const UInt256 *src, UInt256 *dest) {
         dest->elements[i] = src->elements[i];
 }
 
-static UInt256 TEN = (UInt256){ { 0, 0, 0, 10 } };
+/*
+ * Words are stored most significant limb first, so a big-endian
+ * byte string maps onto `elements` by swapping the bytes inside
+ * each 64-bit limb while keeping limb order. Four bswaps (or movbe
+ * loads) are as quick as a pshufb and need no CPU dispatch
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BE64(x) (x)
+#else
+#define BE64(x) __builtin_bswap64(x)
+#endif
+
+void UInt256_load(UInt256 *integer, const uint8_t *buffer) {
+    uint64_t limbs[4];
+    memcpy(limbs, buffer, 32);
+
+    for (int i = 0; i < 4; i++)
+        integer->elements[i] = BE64(limbs[i]);
+}
+
+void UInt256_store(const UInt256 *integer, uint8_t *buffer) {
+    uint64_t limbs[4];
+
+    for (int i = 0; i < 4; i++)
+        limbs[i] = BE64(integer->elements[i]);
+
+    memcpy(buffer, limbs, 32);
+}
+
+/* Load 32 bytes at `offset`, reading zeros past the end of `buffer` */
+void UInt256_load_padded(UInt256 *integer, const uint8_t *buffer, size_t buffer_size, uint64_t offset) {
+    if (offset < buffer_size && buffer_size - offset >= 32) {
+        UInt256_load(integer, buffer + offset);
+        return;
+    }
+
+    uint8_t word[32] = { 0 };
+
+    if (offset < buffer_size)
+        memcpy(word, buffer + offset, buffer_size - offset);
+
+    UInt256_load(integer, word);
+}
+
+/*
+ * Load `length` (<= 32) bytes at `offset` as the low-order bytes
+ * of the word (PUSHn immediates), zero padded past end of `buffer`
+ */
+void UInt256_load_partial(UInt256 *integer, const uint8_t *buffer, size_t buffer_size, uint64_t offset, size_t length) {
+    uint8_t word[32] = { 0 };
+
+    if (offset < buffer_size) {
+        size_t available = buffer_size - offset;
+        memcpy(word + 32 - length, buffer + offset, available < length ? available : length);
+    }
+
+    UInt256_load(integer, word);
+}
+
+/* Keccak-256 of `buffer`, read as a big-endian word like SHA3 */
+void UInt256_keccak(UInt256 *integer, const uint8_t *buffer, size_t size) {
+    SHA3_CTX ctx;
+    Keccak_init(&ctx);
+
+    /* Keccak_update takes at most UINT16_MAX bytes at a time */
+    while (size > 0) {
+        uint16_t chunk = size > UINT16_MAX ? UINT16_MAX : (uint16_t)size;
+        Keccak_update(&ctx, buffer, chunk);
+        buffer += chunk;
+        size -= chunk;
+    }
+
+    uint8_t hash[32];
+    Keccak_final(&ctx, hash);
+
+    UInt256_load(integer, hash);
+}
+
+static const UInt256 TEN = (UInt256){ { 0, 0, 0, 10 } };
 
 void __print_bits(size_t size, const void *ptr) {
     uint8_t *b = (uint8_t*)ptr;
@@ -18,7 +18,7 @@ typedef struct {
 #define TO_UINT64(integer) ((integer).elements[3])
 #define TO_SIZE_T(integer) ((size_t)((integer).elements[3]))
 
-extern UInt256 ZERO, ONE;
+extern const UInt256 ZERO, ONE;
 
 // Init
 void UInt256_init(UInt256 *integer, uint64_t value);
@@ -61,6 +61,13 @@ void __print_bits(size_t const size, void const * const ptr);
 void UInt256_copy(const UInt256 *src, UInt256 *dest);
 void __UInt256_print_parts(const UInt256 *integer);
 
+// Big-endian byte conversion (EVM memory, calldata and code layout)
+void UInt256_load(UInt256 *integer, const uint8_t *buffer);
+void UInt256_store(const UInt256 *integer, uint8_t *buffer);
+void UInt256_load_padded(UInt256 *integer, const uint8_t *buffer, size_t buffer_size, uint64_t offset);
+void UInt256_load_partial(UInt256 *integer, const uint8_t *buffer, size_t buffer_size, uint64_t offset, size_t length);
+void UInt256_keccak(UInt256 *integer, const uint8_t *buffer, size_t size);
+
 void UInt256_print_to_buffer(char *buffer, const UInt256 *integer);
 void UInt256_print_to(FILE *file, const UInt256 *integer);
 
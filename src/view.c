@@ -0,0 +1,335 @@
+/**
+ * Read/write sets over storage slots and accounts, kept in
+ * open-addressed maps using linear probing
+ */
+
+#include "view.h"
+#include "alloc.h"
+
+#define DEFAULT_CAPACITY 32 /* Must be a power of 2 */
+#define JOURNAL_CAPACITY 32
+#define GROWTH_RATE 2
+
+static uint64_t hash(const Location *location) {
+    uint64_t h = ((uint64_t)(uintptr_t)location->space ^ location->kind) * 0x9E3779B97F4A7C15ULL;
+
+    for (int i = 0; i < 4; i++)
+        h = (h ^ location->key.elements[i]) * 0xFF51AFD7ED558CCDULL;
+
+    return h ^ (h >> 32);
+}
+
+static bool location_equals(const Location *a, const Location *b) {
+    return a->kind == b->kind && a->space == b->space && UInt256_equals(&a->key, &b->key);
+}
+
+static size_t find(const LocationMap *map, const Location *location) {
+    size_t mask = map->capacity - 1,
+            index = hash(location) & mask;
+
+    while (map->entries[index].used && !location_equals(&map->entries[index].location, location))
+        index = (index + 1) & mask;
+
+    return index;
+}
+
+void LocationMap_init(LocationMap *map) {
+    map->capacity = DEFAULT_CAPACITY;
+    map->entries = (LocationEntry*)Alloc_calloc(ALLOC_STATE, sizeof(LocationEntry), map->capacity);
+    map->length = 0;
+}
+
+static void resize(LocationMap *map) {
+    LocationEntry *old_entries = map->entries;
+    size_t old_capacity = map->capacity;
+
+    map->capacity = old_capacity * GROWTH_RATE;
+    map->entries = (LocationEntry*)Alloc_calloc(ALLOC_STATE, sizeof(LocationEntry), map->capacity);
+
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old_entries[i].used)
+            map->entries[find(map, &old_entries[i].location)] = old_entries[i];
+
+    Alloc_free(old_entries);
+}
+
+/* Value stored for `location`, NULL if absent */
+UInt256 *LocationMap_get(const LocationMap *map, const Location *location) {
+    LocationEntry *entry = &map->entries[find(map, location)];
+    return entry->used ? &entry->value : NULL;
+}
+
+void LocationMap_set(LocationMap *map, const Location *location, const UInt256 *value) {
+    LocationEntry *entry = &map->entries[find(map, location)];
+
+    entry->value = *value;
+
+    if (entry->used)
+        return;
+
+    entry->location = *location;
+    entry->used = true;
+
+    if (++map->length * 2 >= map->capacity)
+        resize(map);
+}
+
+/* Drop `location`, shifting the rest of its probe run back so lookups still find them */
+void LocationMap_remove(LocationMap *map, const Location *location) {
+    size_t mask = map->capacity - 1,
+            index = find(map, location);
+
+    if (!map->entries[index].used)
+        return;
+
+    for (size_t next = (index + 1) & mask; map->entries[next].used; next = (next + 1) & mask) {
+        size_t home = hash(&map->entries[next].location) & mask;
+
+        /* Only move entries whose home is at or before the hole */
+        if (((next - home) & mask) >= ((next - index) & mask)) {
+            map->entries[index] = map->entries[next];
+            index = next;
+        }
+    }
+
+    map->entries[index].used = false;
+    map->length--;
+}
+
+/* Copy every entry of `from` into `into`, overwriting what's there */
+void LocationMap_merge(LocationMap *into, const LocationMap *from) {
+    for (size_t i = 0; i < from->capacity; i++) {
+        const LocationEntry *entry = &from->entries[i];
+
+        if (entry->used)
+            LocationMap_set(into, &entry->location, &entry->value);
+    }
+}
+
+void LocationMap_clear(LocationMap *map) {
+    if (map->length > 0)
+        memset(map->entries, 0, sizeof(LocationEntry) * map->capacity);
+
+    map->length = 0;
+}
+
+void LocationMap_free(LocationMap *map) {
+    Alloc_free(map->entries);
+}
+
+void StateView_init(StateView *view, bool buffered) {
+    view->buffered = buffered;
+    view->aborted = false;
+
+    LocationMap_init(&view->reads);
+    LocationMap_init(&view->writes);
+
+    view->journal_capacity = JOURNAL_CAPACITY;
+    view->journal = (ViewJournalEntry*)Alloc_malloc(ALLOC_STATE, sizeof(ViewJournalEntry) * view->journal_capacity);
+    view->journal_length = 0;
+}
+
+/* Forget everything recorded, to reuse view for another transaction */
+void StateView_reset(StateView *view, bool buffered) {
+    view->buffered = buffered;
+    view->aborted = false;
+
+    LocationMap_clear(&view->reads);
+    LocationMap_clear(&view->writes);
+
+    view->journal_length = 0;
+}
+
+static UInt256 read_slot(StateView *view, Storage *storage, const Location *location) {
+    UInt256 *written = LocationMap_get(&view->writes, location);
+
+    if (view->buffered && written != NULL)
+        return *written;
+
+    UInt256 value = *Storage_get(storage, &location->key);
+
+    /* Only reads of state from outside the transaction matter for conflicts */
+    if (written == NULL && LocationMap_get(&view->reads, location) == NULL)
+        LocationMap_set(&view->reads, location, &value);
+
+    return value;
+}
+
+static void write_slot(StateView *view, Storage *storage, const Location *location, const UInt256 *value) {
+    LocationMap_set(&view->writes, location, value);
+
+    if (!view->buffered)
+        Storage_insert(storage, &location->key, value);
+}
+
+UInt256 StateView_sload(StateView *view, Storage *storage, const UInt256 *key) {
+    Location location = { .kind = LOCATION_SLOT, .space = storage, .key = *key };
+    return read_slot(view, storage, &location);
+}
+
+static void journal(StateView *view, JournalKind kind, const Location *location, const UInt256 *value) {
+    if (view->journal_length == view->journal_capacity) {
+        view->journal_capacity *= GROWTH_RATE;
+        view->journal = Alloc_realloc(ALLOC_STATE, view->journal, sizeof(ViewJournalEntry) * view->journal_capacity);
+    }
+
+    view->journal[view->journal_length++] = (ViewJournalEntry){
+        .kind = kind,
+        .location = *location,
+        .value = *value,
+        .first_write = LocationMap_get(&view->writes, location) == NULL,
+    };
+}
+
+void StateView_sstore(StateView *view, Storage *storage, const UInt256 *key, const UInt256 *value) {
+    Location location = { .kind = LOCATION_SLOT, .space = storage, .key = *key };
+
+    UInt256 previous = read_slot(view, storage, &location);
+    journal(view, JOURNAL_SLOT, &location, &previous);
+
+    write_slot(view, storage, &location, value);
+}
+
+/* Look up an account, recording that the transaction depends on it */
+Account *StateView_account(StateView *view, const Accounts *accounts, const Address *address) {
+    Location location = { .kind = LOCATION_ACCOUNT, .space = accounts, .key = Address_to_uint256(address) };
+
+    if (LocationMap_get(&view->writes, &location) == NULL && LocationMap_get(&view->reads, &location) == NULL)
+        LocationMap_set(&view->reads, &location, &ZERO);
+
+    return Accounts_get(accounts, address);
+}
+
+/* Record that the transaction created or changed an account */
+void StateView_touch_account(StateView *view, const Accounts *accounts, const Address *address) {
+    Location location = { .kind = LOCATION_ACCOUNT, .space = accounts, .key = Address_to_uint256(address) };
+    LocationMap_set(&view->writes, &location, &ONE);
+}
+
+/*
+ * Create the account at `address`, which mustn't exist. Only direct
+ * views create accounts, reverting past this removes it again
+ */
+Account *StateView_create_account(StateView *view, Accounts *accounts, const Address *address) {
+    Location location = { .kind = LOCATION_ACCOUNT, .space = accounts, .key = Address_to_uint256(address) };
+
+    journal(view, JOURNAL_CREATE, &location, &ZERO);
+    StateView_touch_account(view, accounts, address);
+
+    return Accounts_insert(accounts, address);
+}
+
+/* Bump the nonce of the account at `address`, creating it if needed. Returns the nonce it had */
+uint64_t StateView_increment_nonce(StateView *view, Accounts *accounts, const Address *address) {
+    Location location = { .kind = LOCATION_ACCOUNT, .space = accounts, .key = Address_to_uint256(address) };
+
+    Account *account = Accounts_get(accounts, address);
+    if (account == NULL) account = StateView_create_account(view, accounts, address);
+
+    uint64_t nonce = account->nonce;
+
+    journal(view, JOURNAL_NONCE, &location, &(UInt256){ { 0, 0, 0, nonce } });
+    StateView_touch_account(view, accounts, address);
+
+    account->nonce = nonce + 1;
+
+    return nonce;
+}
+
+/* Give the account at `address`, which has no code, a reference to `code` */
+void StateView_set_code(StateView *view, Accounts *accounts, const Address *address, Code *code) {
+    Location location = { .kind = LOCATION_ACCOUNT, .space = accounts, .key = Address_to_uint256(address) };
+
+    journal(view, JOURNAL_CODE, &location, &ZERO);
+    StateView_touch_account(view, accounts, address);
+
+    Accounts_get(accounts, address)->code = code;
+}
+
+/* Journal position to pass to StateView_revert */
+size_t StateView_checkpoint(const StateView *view) {
+    return view->journal_length;
+}
+
+/*
+ * Locations first written since the checkpoint leave the write set,
+ * the transaction only read them in the end
+ */
+static void forget_write(StateView *view, const ViewJournalEntry *undo) {
+    LocationMap_remove(&view->writes, &undo->location);
+
+    if (LocationMap_get(&view->reads, &undo->location) == NULL)
+        LocationMap_set(&view->reads, &undo->location, undo->location.kind == LOCATION_SLOT ? &undo->value : &ZERO);
+}
+
+/*
+ * Undo every storage write and account change since `checkpoint`,
+ * newest first. Code taken off accounts is released to `codes`
+ */
+void StateView_revert(StateView *view, size_t checkpoint, CodeCache *codes) {
+    while (view->journal_length > checkpoint) {
+        ViewJournalEntry *undo = &view->journal[--view->journal_length];
+
+        if (undo->kind == JOURNAL_SLOT) {
+            Storage *storage = (Storage*)undo->location.space;
+
+            if (!undo->first_write) {
+                write_slot(view, storage, &undo->location, &undo->value);
+                continue;
+            }
+
+            forget_write(view, undo);
+            if (!view->buffered) Storage_insert(storage, &undo->location.key, &undo->value);
+            continue;
+        }
+
+        if (undo->first_write) forget_write(view, undo);
+
+        Accounts *accounts = (Accounts*)undo->location.space;
+        Address address = Address_from_uint256(&undo->location.key);
+        Code *code = NULL;
+
+        if (undo->kind == JOURNAL_CREATE) {
+            code = Accounts_remove(accounts, &address);
+        } else if (undo->kind == JOURNAL_NONCE) {
+            Accounts_get(accounts, &address)->nonce = undo->value.elements[3];
+        } else /* JOURNAL_CODE */ {
+            Account *account = Accounts_get(accounts, &address);
+            code = account->code;
+            account->code = NULL;
+        }
+
+        if (code != NULL) CodeCache_release(codes, code);
+    }
+}
+
+/* Whether anything this view read has since been written by someone in `written` */
+bool StateView_conflicts(const StateView *view, const LocationMap *written) {
+    for (size_t i = 0; i < view->reads.capacity; i++) {
+        const LocationEntry *entry = &view->reads.entries[i];
+
+        if (entry->used && LocationMap_get(written, &entry->location) != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+/* Apply buffered storage writes */
+void StateView_commit(StateView *view) {
+    if (!view->buffered)
+        return;
+
+    for (size_t i = 0; i < view->writes.capacity; i++) {
+        const LocationEntry *entry = &view->writes.entries[i];
+
+        if (entry->used && entry->location.kind == LOCATION_SLOT)
+            Storage_insert((Storage*)entry->location.space, &entry->location.key, &entry->value);
+    }
+}
+
+void StateView_free(StateView *view) {
+    LocationMap_free(&view->reads);
+    LocationMap_free(&view->writes);
+    Alloc_free(view->journal);
+}
\ No newline at end of file
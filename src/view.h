@@ -0,0 +1,93 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "common.h"
+#include "storage.h"
+#include "accounts.h"
+
+typedef enum {
+    LOCATION_SLOT,
+    LOCATION_ACCOUNT,
+} LocationKind;
+
+/* A storage slot (space is its Storage) or an account (space is the Accounts table) */
+typedef struct {
+    LocationKind kind;
+    const void *space;
+    UInt256 key;
+} Location;
+
+typedef struct {
+    Location location;
+    UInt256 value;
+    bool used;
+} LocationEntry;
+
+/* Open-addressed map from Location to value */
+typedef struct {
+    LocationEntry *entries;
+    size_t capacity;
+    size_t length;
+} LocationMap;
+
+typedef enum {
+    JOURNAL_SLOT,       /* value is the slot's previous value */
+    JOURNAL_CREATE,     /* the account was created */
+    JOURNAL_NONCE,      /* value is the account's previous nonce */
+    JOURNAL_CODE,       /* the account got code, it had none before */
+} JournalKind;
+
+/* How to undo one change to a slot or an account */
+typedef struct {
+    JournalKind kind;
+    Location location;
+    UInt256 value;
+
+    /* The location wasn't written before, undoing this takes it out of the write set */
+    bool first_write;
+} ViewJournalEntry;
+
+/*
+ * Transaction-scoped access to state. Records every location read
+ * from and written to, and journals writes and account changes so
+ * frames can be reverted. Buffered views keep writes to themselves until
+ * committed, direct views write through to Storage
+ */
+typedef struct {
+    bool buffered;
+
+    /* Set when a buffered transaction needs to change state it can't buffer */
+    bool aborted;
+
+    LocationMap reads;
+    LocationMap writes;
+
+    ViewJournalEntry *journal;
+    size_t journal_capacity;
+    size_t journal_length;
+} StateView;
+
+void LocationMap_init(LocationMap *map);
+UInt256 *LocationMap_get(const LocationMap *map, const Location *location);
+void LocationMap_set(LocationMap *map, const Location *location, const UInt256 *value);
+void LocationMap_remove(LocationMap *map, const Location *location);
+void LocationMap_merge(LocationMap *into, const LocationMap *from);
+void LocationMap_clear(LocationMap *map);
+void LocationMap_free(LocationMap *map);
+
+void StateView_init(StateView *view, bool buffered);
+void StateView_reset(StateView *view, bool buffered);
+UInt256 StateView_sload(StateView *view, Storage *storage, const UInt256 *key);
+void StateView_sstore(StateView *view, Storage *storage, const UInt256 *key, const UInt256 *value);
+Account *StateView_account(StateView *view, const Accounts *accounts, const Address *address);
+void StateView_touch_account(StateView *view, const Accounts *accounts, const Address *address);
+Account *StateView_create_account(StateView *view, Accounts *accounts, const Address *address);
+uint64_t StateView_increment_nonce(StateView *view, Accounts *accounts, const Address *address);
+void StateView_set_code(StateView *view, Accounts *accounts, const Address *address, Code *code);
+size_t StateView_checkpoint(const StateView *view);
+void StateView_revert(StateView *view, size_t checkpoint, CodeCache *codes);
+bool StateView_conflicts(const StateView *view, const LocationMap *written);
+void StateView_commit(StateView *view);
+void StateView_free(StateView *view);
+
+#endif
\ No newline at end of file
@@ -1,41 +1,341 @@
 #include "vm.h"
+#include "profile.h"
+#include "sampler.h"
+#include "alloc.h"
+
+#include <pthread.h>
+
+const char *STATUS_TO_NAME[] = {
+    [STATUS_SUCCESS] = "success",
+    [STATUS_REVERT] = "revert",
+    [STATUS_STACK_UNDERFLOW] = "stack underflow",
+    [STATUS_STACK_OVERFLOW] = "stack overflow",
+    [STATUS_INVALID_JUMP] = "invalid jump",
+    [STATUS_INVALID_OPCODE] = "invalid opcode",
+    [STATUS_UNSUPPORTED_OPCODE] = "unsupported opcode",
+    [STATUS_OUT_OF_MEMORY] = "out of memory",
+    [STATUS_ABORTED] = "aborted",
+    [STATUS_CRASHED] = "crashed",
+};
 
 void VM_init(VM *vm) {
-    /* Contracts */
-    vm->contracts_length = 0;
+    Accounts_init(&vm->accounts);
+    CodeCache_init(&vm->codes);
+    vm->wal = NULL;
 }
 
-static size_t add_contract(VM *vm, Contract *contract) {
-    vm->contracts[vm->contracts_length++] = contract;
-    return vm->contracts_length - 1;
-}
+/* keccak of empty code */
+static const UInt256 EMPTY_CODE_HASH = (UInt256){ { 0xC5D2460186F7233CULL, 0x927E7DB2DCC703C0ULL, 0xE500B653CA82273BULL, 0x7BFAD8045D85A470ULL } };
 
 /* -2^255 in 2's compliment is 1 */
-static UInt256 MINUS_UINT256_LIMIT = (UInt256){ { 0, 0, 0, 1 } };
-static UInt256 MINUS_ONE = (UInt256){ { ULLONG_MAX, ULLONG_MAX, ULLONG_MAX, ULLONG_MAX } };
+static const UInt256 MINUS_UINT256_LIMIT = (UInt256){ { 0, 0, 0, 1 } };
+static const UInt256 MINUS_ONE = (UInt256){ { ULLONG_MAX, ULLONG_MAX, ULLONG_MAX, ULLONG_MAX } };
+
+/* Memory offset or size, saturating: anything past a limb is past MEMORY_MAX too */
+static inline uint64_t to_offset(UInt256 value) {
+    return (value.elements[0] | value.elements[1] | value.elements[2]) ? UINT64_MAX : value.elements[3];
+}
+
+/*
+ * Frames are recycled per thread, along with their memory and return
+ * buffers, so warm calls don't allocate. A frame that grew its memory
+ * past SPARE_MEMORY_MAX, or finds the free list full, is freed. What
+ * a thread keeps is freed when it exits
+ */
+#define SPARE_FRAMES_MAX 64
+#define SPARE_MEMORY_MAX (1 << 20)
+#define SPARE_LOGS_MAX 16
+
+static __thread Context *spare_frames = NULL;
+static __thread size_t spare_frames_length = 0;
+
+/* Return buffer of a freed receipt, for the next frame that needs a bigger one */
+static __thread uint8_t *spare_return = NULL;
+static __thread size_t spare_return_capacity = 0;
+
+/* Logs of finished executions, VM_begin's to hand out */
+static __thread Logs *spare_logs[SPARE_LOGS_MAX];
+static __thread size_t spare_logs_length = 0;
+
+/* Whether the thread's spares are freed at its exit yet */
+static __thread bool spares_held = false;
+
+static pthread_key_t spares_key;
+static pthread_once_t spares_once = PTHREAD_ONCE_INIT;
+
+static void free_frame(Context *frame) {
+    Memory_free(frame->memory);
+    Alloc_free(frame->return_buffer);
+    Alloc_free(frame);
+}
+
+/* Thread exit hook */
+static void free_spares(void *unused) {
+    (void)unused;
+
+    while (spare_frames != NULL) {
+        Context *frame = spare_frames;
+        spare_frames = frame->caller;
+        free_frame(frame);
+    }
+
+    spare_frames_length = 0;
+
+    Alloc_free(spare_return);
+    spare_return = NULL;
+    spare_return_capacity = 0;
+
+    while (spare_logs_length > 0)
+        Alloc_free(spare_logs[--spare_logs_length]);
+
+    spares_held = false;
+}
+
+static void create_spares_key(void) {
+    pthread_key_create(&spares_key, free_spares);
+}
+
+/* Before the thread keeps anything, so it's freed when the thread exits */
+static inline void hold_spares(void) {
+    if (spares_held) return;
+
+    pthread_once(&spares_once, create_spares_key);
+    pthread_setspecific(spares_key, &spares_held);
+    spares_held = true;
+}
+
+/* A frame with empty memory, the caller fills in everything else */
+static Context *new_frame(void) {
+    Context *frame = spare_frames;
+
+    if (frame != NULL) {
+        spare_frames = frame->caller;
+        spare_frames_length--;
+        return frame;
+    }
+
+    frame = (Context*)Alloc_malloc(ALLOC_FRAME, sizeof(Context));
+    frame->memory = (Memory*)Alloc_malloc(ALLOC_FRAME, sizeof(Memory));
+    Memory_init(frame->memory);
+
+    frame->return_buffer = NULL;
+    frame->return_capacity = 0;
+
+    return frame;
+}
+
+static void recycle_frame(Context *frame) {
+    if (spare_frames_length == SPARE_FRAMES_MAX || frame->memory->capacity > SPARE_MEMORY_MAX) {
+        free_frame(frame);
+        return;
+    }
+
+    hold_spares();
+    Memory_reset(frame->memory);
+
+    frame->caller = spare_frames;
+    spare_frames = frame;
+    spare_frames_length++;
+}
+
+/* Room for `size` bytes of return data in the frame's buffer, NULL if it can't grow */
+static uint8_t *return_buffer(Context *frame, size_t size) {
+    if (frame->return_capacity < size && spare_return_capacity > frame->return_capacity) {
+        /* spare_return is only set once the thread holds spares */
+        uint8_t *buffer = frame->return_buffer;
+        size_t capacity = frame->return_capacity;
+
+        frame->return_buffer = spare_return;
+        frame->return_capacity = spare_return_capacity;
+
+        spare_return = buffer;
+        spare_return_capacity = capacity;
+    }
+
+    if (frame->return_capacity < size) {
+        uint8_t *buffer = (uint8_t*)Alloc_realloc(ALLOC_RETURN, frame->return_buffer, size);
+        if (buffer == NULL) return NULL;
+
+        frame->return_buffer = buffer;
+        frame->return_capacity = size;
+    }
+
+    return frame->return_buffer;
+}
+
+static Logs *new_logs(void) {
+    if (spare_logs_length > 0) return spare_logs[--spare_logs_length];
+
+    Logs *logs = (Logs*)Alloc_malloc(ALLOC_LOGS, sizeof(Logs));
+    Logs_init(logs);
+
+    return logs;
+}
+
+static void recycle_logs(Logs *logs) {
+    if (spare_logs_length == SPARE_LOGS_MAX) {
+        Alloc_free(logs);
+        return;
+    }
+
+    hold_spares();
+    Logs_init(logs);
+    spare_logs[spare_logs_length++] = logs;
+}
+
+/* Make `frame` the innermost frame of `execution`, called by the current one */
+static void enter(Execution *execution, Context *frame) {
+    Context *caller = execution->frame;
+
+    frame->caller = caller;
+    frame->depth = caller == NULL ? 0 : caller->depth + 1;
+    frame->pc = 0;
+    frame->stack_top = frame->stack;
+
+    /* Set by RETURN or REVERT in the frame */
+    frame->return_data = NULL;
+    frame->return_data_size = 0;
+
+    /* Journal positions for reverting state */
+    frame->view_checkpoint = StateView_checkpoint(frame->view);
+    frame->transient_checkpoint = TransientStorage_checkpoint(frame->transient);
+    frame->logs_length = execution->logs->length;
+
+    execution->frame = frame;
+}
 
-bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
-    /* Copy Storage and Memory for reverting state */
-    Storage old_storage;
-    Storage_copy(ctx->storage, &old_storage);
+/* Release a nested frame and everything it owns */
+static void drop(VM *vm, Context *frame) {
+    if (frame->init_code != NULL) CodeCache_release(&vm->codes, frame->init_code);
 
-    Memory old_memory;
-    Memory_copy(ctx->memory, &old_memory);
+    recycle_frame(frame);
+}
+
+/* Make the output of `frame` its caller's return data, swapping buffers rather than copying */
+static void hand_back(Context *ctx, Context *frame) {
+    uint8_t *buffer = ctx->return_buffer;
+    size_t capacity = ctx->return_capacity;
+
+    ctx->return_buffer = frame->return_buffer;
+    ctx->return_capacity = frame->return_capacity;
+    ctx->return_data = frame->return_data;
+    ctx->return_data_size = frame->return_data_size;
+
+    frame->return_buffer = buffer;
+    frame->return_capacity = capacity;
+}
+
+/* Hand the outcome of a nested frame to its caller, then free it */
+static void leave(VM *vm, Context *frame, Status status) {
+    Context *ctx = frame->caller;
+
+    if (frame->kind == OP_CREATE || frame->kind == OP_CREATE2) {
+        if (status == STATUS_SUCCESS) {
+            /* Whatever init code returns becomes the contract's code */
+            if (frame->return_data_size > 0)
+                StateView_set_code(ctx->view, &vm->accounts, &frame->address, CodeCache_insert(&vm->codes, frame->return_data, frame->return_data_size));
+
+            *(ctx->stack_top++) = Address_to_uint256(&frame->address);
+        } else {
+            /* A successful CREATE leaves no return data, a reverted one its reason */
+            *(ctx->stack_top++) = ZERO;
+            hand_back(ctx, frame);
+        }
+    } else {
+        *(ctx->stack_top++) = status == STATUS_SUCCESS ? ONE : ZERO;
 
-    size_t pc = 0;
+        /* Copy as much return data as fits into the output region, expanded by the call */
+        size_t copy_size = frame->return_data_size < frame->return_size ? frame->return_data_size : frame->return_size;
+        Memory_write(ctx->memory, frame->return_offset, frame->return_data, frame->return_data_size, 0, copy_size);
+
+        hand_back(ctx, frame);
+    }
+
+    drop(vm, frame);
+}
+
+/*
+ * Run the innermost frame of `execution`, and the frames it calls,
+ * until the outermost one halts (true) or the budget runs out
+ * (false). Nested calls don't recurse, they push a heap allocated
+ * frame and the loop carries on with it, so a suspended execution
+ * is just its frame chain with each frame's pc
+ */
+static bool run(Execution *execution, SamplerSite *site) {
+    VM *vm = execution->vm;
+    Logs *out_logs = execution->logs;
+
+    Context *ctx = execution->frame;
+    size_t pc = ctx->pc;
 
     /* Copy UInt256 for stack operations */
     #define POP() (*(--ctx->stack_top))
     #define PUSH(value) *(ctx->stack_top++) = value
 
+    /* Stop executing the frame with the given status */
+    #define HALT(code) do { status = code; goto halted; } while (0)
+
+    /* Memory_ calls fail rather than touch memory past MEMORY_MAX */
+    #define EXPANDED(result) do { if (!(result)) HALT(STATUS_OUT_OF_MEMORY); } while (0)
+
+    /*
+     * Backed storage hasn't got the slot on top of the stack yet: start
+     * loading it and suspend so the instruction runs again afterwards
+     */
+    #define AWAIT_SLOT() do { \
+        if (execution->backend != NULL && ctx->storage->backed && !Storage_contains(ctx->storage, ctx->stack_top - 1)) { \
+            execution->load = (Load){ .storage = ctx->storage, .key = *(ctx->stack_top - 1), .context = execution }; \
+            execution->waiting = true; \
+            execution->budget++; \
+            execution->executed--; \
+            ctx->pc = pc - 1; \
+            execution->backend->load(execution->backend, &execution->load); \
+            PROFILE_END(); \
+            return false; \
+        } \
+    } while (0)
+
+    /* Suspend the current frame and continue in `frame` */
+    #define ENTER(frame) do { ctx->pc = pc; enter(execution, frame); ctx = frame; pc = 0; } while (0)
+
     OpCode opcode;
+    Status status;
+
+    PROFILE_BEGIN();
 
     for (;;) {
-        opcode = ctx->code[pc++];
-        printf("Processing %s\n", OPCODE_TO_NAME[opcode]);
+        if (execution->budget == 0) {
+            ctx->pc = pc;
+            PROFILE_END();
+            return false;
+        }
+
+        execution->budget--;
+        execution->executed++;
+
+        site->pc = (uint32_t)pc;
+
+        /* Running off the end of code is an implicit STOP */
+        opcode = pc < ctx->code->size ? ctx->code->bytes[pc++] : OP_STOP;
+        trace("Processing %s\n", OPCODE_TO_NAME[opcode]);
+
+        PROFILE_INSTRUCTION(opcode, ctx->profile_node, pc - 1);
+
+        if (OPCODE_TO_NAME[opcode] == NULL) HALT(STATUS_INVALID_OPCODE);
+
+        /* Check stack bounds once here so handlers can POP and PUSH freely */
+        size_t height = ctx->stack_top - ctx->stack;
+        const StackEffect *effect = &OPCODE_STACK_EFFECT[opcode];
+
+        if (height < effect->inputs) HALT(STATUS_STACK_UNDERFLOW);
+        if (height - effect->inputs + effect->outputs > STACK_MAX) HALT(STATUS_STACK_OVERFLOW);
+
         switch (opcode) {
             case OP_STOP: {
-                return true; /* Successfully terminate */
+                /* No output, whatever the last call returned isn't the frame's */
+                ctx->return_data = NULL;
+                ctx->return_data_size = 0;
+                HALT(STATUS_SUCCESS);
             }
 
             case OP_ADD: {
@@ -61,7 +361,7 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
 
             case OP_DIV: {
                 UInt256 a = POP(), b = POP();
-                if (UInt256_equals(&a, &ZERO)) a = ZERO;
+                if (UInt256_equals(&b, &ZERO)) a = ZERO;
                 else UInt256_div(&a, &b);
                 PUSH(a);
                 break;
@@ -146,6 +446,8 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
                 }
 
                 PUSH(a);
+
+                break;
             }
 
             case OP_EXP: {
@@ -319,41 +621,37 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             }
 
             case OP_SHA3: {
-                uint64_t offset = POP().elements[3], size = POP().elements[3];
+                uint64_t offset = to_offset(POP()), size = to_offset(POP());
 
-                SHA3_CTX sha_ctx;
-                Keccak_init(&sha_ctx);
-                Keccak_update(&sha_ctx, Memory_offset(ctx->memory, offset), size);
+                const uint8_t *data = Memory_expand(ctx->memory, offset, size);
+                EXPANDED(data != NULL);
 
-                uint64_t buffer[4];
-                Keccak_final(&sha_ctx, (uint8_t*)&buffer);
-
-                /* TODO: buffer may have to be reversed?
-                (either byte or bit wise) */
-                UInt256 hash = (UInt256){ { buffer[0], buffer[1], buffer[2], buffer[3] } };
+                UInt256 hash;
+                UInt256_keccak(&hash, data, size);
 
                 PUSH(hash);
-                
                 break;
             }
 
             case OP_ADDRESS: {
-                PUSH(UInt256_from(ctx->address));
+                PUSH(Address_to_uint256(&ctx->address));
                 break;
             }
 
             case OP_BALANCE: {
-                error("Unhandled opcode BALANCE\n");
+                UInt256 _address = POP();
+                Address address = Address_from_uint256(&_address);
+                Account *account = StateView_account(ctx->view, &vm->accounts, &address);
+                PUSH(account == NULL ? ZERO : account->balance);
                 break;
             }
 
             case OP_ORIGIN: {
-                error("Unhandled opcode ORIGIN\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_CALLER: {
-                PUSH(UInt256_from(ctx->sender));
+                PUSH(Address_to_uint256(&ctx->sender));
                 break;
             }
 
@@ -363,8 +661,13 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             }
 
             case OP_CALLDATALOAD: {
-                UInt256 i = POP();
-                PUSH(UInt256_from(*(uint64_t*)&ctx->calldata[i.elements[3]]));
+                UInt256 value;
+
+                /* Offsets that don't fit in a limb read entirely past calldata */
+                uint64_t offset = to_offset(POP());
+                UInt256_load_padded(&value, ctx->calldata, ctx->calldata_size, offset);
+
+                PUSH(value);
                 break;
             }
 
@@ -374,36 +677,43 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             }
 
             case OP_CALLDATACOPY: {
-                size_t dest_offset = TO_SIZE_T(POP()), offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
-                Memory_insert(ctx->memory, dest_offset, ctx->calldata + offset, size);
+                uint64_t dest_offset = to_offset(POP()), offset = to_offset(POP()), size = to_offset(POP());
+                EXPANDED(Memory_write(ctx->memory, dest_offset, ctx->calldata, ctx->calldata_size, offset, size));
                 break;
             }
 
             case OP_CODESIZE: {
-                PUSH(UInt256_from(ctx->code_size));
+                PUSH(UInt256_from(ctx->code->size));
                 break;
             }
 
             case OP_CODECOPY: {
-                size_t dest_offset = TO_SIZE_T(POP()), offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
-                Memory_insert(ctx->memory, dest_offset, ctx->code + offset, size);
+                uint64_t dest_offset = to_offset(POP()), offset = to_offset(POP()), size = to_offset(POP());
+                EXPANDED(Memory_write(ctx->memory, dest_offset, ctx->code->bytes, ctx->code->size, offset, size));
                 break;
             }
 
             case OP_GASPRICE: {
-                error("Unhandled opcode GASPRICE\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_EXTCODESIZE: {
-                UInt256 address = POP();
-                PUSH(UInt256_from(vm->contracts[address.elements[3]]->code_size));
+                UInt256 _address = POP();
+                Address address = Address_from_uint256(&_address);
+                Account *account = StateView_account(ctx->view, &vm->accounts, &address);
+                PUSH(UInt256_from(account == NULL || account->code == NULL ? 0 : account->code->size));
                 break;
             }
 
             case OP_EXTCODECOPY: {
-                size_t address = TO_SIZE_T(POP()), dest_offset = TO_SIZE_T(POP()), offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
-                Memory_insert(ctx->memory, dest_offset, vm->contracts[address]->code + offset, size);
+                UInt256 _address = POP();
+                Address address = Address_from_uint256(&_address);
+                uint64_t dest_offset = to_offset(POP()), offset = to_offset(POP()), size = to_offset(POP());
+
+                /* Missing accounts have empty code, copy reads as zeros */
+                Account *account = StateView_account(ctx->view, &vm->accounts, &address);
+                const Code *code = account == NULL ? NULL : account->code;
+                EXPANDED(Memory_write(ctx->memory, dest_offset, code == NULL ? NULL : code->bytes, code == NULL ? 0 : code->size, offset, size));
                 break;
             }
 
@@ -413,59 +723,56 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             }
 
             case OP_RETURNDATACOPY: {
-                size_t dest_offset = TO_SIZE_T(POP()), offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
-                Memory_insert(ctx->memory, dest_offset, ctx->return_data + offset, size);
+                uint64_t dest_offset = to_offset(POP()), offset = to_offset(POP()), size = to_offset(POP());
+                EXPANDED(Memory_write(ctx->memory, dest_offset, ctx->return_data, ctx->return_data_size, offset, size));
                 break;
             }
 
             case OP_EXTCODEHASH: {
-                error("Unhandled opcode EXTCODEHASH\n");
+                UInt256 _address = POP();
+                Address address = Address_from_uint256(&_address);
+                Account *account = StateView_account(ctx->view, &vm->accounts, &address);
+                if (account == NULL) PUSH(ZERO);
+                else PUSH(account->code == NULL ? EMPTY_CODE_HASH : account->code->hash);
                 break;
             }
 
             case OP_BLOCKHASH: {
-                error("Unhandled opcode BLOCKHASH\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_COINBASE: {
-                error("Unhandled opcode COINBASE\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_TIMESTAMP: {
-                error("Unhandled opcode TIMESTAMP\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_NUMBER: {
-                error("Unhandled opcode NUMBER\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_DIFFICULTY: {
-                error("Unhandled opcode DIFFICULTY\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_GASLIMIT: {
-                error("Unhandled opcode GASLIMIT\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_CHAINID: {
-                error("Unhandled opcode CHAINID\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_SELFBALANCE: {
-                error("Unhandled opcode SELFBALANCE\n");
+                Account *account = StateView_account(ctx->view, &vm->accounts, &ctx->address);
+                PUSH(account == NULL ? ZERO : account->balance);
                 break;
             }
 
             case OP_BASEFEE: {
-                error("Unhandled opcode BASEFEE\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_POP: {
@@ -473,61 +780,60 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
                 break;
             }
 
-            /* BM: Byte array operations are little-endian */
+            /* Words are stored big-endian in memory */
 
             case OP_MLOAD: {
-                uint64_t offset = POP().elements[3];
-                uint64_t *mem = (uint64_t*)Memory_offset(ctx->memory, offset);
-                UInt256 value = (UInt256){ { mem[3], mem[2], mem[1], mem[0] } };
+                uint8_t *word = Memory_expand(ctx->memory, to_offset(POP()), 32);
+                EXPANDED(word != NULL);
+
+                UInt256 value;
+                UInt256_load(&value, word);
                 PUSH(value);
                 break;
             }
 
             case OP_MSTORE: {
-                uint64_t offset = POP().elements[3];
-                UInt256 value = POP();
-                
-                /* Reverse and store in buffer for
-                writing little-endian to memory */
-                uint64_t buffer[] = { value.elements[3], value.elements[2], value.elements[1], value.elements[0] };
-
-                Memory_insert(ctx->memory, offset, (uint8_t*)&buffer[0], 32);
+                uint8_t *word = Memory_expand(ctx->memory, to_offset(POP()), 32);
+                EXPANDED(word != NULL);
 
+                UInt256 value = POP();
+                UInt256_store(&value, word);
                 break;
             }
 
             case OP_MSTORE8: {
                 UInt256 _offset = POP(), _value = POP();
-                size_t offset = TO_SIZE_T(_offset), value = TO_SIZE_T(_value);
-                uint8_t buffer[] = { (uint8_t)value };
-                Memory_insert(ctx->memory, offset, buffer, 1);
+                uint64_t offset = to_offset(_offset);
+                uint8_t buffer[] = { (uint8_t)TO_SIZE_T(_value) };
+                EXPANDED(Memory_insert(ctx->memory, offset, buffer, 1));
 
-                printf("value u256: "); __PRINT(&_value); printf("\n");
-                printf("offset u256: "); __PRINT(&_offset); printf("\n");
-                printf("offset: %d; value: %d\n", (int)offset, (int)value);
-                printf("value at mem 0: %d\n", (int)ctx->memory->array[offset]);
+                trace("offset: %d; value: %d\n", (int)offset, (int)value);
 
                 break;
             }
 
             case OP_SLOAD: {
-                UInt256 key = POP(), value;
-                UInt256_copy(Storage_get(ctx->storage, &key), &value);
-                PUSH(value);
+                AWAIT_SLOT();
+
+                UInt256 key = POP();
+                PUSH(StateView_sload(ctx->view, ctx->storage, &key));
                 break;
             }
 
             case OP_SSTORE: {
+                /* Previous value is journaled, it has to be the real one */
+                AWAIT_SLOT();
+
                 UInt256 key = POP(), value = POP();
-                Storage_insert(ctx->storage, &key, &value);
+                StateView_sstore(ctx->view, ctx->storage, &key, &value);
                 break;
             }
 
             case OP_JUMP: {
                 UInt256 counter = POP();
                 size_t new_pc = (size_t)counter.elements[3];
-                if (ctx->code[new_pc] == OP_JUMPDEST) pc = new_pc;
-                else error("Expected JUMP instruction to jump to JUMPDEST, got %zu\n", pc);
+                if (Code_is_jumpdest(ctx->code, new_pc)) pc = new_pc;
+                else HALT(STATUS_INVALID_JUMP);
                 break;
             }
 
@@ -535,8 +841,8 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
                 UInt256 counter = POP(), b = POP();
                 size_t new_pc = counter.elements[3];
                 if (!UInt256_equals(&b, &ZERO)) {
-                    if (ctx->code[new_pc] == OP_JUMPDEST) pc = new_pc;
-                    else error("Expected JUMPI instruction to jump to JUMPDEST, got %zu\n", pc);
+                    if (Code_is_jumpdest(ctx->code, new_pc)) pc = new_pc;
+                    else HALT(STATUS_INVALID_JUMP);
                 }
                 break;
             }
@@ -547,13 +853,12 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             }
 
             case OP_MSIZE: {
-                PUSH(UInt256_from(ctx->memory->capacity));
+                PUSH(UInt256_from(ctx->memory->length));
                 break;
             }
 
             case OP_GAS: {
-                error("Unhandled opcode GAS\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             case OP_JUMPDEST: {
@@ -561,6 +866,24 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
                 break;
             }
 
+            case OP_TLOAD: {
+                UInt256 key = POP();
+                PUSH(TransientStorage_get(ctx->transient, &ctx->address, &key));
+                break;
+            }
+
+            case OP_TSTORE: {
+                UInt256 key = POP(), value = POP();
+                TransientStorage_set(ctx->transient, &ctx->address, &key, &value);
+                break;
+            }
+
+            case OP_MCOPY: {
+                uint64_t dest_offset = to_offset(POP()), offset = to_offset(POP()), size = to_offset(POP());
+                EXPANDED(Memory_mcopy(ctx->memory, dest_offset, offset, size));
+                break;
+            }
+
             case OP_PUSH1:
             case OP_PUSH2:
             case OP_PUSH3:
@@ -595,12 +918,11 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             case OP_PUSH32: {
                 size_t length = opcode - OP_PUSH1 + 1;
 
-                UInt256 value = ZERO;
-                uint8_t *buffer = ((uint8_t*)&value.elements[3]); /* Last byte in smallest word */
+                /* Immediates running past the end of code read as zero */
+                UInt256 value;
+                UInt256_load_partial(&value, ctx->code->bytes, ctx->code->size, pc, length);
+                pc += length;
 
-                for (size_t i = 0; i < length; i++)
-                    *(buffer - i) = ctx->code[pc++];
-                
                 PUSH(value);
                 
                 break;
@@ -622,10 +944,10 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             case OP_DUP14:
             case OP_DUP15:
             case OP_DUP16: {
-                uint64_t stack_offset = opcode - OP_DUP1;
-                for (int i = stack_offset + 1; i > 0; i--)
-                    ctx->stack[i] = ctx->stack[i - 1];
-                ctx->stack[0] = ctx->stack[stack_offset + 1];
+                /* Stack grows upwards, top is at stack_top - 1 */
+                uint64_t stack_offset = opcode - OP_DUP1 + 1;
+                UInt256 value = *(ctx->stack_top - stack_offset);
+                PUSH(value);
                 break;
             }
 
@@ -646,9 +968,10 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             case OP_SWAP15:
             case OP_SWAP16: {
                 uint64_t swap_index = opcode - OP_SWAP1 + 1;
-                UInt256 tmp = ctx->stack[0];
-                ctx->stack[0] = ctx->stack[swap_index];
-                ctx->stack[swap_index] = tmp;
+                UInt256 *top = ctx->stack_top - 1;
+                UInt256 tmp = *top;
+                *top = *(top - swap_index);
+                *(top - swap_index) = tmp;
                 break;
             }
 
@@ -657,55 +980,96 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             case OP_LOG2:
             case OP_LOG3:
             case OP_LOG4: {
-                size_t offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
+                uint64_t offset = to_offset(POP()), size = to_offset(POP());
+
+                /* Check the data is addressable before the log exists */
+                const uint8_t *data = Memory_expand(ctx->memory, offset, size);
+                EXPANDED(data != NULL);
 
                 size_t topics_length = (size_t)(opcode - OP_LOG0);
-                UInt256 *topics = malloc(sizeof(UInt256) * topics_length);
+                Log *log = Logs_append(out_logs, topics_length, size);
 
                 for (size_t i = 0; i < topics_length; i++)
-                    topics[i] = POP();
-                
-                uint8_t *data = malloc(size);
+                    log->topics[i] = POP();
 
-                for (size_t i = 0; i < size; i++)
-                    data[i] = ctx->memory->array[offset + i];
-                
-                Log *log = malloc(sizeof(Log));
-
-                log->data = data;
-                log->size = size;
-
-                log->topics_length = topics_length;
-                log->topics = topics;
-
-                Logs_push(out_logs, log);
+                if (size > 0) memcpy(log->data, data, size);
 
                 break;
             }
 
             case OP_CREATE:
             case OP_CREATE2: {
-                /* TODO: Add predetermined addresses for CREATE2 */
+                /* Account creation can't be buffered, give up on speculation */
+                if (ctx->view->buffered) {
+                    ctx->view->aborted = true;
+                    HALT(STATUS_ABORTED);
+                }
 
-                POP(); // Throw away value argument (TODO: Balances?)
-                size_t offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
+                UInt256 value = POP(); // TODO: Balances?
+                uint64_t offset = to_offset(POP()), size = to_offset(POP());
 
-                /* Pop unused `salt` parameter if CREATE2 */
-                if (opcode == OP_CREATE2) /* _salt = */ POP();
+                /* Return data of an earlier call doesn't outlive the next one */
+                ctx->return_data = NULL;
+                ctx->return_data_size = 0;
 
-                size_t code_size = size;
-                uint8_t *code = malloc(code_size);
+                const uint8_t *init_bytes = Memory_expand(ctx->memory, offset, size);
+                EXPANDED(init_bytes != NULL);
 
-                for (size_t i = 0; i < code_size; i++)
-                    code[i] = ctx->memory->array[offset + i];
+                if (ctx->depth + 1 >= CALL_DEPTH_MAX) {
+                    if (opcode == OP_CREATE2) ctx->stack_top--; /* Drop salt */
+                    PUSH(ZERO);
+                    break;
+                }
 
-                Contract *contract = (Contract*)malloc(sizeof(Contract));
-                
-                contract->code = code;
-                contract->code_size = code_size;
-                contract->address = add_contract(vm, contract);
+                /* Init code is cached like any other, factories reuse its analysis */
+                Code *init_code = CodeCache_insert(&vm->codes, init_bytes, size);
+
+                /* Journaled like every account change, a revert further out takes it back */
+                uint64_t nonce = StateView_increment_nonce(ctx->view, &vm->accounts, &ctx->address);
+
+                Address address;
+                if (opcode == OP_CREATE2) {
+                    UInt256 salt = POP();
+                    address = Address_create2(&ctx->address, &salt, &init_code->hash);
+                } else {
+                    address = Address_create(&ctx->address, nonce);
+                }
+
+                /* Fail on address collision */
+                if (Accounts_get(&vm->accounts, &address) != NULL) {
+                    CodeCache_release(&vm->codes, init_code);
+                    PUSH(ZERO);
+                    break;
+                }
+
+                /* Journaled, so a failing init frame or a revert further out removes it */
+                size_t checkpoint = StateView_checkpoint(ctx->view);
+                Account *account = StateView_create_account(ctx->view, &vm->accounts, &address);
+                account->nonce = 1;
+
+                /* Run init code, the result is handled once the frame halts */
+                Context *subcontext = new_frame();
 
-                PUSH(UInt256_from(add_contract(vm, contract)));
+                subcontext->kind = opcode;
+                subcontext->code = init_code;
+                subcontext->init_code = init_code;
+
+                subcontext->calldata = NULL;
+                subcontext->calldata_size = 0;
+
+                subcontext->address = address;
+                subcontext->sender = ctx->address;
+                subcontext->value = value;
+
+                subcontext->storage = account->storage;
+                subcontext->view = ctx->view;
+                subcontext->transient = ctx->transient;
+
+                PROFILE_FRAME(subcontext, ctx, &address);
+                ENTER(subcontext);
+
+                /* The init frame's own revert undoes creating its account */
+                ctx->view_checkpoint = checkpoint;
 
                 break;
             }
@@ -714,93 +1078,349 @@ bool VM_call(VM *vm, Context *ctx, Logs *out_logs) {
             case OP_CALLCODE:
             case OP_DELEGATECALL:
             case OP_STATICCALL: {
-                UInt256 _gas = POP(), value; // TODO: Maybe implement some form of gas accounting?
-                size_t address = TO_SIZE_T(POP());
+                UInt256 _gas = POP(), value = ZERO; // TODO: Maybe implement some form of gas accounting?
+                UInt256 _address = POP();
+                Address address = Address_from_uint256(&_address);
                 
                 /* Only CALL and CALLCODE take a `value` parameter */
                 if (opcode == OP_CALL || opcode == OP_CALLCODE) value = POP();
             
-                size_t args_offset = TO_SIZE_T(POP()), args_size = TO_SIZE_T(POP()), return_offset = TO_SIZE_T(POP()), return_size = TO_SIZE_T(POP());
+                uint64_t args_offset = to_offset(POP()), args_size = to_offset(POP()), return_offset = to_offset(POP()), return_size = to_offset(POP());
 
-                Contract *contract = vm->contracts[address];
+                /* Return data of an earlier call doesn't outlive the next one */
+                ctx->return_data = NULL;
+                ctx->return_data_size = 0;
 
-                Context subcontext;
+                /* Both regions are part of the caller's memory from now on, the output one first so args don't move */
+                EXPANDED(Memory_expand(ctx->memory, return_offset, return_size) != NULL);
 
-                /*
-                 * Populate subcontext, start with shared attributes 
-                 * (code, stack, calldata, return data, address of contract to call)
-                 */
-                subcontext.code = contract->code;
-                subcontext.code_size = contract->code_size;
-
-                subcontext.stack_top = subcontext.stack;
-
-                subcontext.calldata = &ctx->memory->array[args_offset];
-                subcontext.calldata_size = args_size;
+                uint8_t *args = Memory_expand(ctx->memory, args_offset, args_size);
+                EXPANDED(args != NULL);
 
-                subcontext.return_data = (uint8_t*)malloc(return_size);
-                subcontext.return_data_size = return_size;
+                Account *account = StateView_account(ctx->view, &vm->accounts, &address);
 
-                subcontext.address = address;
-
-                subcontext.value = opcode == OP_DELEGATECALL ? ctx->value : value;
+                /* Calls to accounts without code succeed and return nothing */
+                if (account == NULL || account->code == NULL) {
+                    PUSH(ONE);
+                    break;
+                }
 
-                if (opcode == OP_CALL) {
-                    subcontext.sender = ctx->address;
-                    Memory_init(subcontext.memory);
-                    subcontext.storage = &contract->storage;
-                } else /* OP_CALLCODE || OP_DELEGATECALL */ {
-                    subcontext.sender = ctx->sender; /* Sender carries over from current ctx */
-                    subcontext.storage = ctx->storage;
+                /* Calls past the depth limit fail without running */
+                if (ctx->depth + 1 >= CALL_DEPTH_MAX) {
+                    PUSH(ZERO);
+                    break;
                 }
 
-                bool status = VM_call(vm, &subcontext, out_logs);
-                PUSH(UInt256_from(status));
+                Context *subcontext = new_frame();
 
-                /* Insert return data into Memory */
-                Memory_insert(ctx->memory, return_offset, subcontext.return_data, return_size);
+                /*
+                 * Populate subcontext, start with shared attributes 
+                 * (code, calldata, memory, where to put the result)
+                 */
+                subcontext->kind = opcode;
+                subcontext->code = account->code;
+                subcontext->init_code = NULL;
+
+                /* Caller's memory can't move while the callee runs, it has its own */
+                subcontext->calldata = args;
+                subcontext->calldata_size = args_size;
+
+                subcontext->return_offset = return_offset;
+                subcontext->return_size = return_size;
+
+                subcontext->view = ctx->view;
+                subcontext->transient = ctx->transient;
+
+                if (opcode == OP_CALL || opcode == OP_STATICCALL) {
+                    subcontext->address = address;
+                    subcontext->sender = ctx->address;
+                    subcontext->value = value;
+                    subcontext->storage = account->storage;
+                } else if (opcode == OP_CALLCODE) {
+                    /* Run callee's code against own storage */
+                    subcontext->address = ctx->address;
+                    subcontext->sender = ctx->address;
+                    subcontext->value = value;
+                    subcontext->storage = ctx->storage;
+                } else /* OP_DELEGATECALL */ {
+                    /* Sender and value carry over from current ctx */
+                    subcontext->address = ctx->address;
+                    subcontext->sender = ctx->sender;
+                    subcontext->value = ctx->value;
+                    subcontext->storage = ctx->storage;
+                }
 
-                free(subcontext.return_data); /* No longer need return data buffer */
+                PROFILE_FRAME(subcontext, ctx, &address);
+                ENTER(subcontext);
 
                 break;
             }
 
             case OP_RETURN: {
-                size_t offset = TO_SIZE_T(POP()), size = TO_SIZE_T(POP());
+                uint64_t offset = to_offset(POP()), size = to_offset(POP());
 
-                uint8_t* return_data = malloc(size);
+                const uint8_t *data = Memory_expand(ctx->memory, offset, size);
+                EXPANDED(data != NULL);
 
-                for (size_t i = 0; i < size; i++)
-                    return_data[i] = ctx->memory->array[offset + i];
-                
-                ctx->return_data = return_data;
-                ctx->return_data_size = size;
+                ctx->return_data = return_buffer(ctx, size);
+                EXPANDED(size == 0 || ctx->return_data != NULL);
 
-                /* Don't need to store state for case of reversion */
-                Storage_free(&old_storage);
-                Memory_free(&old_memory);
+                if (size > 0) memcpy(ctx->return_data, data, size);
+                ctx->return_data_size = size;
 
-                return true; /* Success */
+                HALT(STATUS_SUCCESS);
             }
 
             case OP_REVERT: {
-                /* Revert changes by restoring original state */
-                Storage_move(&old_storage, ctx->storage);
-                Memory_move(&old_memory, ctx->memory);
+                /* Reason is handed back to the caller like return data */
+                uint64_t offset = to_offset(POP()), size = to_offset(POP());
+
+                const uint8_t *data = Memory_expand(ctx->memory, offset, size);
+                EXPANDED(data != NULL);
 
-                return false;
+                ctx->return_data = return_buffer(ctx, size);
+                EXPANDED(size == 0 || ctx->return_data != NULL);
+
+                if (size > 0) memcpy(ctx->return_data, data, size);
+                ctx->return_data_size = size;
+
+                HALT(STATUS_REVERT);
             }
 
             case OP_SELFDESTRUCT: {
-                error("Unhandled opcode SELFDESTRUCT\n");
-                break;
+                HALT(STATUS_UNSUPPORTED_OPCODE);
             }
 
             default: {
-                error("Unexpected opcode %d\n", opcode);
+                HALT(STATUS_INVALID_OPCODE);
             }
         }
+
+        continue;
+
+    halted:
+        /* Only RETURN and REVERT leave output, faults don't */
+        if (status != STATUS_SUCCESS && status != STATUS_REVERT) {
+            ctx->return_data = NULL;
+            ctx->return_data_size = 0;
+        }
+
+        if (status != STATUS_SUCCESS) {
+            /* Revert changes by unwinding journals */
+            StateView_revert(ctx->view, ctx->view_checkpoint, &vm->codes);
+            TransientStorage_revert(ctx->transient, ctx->transient_checkpoint);
+            Logs_truncate(out_logs, ctx->logs_length);
+        }
+
+        if (ctx->caller == NULL) {
+            execution->status = status;
+            execution->finished = true;
+            PROFILE_END();
+            return true;
+        }
+
+        Context *frame = ctx;
+        ctx = execution->frame = frame->caller;
+        pc = ctx->pc;
+
+        /* Speculation gave up, so does every frame below */
+        if (status == STATUS_ABORTED) {
+            drop(vm, frame);
+            goto halted;
+        }
+
+        leave(vm, frame, status);
+    }
+
+    #undef POP
+    #undef PUSH
+    #undef HALT
+    #undef EXPANDED
+    #undef AWAIT_SLOT
+    #undef ENTER
+}
+
+/* Prepare to run `root`, a caller-owned outermost frame, appending to `logs` */
+void Execution_init(Execution *execution, VM *vm, Context *root, Logs *logs) {
+    execution->vm = vm;
+    execution->root = root;
+    execution->frame = NULL;
+    execution->logs = logs;
+    execution->budget = 0;
+    execution->executed = 0;
+    execution->finished = false;
+    execution->status = STATUS_SUCCESS;
+    execution->backend = NULL;
+    execution->waiting = false;
+
+    root->kind = OP_STOP;
+    root->init_code = NULL;
+
+    PROFILE_FRAME(root, (Context*)NULL, &root->address);
+    enter(execution, root);
+}
+
+/*
+ * Execute at most `budget` more instructions. Returns true once the
+ * outermost frame has halted (see `status`), false if the execution
+ * was suspended and can be resumed with another call. If `waiting`
+ * is set it was suspended on a Backend load, the loaded value must
+ * be inserted into its Storage before running again
+ */
+bool Execution_run(Execution *execution, uint64_t budget) {
+    if (execution->finished)
+        return true;
+
+    execution->waiting = false;
+
+    execution->budget = budget;
+
+    /* Lets a sampling signal see where the thread is */
+    SamplerSite *site = Sampler_site();
+    site->execution = execution;
+
+#ifdef PROFILE
+    uint64_t counters[PROFILE_COUNTERS];
+
+    Profile_run_begin(counters);
+    bool finished = run(execution, site);
+    Profile_run_end(counters);
+#else
+    bool finished = run(execution, site);
+#endif
+
+    site->execution = NULL;
+
+    return finished;
+}
+
+/* Give up on a suspended execution, undoing everything it did. Not while `waiting`, the backend still holds its load */
+void Execution_abort(Execution *execution) {
+    if (execution->finished)
+        return;
+
+    Context *root = execution->root;
+
+    StateView_revert(root->view, root->view_checkpoint, &execution->vm->codes);
+    TransientStorage_revert(root->transient, root->transient_checkpoint);
+    Logs_truncate(execution->logs, root->logs_length);
+
+    /* Return data of a call the root made isn't its output */
+    root->return_data = NULL;
+    root->return_data_size = 0;
+
+    while (execution->frame != root) {
+        Context *frame = execution->frame;
+        execution->frame = frame->caller;
+        drop(execution->vm, frame);
+    }
+
+    execution->status = STATUS_ABORTED;
+    execution->finished = true;
+}
+
+/*
+ * Run `ctx` to completion. Faults never leave the frame: they come
+ * back as a status, with every state change made by the frame undone.
+ * Return data is left in ctx->return_data for the caller to free
+ */
+Status VM_call(VM *vm, Context *ctx, Logs *out_logs) {
+    Execution execution;
+
+    ctx->return_buffer = NULL;
+    ctx->return_capacity = 0;
+
+    Execution_init(&execution, vm, ctx, out_logs);
+    Execution_run(&execution, UINT64_MAX);
+
+    return execution.status;
+}
+
+/*
+ * Set up a transaction as a call from `sender` to `to`, reading and
+ * writing state through `view`. Run it with Execution_run, then
+ * collect the receipt with Execution_finish
+ */
+void VM_begin(VM *vm, const Transaction *transaction, StateView *view, TransientStorage *transient, Execution *execution) {
+    Logs *logs = new_logs();
+
+    Account *account = StateView_account(view, &vm->accounts, &transaction->to);
+
+    /* Nothing to run, transaction trivially succeeds */
+    if (account == NULL || account->code == NULL) {
+        execution->vm = vm;
+        execution->root = NULL;
+        execution->frame = NULL;
+        execution->logs = logs;
+        execution->budget = 0;
+        execution->executed = 0;
+        execution->finished = true;
+        execution->status = STATUS_SUCCESS;
+        execution->backend = NULL;
+        execution->waiting = false;
+        return;
+    }
+
+    Context *ctx = new_frame();
+
+    ctx->code = account->code;
+    ctx->value = transaction->value;
+    ctx->address = transaction->to;
+    ctx->sender = transaction->sender;
+    ctx->storage = account->storage;
+    ctx->view = view;
+    ctx->transient = transient;
+    ctx->calldata = (uint8_t*)transaction->calldata;
+    ctx->calldata_size = transaction->calldata_size;
+
+    Execution_init(execution, vm, ctx, logs);
+}
+
+/* Fill `receipt` from a finished (or aborted) execution and free it */
+void Execution_finish(Execution *execution, Receipt *receipt) {
+    Context *root = execution->root;
+
+    receipt->status = execution->status;
+    receipt->logs = *execution->logs;
+    receipt->return_data = root == NULL ? NULL : root->return_data;
+    receipt->return_data_size = root == NULL ? 0 : root->return_data_size;
+    receipt->return_capacity = 0;
+
+    if (root != NULL) {
+        /* The receipt takes the buffer holding the return data */
+        if (root->return_data != NULL) {
+            receipt->return_capacity = root->return_capacity;
+            root->return_buffer = NULL;
+            root->return_capacity = 0;
+        }
+
+        recycle_frame(root);
     }
 
-    error("Expected RETURN in bytecode\n");
+    recycle_logs(execution->logs);
 }
+
+/* Run a transaction to completion, see VM_begin. Receipt is owned by the caller */
+Status VM_execute(VM *vm, const Transaction *transaction, StateView *view, TransientStorage *transient, Receipt *receipt) {
+    Execution execution;
+
+    VM_begin(vm, transaction, view, transient, &execution);
+    Execution_run(&execution, UINT64_MAX);
+    Execution_finish(&execution, receipt);
+
+    return receipt->status;
+}
+
+void Receipt_free(Receipt *receipt) {
+    /* Keep the larger of this buffer and the spare one for the next RETURN */
+    if (receipt->return_capacity > spare_return_capacity) {
+        hold_spares();
+        Alloc_free(spare_return);
+        spare_return = receipt->return_data;
+        spare_return_capacity = receipt->return_capacity;
+    } else {
+        Alloc_free(receipt->return_data);
+    }
+
+    Logs_free(&receipt->logs);
+}
\ No newline at end of file
@@ -3,38 +3,80 @@
 
 #include "common.h"
 #include "storage.h"
+#include "accounts.h"
+#include "transient.h"
+#include "view.h"
+#include "backend.h"
 #include "memory.h"
 #include "logs.h"
 #include "ops.h"
 
 /* 
- * For simplicity, store Stack, Contracts, Calldata,
+ * For simplicity, store Stack, Calldata,
  * and Return Buffer as static arrays
  */
 #define STACK_MAX 1024
-#define CONTRACT_MAX 1024
 #define CALLDATA_MAX 1024
 #define RET_MAX 1024
 
-typedef struct {
-    uint8_t *code;
-    size_t code_size;
+/* Nested CALL/CREATE frames allowed below a transaction */
+#define CALL_DEPTH_MAX 1024
 
-    size_t address;
+/* How a call frame finished, anything but success undoes its changes */
+typedef enum {
+    STATUS_SUCCESS,
+    STATUS_REVERT,
+    STATUS_STACK_UNDERFLOW,
+    STATUS_STACK_OVERFLOW,
+    STATUS_INVALID_JUMP,
+    STATUS_INVALID_OPCODE,
+    STATUS_UNSUPPORTED_OPCODE,
 
-    Storage storage;
-} Contract;
+    /* Memory touched past MEMORY_MAX, or it couldn't be allocated */
+    STATUS_OUT_OF_MEMORY,
 
-typedef struct {
-    uint8_t *code;
-    size_t code_size;
+    /* Speculative execution hit something it can't buffer, or Execution_abort */
+    STATUS_ABORTED,
+
+    /* Process running the call died before answering */
+    STATUS_CRASHED,
+} Status;
+
+extern const char *STATUS_TO_NAME[];
+
+typedef struct Context {
+    const Code *code;
+
+    /* Frame that made this call, NULL for the outermost one */
+    struct Context *caller;
+
+    /* Number of frames below this one */
+    size_t depth;
+
+    /* Opcode that created the frame, OP_STOP for the outermost one */
+    OpCode kind;
+
+    /* Where to continue once the frame is resumed */
+    size_t pc;
+
+    /* Journal positions to unwind to if the frame fails */
+    size_t view_checkpoint;
+    size_t transient_checkpoint;
+    size_t logs_length;
+
+    /* CALL family: caller's memory region for the return data */
+    size_t return_offset;
+    size_t return_size;
+
+    /* CREATE: reference to the running init code, released when the frame ends */
+    Code *init_code;
 
     UInt256 value;
 
-    size_t address;
+    /* Account whose storage is in use (caller's for DELEGATECALL/CALLCODE) */
+    Address address;
 
-    /* Index of calling Contract in Contract array */
-    size_t sender;
+    Address sender;
 
     UInt256 stack[STACK_MAX];
     UInt256 *stack_top;
@@ -43,23 +85,97 @@ typedef struct {
 
     Storage *storage;
 
+    /* Shared by every call frame of the transaction */
+    StateView *view;
+    TransientStorage *transient;
+
     uint8_t *calldata;
     size_t calldata_size;
 
+    /* Output of the last call the frame made, then the frame's own once it halts */
     uint8_t *return_data;
     size_t return_data_size;
+
+    /* Buffer RETURN and REVERT copy into, kept with the frame when it's recycled */
+    uint8_t *return_buffer;
+    size_t return_capacity;
+
+#ifdef PROFILE
+    /* Call graph node the frame's instructions count towards, see profile.h */
+    struct CallNode *profile_node;
+#endif
 } Context;
 
 typedef struct {
-    /*
-     * For purposes of simplified EVM, (only need to execute one root contract
-     * at a time) represent contracts as index-addressable stack
-     */
-    Contract *contracts[CONTRACT_MAX];
-    size_t contracts_length;
+    Accounts accounts;
+
+    /* Code and analysis shared by all accounts with the same code hash */
+    CodeCache codes;
+
+    /* Log of committed changes, NULL to keep state in memory only */
+    struct Wal *wal;
 } VM;
 
+/*
+ * A call in progress. Suspends when its instruction budget runs
+ * out and resumes from the same frame and pc on the next run
+ */
+typedef struct Execution {
+    VM *vm;
+
+    Context *root;
+
+    /* Innermost frame, its callers are reachable through Context.caller */
+    Context *frame;
+
+    Logs *logs;
+
+    /* Instructions left in the current run and executed overall */
+    uint64_t budget;
+    uint64_t executed;
+
+    /* Set once the outermost frame halted, with its status */
+    bool finished;
+    Status status;
+
+    /* Where slots missing from backed storage come from, NULL to treat them as zero */
+    Backend *backend;
+
+    /* Suspended until `load` completes, resume once its value is in Storage */
+    bool waiting;
+    Load load;
+} Execution;
+
+typedef struct {
+    Address sender;
+    Address to;
+    UInt256 value;
+
+    const uint8_t *calldata;
+    size_t calldata_size;
+} Transaction;
+
+typedef struct {
+    Status status;
+
+    uint8_t *return_data;
+    size_t return_data_size;
+
+    /* Size of the return data's buffer, which Receipt_free keeps for reuse */
+    size_t return_capacity;
+
+    Logs logs;
+} Receipt;
+
 void VM_init(VM *vm);
-bool VM_call(VM *vm, Context *ctx, Logs *out_logs);
+Status VM_call(VM *vm, Context *ctx, Logs *out_logs);
+Status VM_execute(VM *vm, const Transaction *transaction, StateView *view, TransientStorage *transient, Receipt *receipt);
+void VM_begin(VM *vm, const Transaction *transaction, StateView *view, TransientStorage *transient, Execution *execution);
+
+void Execution_init(Execution *execution, VM *vm, Context *root, Logs *logs);
+bool Execution_run(Execution *execution, uint64_t budget);
+void Execution_abort(Execution *execution);
+void Execution_finish(Execution *execution, Receipt *receipt);
+void Receipt_free(Receipt *receipt);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,582 @@
+/**
+ * Write-ahead log. Integers are little-endian, 256-bit words are
+ * big-endian like everywhere else in the VM:
+ *
+ *   slot:    1, address[20], key[32], value[32]
+ *   account: 2, address[20], balance[32], nonce u64, code size u32,
+ *            code (size CODE_UNCHANGED and no code if already logged)
+ *   commit:  3, sequence u64, crc32 u32 of the group's other records
+ *
+ * Appends encode into a buffer under the lock. In group mode a
+ * flusher thread swaps the buffer out, writes and syncs it, then
+ * wakes every commit the sync covered, so commits that pile up
+ * during one fdatasync share the next one
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+#define RECORD_SLOT 1
+#define RECORD_ACCOUNT 2
+#define RECORD_COMMIT 3
+
+#define SLOT_RECORD_SIZE (1 + 20 + 32 + 32)
+#define ACCOUNT_RECORD_SIZE (1 + 20 + 32 + 8 + 4)
+#define COMMIT_RECORD_SIZE (1 + 8 + 4)
+
+#define CODE_UNCHANGED UINT32_MAX
+
+#define DEFAULT_CAPACITY 4096
+#define GROWTH_RATE 2
+
+const char *WAL_MODE_TO_NAME[] = {
+    [WAL_ASYNC] = "async",
+    [WAL_GROUP] = "group",
+    [WAL_SYNC] = "sync",
+};
+
+static uint32_t CRC_TABLE[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* Reflected CRC-32 (IEEE) */
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+
+        CRC_TABLE[i] = crc;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size) {
+    uint32_t crc = UINT32_MAX;
+
+    for (size_t i = 0; i < size; i++)
+        crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)p[i] << (8 * i);
+    return value;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+/* Grow `buffer` by `size` bytes, returns where they start */
+static uint8_t *reserve(WalBuffer *buffer, size_t size) {
+    if (buffer->length + size > buffer->capacity) {
+        while (buffer->length + size > buffer->capacity)
+            buffer->capacity = buffer->capacity == 0 ? DEFAULT_CAPACITY : buffer->capacity * GROWTH_RATE;
+
+        buffer->bytes = (uint8_t*)realloc(buffer->bytes, buffer->capacity);
+    }
+
+    uint8_t *start = buffer->bytes + buffer->length;
+    buffer->length += size;
+    return start;
+}
+
+static void encode_slot(WalBuffer *buffer, const Address *address, const UInt256 *key, const UInt256 *value) {
+    uint8_t *p = reserve(buffer, SLOT_RECORD_SIZE);
+
+    p[0] = RECORD_SLOT;
+    memcpy(p + 1, address->bytes, 20);
+    UInt256_store(key, p + 21);
+    UInt256_store(value, p + 53);
+}
+
+static void encode_account(WalBuffer *buffer, const Account *account, bool with_code) {
+    size_t code_size = with_code && account->code != NULL ? account->code->size : 0;
+    uint8_t *p = reserve(buffer, ACCOUNT_RECORD_SIZE + code_size);
+
+    p[0] = RECORD_ACCOUNT;
+    memcpy(p + 1, account->address.bytes, 20);
+    UInt256_store(&account->balance, p + 21);
+    put_u64(p + 53, account->nonce);
+    put_u32(p + 61, with_code ? (uint32_t)code_size : CODE_UNCHANGED);
+
+    if (code_size > 0) memcpy(p + ACCOUNT_RECORD_SIZE, account->code->bytes, code_size);
+}
+
+/* Close the group of records starting at `start` */
+static void encode_commit(WalBuffer *buffer, size_t start, uint64_t sequence) {
+    uint32_t crc = crc32(buffer->bytes + start, buffer->length - start);
+    uint8_t *p = reserve(buffer, COMMIT_RECORD_SIZE);
+
+    p[0] = RECORD_COMMIT;
+    put_u64(p + 1, sequence);
+    put_u32(p + 9, crc);
+}
+
+/* False with errno set if not everything could be written */
+static bool write_all(int fd, const uint8_t *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        bytes += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+/* Write and maybe sync `size` bytes to the log, returns errno on failure or 0 */
+static int write_log(int fd, const uint8_t *bytes, size_t size, bool sync) {
+    if (!write_all(fd, bytes, size) || (sync && fdatasync(fd) < 0))
+        return errno;
+
+    return 0;
+}
+
+/* Address of the account owning `storage`, rebuilding the index if it's new */
+static bool owner(Wal *wal, const VM *vm, const Storage *storage, Address *address) {
+    Location location = { .kind = LOCATION_SLOT, .space = storage, .key = ZERO };
+    UInt256 *found = LocationMap_get(&wal->owners, &location);
+
+    if (found == NULL) {
+        for (size_t i = 0; i < vm->accounts.length; i++) {
+            const Account *account = &vm->accounts.accounts[i];
+            Location owned = { .kind = LOCATION_SLOT, .space = account->storage, .key = ZERO };
+            UInt256 integer = Address_to_uint256(&account->address);
+
+            LocationMap_set(&wal->owners, &owned, &integer);
+        }
+
+        found = LocationMap_get(&wal->owners, &location);
+        if (found == NULL) return false;
+    }
+
+    *address = Address_from_uint256(found);
+    return true;
+}
+
+/* Whether `account`'s code has to go in its record, i.e. it changed since last logged */
+static bool code_changed(Wal *wal, const Account *account, const UInt256 *key) {
+    Location location = { .kind = LOCATION_ACCOUNT, .space = NULL, .key = *key };
+    UInt256 *logged = LocationMap_get(&wal->logged_code, &location);
+    uint64_t code = (uint64_t)(uintptr_t)account->code;
+
+    if (logged != NULL && logged->elements[3] == code) return false;
+
+    LocationMap_set(&wal->logged_code, &location, &(UInt256){ { 0, 0, 0, code } });
+    return true;
+}
+
+/* Apply a group of records already checked by replay */
+static void apply(VM *vm, const uint8_t *p, const uint8_t *end) {
+    while (p < end) {
+        Address address;
+        memcpy(address.bytes, p + 1, 20);
+
+        if (p[0] == RECORD_SLOT) {
+            UInt256 key, value;
+            UInt256_load_padded(&key, p, SLOT_RECORD_SIZE, 21);
+            UInt256_load_padded(&value, p, SLOT_RECORD_SIZE, 53);
+
+            Storage_insert(Accounts_insert(&vm->accounts, &address)->storage, &key, &value);
+            p += SLOT_RECORD_SIZE;
+        } else {
+            Account *account = Accounts_insert(&vm->accounts, &address);
+            uint32_t code_size = get_u32(p + 61);
+
+            UInt256_load_padded(&account->balance, p, ACCOUNT_RECORD_SIZE, 21);
+            account->nonce = get_u64(p + 53);
+
+            if (code_size != CODE_UNCHANGED) {
+                if (account->code != NULL) CodeCache_release(&vm->codes, account->code);
+                account->code = code_size == 0 ? NULL : CodeCache_insert(&vm->codes, p + ACCOUNT_RECORD_SIZE, code_size);
+            }
+
+            p += ACCOUNT_RECORD_SIZE + (code_size == CODE_UNCHANGED ? 0 : code_size);
+        }
+    }
+}
+
+/*
+ * Apply every complete group in the file at `path` to `vm`, setting
+ * `*valid` to the length of the valid prefix: anything after it is
+ * torn. False with errno set if the file is there but can't be read
+ */
+static bool replay(VM *vm, const char *path, size_t *valid, uint64_t *sequence, size_t *groups) {
+    *valid = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const uint8_t *data = (const uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) return false;
+
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+
+    size_t position = 0, group = 0;
+
+    while (position < size) {
+        size_t left = size - position;
+        const uint8_t *p = data + position;
+
+        if (p[0] == RECORD_SLOT && left >= SLOT_RECORD_SIZE) {
+            position += SLOT_RECORD_SIZE;
+        } else if (p[0] == RECORD_ACCOUNT && left >= ACCOUNT_RECORD_SIZE) {
+            uint32_t code_size = get_u32(p + 61);
+            size_t record_size = ACCOUNT_RECORD_SIZE + (code_size == CODE_UNCHANGED ? 0 : code_size);
+
+            if (left < record_size) break;
+            position += record_size;
+        } else if (p[0] == RECORD_COMMIT && left >= COMMIT_RECORD_SIZE) {
+            if (crc32(data + group, position - group) != get_u32(p + 9)) break;
+
+            apply(vm, data + group, p);
+
+            *sequence = get_u64(p + 1);
+            (*groups)++;
+
+            position += COMMIT_RECORD_SIZE;
+            group = position;
+        } else {
+            break;
+        }
+    }
+
+    munmap((void*)data, size);
+
+    *valid = group;
+    return true;
+}
+
+static void *flush(void *arg) {
+    Wal *wal = (Wal*)arg;
+
+    pthread_mutex_lock(&wal->lock);
+
+    for (;;) {
+        while (wal->buffer.length == 0 && !wal->stopping)
+            pthread_cond_wait(&wal->pending, &wal->lock);
+
+        if (wal->buffer.length == 0) break;
+
+        /* Take everything appended so far, appends continue into the other buffer */
+        WalBuffer batch = wal->buffer;
+        wal->buffer = wal->spare;
+        wal->spare = batch;
+
+        uint64_t target = wal->appended;
+        bool failed = wal->failure != 0;
+        wal->flushing = true;
+
+        pthread_mutex_unlock(&wal->lock);
+
+        /* What follows a torn group is dropped on recovery, so a failure stops the writing */
+        int failure = failed ? 0 : write_log(wal->fd, wal->spare.bytes, wal->spare.length, wal->mode == WAL_GROUP);
+
+        wal->spare.length = 0;
+
+        pthread_mutex_lock(&wal->lock);
+
+        if (failure != 0) wal->failure = failure;
+        wal->flushing = false;
+        wal->durable = target;
+        if (wal->mode == WAL_GROUP) wal->syncs++;
+
+        pthread_cond_broadcast(&wal->flushed);
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+
+/*
+ * Open the log in `directory` (created if missing), replay the
+ * snapshot and then the log into `vm`, and cut off a torn tail.
+ * False with errno set if the directory or its files can't be
+ * used, `vm` may hold part of the replayed state then
+ */
+bool Wal_init(Wal *wal, VM *vm, const char *directory, WalMode mode) {
+    pthread_once(&crc_once, crc_init);
+
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST)
+        return false;
+
+    size_t length = strlen(directory) + sizeof("/snapshot.tmp");
+
+    wal->log_path = (char*)malloc(length);
+    wal->snapshot_path = (char*)malloc(length);
+    snprintf(wal->log_path, length, "%s/log", directory);
+    snprintf(wal->snapshot_path, length, "%s/snapshot", directory);
+
+    wal->mode = mode;
+    wal->sequence = 0;
+    wal->recovered = 0;
+
+    double start = now();
+    size_t valid;
+
+    bool opened = replay(vm, wal->snapshot_path, &valid, &wal->sequence, &wal->recovered) &&
+        replay(vm, wal->log_path, &valid, &wal->sequence, &wal->recovered);
+
+    wal->recovery_seconds = now() - start;
+
+    wal->fd = opened ? open(wal->log_path, O_WRONLY | O_CREAT | O_APPEND, 0644) : -1;
+    opened = wal->fd >= 0 && ftruncate(wal->fd, (off_t)valid) == 0;
+
+    if (!opened) {
+        int saved = errno;
+        if (wal->fd >= 0) close(wal->fd);
+        free(wal->log_path);
+        free(wal->snapshot_path);
+        errno = saved;
+        return false;
+    }
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->pending, NULL);
+    pthread_cond_init(&wal->flushed, NULL);
+
+    wal->buffer = (WalBuffer){ NULL, 0, 0 };
+    wal->spare = (WalBuffer){ NULL, 0, 0 };
+
+    wal->appended = 0;
+    wal->durable = 0;
+    wal->flushing = false;
+    wal->stopping = false;
+
+    LocationMap_init(&wal->owners);
+    LocationMap_init(&wal->logged_code);
+
+    wal->commits = 0;
+    wal->syncs = 0;
+    wal->failure = 0;
+
+    if (mode != WAL_SYNC)
+        pthread_create(&wal->flusher, NULL, flush, wal);
+
+    return true;
+}
+
+/*
+ * Log the locations in `writes` (a transaction's StateView writes)
+ * with their current values in `vm`, as one commit. Returns the log
+ * position to pass to Wal_wait. Safe to call from several threads,
+ * as long as none of them changes `vm` meanwhile
+ */
+uint64_t Wal_append(Wal *wal, VM *vm, const LocationMap *writes) {
+    pthread_mutex_lock(&wal->lock);
+
+    size_t start = wal->buffer.length;
+
+    for (size_t i = 0; i < writes->capacity; i++) {
+        const LocationEntry *entry = &writes->entries[i];
+        if (!entry->used) continue;
+
+        if (entry->location.kind == LOCATION_SLOT) {
+            Address address;
+
+            if (owner(wal, vm, (const Storage*)entry->location.space, &address))
+                encode_slot(&wal->buffer, &address, &entry->location.key, &entry->value);
+        } else {
+            Address address = Address_from_uint256(&entry->location.key);
+            const Account *account = Accounts_get(&vm->accounts, &address);
+
+            if (account != NULL)
+                encode_account(&wal->buffer, account, code_changed(wal, account, &entry->location.key));
+        }
+    }
+
+    if (wal->buffer.length > start) {
+        encode_commit(&wal->buffer, start, ++wal->sequence);
+
+        wal->appended += wal->buffer.length - start;
+        wal->commits++;
+
+        if (wal->mode == WAL_SYNC) {
+            if (wal->failure == 0) wal->failure = write_log(wal->fd, wal->buffer.bytes, wal->buffer.length, true);
+
+            wal->buffer.length = 0;
+            wal->durable = wal->appended;
+            wal->syncs++;
+        } else {
+            pthread_cond_signal(&wal->pending);
+        }
+    }
+
+    uint64_t position = wal->appended;
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return position;
+}
+
+/*
+ * Block until everything up to `position` is on disk, returns at
+ * once in async mode. False with errno set if the log failed to
+ * write or sync, then nothing appended since is logged
+ */
+bool Wal_wait(Wal *wal, uint64_t position) {
+    pthread_mutex_lock(&wal->lock);
+
+    while (wal->mode == WAL_GROUP && wal->durable < position)
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+
+    int failure = wal->failure;
+
+    pthread_mutex_unlock(&wal->lock);
+
+    if (failure != 0) errno = failure;
+    return failure == 0;
+}
+
+/*
+ * Write all of `vm`'s state to a new snapshot and empty the log.
+ * The snapshot replaces the old one by rename, so a crash leaves
+ * either the old snapshot and full log or the new one. Replaying
+ * a log over a snapshot that already has it is harmless, records
+ * hold values and not deltas. `vm` must not change meanwhile.
+ * False with errno set if it failed, the log is kept then
+ */
+bool Wal_checkpoint(Wal *wal, VM *vm) {
+    pthread_mutex_lock(&wal->lock);
+
+    while (wal->flushing)
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+
+    WalBuffer snapshot = { NULL, 0, 0 };
+
+    for (size_t i = 0; i < vm->accounts.length; i++) {
+        const Account *account = &vm->accounts.accounts[i];
+        const Storage *storage = account->storage;
+
+        encode_account(&snapshot, account, true);
+
+        for (size_t j = 0; j < storage->capacity; j++)
+            if (storage->entries[j].used)
+                encode_slot(&snapshot, &account->address, &storage->entries[j].key, &storage->entries[j].value);
+    }
+
+    encode_commit(&snapshot, 0, wal->sequence);
+
+    size_t length = strlen(wal->snapshot_path) + sizeof(".tmp");
+    char *temporary = (char*)malloc(length);
+    snprintf(temporary, length, "%s.tmp", wal->snapshot_path);
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = fd >= 0 && write_all(fd, snapshot.bytes, snapshot.length) && fsync(fd) == 0;
+
+    if (fd >= 0) written = close(fd) == 0 && written;
+    written = written && rename(temporary, wal->snapshot_path) == 0;
+
+    int saved = errno;
+
+    if (!written) {
+        unlink(temporary);
+    } else {
+        /* Make the rename itself durable before dropping the log */
+        char *directory = strdup(wal->snapshot_path);
+        *strrchr(directory, '/') = '\0';
+
+        int directory_fd = open(directory, O_RDONLY);
+        if (directory_fd >= 0) {
+            fsync(directory_fd);
+            close(directory_fd);
+        }
+
+        free(directory);
+
+        /* A log left behind only replays values the snapshot already has */
+        written = ftruncate(wal->fd, 0) == 0;
+        saved = errno;
+
+        /* The snapshot holds everything, a torn log no longer matters */
+        if (written) wal->failure = 0;
+
+        /* Pending records are in the snapshot too */
+        wal->buffer.length = 0;
+        wal->durable = wal->appended;
+
+        pthread_cond_broadcast(&wal->flushed);
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+
+    free(snapshot.bytes);
+    free(temporary);
+
+    errno = saved;
+    return written;
+}
+
+/* Flush and sync whatever is left and close the log */
+void Wal_free(Wal *wal) {
+    if (wal->mode != WAL_SYNC) {
+        pthread_mutex_lock(&wal->lock);
+        wal->stopping = true;
+        pthread_cond_signal(&wal->pending);
+        pthread_mutex_unlock(&wal->lock);
+
+        pthread_join(wal->flusher, NULL);
+    }
+
+    fdatasync(wal->fd);
+    close(wal->fd);
+
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->pending);
+    pthread_cond_destroy(&wal->flushed);
+
+    LocationMap_free(&wal->owners);
+    LocationMap_free(&wal->logged_code);
+
+    free(wal->buffer.bytes);
+    free(wal->spare.bytes);
+    free(wal->log_path);
+    free(wal->snapshot_path);
+}
\ No newline at end of file
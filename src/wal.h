@@ -0,0 +1,83 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+
+#include "common.h"
+#include "view.h"
+#include "vm.h"
+
+typedef enum {
+    /* Written by a background thread, never synced: a machine crash can lose recent commits */
+    WAL_ASYNC,
+
+    /* Commits wait for a background sync that covers every commit appended before it */
+    WAL_GROUP,
+
+    /* Every commit is written and synced before Wal_append returns */
+    WAL_SYNC,
+} WalMode;
+
+extern const char *WAL_MODE_TO_NAME[];
+
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+    size_t capacity;
+} WalBuffer;
+
+/*
+ * Write-ahead log of state changes in `directory`. The log holds
+ * one group of records per committed transaction, each group
+ * closed by a commit record with a checksum, so a torn tail is
+ * detected and dropped on recovery. A checkpoint folds the state
+ * into a snapshot (in the same record format) and empties the log
+ */
+typedef struct Wal {
+    WalMode mode;
+
+    char *log_path;
+    char *snapshot_path;
+    int fd;
+
+    pthread_mutex_t lock;
+    pthread_cond_t pending;
+    pthread_cond_t flushed;
+
+    /* Records appended but not written yet, and a spare to swap in while writing */
+    WalBuffer buffer;
+    WalBuffer spare;
+
+    /* Log positions (bytes ever appended) of the last append and the last sync */
+    uint64_t appended;
+    uint64_t durable;
+
+    uint64_t sequence;
+
+    pthread_t flusher;
+    bool flushing;
+    bool stopping;
+
+    /* Address of each Storage, and the code last logged for each account */
+    LocationMap owners;
+    LocationMap logged_code;
+
+    /* Counters */
+    size_t commits;
+    size_t syncs;
+
+    /* errno of the first failed write or sync, 0 while the log is fine */
+    int failure;
+
+    /* What the last Wal_init replayed */
+    size_t recovered;
+    double recovery_seconds;
+} Wal;
+
+bool Wal_init(Wal *wal, VM *vm, const char *directory, WalMode mode);
+uint64_t Wal_append(Wal *wal, VM *vm, const LocationMap *writes);
+bool Wal_wait(Wal *wal, uint64_t position);
+bool Wal_checkpoint(Wal *wal, VM *vm);
+void Wal_free(Wal *wal);
+
+#endif
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <assert.h>
+
 #include "common.h"
 
 static UInt256 LIMIT = (UInt256){ { 0, 0, 0, ULLONG_MAX } };
@@ -25,6 +27,20 @@ void test_UInt256_length() {
     }
 }
 
+void test_UInt256_shiftright() {
+    for (int i = 1; i < 256; i++) {
+        UInt256 a = ONE;
+        UInt256_shiftleft(&a, 255);
+        UInt256_shiftright(&a, (uint32_t)i);
+        assert(UInt256_length(&a) == 256 - i);
+    }
+
+    // Bits shifted out of a limb land at the top of the next one
+    UInt256 b = (UInt256){ { 0, 0, 0xFF, 0 } };
+    UInt256_shiftright(&b, 4);
+    assert(b.elements[2] == 0xF && b.elements[3] == 0xF000000000000000ULL);
+}
+
 void test_UInt256_mult() {
     // char u256_out[255];
     // char double_out[255];
@@ -74,4 +90,36 @@ void test_UInt256_div() {
         UInt256_print_bits(&a_u256);
         printf("\n");
     }
+}
+
+void test_UInt256_load_store() {
+    uint8_t buffer[32], out[32];
+
+    for (int i = 0; i < 32; i++)
+        buffer[i] = (uint8_t)(i + 1);
+
+    UInt256 a;
+    UInt256_load(&a, buffer);
+    assert(a.elements[0] == 0x0102030405060708ULL);
+    assert(a.elements[3] == 0x191a1b1c1d1e1f20ULL);
+
+    UInt256_store(&a, out);
+    assert(memcmp(buffer, out, 32) == 0);
+
+    // Reads past the end of the buffer are zero padded
+    UInt256_load_padded(&a, buffer, 32, 30);
+    assert(a.elements[0] == 0x1f20000000000000ULL && a.elements[3] == 0);
+
+    // PUSH2 immediates land in the low-order bytes
+    UInt256_load_partial(&a, buffer, 32, 31, 2);
+    assert(a.elements[3] == 0x2000 && a.elements[0] == 0);
+}
+
+int main() {
+    test_UInt256_length();
+    test_UInt256_shiftright();
+    test_UInt256_load_store();
+
+    printf("uint256: ok\n");
+    return 0;
 }
\ No newline at end of file
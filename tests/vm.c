@@ -0,0 +1,208 @@
+/**
+ * VM-level tests: each one installs hex bytecode (assembly in the
+ * comment next to it) at an address, runs a call to it through
+ * VM_execute on a direct view and checks the receipt
+ */
+
+#include <assert.h>
+
+#include "common.h"
+#include "vm.h"
+#include "hex.h"
+
+static VM vm;
+static TransientStorage transient;
+
+static Address address(uint8_t last) {
+    Address address = { { 0 } };
+    address.bytes[19] = last;
+    return address;
+}
+
+static void install(const Address *at, uint64_t nonce, const char *hex) {
+    size_t size;
+    uint8_t *code = Hex_decode(hex, &size);
+    assert(code != NULL);
+
+    Account *account = Accounts_insert(&vm.accounts, at);
+    account->nonce = nonce;
+    account->code = CodeCache_insert(&vm.codes, code, size);
+
+    free(code);
+}
+
+static Status call(const Address *to, Receipt *receipt) {
+    Transaction transaction = { .sender = address(0xCA), .to = *to };
+
+    StateView view;
+    StateView_init(&view, false);
+
+    Status status = VM_execute(&vm, &transaction, &view, &transient, receipt);
+
+    TransientStorage_clear(&transient);
+    StateView_free(&view);
+
+    return status;
+}
+
+/* 32-byte word `index` of the return data, as its low 64 bits */
+static uint64_t word(const Receipt *receipt, size_t index) {
+    UInt256 value;
+    UInt256_load_padded(&value, receipt->return_data, receipt->return_data_size, 32 * index);
+    assert(value.elements[0] == 0 && value.elements[1] == 0 && value.elements[2] == 0);
+    return value.elements[3];
+}
+
+static void setup(void) {
+    VM_init(&vm);
+    TransientStorage_init(&transient);
+}
+
+static void teardown(void) {
+    TransientStorage_free(&transient);
+    Accounts_free(&vm.accounts);
+    CodeCache_free(&vm.codes);
+}
+
+/*
+ * Store 42 in transient slot 1, call itself with calldata so the
+ * callee stores 7 there and halts with `ending`, return slot 1
+ */
+static uint64_t transient_after_callee(const char *ending) {
+    char hex[128];
+    snprintf(hex, sizeof(hex), "%s%s",
+        "36602457"                            /* CALLDATASIZE PUSH1 child JUMPI */
+        "602a60015d"                          /* TSTORE(1, 42) */
+        "600060006001600060003061fffff150"    /* POP(CALL(0xFFFF, ADDRESS, 0, 0, 1, 0, 0)) */
+        "60015c60005260206000f3"              /* RETURN(TLOAD(1)) */
+        "5b600760015d",                       /* child: JUMPDEST TSTORE(1, 7) */
+        ending);
+
+    setup();
+
+    Address contract = address(0xC0);
+    install(&contract, 1, hex);
+
+    Receipt receipt;
+    assert(call(&contract, &receipt) == STATUS_SUCCESS);
+
+    uint64_t value = word(&receipt, 0);
+
+    Receipt_free(&receipt);
+    teardown();
+
+    return value;
+}
+
+void test_transient_storage() {
+    /* A callee's TSTORE survives when it succeeds... */
+    assert(transient_after_callee("00") == 7);
+
+    /* ...and is rolled back when it reverts */
+    assert(transient_after_callee("60006000fd") == 42);
+}
+
+void test_mcopy_overlap() {
+    setup();
+
+    Address contract = address(0xC0);
+    install(&contract, 1,
+        "7f0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20"
+        "80600052602052"                      /* MSTORE(0, word) MSTORE(32, word) */
+        "601f600060015e"                      /* MCOPY(1, 0, 31): forward overlap */
+        "601f602160205e"                      /* MCOPY(32, 33, 31): backward overlap */
+        "60406000f3");                        /* RETURN(0, 64) */
+
+    Receipt receipt;
+    assert(call(&contract, &receipt) == STATUS_SUCCESS);
+    assert(receipt.return_data_size == 64);
+
+    const uint8_t *out = receipt.return_data;
+
+    /* Copies behave like memmove, the source is read before it's overwritten */
+    assert(out[0] == 1);
+    for (int i = 1; i < 32; i++) assert(out[i] == i);
+    for (int i = 0; i < 31; i++) assert(out[32 + i] == i + 2);
+    assert(out[63] == 32);
+
+    Receipt_free(&receipt);
+    teardown();
+}
+
+static void check_address(const Receipt *receipt, size_t index, const char *hex) {
+    uint8_t expected[20];
+    assert(Hex_decode_into(hex, 40, expected));
+    assert(memcmp(receipt->return_data + 32 * index + 12, expected, 20) == 0);
+}
+
+void test_create_addresses() {
+    setup();
+
+    /* keccak(rlp([sender, nonce]))[12:], for nonces 0 and 1 */
+    Address creator;
+    assert(Hex_decode_into("6ac7ea33f8831ea9dcc53393aaa88b25a785dbf0", 40, creator.bytes));
+    install(&creator, 0,
+        "600060006000f0600052"                /* MSTORE(0, CREATE(0, 0, 0)) */
+        "600060006000f0602052"                /* MSTORE(32, CREATE(0, 0, 0)) */
+        "60406000f3");
+
+    Receipt receipt;
+    assert(call(&creator, &receipt) == STATUS_SUCCESS);
+
+    check_address(&receipt, 0, "cd234a471b72ba2f1ccf0a70fcaba648a5eecd8d");
+    check_address(&receipt, 1, "343c43a37d37dff08ae8c4a11544c718abb4fcf8");
+    assert(Accounts_get(&vm.accounts, &creator)->nonce == 2);
+
+    Receipt_free(&receipt);
+
+    /* keccak(0xff ++ sender ++ salt ++ keccak(init code))[12:], EIP-1014 example 1 */
+    Address factory;
+    assert(Hex_decode_into("deadbeef00000000000000000000000000000000", 40, factory.bytes));
+    install(&factory, 1,
+        "6000600160006000f5600052"            /* MSTORE(0, CREATE2(0, 0, 1, 0)), init code 0x00 */
+        "60206000f3");
+
+    assert(call(&factory, &receipt) == STATUS_SUCCESS);
+    check_address(&receipt, 0, "b928f69bb1d91cd65274e3c79d8986362984fda3");
+
+    Receipt_free(&receipt);
+    teardown();
+}
+
+void test_call_return_data() {
+    setup();
+
+    Address callee = address(0xBB), stopper = address(0xCC), caller = address(0xC0);
+
+    install(&callee, 1, "602a60005260206000f3");    /* RETURN(42) */
+    install(&stopper, 1, "00");                     /* STOP */
+    install(&caller, 1,
+        "6000600060006000600060bb61fffff150"  /* POP(CALL(0xFFFF, 0xBB, 0, 0, 0, 0, 0)) */
+        "3d602052"                            /* MSTORE(32, RETURNDATASIZE) */
+        "6020600060003e"                      /* RETURNDATACOPY(0, 0, 32) */
+        "6000600060006000600060cc61fffff150"  /* POP(CALL(0xFFFF, 0xCC, 0, 0, 0, 0, 0)) */
+        "3d604052"                            /* MSTORE(64, RETURNDATASIZE) */
+        "60606000f3");                        /* RETURN(0, 96) */
+
+    Receipt receipt;
+    assert(call(&caller, &receipt) == STATUS_SUCCESS);
+    assert(receipt.return_data_size == 96);
+
+    /* The callee's output, then nothing once a call returned nothing */
+    assert(word(&receipt, 0) == 42);
+    assert(word(&receipt, 1) == 32);
+    assert(word(&receipt, 2) == 0);
+
+    Receipt_free(&receipt);
+    teardown();
+}
+
+int main() {
+    test_transient_storage();
+    test_mcopy_overlap();
+    test_create_addresses();
+    test_call_return_data();
+
+    printf("vm: ok\n");
+    return 0;
+}
\ No newline at end of file